@@ -0,0 +1,292 @@
+// ================================================================
+// PathQuery.cpp : Batches path requests and solves them in parallel
+// ================================================================
+
+#include "../Common/CommonStd.h"
+#include "PathQuery.h"
+#include "../EventManager/Events.h"
+#include "../Multicore/JobSystem.h"
+
+PathQueryService::PathQueryService(PathingGraph* pGraph, JobSystem* pJobSystem)
+{
+	//Nv_ASSERT(pGraph);
+
+	m_pGraph = pGraph;
+	m_pJobSystem = pJobSystem;
+	m_numGroups = 0;
+	m_lastId = INVALID_PATH_QUERY_ID;
+	m_maxSearchesPerUpdate = PATH_QUERY_DEFAULT_SEARCHES_PER_UPDATE;
+	m_pGraph->AddQueryService(this);
+
+	// one batch per thread that can run a search, the calling thread included
+	unsigned int numBatches = m_pJobSystem ? m_pJobSystem->GetNumWorkers() + 1 : 1;
+	for (unsigned int i = 0; i < numBatches; ++i)
+	{
+		m_batches.push_back(Nv_NEW SolveBatch);
+	}
+}
+
+PathQueryService::~PathQueryService(void)
+{
+	m_pGraph->RemoveQueryService(this);
+
+	for (QueryMap::iterator it = m_queries.begin(); it != m_queries.end(); ++it)
+	{
+		SAFE_DELETE(it->second.m_pPlan);
+	}
+	m_queries.clear();
+	m_pending.clear();
+
+	for (size_t i = 0; i < m_batches.size(); ++i)
+	{
+		SAFE_DELETE(m_batches[i]);
+	}
+	m_batches.clear();
+}
+
+PathQueryId PathQueryService::Submit(PathingNode* pStartNode, PathingNode* pGoalNode, bool notify)
+{
+	if (!pStartNode || !pGoalNode) {
+		return INVALID_PATH_QUERY_ID;
+	}
+
+	if (++m_lastId == INVALID_PATH_QUERY_ID) {
+		++m_lastId;
+	}
+
+	Query& query = m_queries[m_lastId];
+	query.m_id = m_lastId;
+	query.m_pStartNode = pStartNode;
+	query.m_pGoalNode = pGoalNode;
+	query.m_pPlan = NULL;
+	query.m_status = PQS_Pending;
+	query.m_notify = notify;
+
+	m_pending.push_back(m_lastId);
+	return m_lastId;
+}
+
+PathQueryId PathQueryService::Submit(const Vec3& startPoint, const Vec3& endPoint, bool notify)
+{
+	// same as PathingGraph::FindPath() - the closest nodes stand in for the points
+	PathingNode* pStart = m_pGraph->FindClosestNode(startPoint);
+	PathingNode* pGoal = m_pGraph->FindClosestNode(endPoint);
+	return Submit(pStart, pGoal, notify);
+}
+
+PathQueryStatus PathQueryService::GetStatus(PathQueryId id) const
+{
+	QueryMap::const_iterator findIt = m_queries.find(id);
+	if (findIt == m_queries.end()) {
+		return PQS_Unknown;
+	}
+	return findIt->second.m_status;
+}
+
+PathPlan* PathQueryService::Collect(PathQueryId id)
+{
+	QueryMap::iterator findIt = m_queries.find(id);
+	if (findIt == m_queries.end() || findIt->second.m_status == PQS_Pending) {
+		return NULL;
+	}
+
+	PathPlan* pPlan = findIt->second.m_pPlan;
+	m_queries.erase(findIt);
+	return pPlan;
+}
+
+void PathQueryService::Cancel(PathQueryId id)
+{
+	QueryMap::iterator findIt = m_queries.find(id);
+	if (findIt == m_queries.end()) {
+		return;
+	}
+
+	if (findIt->second.m_status == PQS_Pending) {
+		m_pending.remove(id);
+	}
+	SAFE_DELETE(findIt->second.m_pPlan);
+	m_queries.erase(findIt);
+}
+
+void PathQueryService::OnNodeRemoved(PathingNode* pNode)
+{
+	for (QueryMap::iterator it = m_queries.begin(); it != m_queries.end(); ++it)
+	{
+		Query& query = it->second;
+		if (query.m_status == PQS_Pending)
+		{
+			if (query.m_pStartNode == pNode || query.m_pGoalNode == pNode) {
+				FailQuery(query);
+			}
+		}
+		else if (query.m_status == PQS_Done)
+		{
+			if (query.m_pStartNode == pNode || (query.m_pPlan && query.m_pPlan->Contains(pNode))) {
+				FailQuery(query);
+			}
+		}
+	}
+
+	// FailQuery() leaves m_pending alone so the loop above doesn't walk it once per query
+	m_pending.remove_if([this](PathQueryId id) { return m_queries[id].m_status != PQS_Pending; });
+}
+
+void PathQueryService::OnGraphDestroyed(void)
+{
+	for (QueryMap::iterator it = m_queries.begin(); it != m_queries.end(); ++it)
+	{
+		if (it->second.m_status != PQS_NoPath) {
+			FailQuery(it->second);
+		}
+	}
+	m_pending.clear();
+}
+
+void PathQueryService::FailQuery(Query& query)
+{
+	// the pending ones haven't sent their event yet; the others already did, and are just polled now
+	if (query.m_status == PQS_Pending && query.m_notify)
+	{
+		std::shared_ptr<EvtData_Path_Query_Done> pEvent(Nv_NEW EvtData_Path_Query_Done(query.m_id, false));
+		IEventManager::Get()->VQueueEvent(pEvent);
+	}
+
+	SAFE_DELETE(query.m_pPlan);
+	query.m_pStartNode = NULL;
+	query.m_pGoalNode = NULL;
+	query.m_status = PQS_NoPath;
+}
+
+//
+// PathQueryService::Update				- not described in the book
+//
+void PathQueryService::Update(void)
+{
+	Nv_MEMORY_TAG_SCOPE(MEMTAG_AI);
+
+	if (m_pending.empty()) {
+		return;
+	}
+
+	BuildGroups();
+	if (m_numGroups == 0) {
+		return;
+	}
+
+	unsigned int numNodes = m_pGraph->GetNumNodes();
+	unsigned int numBatches = std::min((unsigned int)m_batches.size(), m_numGroups);
+
+	// deal the groups out so every batch gets a share of the work
+	for (unsigned int i = 0; i < numBatches; ++i)
+	{
+		m_batches[i]->m_aStar.Reserve(numNodes);
+		m_batches[i]->m_groups.clear();
+	}
+	for (unsigned int i = 0; i < m_numGroups; ++i)
+	{
+		m_batches[i % numBatches]->m_groups.push_back(&m_groups[i]);
+	}
+
+	if (numBatches == 1)
+	{
+		SolveBatchJob(m_batches[0]);
+	}
+	else
+	{
+		// the calling thread takes the first batch itself
+		JobCounter counter;
+		for (unsigned int i = 1; i < numBatches; ++i)
+		{
+			m_pJobSystem->Run(SolveBatchJob, m_batches[i], &counter);
+		}
+		SolveBatchJob(m_batches[0]);
+		m_pJobSystem->Wait(counter);
+	}
+
+	// VQueueEvent() belongs to the game thread, so the events go out from here rather than the jobs
+	for (unsigned int i = 0; i < m_numGroups; ++i)
+	{
+		QueryGroup& group = m_groups[i];
+		for (size_t j = 0; j < group.m_queries.size(); ++j)
+		{
+			Query* pQuery = group.m_queries[j];
+			if (pQuery->m_notify)
+			{
+				std::shared_ptr<EvtData_Path_Query_Done> pEvent(Nv_NEW EvtData_Path_Query_Done(pQuery->m_id, pQuery->m_status == PQS_Done));
+				IEventManager::Get()->VQueueEvent(pEvent);
+			}
+		}
+	}
+}
+
+void PathQueryService::BuildGroups(void)
+{
+	m_numGroups = 0;
+	m_groupByGoal.clear();
+
+	std::list<PathQueryId>::iterator it = m_pending.begin();
+	while (it != m_pending.end())
+	{
+		Query& query = m_queries[*it];
+
+		unsigned int groupIndex;
+		std::unordered_map<PathingNode*, unsigned int>::iterator findIt = m_groupByGoal.find(query.m_pGoalNode);
+		if (findIt != m_groupByGoal.end())
+		{
+			// somebody is already heading there this frame, so this one comes for free
+			groupIndex = findIt->second;
+		}
+		else if (m_maxSearchesPerUpdate != 0 && m_numGroups >= m_maxSearchesPerUpdate)
+		{
+			// out of budget, it waits for the next frame
+			++it;
+			continue;
+		}
+		else
+		{
+			groupIndex = m_numGroups++;
+			if (m_groups.size() < m_numGroups) {
+				m_groups.resize(m_numGroups);
+			}
+
+			QueryGroup& group = m_groups[groupIndex];
+			group.m_pGoalNode = query.m_pGoalNode;
+			group.m_queries.clear();
+			group.m_startNodes.clear();
+			m_groupByGoal[query.m_pGoalNode] = groupIndex;
+		}
+
+		QueryGroup& group = m_groups[groupIndex];
+		group.m_queries.push_back(&query);
+		group.m_startNodes.push_back(query.m_pStartNode);
+		it = m_pending.erase(it);
+	}
+}
+
+void PathQueryService::SolveBatchJob(void* pData)
+{
+	// runs on the job system's workers, which don't inherit the game thread's tag
+	Nv_MEMORY_TAG_SCOPE(MEMTAG_AI);
+
+	SolveBatch* pBatch = static_cast<SolveBatch*>(pData);
+	for (size_t i = 0; i < pBatch->m_groups.size(); ++i)
+	{
+		SolveGroup(pBatch->m_aStar, *pBatch->m_groups[i]);
+	}
+}
+
+void PathQueryService::SolveGroup(AStar& aStar, QueryGroup& group)
+{
+	aStar.SearchFromGoal(group.m_pGoalNode, group.m_startNodes);
+
+	for (size_t i = 0; i < group.m_queries.size(); ++i)
+	{
+		Query* pQuery = group.m_queries[i];
+		pQuery->m_pPlan = aStar.BuildPlanFrom(pQuery->m_pStartNode);
+
+		// no plan is fine when the agent is already at the goal
+		bool found = pQuery->m_pPlan || pQuery->m_pStartNode == group.m_pGoalNode;
+		pQuery->m_status = found ? PQS_Done : PQS_NoPath;
+	}
+}
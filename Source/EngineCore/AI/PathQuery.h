@@ -0,0 +1,113 @@
+#pragma once
+
+// ================================================================
+// PathQuery.h : Batches path requests and solves them in parallel
+// ================================================================
+
+#include "../Common/CommonStd.h"
+#include <unordered_map>
+#include "Pathing.h"
+
+class JobSystem;
+
+typedef unsigned int PathQueryId;
+const PathQueryId INVALID_PATH_QUERY_ID = 0;
+
+const unsigned int PATH_QUERY_DEFAULT_SEARCHES_PER_UPDATE = 64;
+
+enum PathQueryStatus
+{
+	PQS_Unknown,		// never submitted, already collected or cancelled
+	PQS_Pending,
+	PQS_Done,			// the plan is ready - it's NULL if start and goal are the same node
+	PQS_NoPath
+};
+
+// -------------------------------------------------------------------------------------------------------
+// class PathQueryService						- not described in the book
+// Agents submit path requests instead of calling PathingGraph::FindPath() themselves. Once per frame
+// Update() groups the pending requests by goal - all the agents heading for one node are served by a
+// single search from that node - and solves the groups in parallel on the job system. The graph isn't
+// modified while the searches run, so they share it without locking.
+//
+// Update() runs at most a budget of searches each frame and leaves the rest for the next one, so a
+// wave of agents retargeting at once is spread over a few frames instead of spiking one. Requests are
+// served in the order they came in.
+//
+// Poll a request with GetStatus() and take the plan with Collect(), or ask for an EvtData_Path_Query_Done
+// event when the request is submitted. Every call must come from the game thread.
+//
+// The service registers with the graph, which tells it about nodes being removed: requests to or from
+// the node, and finished plans through it, turn into PQS_NoPath. Plans that were already collected
+// belong to the caller and aren't tracked.
+// -------------------------------------------------------------------------------------------------------
+class PathQueryService
+{
+	struct Query
+	{
+		PathQueryId m_id;
+		PathingNode* m_pStartNode;
+		PathingNode* m_pGoalNode;
+		PathPlan* m_pPlan;
+		PathQueryStatus m_status;
+		bool m_notify;
+	};
+
+	// one search: every pending query with this goal
+	struct QueryGroup
+	{
+		PathingNode* m_pGoalNode;
+		std::vector<Query*> m_queries;
+		PathingNodeVec m_startNodes;
+	};
+
+	// the groups one job solves, with a search of its own so the jobs don't share scratch memory
+	struct SolveBatch
+	{
+		AStar m_aStar;
+		std::vector<QueryGroup*> m_groups;
+	};
+
+	typedef std::map<PathQueryId, Query> QueryMap;
+
+	PathingGraph* m_pGraph;
+	JobSystem* m_pJobSystem;
+	QueryMap m_queries;
+	std::list<PathQueryId> m_pending;		// oldest first
+	std::vector<QueryGroup> m_groups;		// reused every Update(), only the first m_numGroups are live
+	unsigned int m_numGroups;
+	std::unordered_map<PathingNode*, unsigned int> m_groupByGoal;
+	std::vector<SolveBatch*> m_batches;
+	PathQueryId m_lastId;
+	unsigned int m_maxSearchesPerUpdate;
+
+public:
+	// pJobSystem may be NULL, every search then runs on the calling thread; the graph must outlive the service
+	PathQueryService(PathingGraph* pGraph, JobSystem* pJobSystem);
+	~PathQueryService(void);
+
+	PathQueryId Submit(PathingNode* pStartNode, PathingNode* pGoalNode, bool notify = false);
+	PathQueryId Submit(const Vec3& startPoint, const Vec3& endPoint, bool notify = false);
+
+	PathQueryStatus GetStatus(PathQueryId id) const;
+
+	// Hands over the plan of a finished request and forgets the request. The caller owns the plan.
+	PathPlan* Collect(PathQueryId id);
+	void Cancel(PathQueryId id);
+
+	// 0 means no limit
+	void SetMaxSearchesPerUpdate(unsigned int maxSearches) { m_maxSearchesPerUpdate = maxSearches; }
+	unsigned int GetNumPending(void) const { return (unsigned int)m_pending.size(); }
+
+	void Update(void);
+
+	// called by PathingGraph before it deletes nodes
+	void OnNodeRemoved(PathingNode* pNode);
+	void OnGraphDestroyed(void);
+
+private:
+	void FailQuery(Query& query);
+	void BuildGroups(void);
+	static void SolveBatchJob(void* pData);
+	static void SolveGroup(AStar& aStar, QueryGroup& group);
+};
@@ -4,13 +4,14 @@
 
 #include "../Common/CommonStd.h"
 #include "Pathing.h"
+#include "PathingHierarchy.h"
+#include "PathQuery.h"
 #include "../App/App.h"
 
 // ==============================================================
 // PathingNode
 // ==============================================================
-Nv_MEMORYPOOL_DEFINITION(PathingNode);
-Nv_MEMORYPOOL_AUTOINIT(PathingNode, 128); // there are currently 81 pathing nodes generated; if you make more, you should increase this number
+Nv_MEMORYPOOL_SIZECLASS_DEFINITION(PathingNode);	// graphs are edited at runtime now, so there's no fixed node count to size a pool for
 
 
 void PathingNode::AddArc(PathingArc* pArc)
@@ -21,7 +22,7 @@ void PathingNode::AddArc(PathingArc* pArc)
 
 void PathingNode::GetNeighbors(PathingNodeList& outNeighbors)
 {
-	for (PathingArcList::iterator it = m_arcs.begin(); it != m_arcs.end(); ++it)
+	for (PathingArcVec::iterator it = m_arcs.begin(); it != m_arcs.end(); ++it)
 	{
 		PathingArc* pArc = *it;
 		outNeighbors.push_back(pArc->GetNeighbor(this));
@@ -41,7 +42,7 @@ PathingArc* PathingNode::FindArc(PathingNode* pLinkedNode)
 {
 	//Nv_ASSERT(pLinkedNode);
 
-	for (PathingArcList::iterator it = m_arcs.begin(); it != m_arcs.end(); ++it)
+	for (PathingArcVec::iterator it = m_arcs.begin(); it != m_arcs.end(); ++it)
 	{
 		PathingArc* pArc = *it;
 		if (pArc->GetNeighbor(this) == pLinkedNode)
@@ -64,7 +65,7 @@ void PathingArc::LinkNodes(PathingNode* pNodeA, PathingNode* pNodeB)
 	m_pNodes[1] = pNodeB;
 }
 
-PathingNode* PathingArc::GetNeighbor(PathingNode* pMe)
+PathingNode* PathingArc::GetNeighbor(const PathingNode* pMe) const
 {
 	//Nv_ASSERT(pMe);
 
@@ -111,49 +112,21 @@ bool PathPlan::CheckForEnd(void)
 	return false;
 }
 
-void PathPlan::AddNode(PathingNode* pNode)
+bool PathPlan::Contains(const PathingNode* pNode) const
 {
-	//Nv_ASSERT(pNode);
-	m_path.push_front(pNode);
+	return std::find(m_path.begin(), m_path.end(), pNode) != m_path.end();
 }
 
-// --------------------------------------------------------------------
-// PathPlanNode
-// --------------------------------------------------------------------
-PathPlanNode::PathPlanNode(PathingNode* pNode, PathPlanNode* pPrevNode, PathingNode* pGoalNode)
+void PathPlan::AddNode(PathingNode* pNode)
 {
 	//Nv_ASSERT(pNode);
-
-	m_pPathingNode = pNode;
-	m_pPrev = pPrevNode; // NULL is a valid value, though it should only be NULL for the start node.
-	m_pGoalNode = pGoalNode;
-	m_closed = false;
-	UpdateHeuristics();
-}
-
-void PathPlanNode::UpdatePrevNode(PathPlanNode* pPrev)
-{
-	//Nv_ASSERT(pPrev);
-	m_pPrev = pPrev;
-	UpdateHeuristics();
+	m_path.push_front(pNode);
 }
 
-void PathPlanNode::UpdateHeuristics(void)
+void PathPlan::AppendNode(PathingNode* pNode)
 {
-	// total cost (g)
-	if (m_pPrev) {
-		m_goal = m_pPrev->GetGoal() + m_pPathingNode->GetCostFromNode(m_pPrev->GetPathingNode());
-	}
-	else {
-		m_goal = 0;
-	}
-
-	// heuristic (h)
-	Vec3 diff = m_pPathingNode->GetPos() - m_pGoalNode->GetPos();
-	m_heuristic = diff.Length();
-
-	// cost to goal (f))
-	m_fitness = m_goal + m_heuristic;
+	//Nv_ASSERT(pNode);
+	m_path.push_back(pNode);
 }
 
 // --------------------------------------------------------------------
@@ -161,8 +134,10 @@ void PathPlanNode::UpdateHeuristics(void)
 // --------------------------------------------------------------------
 AStar::AStar(void)
 {
-	m_pStartNode = NULL;
+	m_search = 0;
 	m_pGoalNode = NULL;
+	m_pHeuristicNode = NULL;
+	m_lastExpanded = 0;
 }
 
 AStar::~AStar(void)
@@ -172,18 +147,24 @@ AStar::~AStar(void)
 
 void AStar::Destroy(void)
 {
-	// destroy all the PathPlanNode objects and clear the map
-	for (PathingNodeToPathPlanNodeMap::iterator it = m_nodes.begin(); it != m_nodes.end(); ++it) {
-		delete it->second;
-	}
-	m_nodes.clear();
+	// give the scratch memory back
+	std::vector<NodeState>().swap(m_states);
+	std::vector<unsigned int>().swap(m_openSet);
 
-	// clear the open set
-	m_openSet.clear();
-
-	// clear the start & goal nodes
-	m_pStartNode = NULL;
+	m_search = 0;
 	m_pGoalNode = NULL;
+	m_pHeuristicNode = NULL;
+	m_lastExpanded = 0;
+}
+
+void AStar::Reserve(unsigned int numNodes)
+{
+	if (m_states.size() < numNodes)
+	{
+		NodeState unused = { NULL, 0, 0, INVALID_INDEX, INVALID_INDEX, 0, 0 };
+		m_states.resize(numNodes, unused);
+	}
+	m_openSet.reserve(numNodes);
 }
 
 //
@@ -199,178 +180,280 @@ PathPlan* AStar::operator()(PathingNode* pStartNode, PathingNode* pGoalNode)
 		return NULL;
 	}
 
-	// set our members
-	m_pStartNode = pStartNode;
+	BeginSearch();
 	m_pGoalNode = pGoalNode;
+	m_pHeuristicNode = pGoalNode;
 
 	// The open set is a priority queue of the nodes to be evaluated. If it's ever empty, it means
 	// we couldn't find a path to the goal. The start node is the only node that is initially in
 	// the open set.
-	AddToOpenSet(m_pStartNode, NULL);
+	OpenNode(pStartNode, INVALID_INDEX, 0);
 
 	while (!m_openSet.empty())
 	{
-		// grab the most likely candidate
-		PathPlanNode* pNode = m_openSet.front();
+		// grab the most likely candidate, which closes it
+		unsigned int nodeIndex = PopBestNode();
 
 		// If this node is our goal node, we've succesfully found a path.
-		if (pNode->GetPathingNode() == m_pGoalNode)
+		if (m_states[nodeIndex].m_pNode == m_pGoalNode)
 		{
-			return RebuildPath(pNode);
+			return RebuildPath(nodeIndex);
 		}
 
-		// we're processing this node so remove it form the open set and add it to the closed set
-		m_openSet.pop_front();
-		AddToClosedSet(pNode);
-
-		// get the neighboring nodes
-		PathingNodeList neighbors;
-		pNode->GetPathingNode()->GetNeighbors(neighbors);
+		ExpandNode(nodeIndex);
+	}
 
-		// loop through all the neighboring nodes and evaluate each one.
-		for (PathingNodeList::iterator it = neighbors.begin(); it != neighbors.end(); ++it)
-		{
-			PathingNode* pNodeToEvaluate = *it;
+	// If we get here, there's no path to the goal.
+	return NULL;
+}
 
-			// Try and find a PathPlantNode object for this node.
-			PathingNodeToPathPlanNodeMap::iterator findIt = m_nodes.find(pNodeToEvaluate);
+//
+// AStar::SearchFromGoal				- not described in the book
+//
+unsigned int AStar::SearchFromGoal(PathingNode* pGoalNode, const PathingNodeVec& startNodes)
+{
+	//Nv_ASSERT(pGoalNode);
 
-			// If one exists and it's in the closed list, we've already evaluated the node. We can
-			// safely skip it.
-			if (findIt != m_nodes.end() && findIt->second->IsClosed()) {
-				continue;
-			}
+	BeginSearch();
+	m_pGoalNode = pGoalNode;
 
-			// figure out the cost for this route through the node
-			float costForThisPath = pNode->GetGoal() + pNodeToEvaluate->GetCostFromNode(pNode->GetPathingNode());
-			bool isPathBetter = false;
+	// With one start this is an ordinary A* search run backwards. With more there's no single node
+	// to aim for, so it degrades to Dijkstra and stops once the last start has been reached.
+	m_pHeuristicNode = (startNodes.size() == 1) ? startNodes[0] : NULL;
 
-			// Grab the PathPlanNode if there is one.
-			PathPlanNode* pPathPlanNodeToEvaluate = NULL;
-			if (findIt != m_nodes.end()) {
-				pPathPlanNodeToEvaluate = findIt->second;
-			}
+	unsigned int remaining = 0;
+	for (PathingNodeVec::const_iterator it = startNodes.begin(); it != startNodes.end(); ++it)
+	{
+		unsigned int startIndex = (*it)->GetIndex();
+		if (startIndex >= m_states.size()) {
+			Reserve(std::max(startIndex + 1, (unsigned int)m_states.size() * 2));
+		}
 
-			// No PathPlanNode means we've never evaluated this pathing node so we need to add it to 
-			// the open set, which has the side effect of setting all hte heuristic data. It also
-			// means that this is the best path through this node that we've found so the nodes are
-			// linked together (which is why we don't bother setting isPathBetter to true; it's done
-			// for us in AddToOpenSet()).
-			if (!pPathPlanNodeToEvaluate) {
-				pPathPlanNodeToEvaluate = AddToOpenSet(pNodeToEvaluate, pNode);
-			}
+		// the same start may be in the list more than once
+		if (m_states[startIndex].m_target != m_search)
+		{
+			m_states[startIndex].m_target = m_search;
+			++remaining;
+		}
+	}
+	unsigned int numTargets = remaining;
 
-			// If this node is already in the open set, check to see if this route to it is better than
-			// the last.
-			else if (costForThisPath < pPathPlanNodeToEvaluate->GetGoal()) {
-				isPathBetter = true;
-			}
+	OpenNode(pGoalNode, INVALID_INDEX, 0);
 
-			// If this path is better, relink the nodes appropriately, update the heuristics data, and
-			// reinsert the node into the open list priority queue.
-			if (isPathBetter)
-			{
-				pPathPlanNodeToEvaluate->UpdatePrevNode(pNode);
-				ReinsertNode(pPathPlanNodeToEvaluate);
-			}
+	while (remaining > 0 && !m_openSet.empty())
+	{
+		unsigned int nodeIndex = PopBestNode();
+		if (m_states[nodeIndex].m_target == m_search) {
+			--remaining;
 		}
+
+		ExpandNode(nodeIndex);
 	}
 
-	// If we get here, there's no path to the goal.
-	return NULL;
+	return numTargets - remaining;
 }
 
-PathPlanNode* AStar::AddToOpenSet(PathingNode* pNode, PathPlanNode* pPrevNode)
+PathPlan* AStar::BuildPlanFrom(PathingNode* pStartNode) const
 {
-	//Nv_ASSERT(pNode);
+	//Nv_ASSERT(pStartNode);
 
-	// create a new PathPlanNode if necessary
-	PathingNodeToPathPlanNodeMap::iterator it = m_nodes.find(pNode);
-	PathPlanNode* pThisNode = NULL;
+	// only a closed node's route is final
+	unsigned int nodeIndex = pStartNode->GetIndex();
+	if (nodeIndex >= m_states.size() || m_states[nodeIndex].m_search != m_search || m_states[nodeIndex].m_heapIndex != INVALID_INDEX) {
+		return NULL;
+	}
 
-	if (it == m_nodes.end()) {
-		pThisNode == Nv_NEW PathPlanNode(pNode, pPrevNode, m_pGoalNode);
-		m_nodes.insert(std::make_pair(pNode, pThisNode));
+	// same as operator() when the start is the goal
+	if (pStartNode == m_pGoalNode) {
+		return NULL;
 	}
-	else {
-		//Nv_WARNING("Adding existing PathPlanNode to open set");
-		pThisNode = it->second;
-		pThisNode->SetClosed(false);
+
+	// the search ran from the goal, so following m_prev walks the path in the right order
+	PathPlan* pPlan = Nv_NEW PathPlan;
+	while (nodeIndex != INVALID_INDEX)
+	{
+		pPlan->AppendNode(m_states[nodeIndex].m_pNode);
+		nodeIndex = m_states[nodeIndex].m_prev;
 	}
 
-	// now insert it into the priority queue
-	InsertNode(pThisNode);
+	return pPlan;
+}
+
+void AStar::ExpandNode(unsigned int nodeIndex)
+{
+	// copied out because opening a neighbor may grow m_states
+	PathingNode* pNode = m_states[nodeIndex].m_pNode;
+	float goal = m_states[nodeIndex].m_goal;
+
+	// loop through all the neighboring nodes and evaluate each one.
+	const PathingArcVec& arcs = pNode->GetArcs();
+	for (PathingArcVec::const_iterator it = arcs.begin(); it != arcs.end(); ++it)
+	{
+		PathingArc* pArc = *it;
+		PathingNode* pNodeToEvaluate = pArc->GetNeighbor(pNode);
+		unsigned int indexToEvaluate = pNodeToEvaluate->GetIndex();
 
-	return pThisNode;
+		// figure out the cost for this route through the node
+		Vec3 diff = pNodeToEvaluate->GetPos() - pNode->GetPos();
+		float costForThisPath = goal + pArc->GetWeight() * diff.Length();
+
+		// Never evaluated this search means this is the best route to the node we've found, so
+		// it goes straight into the open set.
+		if (indexToEvaluate >= m_states.size() || m_states[indexToEvaluate].m_search != m_search)
+		{
+			OpenNode(pNodeToEvaluate, nodeIndex, costForThisPath);
+			continue;
+		}
+
+		// If it's closed, we've already evaluated the node. We can safely skip it.
+		NodeState& state = m_states[indexToEvaluate];
+		if (state.m_heapIndex == INVALID_INDEX) {
+			continue;
+		}
+
+		// If this route is better than the last, relink the nodes and move the node up the
+		// open set.
+		if (costForThisPath < state.m_goal)
+		{
+			float heuristic = state.m_fitness - state.m_goal;
+			state.m_prev = nodeIndex;
+			state.m_goal = costForThisPath;
+			state.m_fitness = costForThisPath + heuristic;
+			SiftUp(state.m_heapIndex);
+		}
+	}
 }
 
-void AStar::AddToClosedSet(PathPlanNode* pNode)
+void AStar::BeginSearch(void)
 {
-	//Nv_ASSERT(pNode);
-	pNode->SetClosed();
+	m_openSet.clear();
+	m_lastExpanded = 0;
+
+	// when the stamp wraps around, old state could look current so it has to be wiped once
+	if (++m_search == 0)
+	{
+		for (size_t i = 0; i < m_states.size(); ++i) {
+			m_states[i].m_search = 0;
+			m_states[i].m_target = 0;
+		}
+		m_search = 1;
+	}
 }
 
-//
-// AStar::InsertNode					- Chapter 17, page 636
-//
-void AStar::InsertNode(PathPlanNode* pNode)
+void AStar::OpenNode(PathingNode* pNode, unsigned int prev, float goal)
 {
 	//Nv_ASSERT(pNode);
 
-	// just add the node if the open set is empty
-	if (m_openSet.empty())
-	{
-		m_openSet.push_back(pNode);
-		return;
+	unsigned int nodeIndex = pNode->GetIndex();
+	if (nodeIndex >= m_states.size()) {
+		Reserve(std::max(nodeIndex + 1, (unsigned int)m_states.size() * 2));
 	}
 
-	// otherwise, perform an insertion sort
-	PathPlanNodeList::iterator it = m_openSet.begin();
-	PathPlanNode* pCompare = *it;
-	while (pCompare->IsBetterChoiceThan(pNode))
+	NodeState& state = m_states[nodeIndex];
+	state.m_pNode = pNode;
+	state.m_goal = goal;
+	state.m_fitness = goal + GetHeuristic(pNode);
+	state.m_prev = prev;
+	state.m_search = m_search;
+
+	// now insert it into the priority queue
+	state.m_heapIndex = (unsigned int)m_openSet.size();
+	m_openSet.push_back(nodeIndex);
+	SiftUp(state.m_heapIndex);
+}
+
+unsigned int AStar::PopBestNode(void)
+{
+	unsigned int best = m_openSet.front();
+	unsigned int last = m_openSet.back();
+	m_openSet.pop_back();
+
+	if (!m_openSet.empty())
 	{
-		++it;
+		m_openSet[0] = last;
+		m_states[last].m_heapIndex = 0;
+		SiftDown(0);
+	}
 
-		if (it != m_openSet.end()) {
-			pCompare = *it;
-		}
-		else {
+	// popping a node closes it
+	m_states[best].m_heapIndex = INVALID_INDEX;
+	++m_lastExpanded;
+	return best;
+}
+
+void AStar::SiftUp(unsigned int heapIndex)
+{
+	unsigned int nodeIndex = m_openSet[heapIndex];
+	float fitness = m_states[nodeIndex].m_fitness;
+
+	while (heapIndex > 0)
+	{
+		unsigned int parent = (heapIndex - 1) / 2;
+		unsigned int parentNode = m_openSet[parent];
+		if (m_states[parentNode].m_fitness <= fitness) {
 			break;
 		}
+
+		m_openSet[heapIndex] = parentNode;
+		m_states[parentNode].m_heapIndex = heapIndex;
+		heapIndex = parent;
 	}
-	m_openSet.insert(it, pNode);
+
+	m_openSet[heapIndex] = nodeIndex;
+	m_states[nodeIndex].m_heapIndex = heapIndex;
 }
 
-void AStar::ReinsertNode(PathPlanNode* pNode)
+void AStar::SiftDown(unsigned int heapIndex)
 {
-	//Nv_ASSERT(pNode);
+	unsigned int size = (unsigned int)m_openSet.size();
+	unsigned int nodeIndex = m_openSet[heapIndex];
+	float fitness = m_states[nodeIndex].m_fitness;
 
-	for (PathPlanNodeList::iterator it = m_openSet.begin(); it != m_openSet.end(); ++it)
+	for (;;)
 	{
-		if (pNode == (*it))
-		{
-			m_openSet.erase(it);
-			InsertNode(pNode);
-			return;
+		unsigned int child = heapIndex * 2 + 1;
+		if (child >= size) {
+			break;
 		}
+
+		// pick the better of the two children
+		if (child + 1 < size && m_states[m_openSet[child + 1]].m_fitness < m_states[m_openSet[child]].m_fitness) {
+			++child;
+		}
+
+		unsigned int childNode = m_openSet[child];
+		if (fitness <= m_states[childNode].m_fitness) {
+			break;
+		}
+
+		m_openSet[heapIndex] = childNode;
+		m_states[childNode].m_heapIndex = heapIndex;
+		heapIndex = child;
 	}
 
-	// if we get here, the node was never in the open set to begin with
-	//Nv_WARNING("Attempting to reinsert node that was never in the open list");
-	InsertNode(pNode);
+	m_openSet[heapIndex] = nodeIndex;
+	m_states[nodeIndex].m_heapIndex = heapIndex;
 }
 
-PathPlan* AStar::RebuildPath(PathPlanNode* pGoalNode)
+float AStar::GetHeuristic(PathingNode* pNode) const
 {
-	//Nv_ASSERT(pGoalNode);
+	if (!m_pHeuristicNode) {
+		return 0;
+	}
+
+	Vec3 diff = pNode->GetPos() - m_pHeuristicNode->GetPos();
+	return diff.Length();
+}
 
+PathPlan* AStar::RebuildPath(unsigned int goalIndex)
+{
 	PathPlan* pPlan = Nv_NEW PathPlan;
 
-	PathPlanNode* pNode = pGoalNode;
-	while (pNode)
+	unsigned int nodeIndex = goalIndex;
+	while (nodeIndex != INVALID_INDEX)
 	{
-		pPlan->AddNode(pNode->GetPathingNode());
-		pNode = pNode->GetPrev();
+		pPlan->AddNode(m_states[nodeIndex].m_pNode);
+		nodeIndex = m_states[nodeIndex].m_prev;
 	}
 
 	return pPlan;
@@ -379,8 +462,18 @@ PathPlan* AStar::RebuildPath(PathPlanNode* pGoalNode)
 // --------------------------------------------------------------------
 // PathingGraph
 // --------------------------------------------------------------------
+PathingGraph::~PathingGraph(void)
+{
+	DestroyGraph();
+	SAFE_DELETE(m_pHierarchy);
+}
+
 void PathingGraph::DestroyGraph(void)
 {
+	for (size_t i = 0; i < m_queryServices.size(); ++i) {
+		m_queryServices[i]->OnGraphDestroyed();
+	}
+
 	// destroy all the nodes
 	for (PathingNodeVec::iterator it = m_nodes.begin(); it != m_nodes.end(); ++it) {
 		delete (*it);
@@ -392,75 +485,69 @@ void PathingGraph::DestroyGraph(void)
 		delete (*it);
 	}
 	m_arcs.clear();
+
+	m_grid.Clear();
+	if (m_pHierarchy) {
+		m_pHierarchy->Clear();
+	}
 }
 
-PathingNode* PathingGraph::FindClosestNode(const Vec3& pos)
+void PathingGraph::EnableHierarchy(float clusterSize)
 {
-	// This is a simple brute-force O(n) algorithm that could be made a LOT faster by utilizing
-	// spatial partitioning, like an octree (or quadtree for flat worlds) or something similar.
-	PathingNode* pClosestNode = m_nodes.front();
-	float length = FLT_MAX;
-	for (PathingNodeVec::iterator it = m_nodes.begin(); it != m_nodes.end(); ++it)
-	{
-		PathingNode* pNode = *it;
-		Vec3 diff = pos - pNode->GetPos();
-		if (diff.Length() < length)
-		{
-			pClosestNode = pNode;
-			length = diff.Length();
-		}
+	SAFE_DELETE(m_pHierarchy);
+	m_pHierarchy = Nv_NEW PathingHierarchy(clusterSize);
+	for (PathingNodeVec::iterator it = m_nodes.begin(); it != m_nodes.end(); ++it) {
+		m_pHierarchy->OnNodeAdded(*it);
 	}
+}
 
-	return pClosestNode;
+void PathingGraph::DisableHierarchy(void)
+{
+	SAFE_DELETE(m_pHierarchy);
 }
 
-PathingNode* PathingGraph::FindFurthestNode(const Vec3& pos)
+void PathingGraph::AddQueryService(PathQueryService* pService)
 {
-	// This is a simple brute-force O(n) algorithm that could be made a LOT faster by utilizing
-	// spatial partitioning, like an octree (or quadtree for flat worlds) or something similar.
-	PathingNode* pFurthestNode = m_nodes.front();
-	float length = 0;
-	for (PathingNodeVec::iterator it = m_nodes.begin(); it != m_nodes.end(); ++it)
-	{
-		PathingNode* pNode = *it;
-		Vec3 diff = pos - pNode->GetPos();
-		if (diff.Length() > length)
-		{
-			pFurthestNode = pNode;
-			length = diff.Length();
-		}
+	m_queryServices.push_back(pService);
+}
+
+void PathingGraph::RemoveQueryService(PathQueryService* pService)
+{
+	std::vector<PathQueryService*>::iterator findIt = std::find(m_queryServices.begin(), m_queryServices.end(), pService);
+	if (findIt != m_queryServices.end()) {
+		m_queryServices.erase(findIt);
 	}
+}
 
-	return pFurthestNode;
+PathingNode* PathingGraph::FindClosestNode(const Vec3& pos)
+{
+	return m_grid.FindNearest(pos);
+}
+
+PathingNode* PathingGraph::FindFurthestNode(const Vec3& pos)
+{
+	return m_grid.FindFurthest(pos);
 }
 
 PathingNode* PathingGraph::FindRandomNode(void)
 {
-	// cache this since it's not guaranteed to be constant time
-	unsigned int numNodes = (unsigned int)m_nodes.size();
+	if (m_nodes.empty()) {
+		return NULL;
+	}
 
 	// choose a random node
-	unsigned int node = g_pApp->m_pGame->GetRNG().Random(numNodes);
+	unsigned int node = g_pApp->m_pGame->GetRNG().Random((unsigned int)m_nodes.size());
+	return m_nodes[node];
+}
 
-	// if we're in the lower half of the node list, start from the bottom
-	if (node <= numNodes / 2)
-	{
-		PathingNodeVec::iterator it = m_nodes.begin();
-		for (unsigned int i = 0; i < node; i++) {
-			++it;
-		}
-		return (*it);
-	}
-	// otherwise, start from the top
-	else
-	{
-		PathingNodeVec::iterator it = m_nodes.end();
-		for (unsigned int i = numNodes; i >= node; i--)
-		{
-			--it;
-		}
-		return (*it);
-	}
+void PathingGraph::FindClosestNodes(const Vec3& pos, unsigned int count, PathingNodeVec& outNodes) const
+{
+	m_grid.FindNearest(pos, count, outNodes);
+}
+
+void PathingGraph::FindNodesInRadius(const Vec3& pos, float radius, PathingNodeVec& outNodes) const
+{
+	m_grid.FindInRadius(pos, radius, outNodes);
 }
 
 PathPlan* PathingGraph::FindPath(const Vec3& startPoint, const Vec3& endPoint)
@@ -486,9 +573,19 @@ PathPlan* PathingGraph::FindPath(PathingNode* pStartNode, const Vec3& endPoint)
 
 PathPlan* PathingGraph::FindPath(PathingNode* pStartNode, PathingNode* pGoalNode)
 {
+	// long paths go over the cluster entrances and are refined afterwards
+	if (m_pHierarchy && !m_pHierarchy->InSameCluster(pStartNode, pGoalNode))
+	{
+		HierarchicalPath path;
+		if (!m_pHierarchy->FindPath(pStartNode, pGoalNode, path)) {
+			return NULL;
+		}
+		return m_pHierarchy->BuildPlan(path);
+	}
+
 	// find the best path using an A* search algorithm
-	AStar aStar;
-	return aStar(pStartNode, pGoalNode);
+	m_aStar.Reserve((unsigned int)m_nodes.size());
+	return m_aStar(pStartNode, pGoalNode);
 }
 
 void PathingGraph::BuildTestGraph(void)
@@ -510,7 +607,7 @@ void PathingGraph::BuildTestGraph(void)
 		{
 			// add the new node
 			PathingNode* pNode = new PathingNode(Vec3(x, 0, z));
-			m_nodes.push_back(pNode);
+			AddNode(pNode);
 
 			// link it to the previous node
 			int tempNode = index - 1;
@@ -529,6 +626,66 @@ void PathingGraph::BuildTestGraph(void)
 	}
 }
 
+PathingNode* PathingGraph::AddNode(const Vec3& pos, float tolerance)
+{
+	PathingNode* pNode = Nv_NEW PathingNode(pos, tolerance);
+	AddNode(pNode);
+	return pNode;
+}
+
+void PathingGraph::AddNode(PathingNode* pNode)
+{
+	//Nv_ASSERT(pNode);
+	pNode->m_index = (unsigned int)m_nodes.size();
+	m_nodes.push_back(pNode);
+	m_grid.AddNode(pNode);
+
+	if (m_pHierarchy) {
+		m_pHierarchy->OnNodeAdded(pNode);
+	}
+}
+
+void PathingGraph::RemoveNode(PathingNode* pNode)
+{
+	//Nv_ASSERT(pNode);
+
+	// queries still holding the node fail now rather than read it after it's gone
+	for (size_t i = 0; i < m_queryServices.size(); ++i) {
+		m_queryServices[i]->OnNodeRemoved(pNode);
+	}
+
+	// while the node still has its arcs, so the clusters across them get rebuilt too
+	if (m_pHierarchy) {
+		m_pHierarchy->OnNodeRemoved(pNode);
+	}
+
+	// destroy the node's arcs, unhooking them from the neighbors first
+	for (PathingArcVec::iterator it = pNode->m_arcs.begin(); it != pNode->m_arcs.end(); ++it)
+	{
+		PathingArc* pArc = *it;
+		PathingNode* pNeighbor = pArc->GetNeighbor(pNode);
+		if (pNeighbor != pNode)
+		{
+			PathingArcVec& neighborArcs = pNeighbor->m_arcs;
+			neighborArcs.erase(std::find(neighborArcs.begin(), neighborArcs.end(), pArc));
+		}
+		m_arcs.erase(pArc->m_graphIt);
+		delete pArc;
+	}
+	pNode->m_arcs.clear();
+
+	m_grid.RemoveNode(pNode);
+
+	// move the last node into the gap so the indices stay dense
+	unsigned int index = pNode->m_index;
+	PathingNode* pLast = m_nodes.back();
+	m_nodes[index] = pLast;
+	pLast->m_index = index;
+	m_nodes.pop_back();
+
+	delete pNode;
+}
+
 void PathingGraph::LinkNodes(PathingNode* pNodeA, PathingNode* pNodeB)
 {
 	//Nv_ASSERT(pNodeA);
@@ -538,7 +695,36 @@ void PathingGraph::LinkNodes(PathingNode* pNodeA, PathingNode* pNodeB)
 	pArc->LinkNodes(pNodeA, pNodeB);
 	pNodeA->AddArc(pArc);
 	pNodeB->AddArc(pArc);
-	m_arcs.push_back(pArc);
+	pArc->m_graphIt = m_arcs.insert(m_arcs.end(), pArc);
+
+	if (m_pHierarchy) {
+		m_pHierarchy->OnArcChanged(pNodeA, pNodeB);
+	}
+}
+
+void PathingGraph::UnlinkNodes(PathingNode* pNodeA, PathingNode* pNodeB)
+{
+	//Nv_ASSERT(pNodeA);
+	//Nv_ASSERT(pNodeB);
+
+	PathingArc* pArc = pNodeA->FindArc(pNodeB);
+	if (!pArc) {
+		return;
+	}
+
+	PathingArcVec& arcsA = pNodeA->m_arcs;
+	arcsA.erase(std::find(arcsA.begin(), arcsA.end(), pArc));
+	if (pNodeB != pNodeA)
+	{
+		PathingArcVec& arcsB = pNodeB->m_arcs;
+		arcsB.erase(std::find(arcsB.begin(), arcsB.end(), pArc));
+	}
+	m_arcs.erase(pArc->m_graphIt);
+	delete pArc;
+
+	if (m_pHierarchy) {
+		m_pHierarchy->OnArcChanged(pNodeA, pNodeB);
+	}
 }
 
 // --------------------------------------------------------------------
@@ -11,17 +11,20 @@
 
 #include "../Memory/MemoryPool.h"
 #include "../Memory/MemoryMacros.h"
+#include "PathingGrid.h"
+
+const float PATHING_HIERARCHY_DEFAULT_CLUSTER_SIZE = 100.0f;
 
 class PathingArc;
 class PathingNode;
-class PathPlanNode;
 class AStar;
+class PathingHierarchy;
+class PathQueryService;
 
 typedef std::list<PathingArc*> PathingArcList;
+typedef std::vector<PathingArc*> PathingArcVec;
 typedef std::list<PathingNode*> PathingNodeList;
 typedef std::vector<PathingNode*> PathingNodeVec;
-typedef std::map<PathingNode*, PathPlanNode*> PathingNodeToPathPlanNodeMap;
-typedef std::list<PathPlanNode*> PathPlanNodeList;
 
 const float PATHING_DEFAULT_NODE_TOLERANCE = 5.0f;
 const float PATHING_DEFAULT_ARC_WEIGHT = 1.0f;
@@ -33,20 +36,25 @@ const float PATHING_DEFAULT_ARC_WEIGHT = 1.0f;
 // -------------------------------------------------------------------------------------------------------
 class PathingNode
 {
+	friend class PathingGraph;
+
 	float m_tolerance;
 	Vec3 m_pos;
-	PathingArcList m_arcs;
+	PathingArcVec m_arcs;
+	unsigned int m_index;	// where the node is in PathingGraph::m_nodes; AStar keys its search state by it
 
 public:
-	explicit PathingNode(const Vec3& pos, float tolerance = PATHING_DEFAULT_NODE_TOLERANCE) : m_pos(pos) { m_tolerance = tolerance; }
+	explicit PathingNode(const Vec3& pos, float tolerance = PATHING_DEFAULT_NODE_TOLERANCE) : m_pos(pos) { m_tolerance = tolerance; m_index = 0; }
 	const Vec3& GetPos(void) const { return m_pos; }
 	float GetTolerance(void) const { return m_tolerance; }
+	unsigned int GetIndex(void) const { return m_index; }
+	const PathingArcVec& GetArcs(void) const { return m_arcs; }
 	void AddArc(PathingArc* pArc);
 	void GetNeighbors(PathingNodeList& outNeighbors);
 	float GetCostFromNode(PathingNode* pFromNode);
-private:
 	PathingArc* FindArc(PathingNode* pLinkedNode);
 
+private:
 	Nv_MEMORYPOOL_DECLARATION(0);
 };
 
@@ -56,14 +64,17 @@ private:
 // -------------------------------------------------------------------------------------------------------
 class PathingArc
 {
+	friend class PathingGraph;
+
 	float m_weight;
 	PathingNode* m_pNodes[2];	// an arc always connects two nodes
+	PathingArcList::iterator m_graphIt;	// where the arc is in PathingGraph::m_arcs, so it comes out without a search
 
 public:
 	explicit PathingArc(float weight = PATHING_DEFAULT_ARC_WEIGHT) { m_weight = weight; }
 	float GetWeight(void) const { return m_weight; }
 	void LinkNodes(PathingNode* pNodeA, PathingNode* pNodeB);
-	PathingNode* GetNeighbor(PathingNode* pMe);
+	PathingNode* GetNeighbor(const PathingNode* pMe) const;
 };
 
 // -------------------------------------------------------------------------------------------------------
@@ -73,6 +84,7 @@ public:
 class PathPlan
 {
 	friend class AStar;
+	friend class PathingHierarchy;
 
 	PathingNodeList m_path;
 	PathingNodeList::iterator m_index;
@@ -88,69 +100,81 @@ public:
 	}
 	bool CheckForNextNode(const Vec3& pos);
 	bool CheckForEnd(void);
+	bool Contains(const PathingNode* pNode) const;
 
 private:
 	void AddNode(PathingNode* pNode);
+	void AppendNode(PathingNode* pNode);
 
 };
 
-// -------------------------------------------------------------------------------------------------------
-// class PathPlanNode							- Chapter 18, page 636
-// This class is a helper used in PathingGroup::FindPath(). It tracks the heuristical and cost data for
-// a given node when building a path.
-// -------------------------------------------------------------------------------------------------------
-class PathPlanNode
-{
-	PathPlanNode* m_pPrev;
-	PathingNode* m_pPathingNode;
-	PathingNode* m_pGoalNode;
-	bool m_closed;
-	float m_goal;
-	float m_heuristic;
-	float m_fitness;
-
-public:
-	explicit PathPlanNode(PathingNode* pNode, PathPlanNode* pPrevNode, PathingNode* pGoalNode);
-	PathPlanNode* GetPrev(void) const { return m_pPrev; }
-	PathingNode* GetPathingNode(void) const { return m_pPathingNode; }
-	bool IsClosed(void) const { return m_closed; }
-	float GetGoal(void) const { return m_goal; }
-	float GetHeuristic(void) const { return m_heuristic; }
-	float GetFitness(void) const { return m_fitness; }
-
-	void UpdatePrevNode(PathPlanNode* pPrev);
-	void SetClosed(bool toClose = true) { m_closed = toClose; }
-
-	bool IsBetterChoiceThan(PathPlanNode* pRight) { return (m_fitness < pRight->GetFitness()); }
-
-private:
-	void UpdateHeuristics(void);
-};
-
 // -------------------------------------------------------------------------------------------------------
 // class AStar							- Chapter 18, page 638
 // This class implements the A* algorithm.
+//
+// The search state of every node lives in a flat array indexed by PathingNode::GetIndex(), and the open
+// set is a binary heap that knows where each node sits in it, so finding a cheaper route to a node is a
+// sift up rather than a walk over a sorted list. Both arrays are kept between searches: reuse one AStar
+// and nothing is allocated once they've grown to the size of the graph. Every search gets a new stamp,
+// which tells stale state from current state, so the array never has to be cleared.
+//
+// SearchFromGoal() serves many agents heading for the same node with one search: it expands outwards
+// from the goal until every start has been reached and BuildPlanFrom() then reads each start's path off
+// the search state. Arcs work both ways, so the routes it finds are as good as forward searches.
+//
+// An AStar may only run one search at a time. Use one per thread.
 // -------------------------------------------------------------------------------------------------------
 class AStar
 {
-	PathingNodeToPathPlanNodeMap m_nodes;
-	PathingNode* m_pStartNode;
+	static const unsigned int INVALID_INDEX = 0xffffffff;
+
+	struct NodeState
+	{
+		PathingNode* m_pNode;
+		float m_goal;				// cost of the best route from the start found so far (g)
+		float m_fitness;			// goal + heuristic (f)
+		unsigned int m_prev;		// the node that route came from, INVALID_INDEX for the start node
+		unsigned int m_heapIndex;	// position in the open set, INVALID_INDEX once the node is closed
+		unsigned int m_search;		// the search this state belongs to
+		unsigned int m_target;		// == m_search while SearchFromGoal() still has to reach the node
+	};
+
+	std::vector<NodeState> m_states;
+	std::vector<unsigned int> m_openSet;	// binary heap of node indices, lowest fitness on top
+	unsigned int m_search;
 	PathingNode* m_pGoalNode;
-	PathPlanNodeList m_openSet;
+	PathingNode* m_pHeuristicNode;			// the heuristic is the distance to this node, NULL makes it 0
+	unsigned int m_lastExpanded;
 
 public:
 	AStar(void);
 	~AStar(void);
 	void Destroy(void);
 
+	// grows the scratch arrays up front so the searches don't have to
+	void Reserve(unsigned int numNodes);
+
 	PathPlan* operator()(PathingNode* pStartNode, PathingNode* pGoalNode);
 
+	// returns how many of the start nodes the search reached
+	unsigned int SearchFromGoal(PathingNode* pGoalNode, const PathingNodeVec& startNodes);
+
+	// The path from pStartNode to the goal of the last SearchFromGoal(), or NULL if that search didn't
+	// reach it. The caller owns the plan.
+	PathPlan* BuildPlanFrom(PathingNode* pStartNode) const;
+
+	// nodes the last search expanded, for comparing against PathingHierarchy::GetLastExpanded()
+	unsigned int GetLastExpanded(void) const { return m_lastExpanded; }
+
 private:
-	PathPlanNode* AddToOpenSet(PathingNode* pNode, PathPlanNode* pPrevNode);
-	void AddToClosedSet(PathPlanNode* pNode);
-	void InsertNode(PathPlanNode* pNode);
-	void ReinsertNode(PathPlanNode* pNode);
-	PathPlan* RebuildPath(PathPlanNode* pGoalNode);
+	void BeginSearch(void);
+	void ExpandNode(unsigned int nodeIndex);
+	void OpenNode(PathingNode* pNode, unsigned int prev, float goal);
+	unsigned int PopBestNode(void);
+	void SiftUp(unsigned int heapIndex);
+	void SiftDown(unsigned int heapIndex);
+	float GetHeuristic(PathingNode* pNode) const;
+	PathPlan* RebuildPath(unsigned int goalIndex);
 };
 
 
@@ -165,15 +189,38 @@ class PathingGraph
 {
 	PathingNodeVec m_nodes;
 	PathingArcList m_arcs;
+	PathingGrid m_grid;	// finds nodes by position without looking at all of them
+	AStar m_aStar;		// reused by FindPath() so searches don't allocate
+	PathingHierarchy* m_pHierarchy;	// NULL unless EnableHierarchy() was called
+	std::vector<PathQueryService*> m_queryServices;	// told about removed nodes before they're deleted
 
 public:
-	PathingGraph(void) {}
-	~PathingGraph(void) { DestroyGraph(); }
+	PathingGraph(void) { m_pHierarchy = NULL; }
+	~PathingGraph(void);
 	void DestroyGraph(void);
 
+	// editing - don't change the graph while a PathQueryService update is running
+	PathingNode* AddNode(const Vec3& pos, float tolerance = PATHING_DEFAULT_NODE_TOLERANCE);
+	void RemoveNode(PathingNode* pNode);
+	void LinkNodes(PathingNode* pNodeA, PathingNode* pNodeB);
+	void UnlinkNodes(PathingNode* pNodeA, PathingNode* pNodeB);
+
+	// FindPath() goes through the hierarchy for nodes in different clusters once it's enabled; the
+	// hierarchy keeps up with the edits above on its own
+	void EnableHierarchy(float clusterSize = PATHING_HIERARCHY_DEFAULT_CLUSTER_SIZE);
+	void DisableHierarchy(void);
+	PathingHierarchy* GetHierarchy(void) { return m_pHierarchy; }
+
+	// services holding queries on this graph, PathQueryService registers itself
+	void AddQueryService(PathQueryService* pService);
+	void RemoveQueryService(PathQueryService* pService);
+
 	PathingNode* FindClosestNode(const Vec3& pos);
 	PathingNode* FindFurthestNode(const Vec3& pos);
 	PathingNode* FindRandomNode(void);
+	void FindClosestNodes(const Vec3& pos, unsigned int count, PathingNodeVec& outNodes) const;
+	void FindNodesInRadius(const Vec3& pos, float radius, PathingNodeVec& outNodes) const;
+	unsigned int GetNumNodes(void) const { return (unsigned int)m_nodes.size(); }
 	PathPlan* FindPath(const Vec3& startPoint, const Vec3& endPoint);
 	PathPlan* FindPath(const Vec3& startPoint, PathingNode* pGoalNode);
 	PathPlan* FindPath(PathingNode* pStartNode, const Vec3& endPoint);
@@ -184,7 +231,7 @@ public:
 
 private:
 	// helpers
-	void LinkNodes(PathingNode* pNodeA, PathingNode* pNodeB);
+	void AddNode(PathingNode* pNode);
 };
 
 // Global function for creating & initializing the pathing graph
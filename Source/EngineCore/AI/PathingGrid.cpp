@@ -0,0 +1,330 @@
+// ================================================================
+// PathingGrid.cpp : Spatial index over the pathing node positions
+// ================================================================
+
+#include "../Common/CommonStd.h"
+#include "PathingGrid.h"
+#include "Pathing.h"
+
+static float DistanceSq(const Vec3& a, const Vec3& b)
+{
+	float dx = a.x - b.x;
+	float dy = a.y - b.y;
+	float dz = a.z - b.z;
+	return dx * dx + dy * dy + dz * dz;
+}
+
+PathingGrid::PathingGrid(float cellSize)
+{
+	//Nv_ASSERT(cellSize > 0);
+	m_cellSize = cellSize;
+	m_invCellSize = 1.0f / cellSize;
+	Clear();
+}
+
+void PathingGrid::Clear(void)
+{
+	m_cells.clear();
+	m_numNodes = 0;
+
+	Cell empty = { 0, 0, 0 };
+	m_min = empty;
+	m_max = empty;
+}
+
+void PathingGrid::AddNode(PathingNode* pNode)
+{
+	//Nv_ASSERT(pNode);
+
+	Cell cell = GetCell(pNode->GetPos());
+	m_cells[MakeKey(cell)].push_back(pNode);
+
+	if (m_numNodes == 0)
+	{
+		m_min = cell;
+		m_max = cell;
+	}
+	else
+	{
+		m_min.m_x = std::min(m_min.m_x, cell.m_x);
+		m_min.m_y = std::min(m_min.m_y, cell.m_y);
+		m_min.m_z = std::min(m_min.m_z, cell.m_z);
+		m_max.m_x = std::max(m_max.m_x, cell.m_x);
+		m_max.m_y = std::max(m_max.m_y, cell.m_y);
+		m_max.m_z = std::max(m_max.m_z, cell.m_z);
+	}
+	++m_numNodes;
+}
+
+void PathingGrid::RemoveNode(PathingNode* pNode)
+{
+	//Nv_ASSERT(pNode);
+
+	// the bounds aren't shrunk, searches just look at a few more empty cells
+	CellMap::iterator findIt = m_cells.find(MakeKey(GetCell(pNode->GetPos())));
+	if (findIt == m_cells.end()) {
+		return;
+	}
+
+	PathingNodeVec& nodes = findIt->second;
+	PathingNodeVec::iterator nodeIt = std::find(nodes.begin(), nodes.end(), pNode);
+	if (nodeIt == nodes.end()) {
+		return;
+	}
+
+	*nodeIt = nodes.back();
+	nodes.pop_back();
+	if (nodes.empty()) {
+		m_cells.erase(findIt);
+	}
+	--m_numNodes;
+}
+
+//
+// PathingGrid::FindNearest				- not described in the book
+//
+PathingNode* PathingGrid::FindNearest(const Vec3& pos) const
+{
+	if (m_numNodes == 0) {
+		return NULL;
+	}
+
+	Cell center = GetCell(pos);
+	PathingNode* pBest = NULL;
+	float bestDistSq = FLT_MAX;
+
+	for (int ring = 0; ; ++ring)
+	{
+		// nothing further out can beat what we have
+		float ringDist = GetRingDistance(ring);
+		if (pBest && ringDist > 0 && ringDist * ringDist >= bestDistSq) {
+			break;
+		}
+
+		ForEachCellInRing(center, ring, [&](const PathingNodeVec& nodes)
+		{
+			for (PathingNodeVec::const_iterator it = nodes.begin(); it != nodes.end(); ++it)
+			{
+				float distSq = DistanceSq(pos, (*it)->GetPos());
+				if (distSq < bestDistSq)
+				{
+					bestDistSq = distSq;
+					pBest = *it;
+				}
+			}
+		});
+
+		if (RingCoversBounds(center, ring)) {
+			break;
+		}
+	}
+
+	return pBest;
+}
+
+void PathingGrid::FindNearest(const Vec3& pos, unsigned int k, PathingNodeVec& outNodes) const
+{
+	outNodes.clear();
+	if (m_numNodes == 0 || k == 0) {
+		return;
+	}
+
+	// max heap on distance, so the worst of the k best found so far is on top
+	typedef std::pair<float, PathingNode*> Candidate;
+	std::vector<Candidate> best;
+	best.reserve(k);
+
+	Cell center = GetCell(pos);
+	for (int ring = 0; ; ++ring)
+	{
+		float ringDist = GetRingDistance(ring);
+		if (best.size() == k && ringDist > 0 && ringDist * ringDist >= best.front().first) {
+			break;
+		}
+
+		ForEachCellInRing(center, ring, [&](const PathingNodeVec& nodes)
+		{
+			for (PathingNodeVec::const_iterator it = nodes.begin(); it != nodes.end(); ++it)
+			{
+				float distSq = DistanceSq(pos, (*it)->GetPos());
+				if (best.size() < k)
+				{
+					best.push_back(Candidate(distSq, *it));
+					std::push_heap(best.begin(), best.end());
+				}
+				else if (distSq < best.front().first)
+				{
+					std::pop_heap(best.begin(), best.end());
+					best.back() = Candidate(distSq, *it);
+					std::push_heap(best.begin(), best.end());
+				}
+			}
+		});
+
+		if (RingCoversBounds(center, ring)) {
+			break;
+		}
+	}
+
+	std::sort_heap(best.begin(), best.end());
+	outNodes.reserve(best.size());
+	for (size_t i = 0; i < best.size(); ++i)
+	{
+		outNodes.push_back(best[i].second);
+	}
+}
+
+PathingNode* PathingGrid::FindFurthest(const Vec3& pos) const
+{
+	PathingNode* pBest = NULL;
+	float bestDistSq = -1.0f;
+
+	for (CellMap::const_iterator cellIt = m_cells.begin(); cellIt != m_cells.end(); ++cellIt)
+	{
+		const PathingNodeVec& nodes = cellIt->second;
+
+		// skip the cell if even its furthest corner is closer than the best node so far
+		Vec3 nodePos = nodes.front()->GetPos();
+		Cell cell = GetCell(nodePos);
+		float cornerX = std::max(fabsf(cell.m_x * m_cellSize - pos.x), fabsf((cell.m_x + 1) * m_cellSize - pos.x));
+		float cornerY = std::max(fabsf(cell.m_y * m_cellSize - pos.y), fabsf((cell.m_y + 1) * m_cellSize - pos.y));
+		float cornerZ = std::max(fabsf(cell.m_z * m_cellSize - pos.z), fabsf((cell.m_z + 1) * m_cellSize - pos.z));
+		if (cornerX * cornerX + cornerY * cornerY + cornerZ * cornerZ <= bestDistSq) {
+			continue;
+		}
+
+		for (PathingNodeVec::const_iterator it = nodes.begin(); it != nodes.end(); ++it)
+		{
+			float distSq = DistanceSq(pos, (*it)->GetPos());
+			if (distSq > bestDistSq)
+			{
+				bestDistSq = distSq;
+				pBest = *it;
+			}
+		}
+	}
+
+	return pBest;
+}
+
+void PathingGrid::FindInRadius(const Vec3& pos, float radius, PathingNodeVec& outNodes) const
+{
+	outNodes.clear();
+	if (m_numNodes == 0 || radius < 0) {
+		return;
+	}
+
+	float radiusSq = radius * radius;
+	Vec3 extent(radius, radius, radius);
+	Cell low = GetCell(pos - extent);
+	Cell high = GetCell(pos + extent);
+	low.m_x = std::max(low.m_x, m_min.m_x);
+	low.m_y = std::max(low.m_y, m_min.m_y);
+	low.m_z = std::max(low.m_z, m_min.m_z);
+	high.m_x = std::min(high.m_x, m_max.m_x);
+	high.m_y = std::min(high.m_y, m_max.m_y);
+	high.m_z = std::min(high.m_z, m_max.m_z);
+	if (low.m_x > high.m_x || low.m_y > high.m_y || low.m_z > high.m_z) {
+		return;
+	}
+
+	// a big radius over a sparse grid covers more cells than there are occupied ones
+	double numCells = double(high.m_x - low.m_x + 1) * double(high.m_y - low.m_y + 1) * double(high.m_z - low.m_z + 1);
+	if (numCells > (double)m_cells.size())
+	{
+		for (CellMap::const_iterator cellIt = m_cells.begin(); cellIt != m_cells.end(); ++cellIt)
+		{
+			const PathingNodeVec& nodes = cellIt->second;
+			for (PathingNodeVec::const_iterator it = nodes.begin(); it != nodes.end(); ++it)
+			{
+				if (DistanceSq(pos, (*it)->GetPos()) <= radiusSq) {
+					outNodes.push_back(*it);
+				}
+			}
+		}
+		return;
+	}
+
+	for (int x = low.m_x; x <= high.m_x; ++x)
+	{
+		for (int y = low.m_y; y <= high.m_y; ++y)
+		{
+			for (int z = low.m_z; z <= high.m_z; ++z)
+			{
+				const PathingNodeVec* pNodes = FindCell(x, y, z);
+				if (!pNodes) {
+					continue;
+				}
+
+				for (PathingNodeVec::const_iterator it = pNodes->begin(); it != pNodes->end(); ++it)
+				{
+					if (DistanceSq(pos, (*it)->GetPos()) <= radiusSq) {
+						outNodes.push_back(*it);
+					}
+				}
+			}
+		}
+	}
+}
+
+PathingGrid::Cell PathingGrid::GetCell(const Vec3& pos) const
+{
+	Cell cell;
+	cell.m_x = (int)floorf(pos.x * m_invCellSize);
+	cell.m_y = (int)floorf(pos.y * m_invCellSize);
+	cell.m_z = (int)floorf(pos.z * m_invCellSize);
+	return cell;
+}
+
+unsigned long long PathingGrid::MakeKey(const Cell& cell)
+{
+	// 21 bits per axis, which is a million cells either way of the origin
+	const unsigned long long mask = (1ULL << 21) - 1;
+	return ((unsigned long long)(cell.m_x & mask) << 42) | ((unsigned long long)(cell.m_y & mask) << 21) | (unsigned long long)(cell.m_z & mask);
+}
+
+const PathingNodeVec* PathingGrid::FindCell(int x, int y, int z) const
+{
+	Cell cell = { x, y, z };
+	CellMap::const_iterator findIt = m_cells.find(MakeKey(cell));
+	return (findIt != m_cells.end()) ? &findIt->second : NULL;
+}
+
+bool PathingGrid::RingCoversBounds(const Cell& center, int ring) const
+{
+	return center.m_x - ring <= m_min.m_x && center.m_x + ring >= m_max.m_x &&
+		center.m_y - ring <= m_min.m_y && center.m_y + ring >= m_max.m_y &&
+		center.m_z - ring <= m_min.m_z && center.m_z + ring >= m_max.m_z;
+}
+
+template<typename Func>
+void PathingGrid::ForEachCellInRing(const Cell& center, int ring, Func func) const
+{
+	// only the part of the ring inside the bounds can hold anything, which for a flat world is
+	// a single layer of cells
+	int lowX = std::max(-ring, m_min.m_x - center.m_x), highX = std::min(ring, m_max.m_x - center.m_x);
+	int lowY = std::max(-ring, m_min.m_y - center.m_y), highY = std::min(ring, m_max.m_y - center.m_y);
+	int lowZ = std::max(-ring, m_min.m_z - center.m_z), highZ = std::min(ring, m_max.m_z - center.m_z);
+
+	for (int dx = lowX; dx <= highX; ++dx)
+	{
+		for (int dy = lowY; dy <= highY; ++dy)
+		{
+			bool onShell = (dx == -ring || dx == ring || dy == -ring || dy == ring);
+			for (int dz = lowZ; dz <= highZ; ++dz)
+			{
+				// inside the shell only the two z faces belong to this ring
+				if (!onShell && dz != -ring && dz != ring)
+				{
+					dz = (ring <= highZ) ? ring - 1 : highZ;
+					continue;
+				}
+
+				const PathingNodeVec* pNodes = FindCell(center.m_x + dx, center.m_y + dy, center.m_z + dz);
+				if (pNodes) {
+					func(*pNodes);
+				}
+			}
+		}
+	}
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+// ================================================================
+// PathingGrid.h : Spatial index over the pathing node positions
+// ================================================================
+
+#include "../Common/CommonStd.h"
+#include <unordered_map>
+
+class PathingNode;
+typedef std::vector<PathingNode*> PathingNodeVec;
+
+const float PATHING_GRID_DEFAULT_CELL_SIZE = 20.0f;
+
+// -------------------------------------------------------------------------------------------------------
+// class PathingGrid							- not described in the book
+// A uniform grid of cells with only the occupied cells stored, hashed by their coordinates. Nearest
+// node searches look at the query's cell first and then at rings of cells around it, stopping once
+// no node in the next ring could be closer than the best one found, so a lookup touches a handful of
+// cells instead of every node.
+//
+// Pick a cell size around the spacing of the nodes: much smaller and searches step through empty
+// rings, much larger and cells hold a lot of nodes.
+// -------------------------------------------------------------------------------------------------------
+class PathingGrid
+{
+	struct Cell
+	{
+		int m_x, m_y, m_z;
+	};
+
+	typedef std::unordered_map<unsigned long long, PathingNodeVec> CellMap;
+
+	float m_cellSize;
+	float m_invCellSize;
+	CellMap m_cells;
+	unsigned int m_numNodes;
+	Cell m_min, m_max;						// bounds of the cells that have ever held a node
+
+public:
+	explicit PathingGrid(float cellSize = PATHING_GRID_DEFAULT_CELL_SIZE);
+
+	void Clear(void);
+	void AddNode(PathingNode* pNode);
+	void RemoveNode(PathingNode* pNode);
+	unsigned int GetNumNodes(void) const { return m_numNodes; }
+
+	// NULL when the grid is empty
+	PathingNode* FindNearest(const Vec3& pos) const;
+	PathingNode* FindFurthest(const Vec3& pos) const;
+
+	// the k nodes closest to pos, closest first
+	void FindNearest(const Vec3& pos, unsigned int k, PathingNodeVec& outNodes) const;
+
+	// every node no further than radius from pos, in no particular order
+	void FindInRadius(const Vec3& pos, float radius, PathingNodeVec& outNodes) const;
+
+private:
+	Cell GetCell(const Vec3& pos) const;
+	static unsigned long long MakeKey(const Cell& cell);
+	const PathingNodeVec* FindCell(int x, int y, int z) const;
+
+	// lowest possible distance from pos to anything in a cell ring steps away from pos's cell
+	float GetRingDistance(int ring) const { return (ring - 1) * m_cellSize; }
+	bool RingCoversBounds(const Cell& center, int ring) const;
+
+	// calls func(const PathingNodeVec&) for every occupied cell exactly ring steps away from center
+	template<typename Func>
+	void ForEachCellInRing(const Cell& center, int ring, Func func) const;
+};
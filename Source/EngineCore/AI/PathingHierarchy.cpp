@@ -0,0 +1,471 @@
+// ================================================================
+// PathingHierarchy.cpp : Hierarchical A* (HPA*) over a PathingGraph
+// ================================================================
+
+#include "../Common/CommonStd.h"
+#include "PathingHierarchy.h"
+
+static const unsigned int INVALID_LOCAL_INDEX = 0xffffffff;
+
+static float GetDistance(const PathingNode* pNodeA, const PathingNode* pNodeB)
+{
+	const Vec3& a = pNodeA->GetPos();
+	const Vec3& b = pNodeB->GetPos();
+	float dx = a.x - b.x;
+	float dy = a.y - b.y;
+	float dz = a.z - b.z;
+	return sqrtf(dx * dx + dy * dy + dz * dz);
+}
+
+// same cost AStar gives an arc
+static float GetArcCost(const PathingArc* pArc, const PathingNode* pFrom, const PathingNode* pTo)
+{
+	return pArc->GetWeight() * GetDistance(pFrom, pTo);
+}
+
+// std::push_heap() and friends build a max heap, the searches want the lowest fitness on top
+static bool IsWorseEntry(const std::pair<float, unsigned int>& left, const std::pair<float, unsigned int>& right)
+{
+	return left.first > right.first;
+}
+
+PathingHierarchy::PathingHierarchy(float clusterSize)
+{
+	//Nv_ASSERT(clusterSize > 0);
+	m_clusterSize = clusterSize;
+	m_invClusterSize = 1.0f / clusterSize;
+	m_search = 0;
+	m_lastExpanded = 0;
+}
+
+void PathingHierarchy::Clear(void)
+{
+	m_clusters.clear();
+	m_dirtyClusters.clear();
+}
+
+//
+// PathingHierarchy::FindPath			- not described in the book
+//
+bool PathingHierarchy::FindPath(PathingNode* pStartNode, PathingNode* pGoalNode, HierarchicalPath& outPath)
+{
+	//Nv_ASSERT(pStartNode && pGoalNode);
+
+	outPath.m_waypoints.clear();
+	outPath.m_nextSegment = 0;
+	m_lastExpanded = 0;
+
+	if (pStartNode == pGoalNode) {
+		return true;
+	}
+
+	RebuildDirtyClusters();
+
+	if (++m_search == 0)
+	{
+		std::fill(m_stamp.begin(), m_stamp.end(), 0);
+		std::fill(m_closedStamp.begin(), m_closedStamp.end(), 0);
+		std::fill(m_goalStamp.begin(), m_goalStamp.end(), 0);
+		m_search = 1;
+	}
+
+	// Hook the goal into the abstract graph: the cost from each entrance of its cluster, and from the
+	// start too if it's in there. Arcs work both ways, so searching out from the goal gives those.
+	Cluster& goalCluster = GetCluster(pGoalNode);
+	SearchCluster(goalCluster, pGoalNode, NULL);
+	for (PathingNodeVec::iterator it = goalCluster.m_entrances.begin(); it != goalCluster.m_entrances.end(); ++it)
+	{
+		float cost = GetLocalCost(*it);
+		if (cost < FLT_MAX)
+		{
+			unsigned int index = (*it)->GetIndex();
+			GrowScratch(index);
+			m_goalCost[index] = cost;
+			m_goalStamp[index] = m_search;
+		}
+	}
+	if (InSameCluster(pStartNode, pGoalNode))
+	{
+		float cost = GetLocalCost(pStartNode);
+		if (cost < FLT_MAX)
+		{
+			unsigned int index = pStartNode->GetIndex();
+			GrowScratch(index);
+			m_goalCost[index] = cost;
+			m_goalStamp[index] = m_search;
+		}
+	}
+
+	// and the start: the cost to each entrance of its cluster
+	Cluster& startCluster = GetCluster(pStartNode);
+	SearchCluster(startCluster, pStartNode, NULL);
+	m_startCosts.clear();
+	for (PathingNodeVec::iterator it = startCluster.m_entrances.begin(); it != startCluster.m_entrances.end(); ++it)
+	{
+		float cost = GetLocalCost(*it);
+		if (*it != pStartNode && cost < FLT_MAX) {
+			m_startCosts.push_back(std::make_pair(*it, cost));
+		}
+	}
+
+	m_open.clear();
+	OpenAbstractNode(pStartNode, NULL, 0, pGoalNode);
+
+	while (!m_open.empty())
+	{
+		std::pop_heap(m_open.begin(), m_open.end(), IsWorseEntry);
+		unsigned int nodeIndex = m_open.back().second;
+		m_open.pop_back();
+
+		// a node can be in the heap more than once, only the first pop counts
+		if (m_closedStamp[nodeIndex] == m_search) {
+			continue;
+		}
+		m_closedStamp[nodeIndex] = m_search;
+		++m_lastExpanded;
+
+		PathingNode* pNode = m_node[nodeIndex];
+		float cost = m_cost[nodeIndex];
+
+		if (pNode == pGoalNode)
+		{
+			for (PathingNode* pWaypoint = pGoalNode; pWaypoint; pWaypoint = m_prevNode[pWaypoint->GetIndex()]) {
+				outPath.m_waypoints.push_back(pWaypoint);
+			}
+			std::reverse(outPath.m_waypoints.begin(), outPath.m_waypoints.end());
+			return true;
+		}
+
+		// into the goal
+		if (m_goalStamp[nodeIndex] == m_search) {
+			OpenAbstractNode(pGoalNode, pNode, cost + m_goalCost[nodeIndex], pGoalNode);
+		}
+
+		// across the cluster
+		if (pNode == pStartNode)
+		{
+			for (size_t i = 0; i < m_startCosts.size(); ++i) {
+				OpenAbstractNode(m_startCosts[i].first, pNode, cost + m_startCosts[i].second, pGoalNode);
+			}
+		}
+		else
+		{
+			Cluster& cluster = GetCluster(pNode);
+			size_t numEntrances = cluster.m_entrances.size();
+			size_t row = std::find(cluster.m_entrances.begin(), cluster.m_entrances.end(), pNode) - cluster.m_entrances.begin();
+			for (size_t i = 0; row < numEntrances && i < numEntrances; ++i)
+			{
+				float intraCost = cluster.m_costs[row * numEntrances + i];
+				if (i != row && intraCost < FLT_MAX) {
+					OpenAbstractNode(cluster.m_entrances[i], pNode, cost + intraCost, pGoalNode);
+				}
+			}
+		}
+
+		// into the neighboring clusters
+		unsigned long long key = GetClusterKey(pNode);
+		const PathingArcVec& arcs = pNode->GetArcs();
+		for (PathingArcVec::const_iterator it = arcs.begin(); it != arcs.end(); ++it)
+		{
+			PathingNode* pNeighbor = (*it)->GetNeighbor(pNode);
+			if (GetClusterKey(pNeighbor) != key) {
+				OpenAbstractNode(pNeighbor, pNode, cost + GetArcCost(*it, pNode, pNeighbor), pGoalNode);
+			}
+		}
+	}
+
+	// no path to the goal
+	return false;
+}
+
+bool PathingHierarchy::RefineNextSegment(HierarchicalPath& path, PathingNodeVec& outNodes)
+{
+	if (path.IsFullyRefined()) {
+		return false;
+	}
+
+	PathingNode* pFrom = path.m_waypoints[path.m_nextSegment];
+	PathingNode* pTo = path.m_waypoints[path.m_nextSegment + 1];
+
+	if (!InSameCluster(pFrom, pTo))
+	{
+		// a single arc from one cluster into the next
+		if (!pFrom->FindArc(pTo)) {
+			return false;
+		}
+		outNodes.push_back(pTo);
+	}
+	else
+	{
+		Cluster& cluster = GetCluster(pFrom);
+		if (!SearchCluster(cluster, pFrom, pTo)) {
+			return false;
+		}
+
+		size_t first = outNodes.size();
+		unsigned int localIndex = m_localIndex[pTo->GetIndex()];
+		while (cluster.m_nodes[localIndex] != pFrom)
+		{
+			outNodes.push_back(cluster.m_nodes[localIndex]);
+			localIndex = m_localPrev[localIndex];
+		}
+		std::reverse(outNodes.begin() + first, outNodes.end());
+	}
+
+	++path.m_nextSegment;
+	return true;
+}
+
+PathPlan* PathingHierarchy::BuildPlan(HierarchicalPath& path)
+{
+	// same as AStar when there's nothing to walk
+	if (path.IsFullyRefined()) {
+		return NULL;
+	}
+
+	PathingNodeVec nodes;
+	nodes.push_back(path.m_waypoints[path.m_nextSegment]);
+	while (!path.IsFullyRefined())
+	{
+		if (!RefineNextSegment(path, nodes)) {
+			return NULL;
+		}
+	}
+
+	PathPlan* pPlan = Nv_NEW PathPlan;
+	for (PathingNodeVec::iterator it = nodes.begin(); it != nodes.end(); ++it) {
+		pPlan->AppendNode(*it);
+	}
+	return pPlan;
+}
+
+void PathingHierarchy::OnNodeAdded(PathingNode* pNode)
+{
+	GetCluster(pNode).m_nodes.push_back(pNode);
+	MarkDirty(pNode);
+}
+
+void PathingHierarchy::OnNodeRemoved(PathingNode* pNode)
+{
+	// the node's arcs are about to go, which changes the entrances on the other side of them
+	const PathingArcVec& arcs = pNode->GetArcs();
+	for (PathingArcVec::const_iterator it = arcs.begin(); it != arcs.end(); ++it) {
+		MarkDirty((*it)->GetNeighbor(pNode));
+	}
+
+	Cluster& cluster = GetCluster(pNode);
+	PathingNodeVec::iterator findIt = std::find(cluster.m_nodes.begin(), cluster.m_nodes.end(), pNode);
+	if (findIt != cluster.m_nodes.end())
+	{
+		*findIt = cluster.m_nodes.back();
+		cluster.m_nodes.pop_back();
+	}
+	MarkDirty(pNode);
+}
+
+void PathingHierarchy::OnArcChanged(PathingNode* pNodeA, PathingNode* pNodeB)
+{
+	MarkDirty(pNodeA);
+	MarkDirty(pNodeB);
+}
+
+unsigned long long PathingHierarchy::GetClusterKey(const PathingNode* pNode) const
+{
+	const Vec3& pos = pNode->GetPos();
+	const unsigned long long mask = (1ULL << 21) - 1;
+	unsigned long long x = (unsigned long long)((int)floorf(pos.x * m_invClusterSize)) & mask;
+	unsigned long long y = (unsigned long long)((int)floorf(pos.y * m_invClusterSize)) & mask;
+	unsigned long long z = (unsigned long long)((int)floorf(pos.z * m_invClusterSize)) & mask;
+	return (x << 42) | (y << 21) | z;
+}
+
+PathingHierarchy::Cluster& PathingHierarchy::GetCluster(const PathingNode* pNode)
+{
+	unsigned long long key = GetClusterKey(pNode);
+	ClusterMap::iterator findIt = m_clusters.find(key);
+	if (findIt != m_clusters.end()) {
+		return findIt->second;
+	}
+
+	Cluster& cluster = m_clusters[key];
+	cluster.m_dirty = false;
+	return cluster;
+}
+
+void PathingHierarchy::MarkDirty(const PathingNode* pNode)
+{
+	Cluster& cluster = GetCluster(pNode);
+	if (!cluster.m_dirty)
+	{
+		cluster.m_dirty = true;
+		m_dirtyClusters.push_back(GetClusterKey(pNode));
+	}
+}
+
+void PathingHierarchy::RebuildDirtyClusters(void)
+{
+	for (size_t i = 0; i < m_dirtyClusters.size(); ++i)
+	{
+		ClusterMap::iterator findIt = m_clusters.find(m_dirtyClusters[i]);
+		if (findIt == m_clusters.end()) {
+			continue;
+		}
+
+		if (findIt->second.m_nodes.empty()) {
+			m_clusters.erase(findIt);
+		}
+		else {
+			RebuildCluster(findIt->second, findIt->first);
+		}
+	}
+	m_dirtyClusters.clear();
+}
+
+void PathingHierarchy::RebuildCluster(Cluster& cluster, unsigned long long key)
+{
+	// the entrances are the nodes with an arc leaving the cluster
+	cluster.m_entrances.clear();
+	for (PathingNodeVec::iterator nodeIt = cluster.m_nodes.begin(); nodeIt != cluster.m_nodes.end(); ++nodeIt)
+	{
+		PathingNode* pNode = *nodeIt;
+		const PathingArcVec& arcs = pNode->GetArcs();
+		for (PathingArcVec::const_iterator it = arcs.begin(); it != arcs.end(); ++it)
+		{
+			if (GetClusterKey((*it)->GetNeighbor(pNode)) != key)
+			{
+				cluster.m_entrances.push_back(pNode);
+				break;
+			}
+		}
+	}
+
+	// and the cheapest route between every pair of them that stays inside
+	size_t numEntrances = cluster.m_entrances.size();
+	cluster.m_costs.assign(numEntrances * numEntrances, FLT_MAX);
+	for (size_t i = 0; i < numEntrances; ++i)
+	{
+		SearchCluster(cluster, cluster.m_entrances[i], NULL);
+		for (size_t j = 0; j < numEntrances; ++j) {
+			cluster.m_costs[i * numEntrances + j] = GetLocalCost(cluster.m_entrances[j]);
+		}
+	}
+
+	cluster.m_dirty = false;
+}
+
+bool PathingHierarchy::SearchCluster(Cluster& cluster, PathingNode* pSource, PathingNode* pTarget)
+{
+	unsigned int numNodes = (unsigned int)cluster.m_nodes.size();
+	if (m_localCost.size() < numNodes)
+	{
+		m_localCost.resize(numNodes);
+		m_localPrev.resize(numNodes);
+		m_localClosed.resize(numNodes);
+	}
+
+	for (unsigned int i = 0; i < numNodes; ++i)
+	{
+		unsigned int index = cluster.m_nodes[i]->GetIndex();
+		if (index >= m_localIndex.size()) {
+			m_localIndex.resize(std::max(index + 1, (unsigned int)m_localIndex.size() * 2), INVALID_LOCAL_INDEX);
+		}
+		m_localIndex[index] = i;
+		m_localCost[i] = FLT_MAX;
+		m_localPrev[i] = INVALID_LOCAL_INDEX;
+		m_localClosed[i] = 0;
+	}
+
+	unsigned long long key = GetClusterKey(pSource);
+	unsigned int sourceIndex = m_localIndex[pSource->GetIndex()];
+	m_localCost[sourceIndex] = 0;
+
+	// A* towards the target, Dijkstra when there's no target
+	m_localOpen.clear();
+	m_localOpen.push_back(OpenEntry(pTarget ? GetDistance(pSource, pTarget) : 0, sourceIndex));
+
+	while (!m_localOpen.empty())
+	{
+		std::pop_heap(m_localOpen.begin(), m_localOpen.end(), IsWorseEntry);
+		unsigned int localIndex = m_localOpen.back().second;
+		m_localOpen.pop_back();
+
+		if (m_localClosed[localIndex]) {
+			continue;
+		}
+		m_localClosed[localIndex] = 1;
+
+		PathingNode* pNode = cluster.m_nodes[localIndex];
+		if (pNode == pTarget) {
+			return true;
+		}
+
+		const PathingArcVec& arcs = pNode->GetArcs();
+		for (PathingArcVec::const_iterator it = arcs.begin(); it != arcs.end(); ++it)
+		{
+			PathingNode* pNeighbor = (*it)->GetNeighbor(pNode);
+			if (GetClusterKey(pNeighbor) != key) {
+				continue;
+			}
+
+			unsigned int neighborIndex = m_localIndex[pNeighbor->GetIndex()];
+			if (neighborIndex >= numNodes || cluster.m_nodes[neighborIndex] != pNeighbor || m_localClosed[neighborIndex]) {
+				continue;
+			}
+
+			float cost = m_localCost[localIndex] + GetArcCost(*it, pNode, pNeighbor);
+			if (cost < m_localCost[neighborIndex])
+			{
+				m_localCost[neighborIndex] = cost;
+				m_localPrev[neighborIndex] = localIndex;
+
+				float heuristic = pTarget ? GetDistance(pNeighbor, pTarget) : 0;
+				m_localOpen.push_back(OpenEntry(cost + heuristic, neighborIndex));
+				std::push_heap(m_localOpen.begin(), m_localOpen.end(), IsWorseEntry);
+			}
+		}
+	}
+
+	return pTarget == NULL;
+}
+
+float PathingHierarchy::GetLocalCost(const PathingNode* pNode) const
+{
+	return m_localCost[m_localIndex[pNode->GetIndex()]];
+}
+
+void PathingHierarchy::GrowScratch(unsigned int nodeIndex)
+{
+	if (nodeIndex < m_stamp.size()) {
+		return;
+	}
+
+	size_t size = std::max((size_t)nodeIndex + 1, m_stamp.size() * 2);
+	m_node.resize(size, NULL);
+	m_prevNode.resize(size, NULL);
+	m_cost.resize(size, FLT_MAX);
+	m_stamp.resize(size, 0);
+	m_closedStamp.resize(size, 0);
+	m_goalCost.resize(size, FLT_MAX);
+	m_goalStamp.resize(size, 0);
+}
+
+void PathingHierarchy::OpenAbstractNode(PathingNode* pNode, PathingNode* pPrev, float cost, PathingNode* pGoalNode)
+{
+	unsigned int index = pNode->GetIndex();
+	GrowScratch(index);
+
+	if (m_closedStamp[index] == m_search) {
+		return;
+	}
+	if (m_stamp[index] == m_search && cost >= m_cost[index]) {
+		return;
+	}
+
+	m_node[index] = pNode;
+	m_prevNode[index] = pPrev;
+	m_cost[index] = cost;
+	m_stamp[index] = m_search;
+
+	m_open.push_back(OpenEntry(cost + GetDistance(pNode, pGoalNode), index));
+	std::push_heap(m_open.begin(), m_open.end(), IsWorseEntry);
+}
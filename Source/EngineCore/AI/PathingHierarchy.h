@@ -0,0 +1,127 @@
+#pragma once
+
+// ================================================================
+// PathingHierarchy.h : Hierarchical A* (HPA*) over a PathingGraph
+// ================================================================
+
+#include "../Common/CommonStd.h"
+#include <unordered_map>
+#include "Pathing.h"
+
+// -------------------------------------------------------------------------------------------------------
+// class HierarchicalPath						- not described in the book
+// The result of a hierarchical search: the start, the cluster entrances the path passes through and
+// the goal. PathingHierarchy::RefineNextSegment() turns it into pathing nodes one segment at a time, so
+// an agent only pays for the part of the path it's about to walk. The nodes are only good as long as
+// the graph doesn't lose them.
+// -------------------------------------------------------------------------------------------------------
+class HierarchicalPath
+{
+	friend class PathingHierarchy;
+
+	PathingNodeVec m_waypoints;
+	unsigned int m_nextSegment;
+
+public:
+	HierarchicalPath(void) { m_nextSegment = 0; }
+
+	const PathingNodeVec& GetWaypoints(void) const { return m_waypoints; }
+	bool IsEmpty(void) const { return m_waypoints.empty(); }
+	bool IsFullyRefined(void) const { return m_nextSegment + 1 >= m_waypoints.size(); }
+};
+
+// -------------------------------------------------------------------------------------------------------
+// class PathingHierarchy						- not described in the book
+// Splits the graph into clusters - the nodes that fall into the same cube of the given size - and
+// keeps an abstract graph on top of it. Its nodes are the entrances: nodes with an arc into another
+// cluster. Its edges are those arcs plus, for every pair of entrances of a cluster, the cost of the
+// cheapest route between them that stays inside the cluster. A long search then runs over a few
+// entrances per cluster instead of every node on the way.
+//
+// Only the clusters an edit touches are rebuilt, and only when the next search needs them. The graph
+// reports its edits (see PathingGraph::EnableHierarchy()), so don't call the On* functions yourself.
+//
+// Every node on a cluster border is an entrance, so any path over the graph breaks down into stretches
+// the abstract graph knows about and the path found is as short as a flat search's. The price is more
+// entrances per cluster on dense borders.
+// -------------------------------------------------------------------------------------------------------
+class PathingHierarchy
+{
+	struct Cluster
+	{
+		PathingNodeVec m_nodes;
+		PathingNodeVec m_entrances;
+		std::vector<float> m_costs;			// entrances x entrances, FLT_MAX where there's no route inside the cluster
+		bool m_dirty;
+	};
+
+	typedef std::unordered_map<unsigned long long, Cluster> ClusterMap;
+	typedef std::pair<float, unsigned int> OpenEntry;	// (fitness, node index), a min heap with stale entries skipped
+
+	float m_clusterSize;
+	float m_invClusterSize;
+	ClusterMap m_clusters;
+	std::vector<unsigned long long> m_dirtyClusters;
+
+	// scratch for searches inside one cluster, indexed by the node's position in Cluster::m_nodes
+	std::vector<unsigned int> m_localIndex;		// graph node index -> position in the cluster being searched
+	std::vector<float> m_localCost;
+	std::vector<unsigned int> m_localPrev;
+	std::vector<unsigned char> m_localClosed;
+	std::vector<OpenEntry> m_localOpen;
+
+	// scratch for the abstract search, indexed by graph node index
+	std::vector<PathingNode*> m_node;
+	std::vector<PathingNode*> m_prevNode;		// NULL for the start
+	std::vector<float> m_cost;
+	std::vector<unsigned int> m_stamp;			// == m_search once the node has been reached this search
+	std::vector<unsigned int> m_closedStamp;
+	std::vector<float> m_goalCost;				// cost from an entrance of the goal's cluster to the goal
+	std::vector<unsigned int> m_goalStamp;
+	std::vector<std::pair<PathingNode*, float> > m_startCosts;	// entrances of the start's cluster
+	std::vector<OpenEntry> m_open;
+	unsigned int m_search;
+
+	unsigned int m_lastExpanded;
+
+public:
+	explicit PathingHierarchy(float clusterSize = PATHING_HIERARCHY_DEFAULT_CLUSTER_SIZE);
+
+	void Clear(void);
+
+	// Finds the abstract path; false if there's none. When start and goal are the same node the path
+	// is empty and there's nothing to walk.
+	bool FindPath(PathingNode* pStartNode, PathingNode* pGoalNode, HierarchicalPath& outPath);
+
+	// Appends the nodes of the next segment to outNodes, without the node the segment starts on. False
+	// when the path is fully refined or the graph changed so the segment no longer exists.
+	bool RefineNextSegment(HierarchicalPath& path, PathingNodeVec& outNodes);
+
+	// Refines what's left of the path in one go. The caller owns the plan.
+	PathPlan* BuildPlan(HierarchicalPath& path);
+
+	// nodes the last FindPath() expanded, for comparing against a flat search
+	unsigned int GetLastExpanded(void) const { return m_lastExpanded; }
+	unsigned int GetNumClusters(void) const { return (unsigned int)m_clusters.size(); }
+	bool InSameCluster(const PathingNode* pNodeA, const PathingNode* pNodeB) const { return GetClusterKey(pNodeA) == GetClusterKey(pNodeB); }
+
+	// graph edits
+	void OnNodeAdded(PathingNode* pNode);
+	void OnNodeRemoved(PathingNode* pNode);
+	void OnArcChanged(PathingNode* pNodeA, PathingNode* pNodeB);
+
+private:
+	unsigned long long GetClusterKey(const PathingNode* pNode) const;
+	Cluster& GetCluster(const PathingNode* pNode);
+	void MarkDirty(const PathingNode* pNode);
+	void RebuildDirtyClusters(void);
+	void RebuildCluster(Cluster& cluster, unsigned long long key);
+
+	// Searches from pSource without leaving its cluster - every node when pTarget is NULL, otherwise
+	// until pTarget is reached. Returns false if pTarget can't be reached.
+	bool SearchCluster(Cluster& cluster, PathingNode* pSource, PathingNode* pTarget);
+	float GetLocalCost(const PathingNode* pNode) const;
+
+	void GrowScratch(unsigned int nodeIndex);
+	void OpenAbstractNode(PathingNode* pNode, PathingNode* pPrev, float cost, PathingNode* pGoalNode);
+};
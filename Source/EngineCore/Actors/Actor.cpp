@@ -13,6 +13,7 @@ Actor::Actor(ActorId id)
 {
 	m_id = id;
 	m_type = "Unknown";
+	m_index = INVALID_ACTOR_INDEX;
 
 	// helper
 	m_resource = "Unknown";
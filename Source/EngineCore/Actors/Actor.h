@@ -6,6 +6,7 @@
 // =======================================================================
 
 #include "../Common/CommonStd.h"
+#include "ComponentStore.h"
 
 class TiXmlElement;
 typedef std::string ActorType;
@@ -16,6 +17,7 @@ typedef std::string ActorType;
 class Actor
 {
 	friend class ActorFactory;
+	friend class ComponentStore;
 
 public:
 
@@ -29,6 +31,8 @@ private:
 	// [mrmike] - these were added post press as editor helpers, but will also be great for save game files, if we ever make them.
 	std::string m_resource;					// The XML file from which this actor was initialized (considered the "Archetype" file)
 
+	unsigned int m_index;					// dense index handed out by the ComponentStore, INVALID_ACTOR_INDEX if it isn't in one
+
 public:
 	explicit Actor(ActorId id);
 	~Actor(void);
@@ -45,6 +49,7 @@ public:
 	// accessors
 	ActorId GetId(void) const { return m_id; }
 	ActorType GetType(void) const { return m_type; }
+	unsigned int GetIndex(void) const { return m_index; }
 
 	// template function for retrieving components
 	template <class ComponentType>
@@ -0,0 +1,182 @@
+// =======================================================================
+// ComponentStore.cpp - Flat storage for the components of every actor
+// =======================================================================
+
+#include "../Common/CommonStd.h"
+#include "ComponentStore.h"
+#include "Actor.h"
+#include "TransformComponent.h"
+
+ComponentStore::~ComponentStore(void)
+{
+	// hand the transforms back to their components, which may outlive the store (the actors themselves
+	// must still be alive here - BaseAppLogic removes them before deleting the store anyway)
+	for (size_t i = 0; i < m_actors.size(); ++i)
+	{
+		if (m_actors[i]) {
+			RemoveActor(m_actors[i]);
+		}
+	}
+}
+
+unsigned int ComponentStore::GetTypeIndex(ComponentId id)
+{
+	static std::unordered_map<ComponentId, unsigned int> s_typeIndices;
+
+	std::unordered_map<ComponentId, unsigned int>::iterator findIt = s_typeIndices.find(id);
+	if (findIt != s_typeIndices.end()) {
+		return findIt->second;
+	}
+
+	unsigned int typeIndex = (unsigned int)s_typeIndices.size();
+	s_typeIndices.insert(std::make_pair(id, typeIndex));
+	return typeIndex;
+}
+
+void ComponentStore::AddActor(Actor* pActor)
+{
+	//Nv_ASSERT(pActor);
+	if (pActor->m_index != INVALID_ACTOR_INDEX) {
+		return;
+	}
+
+	// reuse indices so the tables stay as small as the most actors there have been at once
+	unsigned int actorIndex;
+	if (!m_freeIndices.empty())
+	{
+		actorIndex = m_freeIndices.back();
+		m_freeIndices.pop_back();
+		m_actors[actorIndex] = pActor;
+	}
+	else
+	{
+		actorIndex = (unsigned int)m_actors.size();
+		m_actors.push_back(pActor);
+	}
+	pActor->m_index = actorIndex;
+	m_actorIndices[pActor->GetId()] = actorIndex;
+
+	ComponentId transformId = ActorComponent::GetIdFromName(TransformComponent::g_Name);
+	const Actor::ActorComponents* pComponents = pActor->GetComponents();
+	for (Actor::ActorComponents::const_iterator it = pComponents->begin(); it != pComponents->end(); ++it)
+	{
+		AddComponent(actorIndex, it->second.get());
+		if (it->first == transformId) {
+			AddTransform(actorIndex, pActor->GetId(), static_cast<TransformComponent*>(it->second.get()));
+		}
+	}
+}
+
+void ComponentStore::RemoveActor(Actor* pActor)
+{
+	//Nv_ASSERT(pActor);
+	unsigned int actorIndex = pActor->m_index;
+	if (actorIndex == INVALID_ACTOR_INDEX || actorIndex >= m_actors.size() || m_actors[actorIndex] != pActor) {
+		return;
+	}
+
+	ComponentId transformId = ActorComponent::GetIdFromName(TransformComponent::g_Name);
+	const Actor::ActorComponents* pComponents = pActor->GetComponents();
+	for (Actor::ActorComponents::const_iterator it = pComponents->begin(); it != pComponents->end(); ++it)
+	{
+		if (it->first == transformId) {
+			RemoveTransform(actorIndex, static_cast<TransformComponent*>(it->second.get()));
+		}
+		RemoveComponent(actorIndex, it->second.get());
+	}
+
+	m_actorIndices.erase(pActor->GetId());
+	m_actors[actorIndex] = NULL;
+	m_freeIndices.push_back(actorIndex);
+	pActor->m_index = INVALID_ACTOR_INDEX;
+}
+
+unsigned int ComponentStore::FindActorIndex(ActorId id) const
+{
+	std::unordered_map<ActorId, unsigned int>::const_iterator findIt = m_actorIndices.find(id);
+	return (findIt != m_actorIndices.end()) ? findIt->second : INVALID_ACTOR_INDEX;
+}
+
+void ComponentStore::AddComponent(unsigned int actorIndex, ActorComponent* pComponent)
+{
+	unsigned int typeIndex = GetTypeIndex(pComponent->VGetId());
+	if (typeIndex >= m_arrays.size()) {
+		m_arrays.resize(typeIndex + 1);
+	}
+
+	ComponentArray& arr = m_arrays[typeIndex];
+	if (actorIndex >= arr.m_slots.size()) {
+		arr.m_slots.resize(m_actors.size(), INVALID_ACTOR_INDEX);
+	}
+
+	arr.m_slots[actorIndex] = (unsigned int)arr.m_components.size();
+	arr.m_components.push_back(pComponent);
+	arr.m_actorIndices.push_back(actorIndex);
+}
+
+void ComponentStore::RemoveComponent(unsigned int actorIndex, ActorComponent* pComponent)
+{
+	unsigned int typeIndex = GetTypeIndex(pComponent->VGetId());
+	if (typeIndex >= m_arrays.size()) {
+		return;
+	}
+
+	ComponentArray& arr = m_arrays[typeIndex];
+	if (actorIndex >= arr.m_slots.size() || arr.m_slots[actorIndex] == INVALID_ACTOR_INDEX) {
+		return;
+	}
+
+	// move the last component into the hole to keep the array packed
+	unsigned int slot = arr.m_slots[actorIndex];
+	unsigned int last = (unsigned int)arr.m_components.size() - 1;
+	if (slot != last)
+	{
+		arr.m_components[slot] = arr.m_components[last];
+		arr.m_actorIndices[slot] = arr.m_actorIndices[last];
+		arr.m_slots[arr.m_actorIndices[slot]] = slot;
+	}
+	arr.m_components.pop_back();
+	arr.m_actorIndices.pop_back();
+	arr.m_slots[actorIndex] = INVALID_ACTOR_INDEX;
+}
+
+void ComponentStore::AddTransform(unsigned int actorIndex, ActorId id, TransformComponent* pTransform)
+{
+	if (actorIndex >= m_transformSlots.size()) {
+		m_transformSlots.resize(m_actors.size(), INVALID_ACTOR_INDEX);
+	}
+
+	// the component's own matrix moves in here until the actor leaves the store
+	m_transformSlots[actorIndex] = (unsigned int)m_transforms.size();
+	m_transforms.push_back(pTransform->m_transform);
+	m_transformActorIds.push_back(id);
+	m_transformActorIndices.push_back(actorIndex);
+
+	pTransform->m_pStore = this;
+	pTransform->m_actorIndex = actorIndex;
+}
+
+void ComponentStore::RemoveTransform(unsigned int actorIndex, TransformComponent* pTransform)
+{
+	if (actorIndex >= m_transformSlots.size() || m_transformSlots[actorIndex] == INVALID_ACTOR_INDEX) {
+		return;
+	}
+
+	unsigned int slot = m_transformSlots[actorIndex];
+	pTransform->m_transform = m_transforms[slot];
+	pTransform->m_pStore = NULL;
+	pTransform->m_actorIndex = INVALID_ACTOR_INDEX;
+
+	unsigned int last = (unsigned int)m_transforms.size() - 1;
+	if (slot != last)
+	{
+		m_transforms[slot] = m_transforms[last];
+		m_transformActorIds[slot] = m_transformActorIds[last];
+		m_transformActorIndices[slot] = m_transformActorIndices[last];
+		m_transformSlots[m_transformActorIndices[slot]] = slot;
+	}
+	m_transforms.pop_back();
+	m_transformActorIds.pop_back();
+	m_transformActorIndices.pop_back();
+	m_transformSlots[actorIndex] = INVALID_ACTOR_INDEX;
+}
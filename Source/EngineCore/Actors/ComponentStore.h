@@ -0,0 +1,123 @@
+#pragma once
+
+// =======================================================================
+// ComponentStore.h - Flat storage for the components of every actor
+// =======================================================================
+
+#include "../Common/CommonStd.h"
+#include <unordered_map>
+#include "ActorComponent.h"
+
+class Actor;
+class TransformComponent;
+
+const unsigned int INVALID_ACTOR_INDEX = 0xffffffff;
+
+// -------------------------------------------------------------------------------------------------------------
+// class ComponentStore						- not described in the book
+//
+// Gives every actor added to it a small, dense index and keeps, for each component type, a packed array of
+// that type's components next to a table from actor index to position in the array. Finding an actor's
+// component is then two array reads instead of a map lookup and a round trip through weak_ptr, and a system
+// that wants every component of a type walks one contiguous array.
+//
+// The transforms are stored by field rather than by object: the matrices of all TransformComponents sit in
+// one array, so code that reads or writes every transform streams through memory the size of the matrices
+// and nothing else. A TransformComponent keeps working as before - it just reads and writes its row here
+// while its actor is in the store.
+//
+// Actor's own component map and GetComponent() stay as they are. The store is an index on top of them, so
+// it never owns a component. Game thread only.
+// -------------------------------------------------------------------------------------------------------------
+class ComponentStore : public Nv_noncopyable
+{
+	struct ComponentArray
+	{
+		std::vector<ActorComponent*> m_components;
+		std::vector<unsigned int> m_actorIndices;	// the actor each component belongs to
+		std::vector<unsigned int> m_slots;			// actor index -> position in m_components, INVALID_ACTOR_INDEX if it has none
+	};
+
+	std::vector<Actor*> m_actors;					// actor index -> actor, NULL for free indices
+	std::vector<unsigned int> m_freeIndices;
+	std::unordered_map<ActorId, unsigned int> m_actorIndices;
+	std::vector<ComponentArray> m_arrays;			// by type index
+
+	// transforms, by field
+	std::vector<Mat4x4> m_transforms;
+	std::vector<ActorId> m_transformActorIds;
+	std::vector<unsigned int> m_transformActorIndices;
+	std::vector<unsigned int> m_transformSlots;		// actor index -> position in the arrays above
+
+public:
+	ComponentStore(void) { }
+	~ComponentStore(void);
+
+	void AddActor(Actor* pActor);
+	void RemoveActor(Actor* pActor);
+
+	unsigned int FindActorIndex(ActorId id) const;
+	Actor* GetActor(unsigned int actorIndex) const { return (actorIndex < m_actors.size()) ? m_actors[actorIndex] : NULL; }
+	unsigned int GetNumActorIndices(void) const { return (unsigned int)m_actors.size(); }
+
+	// every component of one type, in no particular order
+	template <class ComponentType>
+	unsigned int GetNumComponents(void) const
+	{
+		const ComponentArray* pArray = FindArray(GetTypeIndex<ComponentType>());
+		return pArray ? (unsigned int)pArray->m_components.size() : 0;
+	}
+
+	// NULL if there's no such component, as when none of the type has been added yet
+	template <class ComponentType>
+	ComponentType* GetComponentAt(unsigned int i) const
+	{
+		const ComponentArray* pArray = FindArray(GetTypeIndex<ComponentType>());
+		if (!pArray || i >= pArray->m_components.size()) {
+			return NULL;
+		}
+		return static_cast<ComponentType*>(pArray->m_components[i]);
+	}
+
+	// NULL if the actor has no such component
+	template <class ComponentType>
+	ComponentType* GetComponent(unsigned int actorIndex) const
+	{
+		const ComponentArray* pArray = FindArray(GetTypeIndex<ComponentType>());
+		if (!pArray || actorIndex >= pArray->m_slots.size() || pArray->m_slots[actorIndex] == INVALID_ACTOR_INDEX) {
+			return NULL;
+		}
+		return static_cast<ComponentType*>(pArray->m_components[pArray->m_slots[actorIndex]]);
+	}
+
+	// transforms
+	unsigned int GetNumTransforms(void) const { return (unsigned int)m_transforms.size(); }
+	Mat4x4* GetTransforms(void) { return m_transforms.empty() ? NULL : &m_transforms[0]; }
+	const ActorId* GetTransformActorIds(void) const { return m_transformActorIds.empty() ? NULL : &m_transformActorIds[0]; }
+	const unsigned int* GetTransformActorIndices(void) const { return m_transformActorIndices.empty() ? NULL : &m_transformActorIndices[0]; }
+	Mat4x4* FindTransform(unsigned int actorIndex)
+	{
+		if (actorIndex >= m_transformSlots.size() || m_transformSlots[actorIndex] == INVALID_ACTOR_INDEX) {
+			return NULL;
+		}
+		return &m_transforms[m_transformSlots[actorIndex]];
+	}
+	Mat4x4* FindTransformById(ActorId id) { return FindTransform(FindActorIndex(id)); }
+
+	// Type indices are shared by every store and handed out the first time a type is asked for.
+	static unsigned int GetTypeIndex(ComponentId id);
+
+	template <class ComponentType>
+	static unsigned int GetTypeIndex(void)
+	{
+		static const unsigned int s_typeIndex = GetTypeIndex(ActorComponent::GetIdFromName(ComponentType::g_Name));
+		return s_typeIndex;
+	}
+
+private:
+	const ComponentArray* FindArray(unsigned int typeIndex) const { return (typeIndex < m_arrays.size()) ? &m_arrays[typeIndex] : NULL; }
+	void AddComponent(unsigned int actorIndex, ActorComponent* pComponent);
+	void RemoveComponent(unsigned int actorIndex, ActorComponent* pComponent);
+	void AddTransform(unsigned int actorIndex, ActorId id, TransformComponent* pTransform);
+	void RemoveTransform(unsigned int actorIndex, TransformComponent* pTransform);
+};
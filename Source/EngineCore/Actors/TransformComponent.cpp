@@ -16,12 +16,13 @@ bool TransformComponent::VInit(TiXmlElement* pData)
 	// [mrmike] - this was changed post-press - because changes to the TransformComponents can come in partial definitions,
 	//			  such as from the editor, its better to grab the current values rather than clear them out.
 
-	Vec3 yawPitchRoll = m_transform.GetYawPitchRoll();
+	Mat4x4& transform = GetTransformRef();
+	Vec3 yawPitchRoll = transform.GetYawPitchRoll();
 	yawPitchRoll.x = RADIANS_TO_DEGREES(yawPitchRoll.x);
 	yawPitchRoll.y = RADIANS_TO_DEGREES(yawPitchRoll.y);
 	yawPitchRoll.z = RADIANS_TO_DEGREES(yawPitchRoll.z);
 
-	Vec3 position = m_transform.GetPosition();
+	Vec3 position = transform.GetPosition();
 
 	TiXmlElement* pPositionElement = pData->FirstChildElement("Position");
 	if (pPositionElement)
@@ -82,7 +83,7 @@ bool TransformComponent::VInit(TiXmlElement* pData)
 	}
 	**/
 
-	m_transform = rotation * translation;
+	transform = rotation * translation;
 
 	return true;
 }
@@ -93,7 +94,7 @@ TiXmlElement* TransformComponent::VGenerateXml(void)
 
 	// initial transform -> position
 	TiXmlElement* pPosition = Nv_NEW TiXmlElement("Position");
-	Vec3 pos(m_transform.GetPosition());
+	Vec3 pos(GetTransformRef().GetPosition());
 	pPosition->SetAttribute("x", ToStr(pos.x).c_str());
 	pPosition->SetAttribute("y", ToStr(pos.y).c_str());
 	pPosition->SetAttribute("z", ToStr(pos.z).c_str());
@@ -101,7 +102,7 @@ TiXmlElement* TransformComponent::VGenerateXml(void)
 
 	// initial transform -> LookAt
 	TiXmlElement* pDirection = Nv_NEW TiXmlElement("YawPitchRoll");
-	Vec3 orient(m_transform.GetYawPitchRoll());
+	Vec3 orient(GetTransformRef().GetYawPitchRoll());
 	orient.x = RADIANS_TO_DEGREES(orient.x);
 	orient.y = RADIANS_TO_DEGREES(orient.y);
 	orient.z = RADIANS_TO_DEGREES(orient.z);
@@ -5,27 +5,39 @@
 // ===========================================================================================
 
 #include "ActorComponent.h"
+#include "ComponentStore.h"
 
 // ---------------------------------------------------------------------------------------------------------------------------
 // This component implementation is a very simple representation of the physical aspect of an actor. It just defines
 // the transform and doesn't register with the physics system at all.
+//
+// While its actor is in a ComponentStore, the transform lives in the store's transform array and m_transform
+// is left alone; the functions below read and write wherever it currently is.
 // ---------------------------------------------------------------------------------------------------------------------------
 class TransformComponent : public ActorComponent
 {
+	friend class ComponentStore;
+
 	Mat4x4 m_transform;
+	ComponentStore* m_pStore;		// NULL unless the actor is in a store
+	unsigned int m_actorIndex;
 
 public:
 	static const char* g_Name;
 	virtual const char* VGetName() const { return g_Name; }
 
-	TransformComponent(void) : m_transform(Mat4x4::g_Identity) { }
+	TransformComponent(void) : m_transform(Mat4x4::g_Identity) { m_pStore = NULL; m_actorIndex = INVALID_ACTOR_INDEX; }
 	virtual bool VInit(TiXmlElement* pData) override;
 	virtual TiXmlElement* VGenerateXml(void) override;
 
 	// transform functions
-	Mat4x4 GetTransform(void) const { return m_transform; }
-	void SetTransform(const Mat4x4& newTransform) { m_transform = newTransform; }
-	Vec3 GetPosition(void) const { return m_transform.GetPosition(); }
-	void SetPosition(const Vec3& pos) { m_transform.SetPosition(pos); }
-	Vec3 GetLookAt(void) const { return m_transform.GetDirection(); }
+	Mat4x4 GetTransform(void) const { return GetTransformRef(); }
+	void SetTransform(const Mat4x4& newTransform) { GetTransformRef() = newTransform; }
+	Vec3 GetPosition(void) const { return GetTransformRef().GetPosition(); }
+	void SetPosition(const Vec3& pos) { GetTransformRef().SetPosition(pos); }
+	Vec3 GetLookAt(void) const { return GetTransformRef().GetDirection(); }
+
+private:
+	Mat4x4& GetTransformRef(void) { return m_pStore ? *m_pStore->FindTransform(m_actorIndex) : m_transform; }
+	const Mat4x4& GetTransformRef(void) const { return m_pStore ? *m_pStore->FindTransform(m_actorIndex) : m_transform; }
 };
\ No newline at end of file
@@ -25,6 +25,7 @@
 // All event type headers
 #include "Physics/PhysicsEventListener.h"
 #include "EventManager/Events.h"
+#include "Multicore/JobSystem.h"
 
 #define MAX_LOADSTRING 100
 
@@ -45,6 +46,7 @@ App::App()
 	m_bIsEditorRunning = false;
 
 	m_pEventManager = nullptr;
+	m_pJobSystem = nullptr;
 	m_ResCache = nullptr;
 
 
@@ -123,10 +125,12 @@ bool App::InitInstance(HINSTANCE hInstance, LPWSTR lpCmdLine, HWND hWnd, int scr
 	//	Note - this is a little different from the book. Here we have a special resource ZIP file class, DevelopmentResourceZipFile,
 	//  that actually reads directly from the source asset files, rather than the ZIP file. This is MUCH better during development, since
 	//  you don't have to rebuild the ZIP file every time you make aminor change to an asset.
+	//  The release ZIP file is memory mapped, so stored entries are used in place and loader threads
+	//  can read it concurrently.
 	//
 	IResourceFile *zipFile = (m_bIsEditorRunning || m_Options.m_useDevelopmentDirectories) ?
 		Nv_NEW DevelopmentResourceZipFile(L"Assets.zip", DevelopmentResourceZipFile::Editor) :
-		Nv_NEW ResourceZipFile(L"Assets.zip");
+		Nv_NEW ResourceZipFile(L"Assets.zip", true);
 
 	m_ResCache = Nv_NEW ResCache(50, zipFile);
 
@@ -156,6 +160,19 @@ bool App::InitInstance(HINSTANCE hInstance, LPWSTR lpCmdLine, HWND hWnd, int scr
 	m_ResCache->RegisterLoader(CreateSdkMeshResourceLoader());
 	m_ResCache->RegisterLoader(CreateScriptResourceLoader());
 
+	// Budget categories - a burst of textures or sounds shouldn't push the actor definitions and
+	// scripts out of the cache. Everything else is in the "default" category.
+	const unsigned __int64 MB = 1024 * 1024;
+	m_ResCache->AddCategory("actors", "actors\\*.xml", 4 * MB);
+	m_ResCache->AddCategory("scripts", "*.lua", 2 * MB);
+	int textures = m_ResCache->AddCategory("textures", "*.dds", 24 * MB, 40 * MB);
+	m_ResCache->AddCategoryPattern(textures, "*.jpg");
+	int sounds = m_ResCache->AddCategory("sounds", "*.wav", 8 * MB, 16 * MB);
+	m_ResCache->AddCategoryPattern(sounds, "*.ogg");
+
+	// background threads for ResCache::GetHandleAsync() - started once every loader is registered
+	m_ResCache->StartAsyncLoading();
+
 	if (!LoadStrings("English"))
 	{
 		//Nv_ERROR("Failed to load strings");
@@ -191,6 +208,9 @@ bool App::InitInstance(HINSTANCE hInstance, LPWSTR lpCmdLine, HWND hWnd, int scr
 		//Nv_ERROR("Failed to create EventManager.");
 		return false;
 	}
+
+	// one worker per core, less one for the game thread - the game logic's process manager uses it
+	m_pJobSystem = Nv_NEW JobSystem();
 	
 
 	// DXUTInit, DXUTCreateWindow - Chapter 5, page 145
@@ -640,6 +660,7 @@ LRESULT App::OnClose()
 {
 	// release all the game systems in reverse order from which they were created
 	SAFE_DELETE(m_pGame);
+	SAFE_DELETE(m_pJobSystem);
 
 	DestroyWindow(GetHwnd());
 
@@ -647,6 +668,12 @@ LRESULT App::OnClose()
 
 	SAFE_DELETE(m_pBaseSocketManager);
 
+	// the loader threads post completion events, so they have to be gone before the event manager
+	if (m_ResCache)
+	{
+		m_ResCache->StopAsyncLoading();
+	}
+
 	SAFE_DELETE(m_pEventManager);
 
 	BaseScriptComponent::UnregisterScriptFunctions();
@@ -1050,6 +1077,12 @@ void CALLBACK App::OnUpdateGame(double fTime, float fElapsedTime, void *pUserCon
 		PostMessage(g_pApp->GetHwnd(), WM_CLOSE, 0, 0);
 	}
 
+	// async loads of scripts and the like, whose loaders have to run on this thread
+	if (g_pApp->m_ResCache)
+	{
+		g_pApp->m_ResCache->FinishGameThreadLoads();
+	}
+
 	if (g_pApp->m_pGame)
 	{
 		/*
@@ -13,6 +13,7 @@
 
 class BaseSocketManager;
 class NetworkEventForwarder;
+class JobSystem;
 
 class App {
 protected:
@@ -117,6 +118,9 @@ public:
 	// Event Manager
 	EventManager* m_pEventManager;
 
+	// Worker threads shared by the engine, e.g. for parallel safe processes
+	JobSystem* m_pJobSystem;
+
 	// Socket Manager - could be server or client
 	BaseSocketManager* m_pBaseSocketManager;
 	NetworkEventForwarder* m_pNetworkEventForwarder;
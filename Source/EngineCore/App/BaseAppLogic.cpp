@@ -8,14 +8,18 @@
 #include <mmsystem.h>
 
 #include "../AI/Pathing.h"
+#include "../AI/PathQuery.h"
 #include "../EventManager/Events.h"							// only for EvtData_Game_State
 #include "../Initialization/Initialization.h"				// only for GameOptions
 #include "../MainLoop/Process.h"
+#include "../Memory/FrameArena.h"
 //#include "../Network/Network.h"
+#include "../Network/Snapshot.h"
 #include "../ResourceCache/XmlResource.h"
 #include "../Physics/Physics.h"
 #include "../Actors/Actor.h"
 #include "../Actors/ActorFactory.h"
+#include "../Actors/ComponentStore.h"
 #include "../Utilities/String.h"
 #include "../UserInterface/HumanView.h"						// [rez] not ideal, but the loading sequence needs to know if this is a human view.
 
@@ -39,7 +43,7 @@ BaseAppLogic::BaseAppLogic()
 {
 	m_LastActorId = 0;
 	m_Lifetime = 0;
-	m_pProcessManager = Nv_NEW ProcessManager;
+	m_pProcessManager = Nv_NEW ProcessManager(g_pApp->m_pJobSystem);
 	m_random.Randomize();
 	m_State = BGS_Initializing;
 	m_bProxy = false;
@@ -51,7 +55,12 @@ BaseAppLogic::BaseAppLogic()
 	m_AIPlayersAttached = 0;
 	m_HumanGamesLoaded = 0;
 	m_pPathingGraph = NULL;
+	m_pPathQueries = NULL;
 	m_pActorFactory = NULL;
+	m_pComponentStore = Nv_NEW ComponentStore;
+	m_pSnapshotSocket = NULL;
+	m_pSnapshotReplicator = NULL;
+	m_pSnapshotReceiver = NULL;
 
 	m_pLevelManager = Nv_NEW LevelManager;
 	//Nv_ASSERT(m_pProcessManager && m_pLevelManager);
@@ -70,16 +79,20 @@ BaseAppLogic::~BaseAppLogic()
 		m_gameViews.pop_front();
 	}
 
+	StopSnapshots();
 	SAFE_DELETE(m_pLevelManager);
 	SAFE_DELETE(m_pProcessManager);
+	SAFE_DELETE(m_pPathQueries);
 	SAFE_DELETE(m_pActorFactory);
 
 	// destroy all actors
 	for (auto it = m_actors.begin(); it != m_actors.end(); ++it)
 	{
+		m_pComponentStore->RemoveActor(it->second.get());
 		it->second->Destroy();
 	}
 	m_actors.clear();
+	SAFE_DELETE(m_pComponentStore);
 
 	IEventManager::Get()->VRemoveListener(fastdelegate::MakeDelegate(this, &BaseAppLogic::RequestDestroyActorDelegate), EvtData_Request_Destroy_Actor::sk_EventType);
 }
@@ -87,13 +100,81 @@ BaseAppLogic::~BaseAppLogic()
 bool BaseAppLogic::Init(void)
 {
 	m_pActorFactory = VCreateActorFactory();
-	//m_pPathingGraph.reset(CreatePathingGraph());
+	//SetPathingGraph(std::shared_ptr<PathingGraph>(CreatePathingGraph()));
 
 	IEventManager::Get()->VAddListener(fastdelegate::MakeDelegate(this, &BaseAppLogic::RequestDestroyActorDelegate), EvtData_Request_Destroy_Actor::sk_EventType);
 
 	return true;
 }
 
+//
+// BaseAppLogic::SetPathingGraph					- not described in the book
+//
+//		Path requests go to a new PathQueryService on the graph; any still pending on the old one
+//		are dropped with it.
+//
+void BaseAppLogic::SetPathingGraph(std::shared_ptr<PathingGraph> pGraph)
+{
+	SAFE_DELETE(m_pPathQueries);
+	m_pPathingGraph = pGraph;
+	if (m_pPathingGraph) {
+		m_pPathQueries = Nv_NEW PathQueryService(m_pPathingGraph.get(), g_pApp->m_pJobSystem);
+	}
+}
+
+//
+// BaseAppLogic::StartSnapshotServer				- not described in the book
+//
+bool BaseAppLogic::StartSnapshotServer(unsigned short port)
+{
+	StopSnapshots();
+
+	UdpEventSocket* pSocket = Nv_NEW UdpEventSocket;
+	if (!g_pSocketManager || !pSocket->Init(port))
+	{
+		SAFE_DELETE(pSocket);
+		return false;
+	}
+	pSocket->SetAcceptConnections(true);
+	g_pSocketManager->AddSocket(pSocket);
+
+	m_pSnapshotSocket = pSocket;
+	m_pSnapshotReplicator = Nv_NEW SnapshotReplicator(pSocket, m_pComponentStore);
+	pSocket->SetSnapshotReplicator(m_pSnapshotReplicator);
+	return true;
+}
+
+//
+// BaseAppLogic::StartSnapshotClient				- not described in the book
+//
+bool BaseAppLogic::StartSnapshotClient(unsigned int ip, unsigned short port, unsigned int token)
+{
+	StopSnapshots();
+
+	UdpEventSocket* pSocket = Nv_NEW UdpEventSocket;
+	if (!g_pSocketManager || !pSocket->Init() || pSocket->Connect(ip, port, token) == INVALID_SOCKET_ID)
+	{
+		SAFE_DELETE(pSocket);
+		return false;
+	}
+	g_pSocketManager->AddSocket(pSocket);
+
+	m_pSnapshotSocket = pSocket;
+	m_pSnapshotReceiver = Nv_NEW SnapshotReceiver(pSocket, m_pComponentStore);
+	pSocket->SetSnapshotReceiver(m_pSnapshotReceiver);
+	return true;
+}
+
+void BaseAppLogic::StopSnapshots(void)
+{
+	if (m_pSnapshotSocket && g_pSocketManager) {
+		g_pSocketManager->RemoveSocket(m_pSnapshotSocket);
+	}
+	m_pSnapshotSocket = NULL;
+	SAFE_DELETE(m_pSnapshotReplicator);
+	SAFE_DELETE(m_pSnapshotReceiver);
+}
+
 std::string BaseAppLogic::GetActorXml(const ActorId id)
 {
 	StrongActorPtr pActor = MakeStrongPtr(VGetActor(id));
@@ -131,6 +212,7 @@ StrongActorPtr BaseAppLogic::VCreateActor(const std::string& actorResource, TiXm
 	StrongActorPtr pActor = m_pActorFactory->CreateActor(actorResource.c_str(), overrides, initialTransform, serversActorId);
 	if (pActor) {
 		m_actors.insert(std::make_pair(pActor->GetId(), pActor));
+		m_pComponentStore->AddActor(pActor.get());
 		if (!m_bProxy && (m_State == BGS_SpawningPlayersActors || m_State == BGS_Running))
 		{
 			std::shared_ptr<EvtData_Request_New_Actor> pNewActor(Nv_NEW EvtData_Request_New_Actor(actorResource, initialTransform, pActor->GetId()));
@@ -155,6 +237,7 @@ void BaseAppLogic::VDestroyActor(const ActorId actorId)
 	auto findIt = m_actors.find(actorId);
 	if (findIt != m_actors.end())
 	{
+		m_pComponentStore->RemoveActor(findIt->second.get());
 		findIt->second->Destroy();
 		m_actors.erase(findIt);
 	}
@@ -177,8 +260,12 @@ void BaseAppLogic::VModifyActor(const ActorId actorId, TiXmlElement* overrides)
 	}
 
 	auto findIt = m_actors.find(actorId);
-	if (findIt != m_actors.end()) {
+	if (findIt != m_actors.end())
+	{
+		// the overrides can add components, so the actor goes back into the store afresh
+		m_pComponentStore->RemoveActor(findIt->second.get());
 		m_pActorFactory->ModifyActor(findIt->second, overrides);
+		m_pComponentStore->AddActor(findIt->second.get());
 	}
 }
 
@@ -238,6 +325,18 @@ void BaseAppLogic::VOnUpdate(float time, float elapsedTime)
 		case BGS_Running:
 			m_pProcessManager->UpdateProcesses(deltaMilliseconds);
 
+			if (m_pPathQueries) {
+				m_pPathQueries->Update();
+			}
+
+			// the socket itself is pumped by the socket manager along with the others
+			if (m_pSnapshotReplicator) {
+				m_pSnapshotReplicator->Update(timeGetTime());
+			}
+			if (m_pSnapshotReceiver) {
+				m_pSnapshotReceiver->Update(timeGetTime());
+			}
+
 			if (m_pPhysics && !m_bProxy)
 			{
 				m_pPhysics->VOnUpdate(elapsedTime);
@@ -262,6 +361,9 @@ void BaseAppLogic::VOnUpdate(float time, float elapsedTime)
 		it->second->Update(deltaMilliseconds);
 	}
 
+	// this frame's transient allocations stay valid through the next frame, then they're dropped
+	FrameArena::Get().EndFrame();
+	Nv_MEMORY_TRACKER_UPDATE();
 }
 
 //
@@ -10,8 +10,13 @@
 #include "../Actors/Actor.h"
 
 class PathingGraph;
+class PathQueryService;
 class ActorFactory;
+class ComponentStore;
 class LevelManager;
+class UdpEventSocket;
+class SnapshotReplicator;
+class SnapshotReceiver;
 
 enum BaseGameState
 {
@@ -53,7 +58,13 @@ protected:
 	int m_HumanGamesLoaded;
 	GameViewList m_gameViews;									// views that are attached to our game.
 	std::shared_ptr<PathingGraph> m_pPathingGraph;				// the pathing graph
+	PathQueryService* m_pPathQueries;							// batched path requests against m_pPathingGraph
 	ActorFactory* m_pActorFactory;
+	ComponentStore* m_pComponentStore;							// flat, per-type arrays over the components in m_actors
+
+	UdpEventSocket* m_pSnapshotSocket;							// owned by g_pSocketManager once added to it
+	SnapshotReplicator* m_pSnapshotReplicator;					// on the server, if it's sending snapshots
+	SnapshotReceiver* m_pSnapshotReceiver;						// on a client, if it's receiving them
 
 	bool m_bProxy;												// set if this is a proxy game logic, not a real one
 	int m_remotePlayerId;										// if we are a remote player - what is our socket on the server
@@ -87,8 +98,20 @@ public:
 	}
 
 	std::shared_ptr<PathingGraph> GetPathingGraph(void) { return m_pPathingGraph; }
+	void SetPathingGraph(std::shared_ptr<PathingGraph> pGraph);
+	PathQueryService* GetPathQueries(void) { return m_pPathQueries; }
+	ComponentStore* GetComponentStore(void) { return m_pComponentStore; }
 	NvRandom& GetRNG(void) { return m_random; }
 
+	// Snapshot replication of actor transforms over UDP, alongside the TCP session. The server starts
+	// it on the same port number as its listen socket, and NetworkGameView gives each remote player a
+	// token for it at login; a client starts it on getting one. See SnapshotReplicator.
+	bool StartSnapshotServer(unsigned short port);
+	bool StartSnapshotClient(unsigned int ip, unsigned short port, unsigned int token);
+	void StopSnapshots(void);
+	UdpEventSocket* GetSnapshotSocket(void) { return m_pSnapshotSocket; }
+	SnapshotReplicator* GetSnapshotReplicator(void) { return m_pSnapshotReplicator; }
+
 	virtual void VAddView(std::shared_ptr<IGameView> pView, ActorId actorId = INVALID_ACTOR_ID);
 	virtual void VRemoveView(std::shared_ptr<IGameView> pView);
 
@@ -52,6 +52,9 @@ public:
 	virtual void VSetPosition(unsigned long newPosition) = 0;
 	virtual int VGetVolume() const = 0;
 	virtual float VGetProgress() = 0;
+
+	// Called every frame while the sound plays - streaming buffers decode the next piece here.
+	virtual void VUpdate() = 0;
 };
 
 // -------------------------------------------------------------------
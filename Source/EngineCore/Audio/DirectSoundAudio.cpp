@@ -154,6 +154,13 @@ IAudioBuffer* DirectSoundAudio::VInitAudioBuffer(std::shared_ptr<ResHandle> resH
 	dsbd.guid3DAlgorithm = GUID_NULL;
 	dsbd.lpwfxFormat = const_cast<WAVEFORMATEX*>(extra->GetFormat());
 
+	if (extra->IsStreaming())
+	{
+		// only a couple of seconds are ever decoded ahead of the play cursor
+		dsbd.dwFlags |= DSBCAPS_GETCURRENTPOSITION2;
+		dsbd.dwBufferBytes = DirectSoundAudioBuffer::GetStreamBufferBytes(extra->GetFormat());
+	}
+
 	HRESULT hr;
 	if (FAILED(hr = m_pDS->CreateSoundBuffer(&dsbd, &sampleHandle, NULL)))
 	{
@@ -183,9 +190,52 @@ DirectSoundAudioBuffer::DirectSoundAudioBuffer(
 	: AudioBuffer(resource)
 {
 	m_Sample = sample;
+
+	m_pStream = nullptr;
+	m_StreamBufferBytes = 0;
+	m_WriteOffset = 0;
+	m_LastPlayCursor = 0;
+	m_StreamStart = 0;
+	m_BytesQueued = 0;
+	m_BytesPlayed = 0;
+
+	std::shared_ptr<SoundResourceExtraData> extra = static_pointer_cast<SoundResourceExtraData>(resource->GetExtra());
+	if (extra->IsStreaming())
+	{
+		m_pStream = Nv_NEW SoundStream(resource);
+		if (!m_pStream->Open())
+		{
+			// plays silence rather than crash
+			SAFE_DELETE(m_pStream);
+		}
+
+		DSBCAPS caps;
+		ZeroMemory(&caps, sizeof(DSBCAPS));
+		caps.dwSize = sizeof(DSBCAPS);
+		if (SUCCEEDED(m_Sample->GetCaps(&caps)))
+		{
+			m_StreamBufferBytes = caps.dwBufferBytes;
+		}
+	}
+
 	FillBufferWithSound();
 }
 
+DirectSoundAudioBuffer::~DirectSoundAudioBuffer()
+{
+	SAFE_DELETE(m_pStream);
+}
+
+//
+// DirectSoundAudioBuffer::GetStreamBufferBytes			- not described in the book
+//
+DWORD DirectSoundAudioBuffer::GetStreamBufferBytes(WAVEFORMATEX const* pFormat)
+{
+	DWORD bytes = (DWORD)(((unsigned __int64)pFormat->nAvgBytesPerSec * STREAM_BUFFER_MILLI) / 1000);
+	DWORD blockAlign = std::max<DWORD>(pFormat->nBlockAlign, 1);
+	return std::max<DWORD>(bytes - bytes % blockAlign, blockAlign);
+}
+
 void* DirectSoundAudioBuffer::VGet()
 {
 	if (!VOnRestore()) {
@@ -215,6 +265,14 @@ bool DirectSoundAudioBuffer::VPlay(int volume, bool looping)
 
 	DWORD dwFlags = looping ? DSBPLAY_LOOPING : 0L;
 
+	if (m_pStream)
+	{
+		// the stream buffer always loops, VUpdate() stops it once the sound has run out
+		m_pStream->Seek(0);
+		PrimeStreamBuffer();
+		dwFlags = DSBPLAY_LOOPING;
+	}
+
 	return (S_OK == pDSB->Play(0, 0, dwFlags));
 }//end Play
 
@@ -268,6 +326,14 @@ bool DirectSoundAudioBuffer::VPause()
 bool DirectSoundAudioBuffer::VResume()
 {
 	m_isPaused = false;
+
+	// VPlay() would start a stream over from the top, so just carry on where it stopped
+	if (m_pStream)
+	{
+		LPDIRECTSOUNDBUFFER pDSB = (LPDIRECTSOUNDBUFFER)VGet();
+		return pDSB && (S_OK == pDSB->Play(0, 0, DSBPLAY_LOOPING));
+	}
+
 	return VPlay(VGetVolume(), VIsLooping());
 }
 
@@ -343,6 +409,13 @@ void DirectSoundAudioBuffer::VSetVolume(int volume)
 
 void DirectSoundAudioBuffer::VSetPosition(unsigned long newPosition)
 {
+	if (m_pStream)
+	{
+		m_pStream->Seek(newPosition);
+		PrimeStreamBuffer();
+		return;
+	}
+
 	m_Sample->SetCurrentPosition(newPosition);
 }
 
@@ -441,6 +514,11 @@ HRESULT DirectSoundAudioBuffer::FillBufferWithSound(void)
 		return DXUT_ERR(L"RestoreBuffer", hr);
 	}
 
+	if (m_pStream)
+	{
+		return PrimeStreamBuffer();
+	}
+
 	int pcmBufferSize = m_Resource->Size();
 	std::shared_ptr<SoundResourceExtraData> extra = static_pointer_cast<SoundResourceExtraData>(m_Resource->GetExtra());
 
@@ -484,7 +562,114 @@ float DirectSoundAudioBuffer::VGetProgress()
 
 	pDSB->GetCurrentPosition(&progress, NULL);
 
+	if (m_pStream)
+	{
+		std::shared_ptr<SoundResourceExtraData> extra = static_pointer_cast<SoundResourceExtraData>(m_Resource->GetExtra());
+		if (extra->GetPcmBytes() == 0)
+		{
+			return 0.0f;
+		}
+
+		// bytes played past the end of a looping sound have wrapped to the start
+		DWORD played = m_StreamStart + std::min(m_BytesPlayed, m_BytesQueued);
+		return (float)(played % extra->GetPcmBytes()) / (float)extra->GetPcmBytes();
+	}
+
 	float length = (float)m_Resource->Size();
 
 	return (float)progress / length;
-}
\ No newline at end of file
+}
+
+//
+// DirectSoundAudioBuffer::VUpdate						- not described in the book
+//
+//		Refills the part of a streaming buffer that has played since the last update.
+//
+void DirectSoundAudioBuffer::VUpdate()
+{
+	if (!m_pStream || m_StreamBufferBytes == 0 || !g_pAudio->VActive())
+	{
+		return;
+	}
+
+	DWORD playCursor = 0;
+	if (FAILED(m_Sample->GetCurrentPosition(&playCursor, NULL)))
+	{
+		return;
+	}
+
+	m_BytesPlayed += (playCursor + m_StreamBufferBytes - m_LastPlayCursor) % m_StreamBufferBytes;
+	m_LastPlayCursor = playCursor;
+
+	// everything that was decoded has been heard, the rest of the buffer is silence
+	if (!m_isLooping && m_pStream->IsFinished() && m_BytesPlayed >= m_BytesQueued)
+	{
+		m_Sample->Stop();
+		return;
+	}
+
+	DWORD freeBytes = (playCursor + m_StreamBufferBytes - m_WriteOffset) % m_StreamBufferBytes;
+	if (freeBytes > 0 && SUCCEEDED(StreamIntoBuffer(m_WriteOffset, freeBytes)))
+	{
+		m_WriteOffset = (m_WriteOffset + freeBytes) % m_StreamBufferBytes;
+	}
+}
+
+//
+// DirectSoundAudioBuffer::PrimeStreamBuffer				- not described in the book
+//
+//		Fills the whole stream buffer from the stream's current position and rewinds the buffer.
+//
+HRESULT DirectSoundAudioBuffer::PrimeStreamBuffer()
+{
+	if (m_StreamBufferBytes == 0)
+	{
+		return E_FAIL;
+	}
+
+	m_StreamStart = m_pStream->GetPosition();
+	m_WriteOffset = 0;
+	m_LastPlayCursor = 0;
+	m_BytesQueued = 0;
+	m_BytesPlayed = 0;
+
+	m_Sample->SetCurrentPosition(0);
+	return StreamIntoBuffer(0, m_StreamBufferBytes);
+}
+
+//
+// DirectSoundAudioBuffer::StreamIntoBuffer				- not described in the book
+//
+HRESULT DirectSoundAudioBuffer::StreamIntoBuffer(DWORD offset, DWORD bytes)
+{
+	HRESULT hr;
+	VOID* pLocked[2] = { NULL, NULL };
+	DWORD lockedBytes[2] = { 0, 0 };
+
+	// the locked region wraps around the end of the buffer in two pieces
+	if (FAILED(hr = m_Sample->Lock(offset, bytes, &pLocked[0], &lockedBytes[0], &pLocked[1], &lockedBytes[1], 0L))) {
+		return DXUT_ERR(L"Lock", hr);
+	}
+
+	std::shared_ptr<SoundResourceExtraData> extra = static_pointer_cast<SoundResourceExtraData>(m_Resource->GetExtra());
+	BYTE silence = (BYTE)(extra->GetFormat()->wBitsPerSample == 8 ? 128 : 0);
+
+	for (int i = 0; i < 2; ++i)
+	{
+		if (pLocked[i] == NULL)
+		{
+			continue;
+		}
+
+		DWORD decoded = m_pStream->Read((char*)pLocked[i], lockedBytes[i], m_isLooping);
+		m_BytesQueued += decoded;
+
+		if (decoded < lockedBytes[i])
+		{
+			FillMemory((BYTE*)pLocked[i] + decoded, lockedBytes[i] - decoded, silence);
+		}
+	}
+
+	m_Sample->Unlock(pLocked[0], lockedBytes[0], pLocked[1], lockedBytes[1]);
+	return S_OK;
+}
@@ -20,13 +20,33 @@
 //
 // ---------------------------------------------------------------------------
 
+class SoundStream;
+
 class DirectSoundAudioBuffer : public AudioBuffer
 {
 protected:
 	LPDIRECTSOUNDBUFFER m_Sample;
 
+	// [streaming] - a streaming sound plays out of a short looping buffer that VUpdate() refills
+	//				 behind the play cursor.
+	SoundStream* m_pStream;
+	DWORD m_StreamBufferBytes;
+	DWORD m_WriteOffset;				// where the next decoded bytes go in the buffer
+	DWORD m_LastPlayCursor;
+	DWORD m_StreamStart;				// PCM offset the buffer was primed from
+	DWORD m_BytesQueued;				// PCM written into the buffer since it was primed
+	DWORD m_BytesPlayed;				// buffer bytes played since it was primed, silence included
+
 public:
+	enum
+	{
+		STREAM_BUFFER_MILLI = 2000,
+	};
+
+	static DWORD GetStreamBufferBytes(WAVEFORMATEX const* pFormat);
+
 	DirectSoundAudioBuffer(LPDIRECTSOUNDBUFFER sample, std::shared_ptr<ResHandle> resource);
+	virtual ~DirectSoundAudioBuffer();
 	virtual void* VGet();
 	virtual bool VOnRestore();
 
@@ -41,10 +61,13 @@ public:
 	virtual void VSetPosition(unsigned long newPosition);
 
 	virtual float VGetProgress();
+	virtual void VUpdate();
 
 private:
 	HRESULT FillBufferWithSound();
 	HRESULT RestoreBuffer(BOOL* pbWasRestored);
+	HRESULT PrimeStreamBuffer();
+	HRESULT StreamIntoBuffer(DWORD offset, DWORD bytes);
 };
 
 
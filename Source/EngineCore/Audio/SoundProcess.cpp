@@ -81,6 +81,10 @@ void SoundProcess::VOnInit()
 //
 void SoundProcess::VOnUpdate(unsigned long deltaMs)
 {
+	if (m_AudioBuffer) {
+		m_AudioBuffer->VUpdate();
+	}
+
 	if (!IsPlaying())
 	{
 		Succeed();
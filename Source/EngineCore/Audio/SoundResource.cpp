@@ -20,7 +20,10 @@
 SoundResourceExtraData::SoundResourceExtraData()
 	: m_SoundType(SOUND_TYPE_UNKNOWN),
 	m_bInitialized(false),
-	m_LengthMilli(0)
+	m_LengthMilli(0),
+	m_bStreaming(false),
+	m_PcmBytes(0),
+	m_DataOffset(0)
 {
 
 }
@@ -219,6 +222,64 @@ bool WaveResourceLoader::ParseWave(char* wavStream, size_t bufferLength, std::sh
 	return false;
 }
 
+//
+// WaveResourceLoader::VLoadStreamingResource			- not described in the book
+//
+//		Walks the chunks of a streamed .wav for the format and the position of the data, without
+//		reading the data itself.
+//
+bool WaveResourceLoader::VLoadStreamingResource(IResourceStream* pStream, std::shared_ptr<ResHandle> handle)
+{
+	std::shared_ptr<SoundResourceExtraData> extra = std::shared_ptr<SoundResourceExtraData>(Nv_NEW SoundResourceExtraData());
+	extra->m_SoundType = SOUND_TYPE_WAVE;
+	extra->m_bStreaming = true;
+	handle->SetExtra(extra);
+
+	memset(&extra->m_WavFormatEx, 0, sizeof(WAVEFORMATEX));
+
+	DWORD header[3];
+	if (pStream->VRead(header, sizeof(header)) != sizeof(header) ||
+		header[0] != mmioFOURCC('R', 'I', 'F', 'F') || header[2] != mmioFOURCC('W', 'A', 'V', 'E'))
+	{
+		return false;		// not a WAV
+	}
+
+	bool foundFormat = false;
+	DWORD chunk[2];			// type and length
+	while (pStream->VRead(chunk, sizeof(chunk)) == sizeof(chunk))
+	{
+		DWORD length = chunk[1];
+		unsigned int chunkStart = pStream->VTell();
+
+		if (chunk[0] == mmioFOURCC('f', 'm', 't', ' '))
+		{
+			DWORD formatBytes = std::min<DWORD>(length, sizeof(WAVEFORMATEX));
+			if (pStream->VRead(&extra->m_WavFormatEx, formatBytes) != formatBytes)
+				return false;
+			extra->m_WavFormatEx.cbSize = (WORD)length;
+			foundFormat = true;
+		}
+		else if (chunk[0] == mmioFOURCC('d', 'a', 't', 'a'))
+		{
+			// The data is left where it is - a SoundStream reads it from here.
+			if (!foundFormat || extra->m_WavFormatEx.nAvgBytesPerSec == 0)
+				return false;
+
+			extra->m_DataOffset = chunkStart;
+			extra->m_PcmBytes = std::min<DWORD>(length, pStream->VGetSize() - chunkStart);
+			extra->m_LengthMilli = (int)(((unsigned __int64)extra->m_PcmBytes * 1000) / extra->m_WavFormatEx.nAvgBytesPerSec);
+			return true;
+		}
+
+		// chunks are word aligned
+		if (!pStream->VSeek(chunkStart + length + (length & 1)))
+			break;
+	}
+
+	// If we get to here, the .wav file didn't contain all the right pieces.
+	return false;
+}
+
 //
 //	struct OggMemoryFile						- Chapter 13, page 403
 //
@@ -337,6 +398,92 @@ long VorbisTell(void* data_src)
 	return static_cast<long>(pVorbisData->dataRead);
 }
 
+//
+// VorbisStreamRead, VorbisStreamSeek, VorbisStreamTell		- not described in the book
+//
+//		The same callbacks as above, reading from an IResourceStream instead of memory.
+//
+size_t VorbisStreamRead(void* data_ptr, size_t byteSize, size_t sizeToRead, void* data_src)
+{
+	IResourceStream* pStream = static_cast<IResourceStream*>(data_src);
+	if (NULL == pStream)
+	{
+		return -1;
+	}
+
+	return pStream->VRead(data_ptr, (unsigned int)(byteSize * sizeToRead));
+}
+
+int VorbisStreamSeek(void* data_src, ogg_int64_t offset, int origin)
+{
+	IResourceStream* pStream = static_cast<IResourceStream*>(data_src);
+	if (NULL == pStream)
+	{
+		return -1;
+	}
+
+	ogg_int64_t target = offset;
+	switch (origin)
+	{
+		case SEEK_SET:
+			break;
+		case SEEK_CUR:
+			target += pStream->VTell();
+			break;
+		case SEEK_END:
+			target += pStream->VGetSize();
+			break;
+		default:
+			//Nv_ASSERT(false && "Bad parameter for 'origin', requires same as fseek.");
+			return -1;
+	}
+
+	if (target < 0 || target > pStream->VGetSize())
+	{
+		return -1;
+	}
+
+	return pStream->VSeek((unsigned int)target) ? 0 : -1;
+}
+
+long VorbisStreamTell(void* data_src)
+{
+	IResourceStream* pStream = static_cast<IResourceStream*>(data_src);
+	if (NULL == pStream)
+	{
+		return -1L;
+	}
+
+	return static_cast<long>(pStream->VTell());
+}
+
+static ov_callbacks GetVorbisStreamCallbacks()
+{
+	ov_callbacks oggCallbacks;
+	oggCallbacks.read_func = VorbisStreamRead;
+	oggCallbacks.close_func = VorbisClose;		// the SoundStream owns the IResourceStream
+	oggCallbacks.seek_func = VorbisStreamSeek;
+	oggCallbacks.tell_func = VorbisStreamTell;
+	return oggCallbacks;
+}
+
+//
+// SetOggFormat										- not described in the book
+//
+static void SetOggFormat(WAVEFORMATEX& format, vorbis_info* vi)
+{
+	memset(&format, 0, sizeof(format));
+
+	format.cbSize = sizeof(format);
+	format.nChannels = vi->channels;
+	// ogg vorbis is always 16 bit.
+	format.wBitsPerSample = 16;
+	format.nSamplesPerSec = vi->rate;
+	format.nAvgBytesPerSec = format.nSamplesPerSec * format.nChannels * 2;
+	format.nBlockAlign = 2 * format.nChannels;
+	format.wFormatTag = 1;
+}
+
 std::shared_ptr<IResourceLoader> CreateWAVResourceLoader()
 {
 	return std::shared_ptr<IResourceLoader>(Nv_NEW WaveResourceLoader());
@@ -425,16 +572,7 @@ bool OggResourceLoader::ParseOgg(char* oggStream, size_t length, std::shared_ptr
 	// the vorbis_info struct keeps the most of the interesting format info
 	vorbis_info* vi = ov_info(&vf, -1);
 
-	memset(&(extra->m_WavFormatEx), 0, sizeof(extra->m_WavFormatEx));
-
-	extra->m_WavFormatEx.cbSize = sizeof(extra->m_WavFormatEx);
-	extra->m_WavFormatEx.nChannels = vi->channels;
-	// ogg vorbis is always 16 bit.
-	extra->m_WavFormatEx.wBitsPerSample = 16;
-	extra->m_WavFormatEx.nSamplesPerSec = vi->rate;
-	extra->m_WavFormatEx.nAvgBytesPerSec = extra->m_WavFormatEx.nSamplesPerSec * extra->m_WavFormatEx.nChannels * 2;
-	extra->m_WavFormatEx.nBlockAlign = 2 * extra->m_WavFormatEx.nChannels;
-	extra->m_WavFormatEx.wFormatTag = 1;
+	SetOggFormat(extra->m_WavFormatEx, vi);
 
 	DWORD	size	= 4096 * 16;
 	DWORD	pos		= 0;
@@ -471,4 +609,203 @@ bool OggResourceLoader::ParseOgg(char* oggStream, size_t length, std::shared_ptr
 	SAFE_DELETE(vorbisMemoryFile);
 
 	return true;
-}
\ No newline at end of file
+}
+
+//
+// OggResourceLoader::VLoadStreamingResource			- not described in the book
+//
+//		Only the headers are decoded here. ov_open_callbacks() also seeks to the end of the
+//		stream to find its length, which is cheap for the usual stored .ogg entries.
+//
+bool OggResourceLoader::VLoadStreamingResource(IResourceStream* pStream, std::shared_ptr<ResHandle> handle)
+{
+	std::shared_ptr<SoundResourceExtraData> extra = std::shared_ptr<SoundResourceExtraData>(Nv_NEW SoundResourceExtraData());
+	extra->m_SoundType = SOUND_TYPE_OGG;
+	extra->m_bStreaming = true;
+	handle->SetExtra(extra);
+
+	OggVorbis_File vf;			// for the vorbisfile interface
+	if (ov_open_callbacks(pStream, &vf, nullptr, 0, GetVorbisStreamCallbacks()) < 0)
+	{
+		return false;
+	}
+
+	vorbis_info* vi = ov_info(&vf, -1);
+	SetOggFormat(extra->m_WavFormatEx, vi);
+
+	// get the total number of PCM samples
+	extra->m_PcmBytes = (unsigned int)ov_pcm_total(&vf, -1) * 2 * vi->channels;
+	extra->m_LengthMilli = (int)(1000.0f * ov_time_total(&vf, -1));
+
+	ov_clear(&vf);
+	return true;
+}
+
+//
+// SoundStream									- not described in the book
+//
+SoundStream::SoundStream(std::shared_ptr<ResHandle> handle, unsigned int ringBytes)
+	: m_Handle(handle),
+	m_pStream(nullptr),
+	m_pVorbisFile(nullptr),
+	m_RingRead(0),
+	m_RingUsed(0),
+	m_Position(0),
+	m_PcmDecoded(0),
+	m_bEndOfStream(false)
+{
+	m_Extra = static_pointer_cast<SoundResourceExtraData>(handle->GetExtra());
+
+	// keep the ring a whole number of sample frames
+	unsigned int blockAlign = m_Extra ? std::max<unsigned int>(m_Extra->GetFormat()->nBlockAlign, 1) : 1;
+	m_Ring.resize(std::max(ringBytes - ringBytes % blockAlign, blockAlign));
+}
+
+SoundStream::~SoundStream()
+{
+	if (m_pVorbisFile)
+	{
+		ov_clear(m_pVorbisFile);
+		SAFE_DELETE(m_pVorbisFile);
+	}
+	SAFE_DELETE(m_pStream);
+}
+
+bool SoundStream::Open()
+{
+	if (!m_Extra || !m_Extra->IsStreaming())
+	{
+		return false;
+	}
+
+	m_pStream = m_Handle->OpenStream();
+	if (!m_pStream)
+	{
+		return false;
+	}
+
+	if (m_Extra->GetSoundType() == SOUND_TYPE_OGG)
+	{
+		m_pVorbisFile = Nv_NEW OggVorbis_File;
+		if (ov_open_callbacks(m_pStream, m_pVorbisFile, nullptr, 0, GetVorbisStreamCallbacks()) < 0)
+		{
+			SAFE_DELETE(m_pVorbisFile);
+			return false;
+		}
+		return true;
+	}
+
+	return m_pStream->VSeek(m_Extra->m_DataOffset);
+}
+
+//
+// SoundStream::Decode
+//
+//		Fills the free part of the ring. Returns the number of bytes decoded.
+//
+unsigned int SoundStream::Decode()
+{
+	unsigned int decoded = 0;
+	unsigned int ringSize = (unsigned int)m_Ring.size();
+
+	while (!m_bEndOfStream && m_RingUsed < ringSize)
+	{
+		unsigned int writePos = (m_RingRead + m_RingUsed) % ringSize;
+		unsigned int space = (writePos >= m_RingRead) ? ringSize - writePos : m_RingRead - writePos;
+		space = std::min(space, ringSize - m_RingUsed);
+
+		unsigned int got = 0;
+		if (m_pVorbisFile)
+		{
+			int sec = 0;
+			long ret = ov_read(m_pVorbisFile, &m_Ring[writePos], space, 0, 2, 1, &sec);
+			got = (ret > 0) ? (unsigned int)ret : 0;
+		}
+		else
+		{
+			unsigned int wanted = std::min(space, m_Extra->m_PcmBytes - m_PcmDecoded);
+			got = (wanted > 0) ? m_pStream->VRead(&m_Ring[writePos], wanted) : 0;
+			m_PcmDecoded += got;
+		}
+
+		if (got == 0)
+		{
+			m_bEndOfStream = true;
+			break;
+		}
+
+		m_RingUsed += got;
+		decoded += got;
+	}
+
+	return decoded;
+}
+
+unsigned int SoundStream::Read(char* pDest, unsigned int bytes, bool looping)
+{
+	if (!m_pStream)
+	{
+		return 0;
+	}
+
+	unsigned int ringSize = (unsigned int)m_Ring.size();
+	unsigned int copied = 0;
+	bool rewound = false;
+
+	while (copied < bytes)
+	{
+		if (m_RingUsed == 0)
+		{
+			Decode();
+			if (m_RingUsed == 0)
+			{
+				// the end of the sound - start over if it loops, but don't spin on an empty one
+				if (!looping || rewound || !Seek(0))
+				{
+					break;
+				}
+				rewound = true;
+				continue;
+			}
+		}
+
+		unsigned int count = std::min(std::min(bytes - copied, m_RingUsed), ringSize - m_RingRead);
+		memcpy(pDest + copied, &m_Ring[m_RingRead], count);
+
+		m_RingRead = (m_RingRead + count) % ringSize;
+		m_RingUsed -= count;
+		m_Position += count;
+		copied += count;
+		rewound = false;
+	}
+
+	return copied;
+}
+
+bool SoundStream::Seek(unsigned int pcmOffset)
+{
+	if (!m_pStream)
+	{
+		return false;
+	}
+
+	unsigned int blockAlign = std::max<unsigned int>(m_Extra->GetFormat()->nBlockAlign, 1);
+	pcmOffset = std::min(pcmOffset - pcmOffset % blockAlign, m_Extra->m_PcmBytes);
+
+	bool success = false;
+	if (m_pVorbisFile)
+	{
+		success = ov_pcm_seek(m_pVorbisFile, pcmOffset / blockAlign) == 0;
+	}
+	else
+	{
+		success = m_pStream->VSeek(m_Extra->m_DataOffset + pcmOffset);
+		m_PcmDecoded = pcmOffset;
+	}
+
+	m_RingRead = 0;
+	m_RingUsed = 0;
+	m_Position = pcmOffset;
+	m_bEndOfStream = !success;
+	return success;
+}
@@ -16,6 +16,7 @@ class SoundResourceExtraData : public IResourceExtraData
 {
 	friend class WaveResourceLoader;
 	friend class OggResourceLoader;
+	friend class SoundStream;
 
 public:
 	SoundResourceExtraData();
@@ -24,28 +25,46 @@ public:
 	enum SoundType GetSoundType() { return m_SoundType; }
 	WAVEFORMATEX const* GetFormat() { return &m_WavFormatEx; }
 	int GetLengthMilli() const { return m_LengthMilli; }
+	bool IsStreaming() const { return m_bStreaming; }
+	unsigned int GetPcmBytes() const { return m_PcmBytes; }
 
 protected:		
 	enum SoundType m_SoundType;				// is this an Ogg, WAV, etc. ?
 	bool m_bInitialized;					// has the sound been initialized
 	WAVEFORMATEX m_WavFormatEx;				// description of the PCM format
 	int m_LengthMilli;						// how long the sound is in milliseconds
+
+	// [streaming] - set for sounds played through a SoundStream instead of from the handle's buffer
+	bool m_bStreaming;
+	unsigned int m_PcmBytes;				// size of the whole sound once decoded
+	unsigned int m_DataOffset;				// where the PCM data starts in a streamed WAV
 };
 
 //
 // class WaveResourceLoader						- Chapter 13, page 399
 //
+// Sounds this big or bigger in the resource file are streamed. Short effects are still decoded
+// up front, so they can be played any number of times at once.
+const unsigned int SOUND_STREAMING_THRESHOLD = 1024 * 1024;
+
 class WaveResourceLoader : public IResourceLoader
 {
 public:
+	WaveResourceLoader(unsigned int streamingThreshold = SOUND_STREAMING_THRESHOLD) { m_StreamingThreshold = streamingThreshold; }
+
 	virtual bool VUseRawFile() { return false; }
 	virtual bool VDiscardRawBufferAfterLoad() { return true; }
 	virtual unsigned int VGetLoadedResourceSize(char* rawBuffer, unsigned int rawSize);
 	virtual bool VLoadResource(char* rawBuffer, unsigned int rawSize, std::shared_ptr<ResHandle> handle);
 	virtual std::string VGetPattern() { return "*.wav"; }
 
+	virtual bool VStreamResource(unsigned int rawSize) { return m_StreamingThreshold > 0 && rawSize >= m_StreamingThreshold; }
+	virtual bool VLoadStreamingResource(IResourceStream* pStream, std::shared_ptr<ResHandle> handle);
+
 protected:
 	bool ParseWave(char* wavStream, size_t length, std::shared_ptr<ResHandle> handle);
+
+	unsigned int m_StreamingThreshold;		// 0 never streams
 };
 
 //
@@ -54,12 +73,67 @@ protected:
 class OggResourceLoader : public IResourceLoader
 {
 public:
+	OggResourceLoader(unsigned int streamingThreshold = SOUND_STREAMING_THRESHOLD) { m_StreamingThreshold = streamingThreshold; }
+
 	virtual bool VUseRawFile() { return false; }
 	virtual bool VDiscardRawBufferAfterLoad() { return true; }
 	virtual unsigned int VGetLoadedResourceSize(char* rawBuffer, unsigned int rawSize);
 	virtual bool VLoadResource(char* rawBuffer, unsigned int rawSize, std::shared_ptr<ResHandle> handle);
 	virtual std::string VGetPattern() { return "*.ogg"; }
 
+	virtual bool VStreamResource(unsigned int rawSize) { return m_StreamingThreshold > 0 && rawSize >= m_StreamingThreshold; }
+	virtual bool VLoadStreamingResource(IResourceStream* pStream, std::shared_ptr<ResHandle> handle);
+
 protected:
 	bool ParseOgg(char* oggStream, size_t length, std::shared_ptr<ResHandle> handle);
+
+	unsigned int m_StreamingThreshold;		// 0 never streams
+};
+
+struct OggVorbis_File;
+
+//
+// class SoundStream							- not described in the book
+//
+// Decodes a streaming sound resource on demand. Each SoundStream opens its own reader over the
+// resource and decodes into a small ring buffer, which Read() drains - so a long music track
+// costs the ring, the decoder state and the read-ahead, not the whole track as PCM.
+// A SoundStream is meant to be used by one thread, the one that owns the audio buffer.
+//
+class SoundStream
+{
+public:
+	enum
+	{
+		DEFAULT_RING_BYTES = 64 * 1024,
+	};
+
+	SoundStream(std::shared_ptr<ResHandle> handle, unsigned int ringBytes = DEFAULT_RING_BYTES);
+	~SoundStream();
+
+	bool Open();
+
+	// Copies up to bytes of PCM into pDest, decoding more as the ring runs dry. A looping stream
+	// starts over at the end, so it only comes up short if the sound is empty.
+	unsigned int Read(char* pDest, unsigned int bytes, bool looping);
+	bool Seek(unsigned int pcmOffset);
+
+	unsigned int GetPosition() const { return m_Position; }
+	bool IsFinished() const { return m_bEndOfStream && m_RingUsed == 0; }
+
+private:
+	unsigned int Decode();
+
+	std::shared_ptr<ResHandle> m_Handle;
+	std::shared_ptr<SoundResourceExtraData> m_Extra;
+	IResourceStream* m_pStream;
+	OggVorbis_File* m_pVorbisFile;			// ogg only
+
+	std::vector<char> m_Ring;
+	unsigned int m_RingRead;				// where the next Read() starts
+	unsigned int m_RingUsed;				// decoded bytes waiting in the ring
+
+	unsigned int m_Position;				// offset in the PCM of the next byte Read() hands out
+	unsigned int m_PcmDecoded;				// wav only, PCM bytes read from the data chunk
+	bool m_bEndOfStream;
 };
\ No newline at end of file
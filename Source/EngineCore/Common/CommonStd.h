@@ -48,12 +48,18 @@ public:
 };
 
 // Game Code Complete - Chapter 12, page 446-447
-#if defined(_DEBUG)
+// The memory tracker replaces the global operator new, and blocks from the debug CRT's placement new
+// can't be freed through it, so tracked builds use plain new.
+#if defined(ENABLE_MEMORY_TRACKING)
+#	define Nv_NEW new
+#elif defined(_DEBUG)
 #	define Nv_NEW new(_NORMAL_BLOCK,__FILE__, __LINE__)
 #else
 #	define Nv_NEW new
 #endif
 
+#include "../Memory/MemoryTracker.h"
+
 #define DXUT_AUTOLIB
 
 // DirectX Includes
@@ -204,6 +204,23 @@ class Resource;
 class IResourceFile;
 class ResHandle;
 
+//
+// class IResourceStream					- not described in the book
+//
+// A pull based reader over a single resource, handed out by IResourceFile::VOpenResourceStream().
+// Offsets are in the resource's raw (uncompressed) bytes.
+//
+class IResourceStream
+{
+public:
+	virtual unsigned int VRead(void* pBuffer, unsigned int bytes) = 0;	// returns the bytes read, 0 at the end
+	virtual bool VSeek(unsigned int offset) = 0;
+	virtual unsigned int VTell() const = 0;
+	virtual unsigned int VGetSize() const = 0;
+
+	virtual ~IResourceStream() { }
+};
+
 //
 // class IResourceLoader					- Chapter 8, page 224
 //
@@ -216,6 +233,17 @@ public:
 	virtual bool VAddNullZero() { return false; }
 	virtual unsigned int VGetLoadedResourceSize(char* rawBuffer, unsigned int rawSize) = 0;
 	virtual bool VLoadResource(char* rawBuffer, unsigned int rawSize, std::shared_ptr<ResHandle> handle) = 0;
+
+	// Loaders whose VLoadResource() has to run on the game thread - it runs a script, say - return
+	// false here. ResCache::GetHandleAsync() then only reads their raw bytes on a loader thread and
+	// leaves the rest to ResCache::FinishGameThreadLoads().
+	virtual bool VSupportsAsyncLoad() { return true; }
+
+	// Loaders that return true here get a streaming handle - no buffer is loaded, the loader only
+	// reads what it needs (a header, say) to set up the extra data, and whoever uses the handle
+	// calls ResHandle::OpenStream() to read the rest a piece at a time.
+	virtual bool VStreamResource(unsigned int rawSize) { return false; }
+	virtual bool VLoadStreamingResource(IResourceStream* pStream, std::shared_ptr<ResHandle> handle) { return false; }
 };
 
 class IResourceFile
@@ -227,6 +255,18 @@ public:
 	virtual int VGetNumResources() const = 0;
 	virtual std::string VGetResourceName(int num) const = 0;
 	virtual bool VIsUsingDevelopmentDirectories(void) const = 0;
+
+	// Optional zero copy access: resource files that can hand out a read-only pointer to a
+	// resource's raw bytes (e.g. a stored entry in a memory mapped zip) return it here.
+	virtual const char* VGetRawResourceView(const Resource &r) { return nullptr; }
+
+	// True if VGetRawResource() may be called from several threads at once.
+	virtual bool VSupportsConcurrentReads(void) const { return false; }
+
+	// Optional streaming access. The caller owns the returned stream, which can be used from any
+	// one thread while other threads read the file. Returns nullptr if streaming isn't supported.
+	virtual IResourceStream* VOpenResourceStream(const Resource &r) { return nullptr; }
+
 	virtual ~IResourceFile() { }
 };
 
@@ -0,0 +1,279 @@
+//========================================================================
+// EventCodec.cpp : Compact binary encoding for events sent over the network
+//========================================================================
+
+#include "Common/CommonStd.h"
+#include "EventCodec.h"
+
+// the three smaller components of a unit quaternion all lie within +/- 1/sqrt(2)
+static const float QUAT_COMPONENT_RANGE = 0.70710678f;
+static const unsigned int QUAT_COMPONENT_BITS = 10;
+static const unsigned int QUAT_COMPONENT_MAX = (1 << QUAT_COMPONENT_BITS) - 1;
+
+// ==============================================================
+// QuantizedTransform
+// ==============================================================
+void QuantizedTransform::Quantize(const Mat4x4& mat)
+{
+	Vec3 position = mat.GetPosition();
+	m_position[0] = (int)floorf(position.x * EVENT_CODEC_POSITION_SCALE + 0.5f);
+	m_position[1] = (int)floorf(position.y * EVENT_CODEC_POSITION_SCALE + 0.5f);
+	m_position[2] = (int)floorf(position.z * EVENT_CODEC_POSITION_SCALE + 0.5f);
+
+	Quaternion q;
+	q.Build(mat);
+	q.Normalize();
+	float components[4] = { q.x, q.y, q.z, q.w };
+
+	unsigned int largest = 0;
+	for (unsigned int i = 1; i < 4; ++i)
+	{
+		if (fabsf(components[i]) > fabsf(components[largest])) {
+			largest = i;
+		}
+	}
+
+	// q and -q are the same rotation, so flip it to make the dropped component positive
+	float sign = (components[largest] < 0.0f) ? -1.0f : 1.0f;
+
+	m_rotation = largest;
+	unsigned int shift = 2;
+	for (unsigned int i = 0; i < 4; ++i)
+	{
+		if (i == largest) {
+			continue;
+		}
+
+		float normalized = (components[i] * sign + QUAT_COMPONENT_RANGE) / (2.0f * QUAT_COMPONENT_RANGE);
+		normalized = std::min(std::max(normalized, 0.0f), 1.0f);
+		m_rotation |= (unsigned int)(normalized * QUAT_COMPONENT_MAX + 0.5f) << shift;
+		shift += QUAT_COMPONENT_BITS;
+	}
+}
+
+void QuantizedTransform::DequantizeRotation(Quaternion& q) const
+{
+	unsigned int largest = m_rotation & 3;
+	float components[4];
+	float sumSquares = 0.0f;
+	unsigned int shift = 2;
+	for (unsigned int i = 0; i < 4; ++i)
+	{
+		if (i == largest) {
+			continue;
+		}
+
+		unsigned int value = (m_rotation >> shift) & QUAT_COMPONENT_MAX;
+		components[i] = ((float)value / QUAT_COMPONENT_MAX) * 2.0f * QUAT_COMPONENT_RANGE - QUAT_COMPONENT_RANGE;
+		sumSquares += components[i] * components[i];
+		shift += QUAT_COMPONENT_BITS;
+	}
+	components[largest] = sqrtf(std::max(1.0f - sumSquares, 0.0f));
+
+	q.x = components[0];
+	q.y = components[1];
+	q.z = components[2];
+	q.w = components[3];
+	q.Normalize();
+}
+
+void QuantizedTransform::Dequantize(Mat4x4& mat) const
+{
+	Quaternion q;
+	DequantizeRotation(q);
+	mat.BuildRotationQuat(q);
+	mat.SetPosition(Vec3(m_position[0] / EVENT_CODEC_POSITION_SCALE, m_position[1] / EVENT_CODEC_POSITION_SCALE, m_position[2] / EVENT_CODEC_POSITION_SCALE));
+}
+
+// ==============================================================
+// BinaryWriter
+// ==============================================================
+BinaryWriter::BinaryWriter(char* pBuffer, size_t capacity, EventDeltaCache* pDeltaCache)
+{
+	m_pData = pBuffer;
+	m_size = 0;
+	m_capacity = pBuffer ? capacity : 0;
+	m_pDeltaCache = pDeltaCache;
+}
+
+void BinaryWriter::WriteBytes(const void* pData, size_t size)
+{
+	if (m_size + size > m_capacity)
+	{
+		// out of room - carry on in a heap buffer that doubles as it needs to
+		size_t newCapacity = std::max(m_size + size, m_capacity * 2);
+		if (m_heap.empty())
+		{
+			m_heap.resize(newCapacity);
+			if (m_size > 0) {
+				memcpy(&m_heap[0], m_pData, m_size);
+			}
+		}
+		else
+		{
+			m_heap.resize(newCapacity);
+		}
+		m_pData = &m_heap[0];
+		m_capacity = newCapacity;
+	}
+
+	memcpy(m_pData + m_size, pData, size);
+	m_size += size;
+}
+
+void BinaryWriter::WriteU32(unsigned int value)
+{
+	unsigned char bytes[4];
+	bytes[0] = (unsigned char)(value);
+	bytes[1] = (unsigned char)(value >> 8);
+	bytes[2] = (unsigned char)(value >> 16);
+	bytes[3] = (unsigned char)(value >> 24);
+	WriteBytes(bytes, sizeof(bytes));
+}
+
+void BinaryWriter::WriteFloat(float value)
+{
+	unsigned int bits;
+	memcpy(&bits, &value, sizeof(bits));
+	WriteU32(bits);
+}
+
+void BinaryWriter::WriteVarUInt(unsigned int value)
+{
+	unsigned char bytes[5];
+	size_t count = 0;
+	while (value >= 0x80)
+	{
+		bytes[count++] = (unsigned char)(value | 0x80);
+		value >>= 7;
+	}
+	bytes[count++] = (unsigned char)value;
+	WriteBytes(bytes, count);
+}
+
+void BinaryWriter::WriteVarInt(int value)
+{
+	WriteVarUInt(((unsigned int)value << 1) ^ (unsigned int)(value >> 31));
+}
+
+void BinaryWriter::WriteString(const std::string& value)
+{
+	WriteVarUInt((unsigned int)value.size());
+	if (!value.empty()) {
+		WriteBytes(value.data(), value.size());
+	}
+}
+
+void BinaryWriter::WriteTransform(const QuantizedTransform& transform)
+{
+	WriteVarInt(transform.m_position[0]);
+	WriteVarInt(transform.m_position[1]);
+	WriteVarInt(transform.m_position[2]);
+	WriteU32(transform.m_rotation);
+}
+
+// ==============================================================
+// BinaryReader
+// ==============================================================
+BinaryReader::BinaryReader(const char* pData, size_t size, EventDeltaCache* pDeltaCache)
+{
+	m_pData = pData;
+	m_size = pData ? size : 0;
+	m_pos = 0;
+	m_failed = false;
+	m_pDeltaCache = pDeltaCache;
+}
+
+bool BinaryReader::ReadBytes(void* pData, size_t size)
+{
+	if (m_failed || size > m_size - m_pos)
+	{
+		m_failed = true;
+		memset(pData, 0, size);
+		return false;
+	}
+
+	memcpy(pData, m_pData + m_pos, size);
+	m_pos += size;
+	return true;
+}
+
+unsigned char BinaryReader::ReadU8(void)
+{
+	unsigned char value;
+	ReadBytes(&value, 1);
+	return value;
+}
+
+unsigned int BinaryReader::ReadU32(void)
+{
+	unsigned char bytes[4];
+	ReadBytes(bytes, sizeof(bytes));
+	return (unsigned int)bytes[0] | ((unsigned int)bytes[1] << 8) | ((unsigned int)bytes[2] << 16) | ((unsigned int)bytes[3] << 24);
+}
+
+float BinaryReader::ReadFloat(void)
+{
+	unsigned int bits = ReadU32();
+	float value;
+	memcpy(&value, &bits, sizeof(value));
+	return value;
+}
+
+unsigned int BinaryReader::ReadVarUInt(void)
+{
+	unsigned int value = 0;
+	for (unsigned int shift = 0; shift < 35; shift += 7)
+	{
+		unsigned char byte = ReadU8();
+		if (m_failed) {
+			return 0;
+		}
+
+		value |= (unsigned int)(byte & 0x7f) << shift;
+		if (!(byte & 0x80)) {
+			return value;
+		}
+	}
+
+	// more than five bytes can't be an unsigned int
+	m_failed = true;
+	return 0;
+}
+
+int BinaryReader::ReadVarInt(void)
+{
+	unsigned int value = ReadVarUInt();
+	return (int)(value >> 1) ^ -(int)(value & 1);
+}
+
+std::string BinaryReader::ReadString(void)
+{
+	unsigned int length = ReadVarUInt();
+	if (m_failed || length > GetRemaining())
+	{
+		m_failed = true;
+		return std::string();
+	}
+
+	std::string value(m_pData + m_pos, length);
+	m_pos += length;
+	return value;
+}
+
+void BinaryReader::ReadTransform(QuantizedTransform& transform)
+{
+	transform.m_position[0] = ReadVarInt();
+	transform.m_position[1] = ReadVarInt();
+	transform.m_position[2] = ReadVarInt();
+	transform.m_rotation = ReadU32();
+}
+
+// ==============================================================
+// EventDeltaCache
+// ==============================================================
+const QuantizedTransform* EventDeltaCache::FindTransform(ActorId id) const
+{
+	TransformMap::const_iterator findIt = m_transforms.find(id);
+	return (findIt != m_transforms.end()) ? &findIt->second : NULL;
+}
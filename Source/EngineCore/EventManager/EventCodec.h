@@ -0,0 +1,119 @@
+#pragma once
+
+//========================================================================
+// EventCodec.h : Compact binary encoding for events sent over the network
+//========================================================================
+
+#include <unordered_map>
+#include "Common/CommonStd.h"
+
+class EventDeltaCache;
+
+const float EVENT_CODEC_POSITION_SCALE = 1024.0f;		// positions go over the wire in 1/1024ths of a unit
+
+//
+// struct QuantizedTransform						- not described in the book
+//
+// A rotation + translation matrix the way the binary codec sends it: the position as fixed point
+// integers and the rotation as a "smallest three" quaternion - the largest component is dropped
+// (it can be rebuilt from the other three) and the rest get 10 bits each, so the whole rotation
+// fits in 32 bits. Scale isn't kept; actor transforms don't have any.
+//
+struct QuantizedTransform
+{
+	int m_position[3];
+	unsigned int m_rotation;
+
+	void Quantize(const Mat4x4& mat);
+	void Dequantize(Mat4x4& mat) const;
+	void DequantizeRotation(Quaternion& q) const;
+};
+
+//
+// class BinaryWriter								- not described in the book
+//
+// Little-endian writer for the binary event path. It starts in the buffer it's given and moves to
+// the heap only if that runs out, so the common case costs no allocation at all. Integers that are
+// usually small (ids, counts, deltas) go out as varints: 7 bits a byte, high bit set when more follow.
+//
+class BinaryWriter : public Nv_noncopyable
+{
+	char* m_pData;
+	size_t m_size;
+	size_t m_capacity;
+	std::vector<char> m_heap;
+	EventDeltaCache* m_pDeltaCache;
+
+public:
+	BinaryWriter(char* pBuffer, size_t capacity, EventDeltaCache* pDeltaCache = NULL);
+
+	void WriteBytes(const void* pData, size_t size);
+	void WriteU8(unsigned char value) { WriteBytes(&value, 1); }
+	void WriteBool(bool value) { WriteU8(value ? 1 : 0); }
+	void WriteU32(unsigned int value);
+	void WriteFloat(float value);
+	void WriteVarUInt(unsigned int value);
+	void WriteVarInt(int value);									// zigzag, so small negative numbers stay small
+	void WriteString(const std::string& value);
+	void WriteTransform(const QuantizedTransform& transform);		// the whole thing, no delta
+
+	const char* GetData(void) const { return m_pData; }
+	size_t GetSize(void) const { return m_size; }
+
+	// NULL unless this stream keeps per-connection state to delta encode against
+	EventDeltaCache* GetDeltaCache(void) const { return m_pDeltaCache; }
+};
+
+//
+// class BinaryReader								- not described in the book
+//
+// Reads what BinaryWriter wrote. Running off the end (or a varint that never ends) sets the failed
+// flag and every read after that returns zero, so codecs can read straight through and check once.
+//
+class BinaryReader : public Nv_noncopyable
+{
+	const char* m_pData;
+	size_t m_size;
+	size_t m_pos;
+	bool m_failed;
+	EventDeltaCache* m_pDeltaCache;
+
+public:
+	BinaryReader(const char* pData, size_t size, EventDeltaCache* pDeltaCache = NULL);
+
+	bool ReadBytes(void* pData, size_t size);
+	unsigned char ReadU8(void);
+	bool ReadBool(void) { return ReadU8() != 0; }
+	unsigned int ReadU32(void);
+	float ReadFloat(void);
+	unsigned int ReadVarUInt(void);
+	int ReadVarInt(void);
+	std::string ReadString(void);
+	void ReadTransform(QuantizedTransform& transform);
+
+	void SetFailed(void) { m_failed = true; }
+	bool Failed(void) const { return m_failed; }
+	size_t GetRemaining(void) const { return m_size - m_pos; }
+
+	EventDeltaCache* GetDeltaCache(void) const { return m_pDeltaCache; }
+};
+
+//
+// class EventDeltaCache							- not described in the book
+//
+// The last transform sent (or received) for each actor on one connection. The sender and the
+// receiver each keep one and update them in the same order, so an event can carry only what has
+// changed since the previous one. That relies on the connection delivering every message in
+// order, which TCP does - and on one forwarder per socket.
+//
+class EventDeltaCache
+{
+	typedef std::unordered_map<ActorId, QuantizedTransform> TransformMap;
+	TransformMap m_transforms;
+
+public:
+	const QuantizedTransform* FindTransform(ActorId id) const;
+	void SetTransform(ActorId id, const QuantizedTransform& transform) { m_transforms[id] = transform; }
+	void RemoveActor(ActorId id) { m_transforms.erase(id); }
+	void Clear(void) { m_transforms.clear(); }
+};
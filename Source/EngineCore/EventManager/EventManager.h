@@ -7,6 +7,8 @@
 #include <strstream>
 
 #include "Multicore/CriticalSection.h"
+#include "Multicore/MpscRingBuffer.h"
+#include "EventPool.h"
 #include "ThirdParty/FastDelegate/FastDelegate.h"
 #include "Common/CommonStd.h"
 
@@ -16,11 +18,13 @@
 // Forward declarations & typedefs
 // ----------------------------------------------
 class IEventData;
+class BinaryWriter;
+class BinaryReader;
 
 typedef unsigned long EventType;
 typedef std::shared_ptr<IEventData> IEventDataPtr;
 typedef fastdelegate::FastDelegate1<IEventDataPtr> EventListenerDelegate;
-typedef concurrent_queue<IEventDataPtr> ThreadSafeEventQueue;
+typedef MpscRingBuffer<IEventDataPtr> ThreadSafeEventQueue;
 
 
 // ----------------------------------------------
@@ -47,6 +51,8 @@ public:
 	virtual float GetTimeStamp(void) const = 0;
 	virtual void VSerialize(std::ostrstream& out) const = 0;
 	virtual void VDeserialize(std::istrstream& in) = 0;
+	virtual bool VSerializeBinary(BinaryWriter& out) const = 0;
+	virtual bool VDeserializeBinary(BinaryReader& in) = 0;
 	virtual IEventDataPtr VCopy(void) const = 0;
 	virtual const char* GetName(void) const = 0;
 };
@@ -69,6 +75,11 @@ public:
 	// Serializing for network input / output
 	virtual void VSerialize(std::ostrstream& out) const { }
 	virtual void VDeserialize(std::istrstream& in) { }
+
+	// Compact binary version of the above - not described in the book. Events that don't override these
+	// return false and go over the network as text.
+	virtual bool VSerializeBinary(BinaryWriter& out) const { return false; }
+	virtual bool VDeserializeBinary(BinaryReader& in) { return false; }
 };
 
 // -----------------------------------------------------------------------------------------------
@@ -113,6 +124,9 @@ public:
 	// Fire off event. This uses the queue and will call the delegate function on the next call to VTick(), assuming
 	// there's enough time.
 	virtual bool VQueueEvent(const IEventDataPtr& pEvent) = 0;
+
+	// VQueueEvent() for any thread. It doesn't drop events when the game thread falls behind, so it
+	// returns false only for an invalid one.
 	virtual bool VThreadSafeQueueEvent(const IEventDataPtr& pEvent) = 0;
 
 	// Find the next-available instance of the named event type and remove it from the processing queue. This may
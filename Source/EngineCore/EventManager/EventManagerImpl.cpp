@@ -7,9 +7,10 @@
 #include "Utilities/String.h"
 
 EventManager::EventManager(const char* pName, bool setAsGlobal)
-	: IEventManager(pName, setAsGlobal)
+	: IEventManager(pName, setAsGlobal), m_realtimeEventQueue(EVENTMANAGER_REALTIME_QUEUE_SIZE)
 {
 	m_activeQueue = 0;
+	m_realtimeEventsSpilled = 0;
 }
 
 EventManager::~EventManager()
@@ -21,65 +22,28 @@ bool EventManager::VAddListener(const EventListenerDelegate& eventDelegate, cons
 {
 	//Nv_LOG("Events", "Attempting to add delegate function for event type: " + ToStr(type, 16));
 
-	EventListenerList& eventListenerList = m_eventListeners[type];	// this will find or create the entry
-	for (auto it = eventListenerList.begin(); it != eventListenerList.end(); ++it)
+	if (!m_eventListeners.Add(eventDelegate, type))
 	{
-		if (eventDelegate == (*it))
-		{
-			//Nv_WARNING("Attempting to double-register a delegate");
-			return false;
-		}
+		//Nv_WARNING("Attempting to double-register a delegate");
+		return false;
 	}
 
-	eventListenerList.push_back(eventDelegate);
 	//Nv_LOG("Events", "Succesfully added delegate for event type: " + ToStr(type, 16));
-
 	return true;
 }
 
 bool EventManager::VRemoveListener(const EventListenerDelegate& eventDelegate, const EventType& type)
 {
 	//Nv_LOG("Events", "Attempting to remove delegate function from event type: " + ToStr(type, 16));
-	bool success = false;
-
-	auto findIt = m_eventListeners.find(type);
-	if (findIt != m_eventListeners.end())
-	{
-		EventListenerList& listeners = findIt->second;
-		for (auto it = listeners.begin(); it != listeners.end(); ++it)
-		{
-			if (eventDelegate == (*it))
-			{
-				listeners.erase(it);
-				//Nv_LOG("Events", "Succesfully removed delegate function from event type: " + ToStr(type, 16));
-				success = true;
-				break;		// We don't need to continue because it should be impossible for the same delegate function to be registered for the same event more than once.
-			}
-		}
-	}
-	
+	bool success = m_eventListeners.Remove(eventDelegate, type);
+	//if (success) Nv_LOG("Events", "Succesfully removed delegate function from event type: " + ToStr(type, 16));
 	return success;
 }
 
 bool EventManager::VTriggerEvent(const IEventDataPtr& pEvent) const
 {
 	//Nv_LOG("Events", "Attempting to trigger event " + std::string(pEvent->GetName()));
-	bool processed = false;
-
-	auto findIt = m_eventListeners.find(pEvent->VGetEventType());
-	if (findIt != m_eventListeners.end())
-	{
-		const EventListenerList& eventListenerList = findIt->second;
-		for (EventListenerList::const_iterator it = eventListenerList.begin(); it != eventListenerList.end(); ++it)
-		{
-			EventListenerDelegate listener = (*it);
-			//Nv_LOG("Events", "Sending Event " + std::string(pEvent->GetName()) + " to delegate.");
-			listener(pEvent);	// call the delegate
-			processed = true;
-		}
-	}
-
-	return processed;
+	return m_eventListeners.Dispatch(pEvent);
 }
 
 bool EventManager::VQueueEvent(const IEventDataPtr& pEvent)
@@ -96,8 +60,7 @@ bool EventManager::VQueueEvent(const IEventDataPtr& pEvent)
 
 	//Nv_LOG("Events", "Attempting to queue event: " + std::string(pEvent->GetName()));
 
-	auto findIt = m_eventListeners.find(pEvent->VGetEventType());
-	if (findIt != m_eventListeners.end())
+	if (m_eventListeners.HasListeners(pEvent->VGetEventType()))
 	{
 		m_queues[m_activeQueue].push_back(pEvent);
 		//Nv_LOG("Events", "Succesfully queued event: " + std::string(pEvent->GetName()));
@@ -112,7 +75,18 @@ bool EventManager::VQueueEvent(const IEventDataPtr& pEvent)
 
 bool EventManager::VThreadSafeQueueEvent(const IEventDataPtr& pEvent)
 {
-	m_realtimeEventQueue.push(pEvent);
+	if (!pEvent)
+	{
+		//Nv_ERROR("Invalid event in VThreadSafeQueueEvent()");
+		return false;
+	}
+
+	// lock free, unless the game thread has fallen EVENTMANAGER_REALTIME_QUEUE_SIZE events behind -
+	// then the event is spilled behind a lock, and VUpdate() reports it
+	if (!m_realtimeEventQueue.Push(pEvent))
+	{
+		InterlockedIncrement(&m_realtimeEventsSpilled);
+	}
 	return true;
 }
 
@@ -122,26 +96,23 @@ bool EventManager::VAbortEvent(const EventType& inType, bool allOfType)
 	//Nv_ASSERT(m_activeQueue < EVENTMANAGER_NUM_QUEUES);;
 
 	bool success = false;
-	EventListenerMap::iterator findIt = m_eventListeners.find(inType);
 
-	if (findIt != m_eventListeners.end())
+	// no check for listeners - a queued event may have lost them since it was queued
+	EventQueue& eventQueue = m_queues[m_activeQueue];
+	auto it = eventQueue.begin();
+	while (it != eventQueue.end())
 	{
-		EventQueue& eventQueue = m_queues[m_activeQueue];
-		auto it = eventQueue.begin();
-		while (it != eventQueue.end())
+		// Removing an item from the queue will invalidate the iterator, so carry on from the one erase() returns.
+		if ((*it)->VGetEventType() == inType)
+		{
+			it = eventQueue.erase(it);
+			success = true;
+			if (!allOfType)
+				break;
+		}
+		else
 		{
-			// Removing an item from the queue will invalidate the iterator, so have it point to the next member. All
-			// work inside this loop will be done using thisIt.
-			auto thisIt = it;
 			++it;
-
-			if ((*thisIt)->VGetEventType() == inType)
-			{
-				eventQueue.erase(thisIt);
-				success = true;
-				if (!allOfType)
-					break;
-			}
 		}
 	}
 
@@ -150,24 +121,21 @@ bool EventManager::VAbortEvent(const EventType& inType, bool allOfType)
 
 bool EventManager::VUpdate(unsigned long maxMillis)
 {
+	Nv_MEMORY_TAG_SCOPE(MEMTAG_EVENTS);
+
 	unsigned long currMs = GetTickCount();
 	unsigned long maxMs = ((maxMillis == IEventManager::kINFINITE) ? (IEventManager::kINFINITE) : (currMs + maxMillis));
 
 	// This section added to handle events from other threads. Check out Chapter 20.
 	// -------------------------------------------------------------------------------------------------
-	IEventDataPtr pRealtimeEvent;
-	while (m_realtimeEventQueue.try_pop(pRealtimeEvent))
+	// One pass over the ring - at most a full ring's worth, so producers can't keep us in here.
+	m_realtimeEventQueue.PopBatch([this](IEventDataPtr& pRealtimeEvent) { VQueueEvent(pRealtimeEvent); });
+	LONG spilled = InterlockedExchange(&m_realtimeEventsSpilled, 0);
+	if (spilled > 0)
 	{
-		VQueueEvent(pRealtimeEvent);
-
-		currMs = GetTickCount();
-		if (maxMillis != IEventManager::kINFINITE)
-		{
-			if (currMs >= maxMs)
-			{
-				//Nv_ERROR("A realtime process is spamming the event manager!");
-			}
-		}
+		char message[128];
+		sprintf_s(message, "EventManager: the realtime event queue is full, %ld events spilled - a realtime process is spamming the event manager!\n", spilled);
+		OutputDebugStringA(message);
 	}
 	// -------------------------------------------------------------------------------------------------
 
@@ -178,31 +146,17 @@ bool EventManager::VUpdate(unsigned long maxMillis)
 
 	//Nv_LOG("EventLoop", "Processing Event Queue " + ToStr(queueToProcess) + "; " + ToStr((unsigned long)m_queues[queueToProcess].size()) + " events to process");
 
-	// Process the queue
-	while (!m_queues[queueToProcess].empty())
+	// Process the queue. Listeners queueing more events only touch the active queue, so walking this
+	// one by index is safe.
+	EventQueue& eventQueue = m_queues[queueToProcess];
+	size_t numProcessed = 0;
+	while (numProcessed < eventQueue.size())
 	{
-		// pop the front of the queue
-		IEventDataPtr pEvent = m_queues[queueToProcess].front();
-		m_queues[queueToProcess].pop_front();
+		const IEventDataPtr& pEvent = eventQueue[numProcessed++];
 		//Nv_LOG("EventLoop", "\t\tProcessing Event " + std::string(pEvent->GetName()));
 
-		const EventType& eventType = pEvent->VGetEventType();
-
-		// find all the delegate functions registered for this event.
-		auto findIt = m_eventListeners.find(eventType);
-		if (findIt != m_eventListeners.end())
-		{
-			const EventListenerList& eventListeners = findIt->second;
-			//Nv_LOG("EventLoop", "\t\tFound " + ToStr((unsigned long)eventListeners.size()) + " delegates");
-
-			// Call each listener
-			for (auto it = eventListeners.begin(); it != eventListeners.end(); ++it)
-			{
-				EventListenerDelegate listener = (*it);
-				//Nv_LOG("EventLoop", "\t\tSending event " + std::string(pEvent->GetName()) + " to delegate");
-				listener(pEvent);
-			}
-		}
+		// call all the delegate functions registered for this event
+		m_eventListeners.Dispatch(pEvent);
 
 		// check to see if time ran out
 		currMs = GetTickCount();
@@ -214,17 +168,253 @@ bool EventManager::VUpdate(unsigned long maxMillis)
 	}
 
 	// If we couldn't process all of the events, push the remaining events to the new active queue.
-	// Note: To preserve sequencing, go back-to-front, inserting them at the head of the active queue.
-	bool queueFlushed = (m_queues[queueToProcess].empty());
+	// Note: To preserve sequencing, they go in ahead of anything queued while we were processing.
+	bool queueFlushed = (numProcessed == eventQueue.size());
 	if (!queueFlushed)
 	{
-		while (!m_queues[queueToProcess].empty())
+		EventQueue& activeQueue = m_queues[m_activeQueue];
+		activeQueue.insert(activeQueue.begin(), eventQueue.begin() + numProcessed, eventQueue.end());
+	}
+
+	// drops our references, pooled events go straight back to their pools
+	eventQueue.clear();
+
+	return queueFlushed;
+}
+
+//
+// EventListenerTable						- not described in the book
+//
+EventListenerTable::EventListenerTable()
+{
+	m_slots.resize(64);
+	m_numTypes = 0;
+	m_dispatchDepth = 0;
+	m_hasClearedListeners = false;
+}
+
+unsigned int EventListenerTable::HashType(EventType type)
+{
+	// event types are hand picked GUID fragments - mix them so the low bits are usable
+	unsigned int hash = (unsigned int)type;
+	hash ^= hash >> 16;
+	hash *= 0x45d9f3b;
+	hash ^= hash >> 16;
+	return hash;
+}
+
+const EventListenerTable::Slot* EventListenerTable::Find(EventType type) const
+{
+	size_t mask = m_slots.size() - 1;
+	for (size_t i = HashType(type) & mask; m_slots[i].m_used; i = (i + 1) & mask)
+	{
+		if (m_slots[i].m_type == type)
 		{
-			IEventDataPtr pEvent = m_queues[queueToProcess].back();
-			m_queues[queueToProcess].pop_back();
-			m_queues[m_activeQueue].push_front(pEvent);
+			return &m_slots[i];
 		}
 	}
+	return nullptr;
+}
 
-	return queueFlushed;
-}
\ No newline at end of file
+EventListenerTable::Slot& EventListenerTable::FindOrInsert(EventType type)
+{
+	const Slot* pSlot = Find(type);
+	if (pSlot)
+	{
+		return const_cast<Slot&>(*pSlot);
+	}
+
+	if ((m_numTypes + 1) * 2 > m_slots.size())
+	{
+		Grow();
+	}
+
+	size_t mask = m_slots.size() - 1;
+	size_t i = HashType(type) & mask;
+	while (m_slots[i].m_used)
+	{
+		i = (i + 1) & mask;
+	}
+
+	m_slots[i].m_used = true;
+	m_slots[i].m_type = type;
+	++m_numTypes;
+	return m_slots[i];
+}
+
+void EventListenerTable::Grow()
+{
+	std::vector<Slot> oldSlots(m_slots.size() * 2);
+	oldSlots.swap(m_slots);
+
+	size_t mask = m_slots.size() - 1;
+	for (size_t j = 0; j < oldSlots.size(); ++j)
+	{
+		if (!oldSlots[j].m_used)
+			continue;
+
+		size_t i = HashType(oldSlots[j].m_type) & mask;
+		while (m_slots[i].m_used)
+		{
+			i = (i + 1) & mask;
+		}
+		m_slots[i].m_used = true;
+		m_slots[i].m_type = oldSlots[j].m_type;
+		m_slots[i].m_listeners.swap(oldSlots[j].m_listeners);
+	}
+}
+
+bool EventListenerTable::Add(const EventListenerDelegate& eventDelegate, EventType type)
+{
+	const Slot* pSlot = Find(type);
+	if (pSlot && std::find(pSlot->m_listeners.begin(), pSlot->m_listeners.end(), eventDelegate) != pSlot->m_listeners.end())
+	{
+		return false;
+	}
+
+	if (m_dispatchDepth > 0)
+	{
+		// adding could grow the arrays being walked, so hold it back until the dispatch is done
+		for (size_t i = 0; i < m_pendingAdds.size(); ++i)
+		{
+			if (m_pendingAdds[i].m_type == type && m_pendingAdds[i].m_delegate == eventDelegate)
+			{
+				return false;
+			}
+		}
+
+		PendingAdd pending = { type, eventDelegate };
+		m_pendingAdds.push_back(pending);
+		return true;
+	}
+
+	FindOrInsert(type).m_listeners.push_back(eventDelegate);
+	return true;
+}
+
+bool EventListenerTable::Remove(const EventListenerDelegate& eventDelegate, EventType type)
+{
+	// it could still be waiting to be added
+	for (size_t i = 0; i < m_pendingAdds.size(); ++i)
+	{
+		if (m_pendingAdds[i].m_type == type && m_pendingAdds[i].m_delegate == eventDelegate)
+		{
+			m_pendingAdds.erase(m_pendingAdds.begin() + i);
+			return true;
+		}
+	}
+
+	Slot* pSlot = const_cast<Slot*>(Find(type));
+	if (pSlot == nullptr)
+	{
+		return false;
+	}
+
+	EventListenerArray& listeners = pSlot->m_listeners;
+	EventListenerArray::iterator it = std::find(listeners.begin(), listeners.end(), eventDelegate);
+	if (it == listeners.end())
+	{
+		return false;
+	}
+
+	if (m_dispatchDepth > 0)
+	{
+		// keep the array as it is for the dispatch in progress, an empty delegate is skipped
+		it->clear();
+		m_hasClearedListeners = true;
+	}
+	else
+	{
+		listeners.erase(it);
+	}
+	return true;
+}
+
+bool EventListenerTable::HasListeners(EventType type) const
+{
+	const Slot* pSlot = Find(type);
+	if (pSlot)
+	{
+		for (size_t i = 0; i < pSlot->m_listeners.size(); ++i)
+		{
+			if (!pSlot->m_listeners[i].empty())
+			{
+				return true;
+			}
+		}
+	}
+
+	for (size_t i = 0; i < m_pendingAdds.size(); ++i)
+	{
+		if (m_pendingAdds[i].m_type == type)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+bool EventListenerTable::Dispatch(const IEventDataPtr& pEvent)
+{
+	const Slot* pSlot = Find(pEvent->VGetEventType());
+	if (pSlot == nullptr || pSlot->m_listeners.empty())
+	{
+		return false;
+	}
+
+	bool processed = false;
+
+	// Adds are deferred while m_dispatchDepth is up, so neither m_slots nor this array can be
+	// reallocated under us - no copy of the delegates needed.
+	++m_dispatchDepth;
+	const EventListenerArray& listeners = pSlot->m_listeners;
+	for (size_t i = 0; i < listeners.size(); ++i)
+	{
+		const EventListenerDelegate& listener = listeners[i];
+		if (!listener.empty())
+		{
+			//Nv_LOG("Events", "Sending Event " + std::string(pEvent->GetName()) + " to delegate.");
+			listener(pEvent);	// call the delegate
+			processed = true;
+		}
+	}
+	if (--m_dispatchDepth == 0)
+	{
+		ApplyDeferredEdits();
+	}
+
+	return processed;
+}
+
+void EventListenerTable::ApplyDeferredEdits()
+{
+	if (m_hasClearedListeners)
+	{
+		for (size_t i = 0; i < m_slots.size(); ++i)
+		{
+			EventListenerArray& listeners = m_slots[i].m_listeners;
+			for (size_t j = 0; j < listeners.size(); )
+			{
+				if (listeners[j].empty())
+				{
+					listeners.erase(listeners.begin() + j);
+				}
+				else
+				{
+					++j;
+				}
+			}
+		}
+		m_hasClearedListeners = false;
+	}
+
+	if (!m_pendingAdds.empty())
+	{
+		std::vector<PendingAdd> pendingAdds;
+		pendingAdds.swap(m_pendingAdds);
+		for (size_t i = 0; i < pendingAdds.size(); ++i)
+		{
+			Add(pendingAdds[i].m_delegate, pendingAdds[i].m_type);
+		}
+	}
+}
@@ -7,18 +7,74 @@
 #include "EventManager.h"
 
 const unsigned int EVENTMANAGER_NUM_QUEUES = 2;
+const unsigned int EVENTMANAGER_REALTIME_QUEUE_SIZE = 4096;	// events other threads can have in flight
+
+//
+// class EventListenerTable					- not described in the book
+//
+// Replaces the std::map of std::lists of listeners. Event types are open addressed in a flat
+// array of slots and each slot keeps its delegates in a contiguous array, so dispatch is usually
+// a single probe followed by a linear walk.
+//
+// Listeners may add and remove listeners from inside a callback. While any dispatch is running,
+// a removed delegate is only cleared in place, so it won't be called again, and new delegates
+// are held back. Both edits are applied when the outermost dispatch returns.
+//
+class EventListenerTable : public Nv_noncopyable
+{
+	typedef std::vector<EventListenerDelegate> EventListenerArray;
+
+	struct Slot
+	{
+		EventType m_type;
+		bool m_used;
+		EventListenerArray m_listeners;
+
+		Slot() : m_type(0), m_used(false) { }
+	};
+
+	struct PendingAdd
+	{
+		EventType m_type;
+		EventListenerDelegate m_delegate;
+	};
+
+	std::vector<Slot> m_slots;					// power of two in size, never more than half full
+	unsigned int m_numTypes;
+	std::vector<PendingAdd> m_pendingAdds;
+	unsigned int m_dispatchDepth;				// > 0 while listeners are being called
+	bool m_hasClearedListeners;					// a remove during dispatch left an empty delegate behind
+
+public:
+	EventListenerTable();
+
+	bool Add(const EventListenerDelegate& eventDelegate, EventType type);
+	bool Remove(const EventListenerDelegate& eventDelegate, EventType type);
+	bool HasListeners(EventType type) const;
+
+	// Calls every listener registered for the event's type. Returns false if there were none.
+	bool Dispatch(const IEventDataPtr& pEvent);
+
+private:
+	static unsigned int HashType(EventType type);
+	const Slot* Find(EventType type) const;
+	Slot& FindOrInsert(EventType type);
+	void Grow();
+	void ApplyDeferredEdits();
+};
 
 class EventManager : public IEventManager
 {
-	typedef std::list<EventListenerDelegate> EventListenerList;
-	typedef std::map<EventType, EventListenerList> EventListenerMap;
-	typedef std::list<IEventDataPtr> EventQueue;
+	// a vector rather than a list - cleared, it keeps its memory, so queueing doesn't allocate once warmed up
+	typedef std::vector<IEventDataPtr> EventQueue;
 
-	EventListenerMap m_eventListeners;
+	// mutable - VTriggerEvent() is const, but listeners it calls may register more listeners
+	mutable EventListenerTable m_eventListeners;
 	EventQueue m_queues[EVENTMANAGER_NUM_QUEUES];
 	int m_activeQueue;		// index of actively processing queue; events enqueue to the opposing queue
 
 	ThreadSafeEventQueue m_realtimeEventQueue;
+	volatile LONG m_realtimeEventsSpilled;		// since the last VUpdate()
 
 public:
 	explicit EventManager(const char* pName, bool setAsGlobal);
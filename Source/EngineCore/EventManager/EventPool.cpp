@@ -0,0 +1,92 @@
+//========================================================================
+// EventPool.cpp : Pooled allocation for events that are sent every frame
+//========================================================================
+
+#include "Common/CommonStd.h"
+#include "EventPool.h"
+
+// Every pool in the game, for GetAllStats(). Built on first use because the pools themselves
+// are function statics that can be created from any thread.
+static CriticalSection& GetPoolRegistryLock()
+{
+	static CriticalSection s_cs;
+	return s_cs;
+}
+
+static std::vector<EventPool*>& GetPoolRegistry()
+{
+	static std::vector<EventPool*> s_pools;
+	return s_pools;
+}
+
+EventPool::EventPool(const char* name, unsigned int chunkSize, unsigned int chunksPerBlock)
+	: m_name(name)
+{
+	m_pool.Init(chunkSize, chunksPerBlock);
+	m_pool.SetDebugName(name);
+	m_live = 0;
+	m_peak = 0;
+	m_allocs = 0;
+	m_frees = 0;
+
+	ScopedCriticalSection locker(GetPoolRegistryLock());
+	GetPoolRegistry().push_back(this);
+}
+
+EventPool::~EventPool()
+{
+	ScopedCriticalSection locker(GetPoolRegistryLock());
+	std::vector<EventPool*>& pools = GetPoolRegistry();
+	pools.erase(std::remove(pools.begin(), pools.end(), this), pools.end());
+}
+
+void* EventPool::Alloc()
+{
+	ScopedCriticalSection locker(m_cs);
+	void* pMem = m_pool.Alloc();
+	if (pMem)
+	{
+		++m_allocs;
+		if (++m_live > m_peak)
+		{
+			m_peak = m_live;
+		}
+	}
+	return pMem;
+}
+
+void EventPool::Free(void* pMem)
+{
+	if (pMem == nullptr)
+	{
+		return;
+	}
+
+	ScopedCriticalSection locker(m_cs);
+	m_pool.Free(pMem);
+	++m_frees;
+	--m_live;
+}
+
+void EventPool::GetStats(EventPoolStats& stats) const
+{
+	ScopedCriticalSection locker(m_cs);
+	stats.m_name = m_name;
+	stats.m_chunkSize = m_pool.GetChunkSize();
+	stats.m_live = m_live;
+	stats.m_peak = m_peak;
+	stats.m_heapBlocks = m_pool.GetNumBlocks();
+	stats.m_allocs = m_allocs;
+	stats.m_frees = m_frees;
+}
+
+void EventPool::GetAllStats(std::vector<EventPoolStats>& stats)
+{
+	ScopedCriticalSection locker(GetPoolRegistryLock());
+	std::vector<EventPool*>& pools = GetPoolRegistry();
+	stats.resize(pools.size());
+	for (size_t i = 0; i < pools.size(); ++i)
+	{
+		pools[i]->GetStats(stats[i]);
+	}
+}
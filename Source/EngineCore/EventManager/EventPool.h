@@ -0,0 +1,115 @@
+#pragma once
+
+//========================================================================
+// EventPool.h : Pooled allocation for events that are sent every frame
+//========================================================================
+
+#include <typeinfo>
+#include "Memory/MemoryPool.h"
+#include "Multicore/CriticalSection.h"
+
+const unsigned int EVENT_POOL_CHUNKS_PER_BLOCK = 256;
+
+//
+// struct EventPoolStats							- not described in the book
+//
+// m_heapBlocks only goes up when the pool runs dry and grows, so once a game has warmed up it
+// should stay put from frame to frame - that's the proof no event hit the heap.
+//
+struct EventPoolStats
+{
+	std::string m_name;
+	unsigned int m_chunkSize;
+	unsigned int m_live;							// allocated and not freed yet
+	unsigned int m_peak;
+	unsigned int m_heapBlocks;						// blocks of EVENT_POOL_CHUNKS_PER_BLOCK chunks malloc'ed so far
+	unsigned __int64 m_allocs;
+	unsigned __int64 m_frees;
+};
+
+//
+// class EventPool									- not described in the book
+//
+// A MemoryPool behind a lock. Events are made on physics, loader and network threads and freed
+// wherever their last reference goes, so unlike Nv_MEMORYPOOL_DECLARATION the pool has to be
+// thread safe. Every pool registers itself so GetAllStats() can report on all of them.
+//
+class EventPool : public Nv_noncopyable
+{
+	MemoryPool m_pool;
+	mutable CriticalSection m_cs;
+	std::string m_name;
+	unsigned int m_live;
+	unsigned int m_peak;
+	unsigned __int64 m_allocs;
+	unsigned __int64 m_frees;
+
+public:
+	EventPool(const char* name, unsigned int chunkSize, unsigned int chunksPerBlock = EVENT_POOL_CHUNKS_PER_BLOCK);
+	~EventPool();
+
+	void* Alloc();
+	void Free(void* pMem);
+
+	void GetStats(EventPoolStats& stats) const;
+	static void GetAllStats(std::vector<EventPoolStats>& stats);
+};
+
+//
+// class PooledEventAllocator						- not described in the book
+//
+// Used by MakePooledEvent() through std::allocate_shared(), which rebinds it to a type holding
+// the shared_ptr control block and the event side by side. Each of those types gets its own
+// EventPool, so creating the event and its control block is a single pool allocation.
+//
+template<typename T, typename EventClass>
+class PooledEventAllocator
+{
+public:
+	typedef T value_type;
+
+	PooledEventAllocator() { }
+	template<typename U> PooledEventAllocator(const PooledEventAllocator<U, EventClass>&) { }
+
+	T* allocate(size_t n)
+	{
+		if (n != 1)
+		{
+			return static_cast<T*>(::operator new(n * sizeof(T)));
+		}
+		return static_cast<T*>(GetPool().Alloc());
+	}
+
+	void deallocate(T* p, size_t n)
+	{
+		if (n != 1)
+		{
+			::operator delete(p);
+			return;
+		}
+		GetPool().Free(p);
+	}
+
+	static EventPool& GetPool()
+	{
+		// created on first use - function statics are thread safe to initialize
+		static EventPool s_pool(typeid(EventClass).name(), sizeof(T));
+		return s_pool;
+	}
+
+	template<typename U> bool operator==(const PooledEventAllocator<U, EventClass>&) const { return true; }
+	template<typename U> bool operator!=(const PooledEventAllocator<U, EventClass>&) const { return false; }
+};
+
+//
+// MakePooledEvent									- not described in the book
+//
+// Use instead of shared_ptr<EvtData_X>(Nv_NEW EvtData_X(...)) for events sent in bulk:
+//
+//		IEventManager::Get()->VQueueEvent(MakePooledEvent<EvtData_Move_Actor>(id, transform));
+//
+template<typename EventClass, typename... Args>
+std::shared_ptr<EventClass> MakePooledEvent(Args&&... args)
+{
+	return std::allocate_shared<EventClass>(PooledEventAllocator<EventClass, EventClass>(), std::forward<Args>(args)...);
+}
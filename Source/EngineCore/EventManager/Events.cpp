@@ -26,6 +26,118 @@ const EventType EvtData_PlaySound::sk_EventType(0xace8a1c1);
 const EventType EvtData_Decompress_Request::sk_EventType(0xfa861fc1);
 const EventType EvtData_Decompression_Progress::sk_EventType(0x343ea7f2);
 
+const EventType EvtData_Resource_Loaded::sk_EventType(0x6e2c1b7d);
+
+const EventType EvtData_Path_Query_Done::sk_EventType(0x2b9f0d4e);
+
+//
+// EvtData_Move_Actor::VSerializeBinary				- not described in the book
+//
+// On a connection with a delta cache only what changed since the last move sent for the actor goes
+// out: the position as small per-axis differences, the rotation only when it turned. An actor that
+// didn't move at all costs its id and a flags byte.
+//
+bool EvtData_Move_Actor::VSerializeBinary(BinaryWriter& out) const
+{
+	QuantizedTransform transform;
+	transform.Quantize(m_matrix);
+
+	EventDeltaCache* pCache = out.GetDeltaCache();
+	const QuantizedTransform* pLast = pCache ? pCache->FindTransform(m_id) : NULL;
+
+	out.WriteVarUInt(m_id);
+	if (pLast)
+	{
+		bool positionChanged = transform.m_position[0] != pLast->m_position[0] ||
+			transform.m_position[1] != pLast->m_position[1] ||
+			transform.m_position[2] != pLast->m_position[2];
+		bool rotationChanged = transform.m_rotation != pLast->m_rotation;
+
+		unsigned char flags = MoveFlag_Delta;
+		if (positionChanged) {
+			flags |= MoveFlag_Position;
+		}
+		if (rotationChanged) {
+			flags |= MoveFlag_Rotation;
+		}
+		out.WriteU8(flags);
+
+		if (positionChanged)
+		{
+			for (int i = 0; i < 3; ++i)
+			{
+				out.WriteVarInt((int)((unsigned int)transform.m_position[i] - (unsigned int)pLast->m_position[i]));
+			}
+		}
+		if (rotationChanged) {
+			out.WriteU32(transform.m_rotation);
+		}
+	}
+	else
+	{
+		out.WriteU8(MoveFlag_Position | MoveFlag_Rotation);
+		out.WriteTransform(transform);
+	}
+
+	if (pCache) {
+		pCache->SetTransform(m_id, transform);
+	}
+	return true;
+}
+
+bool EvtData_Move_Actor::VDeserializeBinary(BinaryReader& in)
+{
+	m_id = in.ReadVarUInt();
+	unsigned char flags = in.ReadU8();
+	if (in.Failed()) {
+		return false;
+	}
+
+	EventDeltaCache* pCache = in.GetDeltaCache();
+	QuantizedTransform transform;
+	if (flags & MoveFlag_Delta)
+	{
+		const QuantizedTransform* pLast = pCache ? pCache->FindTransform(m_id) : NULL;
+		if (!pLast)
+		{
+			// the two ends disagree about what was sent before
+			in.SetFailed();
+			return false;
+		}
+		transform = *pLast;
+
+		if (flags & MoveFlag_Position)
+		{
+			for (int i = 0; i < 3; ++i)
+			{
+				transform.m_position[i] = (int)((unsigned int)transform.m_position[i] + (unsigned int)in.ReadVarInt());
+			}
+		}
+		if (flags & MoveFlag_Rotation) {
+			transform.m_rotation = in.ReadU32();
+		}
+	}
+	else if ((flags & (MoveFlag_Position | MoveFlag_Rotation)) == (MoveFlag_Position | MoveFlag_Rotation))
+	{
+		in.ReadTransform(transform);
+	}
+	else
+	{
+		in.SetFailed();
+		return false;
+	}
+
+	if (in.Failed()) {
+		return false;
+	}
+
+	transform.Dequantize(m_matrix);
+	if (pCache) {
+		pCache->SetTransform(m_id, transform);
+	}
+	return true;
+}
+
 bool EvtData_PlaySound::VBuildEventFromScript(void)
 {
 	if (m_eventData.IsString())
@@ -6,6 +6,7 @@
 #include "Common/CommonStd.h"
 
 #include "EventManager.h"
+#include "EventCodec.h"
 #include "../App/App.h"
 #include "../LUAScripting/ScriptEvent.h"
 
@@ -58,12 +59,26 @@ public:
 		return IEventDataPtr(Nv_NEW EvtData_New_Actor(m_actorId, m_viewId));
 	}
 
-	virtual void VDeserialize(std::ostrstream& out) const
+	virtual void VSerialize(std::ostrstream& out) const
 	{
 		out << m_actorId << " ";
 		out << m_viewId << " ";
 	}
 
+	virtual bool VSerializeBinary(BinaryWriter& out) const
+	{
+		out.WriteVarUInt(m_actorId);
+		out.WriteVarUInt(m_viewId);
+		return true;
+	}
+
+	virtual bool VDeserializeBinary(BinaryReader& in)
+	{
+		m_actorId = in.ReadVarUInt();
+		m_viewId = in.ReadVarUInt();
+		return true;
+	}
+
 	virtual const char* GetName(void) const
 	{
 		return "EvtData_New_Actor";
@@ -117,6 +132,25 @@ public:
 		in >> m_id;
 	}
 
+	virtual bool VSerializeBinary(BinaryWriter& out) const
+	{
+		// the actor won't move again, so neither end needs its last transform any more
+		if (out.GetDeltaCache()) {
+			out.GetDeltaCache()->RemoveActor(m_id);
+		}
+		out.WriteVarUInt(m_id);
+		return true;
+	}
+
+	virtual bool VDeserializeBinary(BinaryReader& in)
+	{
+		m_id = in.ReadVarUInt();
+		if (in.GetDeltaCache()) {
+			in.GetDeltaCache()->RemoveActor(m_id);
+		}
+		return true;
+	}
+
 	virtual const char* GetName(void) const
 	{
 		return "EvtData_Destroy_Actor";
@@ -177,9 +211,20 @@ public:
 		}
 	}
 
+	// flags for the binary version
+	enum
+	{
+		MoveFlag_Position = 1 << 0,			// position follows
+		MoveFlag_Rotation = 1 << 1,			// rotation follows
+		MoveFlag_Delta = 1 << 2,			// position is relative to the last one on this connection
+	};
+
+	virtual bool VSerializeBinary(BinaryWriter& out) const;
+	virtual bool VDeserializeBinary(BinaryReader& in);
+
 	virtual IEventDataPtr VCopy() const
 	{
-		return IEventDataPtr(Nv_NEW EvtData_Move_Actor(m_id, m_matrix));
+		return MakePooledEvent<EvtData_Move_Actor>(m_id, m_matrix);
 	}
 
 	virtual const char* GetName(void) const
@@ -292,6 +337,18 @@ public:
 		in >> m_id;
 	}
 
+	virtual bool VSerializeBinary(BinaryWriter& out) const
+	{
+		out.WriteVarUInt(m_id);
+		return true;
+	}
+
+	virtual bool VDeserializeBinary(BinaryReader& in)
+	{
+		m_id = in.ReadVarUInt();
+		return true;
+	}
+
 	virtual IEventDataPtr VCopy() const
 	{
 		return IEventDataPtr(Nv_NEW EvtData_Modified_Render_Component(m_id));
@@ -327,6 +384,8 @@ public:
 	{
 		return IEventDataPtr(Nv_NEW EvtData_Environment_Loaded());
 	}
+	virtual bool VSerializeBinary(BinaryWriter& out) const { return true; }
+	virtual bool VDeserializeBinary(BinaryReader& in) { return true; }
 	virtual const char* GetName(void) const { return "EvtData_Environment_Loaded"; }
 };
 
@@ -385,6 +444,20 @@ public:
 		in >> m_ipAddress;
 	}
 
+	virtual bool VSerializeBinary(BinaryWriter& out) const
+	{
+		out.WriteVarInt(m_socketId);
+		out.WriteU32((unsigned int)m_ipAddress);
+		return true;
+	}
+
+	virtual bool VDeserializeBinary(BinaryReader& in)
+	{
+		m_socketId = in.ReadVarInt();
+		m_ipAddress = (int)in.ReadU32();
+		return true;
+	}
+
 	int GetSocketId(void) const
 	{
 		return m_socketId;
@@ -483,6 +556,20 @@ public:
 		in >> m_SocketId;
 	}
 
+	virtual bool VSerializeBinary(BinaryWriter& out) const
+	{
+		out.WriteVarUInt(m_ActorId);
+		out.WriteVarInt(m_SocketId);
+		return true;
+	}
+
+	virtual bool VDeserializeBinary(BinaryReader& in)
+	{
+		m_ActorId = in.ReadVarUInt();
+		m_SocketId = in.ReadVarInt();
+		return true;
+	}
+
 	ActorId GetActorId(void) const
 	{
 		return m_ActorId;
@@ -586,6 +673,109 @@ public:
 };
 
 
+// --------------------------------------------------------------------------------------------------
+// EvtData_Resource_Loaded - sent by the resource cache loader threads when a resource requested
+//							 with ResCache::GetHandleAsync() has finished loading (or failed).
+// --------------------------------------------------------------------------------------------------
+class EvtData_Resource_Loaded : public BaseEventData
+{
+	std::string m_resourceName;
+	std::shared_ptr<ResHandle> m_handle;
+
+public:
+	static const EventType sk_EventType;
+
+	EvtData_Resource_Loaded(const std::string& resourceName, std::shared_ptr<ResHandle> handle)
+		: m_resourceName(resourceName),
+		m_handle(handle)
+	{
+	}
+
+	virtual const EventType& VGetEventType(void) const
+	{
+		return sk_EventType;
+	}
+
+	virtual IEventDataPtr VCopy() const
+	{
+		return IEventDataPtr(Nv_NEW EvtData_Resource_Loaded(m_resourceName, m_handle));
+	}
+
+	virtual void VSerialize(std::ostrstream& out) const
+	{
+		//Nv_ERROR("You should not be serializing resource loaded events!");
+	}
+
+	virtual const char* GetName(void) const
+	{
+		return "EvtData_Resource_Loaded";
+	}
+
+	const std::string& GetResourceName(void) const
+	{
+		return m_resourceName;
+	}
+
+	bool Succeeded(void) const
+	{
+		return m_handle != nullptr;
+	}
+
+	std::shared_ptr<ResHandle> GetHandle(void) const
+	{
+		return m_handle;
+	}
+};
+
+// --------------------------------------------------------------------------------------------------
+// EvtData_Path_Query_Done - sent by PathQueryService for requests submitted with notify set, once
+//							 the request has been solved. Collect the plan with the query id.
+// --------------------------------------------------------------------------------------------------
+class EvtData_Path_Query_Done : public BaseEventData
+{
+	unsigned int m_queryId;						// a PathQueryId
+	bool m_found;
+
+public:
+	static const EventType sk_EventType;
+
+	EvtData_Path_Query_Done(unsigned int queryId, bool found)
+		: m_queryId(queryId),
+		m_found(found)
+	{
+	}
+
+	virtual const EventType& VGetEventType(void) const
+	{
+		return sk_EventType;
+	}
+
+	virtual IEventDataPtr VCopy() const
+	{
+		return IEventDataPtr(Nv_NEW EvtData_Path_Query_Done(m_queryId, m_found));
+	}
+
+	virtual void VSerialize(std::ostrstream& out) const
+	{
+		//Nv_ERROR("You should not be serializing path query events!");
+	}
+
+	virtual const char* GetName(void) const
+	{
+		return "EvtData_Path_Query_Done";
+	}
+
+	unsigned int GetQueryId(void) const
+	{
+		return m_queryId;
+	}
+
+	bool Found(void) const
+	{
+		return m_found;
+	}
+};
+
 // --------------------------------------------------------------------------------------------------
 // class EvtData_Request_New_Actor
 // This event is sent by a server asking Client proxy logics to create new actors from their local
@@ -677,6 +867,36 @@ public:
 		out << m_viewId << " ";
 	}
 
+	virtual bool VSerializeBinary(BinaryWriter& out) const
+	{
+		out.WriteString(m_actorResource);
+		out.WriteBool(m_hasInitialTransform);
+		if (m_hasInitialTransform)
+		{
+			QuantizedTransform transform;
+			transform.Quantize(m_initialTransform);
+			out.WriteTransform(transform);
+		}
+		out.WriteVarUInt(m_serverActorId);
+		out.WriteVarUInt(m_viewId);
+		return true;
+	}
+
+	virtual bool VDeserializeBinary(BinaryReader& in)
+	{
+		m_actorResource = in.ReadString();
+		m_hasInitialTransform = in.ReadBool();
+		if (m_hasInitialTransform)
+		{
+			QuantizedTransform transform;
+			in.ReadTransform(transform);
+			transform.Dequantize(m_initialTransform);
+		}
+		m_serverActorId = in.ReadVarUInt();
+		m_viewId = in.ReadVarUInt();
+		return true;
+	}
+
 	virtual const char* GetName(void) const { return "EvtData_Request_New_Actor"; }
 
 	const std::string& GetActorResource(void) const { return m_actorResource; }
@@ -728,6 +948,18 @@ public:
 		out << m_actorId;
 	}
 
+	virtual bool VSerializeBinary(BinaryWriter& out) const
+	{
+		out.WriteVarUInt(m_actorId);
+		return true;
+	}
+
+	virtual bool VDeserializeBinary(BinaryReader& in)
+	{
+		m_actorId = in.ReadVarUInt();
+		return true;
+	}
+
 	virtual const char* GetName(void) const
 	{
 		return "EvtData_Request_Destroy_Actor";
@@ -787,6 +1019,18 @@ public:
 		in >> m_soundResource;
 	}
 
+	virtual bool VSerializeBinary(BinaryWriter& out) const
+	{
+		out.WriteString(m_soundResource);
+		return true;
+	}
+
+	virtual bool VDeserializeBinary(BinaryReader& in)
+	{
+		m_soundResource = in.ReadString();
+		return true;
+	}
+
 	const std::string& GetResource(void) const
 	{
 		return m_soundResource;
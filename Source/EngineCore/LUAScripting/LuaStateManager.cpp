@@ -61,6 +61,7 @@ bool LuaStateManager::VInit(void)
 
 void LuaStateManager::VExecuteFile(const char* path)
 {
+	Nv_MEMORY_TAG_SCOPE(MEMTAG_SCRIPTING);
 	int result = m_pLuaState->DoFile(path);
 	if (result != 0)
 		SetError(result);
@@ -68,6 +69,7 @@ void LuaStateManager::VExecuteFile(const char* path)
 
 void LuaStateManager::VExecuteString(const char* chunk)
 {
+	Nv_MEMORY_TAG_SCOPE(MEMTAG_SCRIPTING);
 	int result = 0;
 
 	// Most strings are passed straight through to the Lua interpreter
@@ -105,6 +105,8 @@ void ScriptProcess::VOnInit(void)
 
 void ScriptProcess::VOnUpdate(unsigned long deltaMs)
 {
+	Nv_MEMORY_TAG_SCOPE(MEMTAG_SCRIPTING);
+
 	m_time += deltaMs;
 	if (m_time >= m_frequency)
 	{
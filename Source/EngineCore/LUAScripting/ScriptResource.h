@@ -25,5 +25,6 @@ public:
 	virtual bool VAddNullZero() { return true; }
 	virtual unsigned int VGetLoadedResourceSize(char* rawBuffer, unsigned int rawSize) { return rawSize; }
 	virtual bool VLoadResource(char* rawBuffer, unsigned int rawSize, std::shared_ptr<ResHandle> handle);
+	virtual bool VSupportsAsyncLoad() { return false; }		// runs the script in the game thread's Lua state
 	virtual std::string VGetPattern() { return "*.lua"; }
 };
\ No newline at end of file
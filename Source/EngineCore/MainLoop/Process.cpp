@@ -11,6 +11,7 @@
 Process::Process(void)
 {
 	m_state = UNITIALIZED;
+	m_deferredMs = 0;
 	// m_pParent = NULL;
 	// m_pChild = NULL;
 }
@@ -73,6 +74,7 @@ StrongProcessPtr Process::RemoveChild(void)
 		//pChild->SetParent(nullptr);
 		return pChild;
 	}
+	return StrongProcessPtr();
 }
 
 /*
@@ -49,6 +49,7 @@ public:
 private:
 	State m_state;
 	StrongProcessPtr m_pChild;
+	unsigned long m_deferredMs;		// time of the ticks skipped because the process manager ran out of budget
 
 public:
 	// construction
@@ -63,6 +64,11 @@ protected:
 	virtual void VOnFail(void) { }						// called if the process fails (see below)
 	virtual void VOnAbort(void) { }						// called if the process is aborted (see below)
 
+	// Parallel safe processes may get VOnUpdate() called on a JobSystem worker, at the same time as
+	// other parallel safe processes. They must not touch anything shared without locking and must
+	// not attach processes. Every other callback stays on the thread calling UpdateProcesses().
+	virtual bool VIsParallelSafe(void) const { return false; }
+
 public:
 	// Functions for ending the process.
 	inline void Succeed(void);
@@ -4,6 +4,16 @@
 
 #include "Common/CommonStd.h"
 #include "ProcessManager.h"
+#include "Multicore/JobSystem.h"
+
+// ---------------------------------------------------------------------------------------------------
+// Constructor
+// ---------------------------------------------------------------------------------------------------
+ProcessManager::ProcessManager(JobSystem* pJobSystem)
+{
+	m_pJobSystem = pJobSystem;
+	m_tickBudgetMs = 0;
+}
 
 // ---------------------------------------------------------------------------------------------------
 // Destructor
@@ -17,21 +27,31 @@ ProcessManager::~ProcessManager(void)
 // The process update tick. Called every logic tick. This function returns the number of process 
 // chains that succeeded in the upper 32 bits and the number of process chains that failed or
 // were aborted in the lower 32 bits.
+//
+// [parallel] - the tick runs in three passes: initialize new processes and sort the running ones
+//				into a serial and a parallel schedule, update them, then deal with the dead ones.
+//				Only the update pass uses the job system.
 // ---------------------------------------------------------------------------------------------------
 unsigned int ProcessManager::UpdateProcesses(unsigned long deltaMs)
 {
 	unsigned short int successCount = 0;
 	unsigned short int failCount = 0;
+
+	bool hasDeadline = (m_tickBudgetMs != 0);
+	LONGLONG deadline = 0;
+	if (hasDeadline)
+	{
+		LARGE_INTEGER now, frequency;
+		QueryPerformanceCounter(&now);
+		QueryPerformanceFrequency(&frequency);
+		deadline = now.QuadPart + frequency.QuadPart * m_tickBudgetMs / 1000;
+	}
 	
-	ProcessList::iterator it = m_processList.begin();
-	while (it != m_processList.end())
+	m_serialSchedule.clear();
+	m_parallelSchedule.clear();
+	for (ProcessList::iterator it = m_processList.begin(); it != m_processList.end(); ++it)
 	{
-		// grab the next process
-		StrongProcessPtr pCurrProcess = (*it);
-
-		// save the iterator and increment the old one in case we need to remove this process from the list
-		ProcessList::iterator thisIt = it;
-		++it;
+		Process* pCurrProcess = it->get();
 
 		// process is unitialized, so initialize it
 		if (pCurrProcess->GetState() == Process::UNITIALIZED)
@@ -42,9 +62,63 @@ unsigned int ProcessManager::UpdateProcesses(unsigned long deltaMs)
 		// give the process and update tick if it's running
 		if (pCurrProcess->GetState() == Process::RUNNING)
 		{
-			pCurrProcess->VOnUpdate(deltaMs);
+			if (m_pJobSystem && pCurrProcess->VIsParallelSafe())
+				m_parallelSchedule.push_back(pCurrProcess);
+			else
+				m_serialSchedule.push_back(pCurrProcess);
+		}
+	}
+
+	// with a budget, whoever was skipped last time goes first
+	if (hasDeadline)
+	{
+		std::stable_sort(m_serialSchedule.begin(), m_serialSchedule.end(), IsMoreOverdue);
+		std::stable_sort(m_parallelSchedule.begin(), m_parallelSchedule.end(), IsMoreOverdue);
+	}
+
+	// fork - the parallel safe processes go to the job system in batches...
+	JobCounter counter;
+	if (!m_parallelSchedule.empty())
+	{
+		m_batches.clear();
+		for (size_t first = 0; first < m_parallelSchedule.size(); first += PROCESS_BATCH_SIZE)
+		{
+			ProcessBatch batch;
+			batch.m_ppProcesses = &m_parallelSchedule[first];
+			batch.m_count = (unsigned int)std::min<size_t>(PROCESS_BATCH_SIZE, m_parallelSchedule.size() - first);
+			batch.m_deltaMs = deltaMs;
+			batch.m_deadline = deadline;
+			batch.m_hasDeadline = hasDeadline;
+			m_batches.push_back(batch);
 		}
 
+		// the batches can't move once the jobs are queued
+		for (size_t i = 0; i < m_batches.size(); ++i)
+		{
+			m_pJobSystem->Run(UpdateBatchJob, &m_batches[i], &counter);
+		}
+	}
+
+	// ...while this thread runs the rest, then joins in on the batches
+	for (size_t i = 0; i < m_serialSchedule.size(); ++i)
+	{
+		UpdateProcess(m_serialSchedule[i], deltaMs, deadline, hasDeadline);
+	}
+	if (!m_parallelSchedule.empty())
+	{
+		m_pJobSystem->Wait(counter);
+	}
+
+	ProcessList::iterator it = m_processList.begin();
+	while (it != m_processList.end())
+	{
+		// grab the next process
+		StrongProcessPtr pCurrProcess = (*it);
+
+		// save the iterator and increment the old one in case we need to remove this process from the list
+		ProcessList::iterator thisIt = it;
+		++it;
+
 		// check to see if the process is dead
 		if (pCurrProcess->IsDead())
 		{
@@ -56,15 +130,17 @@ unsigned int ProcessManager::UpdateProcesses(unsigned long deltaMs)
 					pCurrProcess->VOnSuccess();
 					StrongProcessPtr pChild = pCurrProcess->RemoveChild();
 					if (pChild) {
-						//AttachProcess(pChild);
+						// the chain goes on - the child starts on the next tick
+						AttachProcess(pChild);
 					}
 					else {
 						++successCount; // only counts if the whole chain completed
 					}
+					break;
 				}
 				case Process::FAILED :
 				{
-					pCurrProcess->VOnAbort();
+					pCurrProcess->VOnFail();
 					++failCount;
 					break;
 				}
@@ -84,6 +160,42 @@ unsigned int ProcessManager::UpdateProcesses(unsigned long deltaMs)
 	return ((successCount << 16) | failCount);
 }
 
+// ---------------------------------------------------------------------------------------------------
+// Updates one process, or skips it if the tick is over budget. Runs on job system workers too.
+// ---------------------------------------------------------------------------------------------------
+void ProcessManager::UpdateProcess(Process* pProcess, unsigned long deltaMs, LONGLONG deadline, bool hasDeadline)
+{
+	if (hasDeadline)
+	{
+		LARGE_INTEGER now;
+		QueryPerformanceCounter(&now);
+		if (now.QuadPart >= deadline)
+		{
+			pProcess->m_deferredMs += deltaMs;
+			return;
+		}
+	}
+
+	unsigned long elapsedMs = deltaMs + pProcess->m_deferredMs;
+	pProcess->m_deferredMs = 0;
+	pProcess->VOnUpdate(elapsedMs);
+}
+
+// most overdue first
+bool ProcessManager::IsMoreOverdue(const Process* pLeft, const Process* pRight)
+{
+	return pLeft->m_deferredMs > pRight->m_deferredMs;
+}
+
+void ProcessManager::UpdateBatchJob(void* pData)
+{
+	ProcessBatch* pBatch = static_cast<ProcessBatch*>(pData);
+	for (unsigned int i = 0; i < pBatch->m_count; ++i)
+	{
+		UpdateProcess(pBatch->m_ppProcesses[i], pBatch->m_deltaMs, pBatch->m_deadline, pBatch->m_hasDeadline);
+	}
+}
+
 // ---------------------------------------------------------------------------------------------------
 // Attaches the process to the process list so it can be run on the next update.
 // ---------------------------------------------------------------------------------------------------
@@ -6,16 +6,45 @@
 // ProcessManager.h : defines common game events
 // ==============================================================
 
+#include <vector>
 #include "Process.h"
 
+class JobSystem;
+
+// parallel safe processes are handed to the job system in batches of this many
+const unsigned int PROCESS_BATCH_SIZE = 32;
+
 class ProcessManager
 {
 	typedef std::list<StrongProcessPtr> ProcessList;
+	typedef std::vector<Process*> ProcessSchedule;
+
+	// a slice of the parallel safe processes, updated by one job
+	struct ProcessBatch
+	{
+		Process** m_ppProcesses;
+		unsigned int m_count;
+		unsigned long m_deltaMs;
+		LONGLONG m_deadline;
+		bool m_hasDeadline;
+	};
 
 	ProcessList m_processList;
 
+	// [parallel] - with a job system, parallel safe processes are updated on its workers while the
+	//				rest run on the calling thread. With a tick budget, processes that would start
+	//				after the deadline are skipped and go first on the next tick, the skipped time
+	//				added to their deltaMs. The deadline is in QueryPerformanceCounter() ticks, since
+	//				budgets are a few milliseconds and GetTickCount() only moves every 10-16.
+	JobSystem* m_pJobSystem;
+	unsigned long m_tickBudgetMs;					// 0 for no budget
+	ProcessSchedule m_serialSchedule;				// rebuilt every tick, kept to reuse the memory
+	ProcessSchedule m_parallelSchedule;
+	std::vector<ProcessBatch> m_batches;
+
 public:
 	// construction
+	explicit ProcessManager(JobSystem* pJobSystem = nullptr);
 	~ProcessManager(void);
 
 	// interface
@@ -23,9 +52,16 @@ public:
 	WeakProcessPtr AttachProcess(StrongProcessPtr pProcess);	// attaches a process to the process manager
 	void AbortAllProcesses(bool immediate);
 
+	void SetJobSystem(JobSystem* pJobSystem) { m_pJobSystem = pJobSystem; }
+	void SetTickBudget(unsigned long maxMillis) { m_tickBudgetMs = maxMillis; }
+
 	// accessors
 	unsigned int GetProcessCount(void) const { return m_processList.size(); }
 
 private:
 	void ClearAllProcesses(void);	// should only be called by the destructor
+
+	static void UpdateProcess(Process* pProcess, unsigned long deltaMs, LONGLONG deadline, bool hasDeadline);
+	static void UpdateBatchJob(void* pData);
+	static bool IsMoreOverdue(const Process* pLeft, const Process* pRight);
 };
\ No newline at end of file
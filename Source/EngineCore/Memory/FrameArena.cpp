@@ -0,0 +1,160 @@
+// ================================================================
+// FrameArena.cpp : Bump allocators for data that only lives for a frame
+// ================================================================
+
+#include "../Common/CommonStd.h"
+#include "FrameArena.h"
+
+// ==============================================================
+// LinearAllocator
+// ==============================================================
+LinearAllocator::LinearAllocator(size_t initialSize)
+{
+	m_currentBlock = 0;
+	m_offset = 0;
+	m_usedInEarlierBlocks = 0;
+	m_numAllocs = 0;
+	m_peakBytes = 0;
+	m_numBlocksAdded = 0;
+
+	AddBlock(initialSize);
+}
+
+LinearAllocator::~LinearAllocator(void)
+{
+	for (std::vector<Block>::iterator it = m_blocks.begin(); it != m_blocks.end(); ++it)
+	{
+		Nv_MEMORY_RECORD_FREE(MEMTAG_POOLS, it->m_size);
+		free(it->m_pMem);
+	}
+}
+
+void* LinearAllocator::Alloc(size_t size, size_t alignment)
+{
+	//Nv_ASSERT(alignment > 0 && (alignment & (alignment - 1)) == 0);
+
+	for (;;)
+	{
+		if (m_currentBlock < m_blocks.size())
+		{
+			Block& block = m_blocks[m_currentBlock];
+			uintptr_t base = (uintptr_t)block.m_pMem;
+			uintptr_t aligned = (base + m_offset + alignment - 1) & ~(uintptr_t)(alignment - 1);
+			size_t end = (size_t)(aligned - base) + size;
+			if (end <= block.m_size)
+			{
+				m_offset = end;
+				++m_numAllocs;
+				m_peakBytes = std::max(m_peakBytes, m_usedInEarlierBlocks + m_offset);
+				return (void*)aligned;
+			}
+
+			// doesn't fit, move on to the next block
+			m_usedInEarlierBlocks += m_offset;
+			++m_currentBlock;
+			m_offset = 0;
+			continue;
+		}
+
+		// out of blocks - a rewound scope can leave some behind, so this only happens when the frame
+		// really needs more memory than the arena has
+		if (!AddBlock(std::max(size + alignment, m_blocks.empty() ? FRAME_ARENA_DEFAULT_SIZE : m_blocks.back().m_size))) {
+			return NULL;
+		}
+		++m_numBlocksAdded;
+	}
+}
+
+void LinearAllocator::Reset(void)
+{
+	// The frame ran over the first block. Replace the lot with one block that would have held it all,
+	// so the next frames fit.
+	if (m_blocks.size() > 1)
+	{
+		size_t totalSize = GetCapacity();
+		for (std::vector<Block>::iterator it = m_blocks.begin(); it != m_blocks.end(); ++it)
+		{
+			Nv_MEMORY_RECORD_FREE(MEMTAG_POOLS, it->m_size);
+			free(it->m_pMem);
+		}
+		m_blocks.clear();
+		AddBlock(totalSize);
+	}
+
+	m_currentBlock = 0;
+	m_offset = 0;
+	m_usedInEarlierBlocks = 0;
+	m_numAllocs = 0;
+	m_peakBytes = 0;
+	m_numBlocksAdded = 0;
+}
+
+LinearAllocator::Marker LinearAllocator::GetMarker(void) const
+{
+	Marker marker;
+	marker.m_block = m_currentBlock;
+	marker.m_offset = m_offset;
+	marker.m_usedInEarlierBlocks = m_usedInEarlierBlocks;
+	return marker;
+}
+
+void LinearAllocator::Rewind(const Marker& marker)
+{
+	//Nv_ASSERT(marker.m_block < m_currentBlock || (marker.m_block == m_currentBlock && marker.m_offset <= m_offset));
+
+	// the blocks after the marker's are kept for whatever comes next
+	m_currentBlock = marker.m_block;
+	m_offset = marker.m_offset;
+	m_usedInEarlierBlocks = marker.m_usedInEarlierBlocks;
+}
+
+size_t LinearAllocator::GetCapacity(void) const
+{
+	size_t capacity = 0;
+	for (std::vector<Block>::const_iterator it = m_blocks.begin(); it != m_blocks.end(); ++it)
+	{
+		capacity += it->m_size;
+	}
+	return capacity;
+}
+
+bool LinearAllocator::AddBlock(size_t minSize)
+{
+	Block block;
+	block.m_pMem = (unsigned char*)malloc(minSize);
+	if (!block.m_pMem) {
+		return false;
+	}
+	block.m_size = minSize;
+	m_blocks.push_back(block);
+	Nv_MEMORY_RECORD_ALLOC(MEMTAG_POOLS, minSize);
+	return true;
+}
+
+// ==============================================================
+// FrameArena
+// ==============================================================
+FrameArena& FrameArena::Get(void)
+{
+	static FrameArena s_frameArena;
+	return s_frameArena;
+}
+
+FrameArena::FrameArena(void)
+{
+	m_current = 0;
+	memset(&m_lastFrameStats, 0, sizeof(m_lastFrameStats));
+}
+
+void FrameArena::EndFrame(void)
+{
+	LinearAllocator& finished = m_allocators[m_current];
+	m_lastFrameStats.m_numAllocs = finished.GetNumAllocs();
+	m_lastFrameStats.m_peakBytes = finished.GetPeakBytes();
+	m_lastFrameStats.m_numHeapAllocs = finished.GetNumBlocksAdded();
+	m_lastFrameStats.m_capacity = finished.GetCapacity();
+
+	// what was allocated during this frame stays put through the next one
+	m_current = 1 - m_current;
+	m_allocators[m_current].Reset();
+}
@@ -0,0 +1,161 @@
+#pragma once
+
+// ================================================================
+// FrameArena.h : Bump allocators for data that only lives for a frame
+// ================================================================
+
+#include "../Common/CommonStd.h"
+
+const size_t FRAME_ARENA_DEFAULT_SIZE = 256 * 1024;
+const size_t FRAME_ARENA_DEFAULT_ALIGNMENT = 16;
+
+//
+// class LinearAllocator						- not described in the book
+//
+// Hands out memory by bumping an offset into a block, and frees it all at once with Reset() or back to
+// a marker with Rewind(). When the block fills up, another one is malloc'ed for the rest of the frame;
+// Reset() then swaps them all for one block big enough for the whole frame, so the arena sizes itself
+// after the first busy frames and stops touching the heap.
+//
+class LinearAllocator : public Nv_noncopyable
+{
+	struct Block
+	{
+		unsigned char* m_pMem;
+		size_t m_size;
+	};
+
+	std::vector<Block> m_blocks;
+	unsigned int m_currentBlock;
+	size_t m_offset;					// into the current block
+	size_t m_usedInEarlierBlocks;		// bytes used in the blocks before the current one
+
+	// since the last Reset()
+	unsigned int m_numAllocs;
+	size_t m_peakBytes;
+	unsigned int m_numBlocksAdded;
+
+public:
+	struct Marker
+	{
+		unsigned int m_block;
+		size_t m_offset;
+		size_t m_usedInEarlierBlocks;
+	};
+
+	explicit LinearAllocator(size_t initialSize = FRAME_ARENA_DEFAULT_SIZE);
+	~LinearAllocator(void);
+
+	void* Alloc(size_t size, size_t alignment = FRAME_ARENA_DEFAULT_ALIGNMENT);
+	void Reset(void);
+
+	// Rewind() frees everything allocated since the marker was taken. Markers have to be rewound in
+	// the reverse order they were taken.
+	Marker GetMarker(void) const;
+	void Rewind(const Marker& marker);
+
+	unsigned int GetNumAllocs(void) const { return m_numAllocs; }
+	size_t GetPeakBytes(void) const { return m_peakBytes; }
+	unsigned int GetNumBlocksAdded(void) const { return m_numBlocksAdded; }
+	size_t GetCapacity(void) const;
+
+private:
+	bool AddBlock(size_t minSize);
+};
+
+//
+// struct FrameArenaStats						- not described in the book
+//
+struct FrameArenaStats
+{
+	unsigned int m_numAllocs;			// allocations served from the arena
+	size_t m_peakBytes;					// most bytes in use at once
+	unsigned int m_numHeapAllocs;		// times the arena had to go to the heap for another block
+	size_t m_capacity;
+};
+
+//
+// class FrameArena								- not described in the book
+//
+// Two LinearAllocators used on alternate frames. BaseAppLogic::VOnUpdate() calls EndFrame() at the
+// end of every frame, which switches to the other allocator and resets it, so anything allocated
+// during a frame stays valid until the end of the next one - long enough to hand it to whatever runs
+// after the logic update - and is then dropped without a single free.
+//
+// Game thread only. Nothing in the arena gets its destructor called, so only put things in it that
+// don't need one or that are destroyed before the frame ends, like containers using FrameStlAllocator.
+//
+class FrameArena : public Nv_noncopyable
+{
+	LinearAllocator m_allocators[2];
+	unsigned int m_current;
+	FrameArenaStats m_lastFrameStats;
+
+public:
+	static FrameArena& Get(void);
+
+	void* Alloc(size_t size, size_t alignment = FRAME_ARENA_DEFAULT_ALIGNMENT) { return m_allocators[m_current].Alloc(size, alignment); }
+	LinearAllocator& GetCurrent(void) { return m_allocators[m_current]; }
+
+	void EndFrame(void);
+
+	// how the arena was used over the last whole frame
+	const FrameArenaStats& GetLastFrameStats(void) const { return m_lastFrameStats; }
+
+private:
+	FrameArena(void);
+};
+
+//
+// class ScopedFrameArena						- not described in the book
+//
+// A sub-arena: everything allocated from the frame arena while it's alive is given back when it goes
+// out of scope, so a function that runs several times a frame can reuse the same memory each time.
+//
+//		{
+//			ScopedFrameArena scope;
+//			FrameVector<int>::type scratch;		// gone at the closing brace
+//			...
+//		}
+//
+class ScopedFrameArena : public Nv_noncopyable
+{
+	LinearAllocator& m_allocator;
+	LinearAllocator::Marker m_marker;
+
+public:
+	ScopedFrameArena(void) : m_allocator(FrameArena::Get().GetCurrent()), m_marker(m_allocator.GetMarker()) { }
+	~ScopedFrameArena(void) { m_allocator.Rewind(m_marker); }
+};
+
+//
+// class FrameStlAllocator						- not described in the book
+//
+// Puts an STL container's memory in the frame arena. deallocate() does nothing; the memory goes when
+// the frame, or the ScopedFrameArena around the container, ends. Don't let the container outlive that.
+//
+template<typename T>
+class FrameStlAllocator
+{
+public:
+	typedef T value_type;
+
+	FrameStlAllocator(void) { }
+	template<typename U> FrameStlAllocator(const FrameStlAllocator<U>&) { }
+
+	T* allocate(size_t n)
+	{
+		return static_cast<T*>(FrameArena::Get().Alloc(n * sizeof(T), __alignof(T)));
+	}
+
+	void deallocate(T* p, size_t n) { }
+
+	template<typename U> bool operator==(const FrameStlAllocator<U>&) const { return true; }
+	template<typename U> bool operator!=(const FrameStlAllocator<U>&) const { return false; }
+};
+
+template<typename T>
+struct FrameVector
+{
+	typedef std::vector<T, FrameStlAllocator<T> > type;
+};
@@ -6,6 +6,7 @@
 
 #include "../Common/CommonStd.h"
 #include "MemoryPool.h"
+#include "PoolAllocator.h"
 
 // ===================================================================================================================
 // These macros are designed to allow classes to easily take advantage of memory pools. To use, follow this steps:
@@ -52,6 +53,7 @@
 			SAFE_DELETE(s_pMemoryPool); \
 		} \
 		s_pMemoryPool = Nv_NEW MemoryPool; \
+		s_pMemoryPool->Init(sizeof(_className_), numChunks); \
 		if (debugName) \
 		{ \
 			s_pMemoryPool->SetDebugName(debugName); \
@@ -83,12 +85,48 @@
 		void* pMem = s_pMemoryPool->Alloc(); \
 		return pMem; \
 	} \
-	void _className_::operator delete(void* pPtr) \
+	void _className_::operator delete[](void* pPtr) \
 	{ \
 		/* Nv_ASSERT(s_pMemoryPool); */\
 		s_pMemoryPool->Free(pPtr); \
 	} \
 
+// ------------------------------------------------------------------------------------------------------------------
+// Use this instead of Nv_MEMORYPOOL_DEFINITION() to take the objects from the shared, size-classed PoolAllocator
+// rather than a MemoryPool of the class's own. Objects can then be created and deleted on any thread, and the class
+// doesn't need a pool sized for it up front. InitMemoryPool() and DestroyMemoryPool() do nothing, so there's no need
+// for Nv_MEMORYPOOL_AUTOINIT(). Arrays come from the regular heap.
+//
+// IMPORTANT: delete hands back sizeof(_className_) bytes, so a class deriving from _className_ has to use the macros
+// itself.
+//	- _className_:		the name of this class.
+// ------------------------------------------------------------------------------------------------------------------
+#define Nv_MEMORYPOOL_SIZECLASS_DEFINITION(_className_) \
+	MemoryPool* _className_::s_pMemoryPool = NULL;\
+	void _className_::InitMemoryPool(unsigned int numChunks, const char* debugName) \
+	{ \
+	} \
+	void _className_::DestroyMemoryPool(void) \
+	{ \
+	} \
+	void* _className_::operator new(size_t size) \
+	{ \
+		/* Nv_ASSERT(size == sizeof(_className_)); */ \
+		return PoolAllocator::Get().Alloc(sizeof(_className_)); \
+	} \
+	void _className_::operator delete(void* pPtr) \
+	{ \
+		PoolAllocator::Get().Free(pPtr, sizeof(_className_)); \
+	} \
+	void* _className_::operator new[](size_t size) \
+	{ \
+		return ::operator new[](size); \
+	} \
+	void _className_::operator delete[](void* pPtr) \
+	{ \
+		::operator delete[](pPtr); \
+	} \
+
 //---------------------------------------------------------------------------------------------------------------------
 // This macro defines a static class that automatically initializes a memory pool at global startup and destroys it at
 // global destruction time.  Using this gets around the requirement of manually initializing and destroying the memory
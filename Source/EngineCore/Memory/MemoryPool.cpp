@@ -22,7 +22,7 @@ MemoryPool::~MemoryPool(void)
 bool MemoryPool::Init(unsigned int chunkSize, unsigned int numChunks)
 {
 	// it's safe to call Init() without calling Destroy()
-	if (m_ppRawMemoryArray) {
+	if (m_pMemoryArray) {
 		Destroy();
 	}
 
@@ -55,9 +55,15 @@ void MemoryPool::Destroy(void)
 	// free all memory
 	for (unsigned int i = 0; i < m_memArraySize; ++i)
 	{
-		free(m_ppRawMemoryArray[i]);
+		Nv_MEMORY_RECORD_FREE(MEMTAG_POOLS, m_pMemoryArray[i].m_size);
+		if (m_pMemoryArray[i].m_isLargePage) {
+			VirtualFree(m_pMemoryArray[i].m_pMem, 0, MEM_RELEASE);
+		}
+		else {
+			free(m_pMemoryArray[i].m_pMem);
+		}
 	}
-	free(m_ppRawMemoryArray);
+	free(m_pMemoryArray);
 
 	// update member variables.
 	Reset();
@@ -114,12 +120,14 @@ void MemoryPool::Free(void* pMem)
 
 void MemoryPool::Reset(void)
 {
-	m_ppRawMemoryArray = NULL;
+	m_pMemoryArray = NULL;
 	m_pHead = NULL;
 	m_chunkSize = 0;
 	m_numChunks = 0;
 	m_memArraySize = 0;
+	m_memArrayCapacity = 0;
 	m_toAllowResize = true;
+	m_toUseLargePages = false;
 
 #ifdef _DEBUG
 	m_allocPeak = 0;
@@ -134,65 +142,69 @@ bool MemoryPool::GrowMemoryArray(void)
 	::OutputDebugString(LPCWSTR(str.c_str()));	// the logger is not initialized during many of the initial memory pool growths, so let's just use the OS version.
 #endif
 
-	// allocate a new array
-	size_t allocationSize = sizeof(unsigned char*) * (m_memArraySize + 1);
-	unsigned char** ppNewMemArray = (unsigned char**)malloc(allocationSize);
-
-	// make sure the allocation succeded
-	if (!ppNewMemArray) {
-		return false;
-	}
-
-	// copy any existing memory pointers over
-	for (unsigned int i = 0; i < m_memArraySize; ++i)
+	// The array of blocks doubles when it runs out of room, so growing the pool doesn't copy every
+	// block pointer each time.
+	if (m_memArraySize == m_memArrayCapacity)
 	{
-		ppNewMemArray[i] = m_ppRawMemoryArray[i];
-	}
-
-	// allocate a new block of memory
-	ppNewMemArray[m_memArraySize] = AllocateNewMemoryBlock(); // indexing  m_memArraySize here is safe bacause we haven't incremented it yet to reflect the new size
+		unsigned int newCapacity = (m_memArrayCapacity > 0) ? m_memArrayCapacity * 2 : 4;
+		MemoryBlock* pNewMemArray = (MemoryBlock*)realloc(m_pMemoryArray, sizeof(MemoryBlock) * newCapacity);
 
-	// attach the block to the end of the current memory list
-	if (m_pHead)
-	{
-		unsigned char* pCurr = m_pHead;
-		unsigned char* pNext = GetNext(m_pHead);
-		
-		while (pNext) 
-		{
-			pCurr = pNext;
-			pNext = GetNext(pNext);
+		// make sure the allocation succeded
+		if (!pNewMemArray) {
+			return false;
 		}
-		SetNext(pCurr, ppNewMemArray[m_memArraySize]);
-	}
-	else
-	{
-		m_pHead = ppNewMemArray[m_memArraySize];
+
+		m_pMemoryArray = pNewMemArray;
+		m_memArrayCapacity = newCapacity;
 	}
 
-	// destroy the old memory array
-	if (m_ppRawMemoryArray) {
-		free(m_ppRawMemoryArray);
+	// Allocate a new block of memory. Its last chunk points at the current head, so the block goes on
+	// the front of the list without walking it.
+	MemoryBlock& block = m_pMemoryArray[m_memArraySize]; // indexing  m_memArraySize here is safe bacause we haven't incremented it yet to reflect the new size
+	unsigned char* pNewMem = AllocateNewMemoryBlock(block, m_pHead);
+	if (!pNewMem) {
+		return false;
 	}
 
-	// assign the new memory array and increment the size count
-	m_ppRawMemoryArray = ppNewMemArray;
+	m_pHead = pNewMem;
 	++m_memArraySize;
 
 	return true;
 }
 
-unsigned char* MemoryPool::AllocateNewMemoryBlock(void)
+unsigned char* MemoryPool::AllocateNewMemoryBlock(MemoryBlock& block, unsigned char* pNext)
 {
 	// calculate the size of each block and the size of the actual memory allocation
 	size_t blockSize = m_chunkSize + CHUNK_HEADER_SIZE;
 	size_t trueSize = blockSize * m_numChunks;
 
 	// allocate the memory
-	unsigned char* pNewMem = (unsigned char*)malloc(trueSize);
+	unsigned char* pNewMem = NULL;
+	block.m_isLargePage = false;
+	if (m_toUseLargePages)
+	{
+		// large pages have to be allocated in whole pages, so round up and fit in more chunks
+		size_t largePageSize = GetLargePageMinimum();
+		if (largePageSize > 0)
+		{
+			size_t largeSize = (trueSize + largePageSize - 1) / largePageSize * largePageSize;
+			pNewMem = (unsigned char*)VirtualAlloc(NULL, largeSize, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+			if (pNewMem)
+			{
+				block.m_isLargePage = true;
+				trueSize = largeSize / blockSize * blockSize;
+			}
+		}
+	}
+	if (!pNewMem) {
+		pNewMem = (unsigned char*)malloc(trueSize);
+	}
 	if (!pNewMem) {
 		return NULL;
 	}
+	block.m_pMem = pNewMem;
+	block.m_size = trueSize;
+	Nv_MEMORY_RECORD_ALLOC(MEMTAG_POOLS, trueSize);
 
 	// turn the memory into a linked list of chunks
 	unsigned char* pEnd = pNewMem + trueSize;
@@ -201,11 +213,11 @@ unsigned char* MemoryPool::AllocateNewMemoryBlock(void)
 	while (pCurr < pEnd)
 	{
 		// calculate the next pointer position
-		unsigned char* pNext = pCurr + blockSize;
+		unsigned char* pNextChunk = pCurr + blockSize;
 
 		// set the next & prev pointers
 		unsigned char** ppChunkHeader = (unsigned char**)pCurr;
-		ppChunkHeader[0] = (pNext < pEnd ? pNext : NULL);
+		ppChunkHeader[0] = (pNextChunk < pEnd ? pNextChunk : pNext);
 
 		// move to the next block
 		pCurr += blockSize;
@@ -214,6 +226,36 @@ unsigned char* MemoryPool::AllocateNewMemoryBlock(void)
 	return pNewMem;
 }
 
+//
+// MemoryPool::EnableLargePages				- not described in the book
+//
+// Large pages need the "Lock pages in memory" privilege, which the user has to have been granted
+// and the process has to switch on before VirtualAlloc() will hand any out.
+//
+bool MemoryPool::EnableLargePages(void)
+{
+	if (GetLargePageMinimum() == 0) {
+		return false;
+	}
+
+	HANDLE hToken;
+	if (!OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &hToken)) {
+		return false;
+	}
+
+	TOKEN_PRIVILEGES privileges;
+	privileges.PrivilegeCount = 1;
+	privileges.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+
+	// AdjustTokenPrivileges() succeeds even when the privilege wasn't granted, so check the last error
+	bool enabled = LookupPrivilegeValue(NULL, SE_LOCK_MEMORY_NAME, &privileges.Privileges[0].Luid) &&
+		AdjustTokenPrivileges(hToken, FALSE, &privileges, 0, NULL, NULL) &&
+		GetLastError() == ERROR_SUCCESS;
+
+	CloseHandle(hToken);
+	return enabled;
+}
+
 unsigned char* MemoryPool::GetNext(unsigned char* pBlock)
 {
 	unsigned char** ppChunkHeader = (unsigned char**)pBlock;
@@ -28,14 +28,25 @@
 //
 // Call the Free() function to release a chunk of memory back into the memory pool for reuse. This
 // will cause the chunk to the inserted to the front of the list, ready for the next bit.
+//
+// The pool is not thread safe. See PoolAllocator for one that is.
 // -----------------------------------------------------------------------------------------------
 class MemoryPool
 {
-	unsigned char** m_ppRawMemoryArray; // an array of memory blocks, each split up into chunks and connected
+	struct MemoryBlock
+	{
+		unsigned char* m_pMem;
+		size_t m_size;
+		bool m_isLargePage;		// came from VirtualAlloc() rather than malloc()
+	};
+
+	MemoryBlock* m_pMemoryArray; // an array of memory blocks, each split up into chunks and connected
 	unsigned char* m_pHead; // the front of the memory chunk linked list.
 	unsigned int m_chunkSize, m_numChunks; // the size of each chunk and number of chunks per array, respectively
 	unsigned int m_memArraySize; // the number elements in the memory array
+	unsigned int m_memArrayCapacity; // the number of elements the memory array has room for
 	bool m_toAllowResize; // true if we resize the memory pool when it fills up
+	bool m_toUseLargePages; // true if new blocks should come from large pages when the OS allows it
 
 	// tracking variables we only care about for debug
 #ifdef _DEBUG
@@ -54,10 +65,17 @@ public:
 	void* Alloc(void);
 	void Free(void* pMem);
 	unsigned int GetChunkSize(void) const { return m_chunkSize; }
+	unsigned int GetNumBlocks(void) const { return m_memArraySize; }	// blocks of m_numChunks chunks allocated from the heap
 
 	// settings
 	void SetAllowResize(bool toAllowResize) { m_toAllowResize = toAllowResize; }
 
+	// Blocks allocated from now on are backed by large pages, which saves TLB misses on big pools. A
+	// block is then rounded up to the large page size and holds that many more chunks. Falls back to
+	// malloc() whenever the OS won't hand out large pages; call EnableLargePages() once first.
+	void SetUseLargePages(bool toUseLargePages) { m_toUseLargePages = toUseLargePages; }
+	static bool EnableLargePages(void);
+
 	// debug functions
 #ifdef _DEBUG
 	void SetDebugName(const char* debugName) { m_debugName = debugName; }
@@ -75,7 +93,7 @@ private:
 
 	// internal memory allocation helpers
 	bool GrowMemoryArray(void);
-	unsigned char* AllocateNewMemoryBlock(void);
+	unsigned char* AllocateNewMemoryBlock(MemoryBlock& block, unsigned char* pNext);
 
 	// internal linked list management
 	unsigned char* GetNext(unsigned char* pBlock);
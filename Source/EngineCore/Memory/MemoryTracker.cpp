@@ -0,0 +1,285 @@
+// ================================================================
+// MemoryTracker.cpp : Opt-in allocation tracking by subsystem
+// ================================================================
+
+#include "../Common/CommonStd.h"
+#include "MemoryTracker.h"
+
+#ifdef ENABLE_MEMORY_TRACKING
+
+#include <atomic>
+#include <new>
+
+// in front of every block from the global operator new; 16 bytes keeps the block aligned the way
+// malloc() aligned it
+const size_t MEMORY_TRACKER_HEADER_SIZE = 16;
+const unsigned int MEMORY_TRACKER_MAGIC = 0x4e564d54;
+
+struct AllocationHeader
+{
+	size_t m_size;
+	unsigned int m_tag;
+	unsigned int m_magic;				// catches blocks that didn't come from the tracker's operator new
+};
+
+static_assert(sizeof(AllocationHeader) <= MEMORY_TRACKER_HEADER_SIZE, "the allocation header has outgrown its space");
+
+//
+// struct ThreadCounters						- not described in the book
+//
+// Only the owning thread writes its counters, so an update is a relaxed load and store rather than
+// a locked add. They're atomics so snapshots can read them from other threads. Threads never give
+// theirs back - they're small, and what a thread allocated still counts after it's gone.
+//
+struct ThreadCounters
+{
+	std::atomic<unsigned __int64> m_allocs[MEMTAG_COUNT];
+	std::atomic<unsigned __int64> m_frees[MEMTAG_COUNT];
+	std::atomic<unsigned __int64> m_bytesAllocated[MEMTAG_COUNT];
+	std::atomic<unsigned __int64> m_bytesFreed[MEMTAG_COUNT];
+	ThreadCounters* m_pNext;
+};
+
+static std::atomic<ThreadCounters*> s_pAllThreadCounters(nullptr);
+static std::atomic<__int64> s_peakLiveBytes[MEMTAG_COUNT];
+
+// plain pointers and ints, so using them from inside operator new never runs a constructor
+static thread_local ThreadCounters* s_pThreadCounters = nullptr;
+static thread_local int s_currentTag = MEMTAG_GENERAL;
+
+static const char* s_tagNames[MEMTAG_COUNT] =
+{
+	"General",
+	"ResourceCache",
+	"Events",
+	"Physics",
+	"Scripting",
+	"Pools",
+	"AI",
+	"Network",
+};
+
+static inline void AddToCounter(std::atomic<unsigned __int64>& counter, unsigned __int64 amount)
+{
+	counter.store(counter.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+}
+
+static ThreadCounters* GetThreadCounters(void)
+{
+	ThreadCounters* pCounters = s_pThreadCounters;
+	if (pCounters) {
+		return pCounters;
+	}
+
+	// malloc() rather than new, which would come straight back here
+	pCounters = new (malloc(sizeof(ThreadCounters))) ThreadCounters();
+	pCounters->m_pNext = s_pAllThreadCounters.load(std::memory_order_relaxed);
+	while (!s_pAllThreadCounters.compare_exchange_weak(pCounters->m_pNext, pCounters, std::memory_order_release, std::memory_order_relaxed))
+	{
+	}
+
+	s_pThreadCounters = pCounters;
+	return pCounters;
+}
+
+static void* TrackedAlloc(size_t size)
+{
+	unsigned char* pBlock = (unsigned char*)malloc(size + MEMORY_TRACKER_HEADER_SIZE);
+	if (!pBlock) {
+		return NULL;
+	}
+
+	AllocationHeader* pHeader = (AllocationHeader*)pBlock;
+	pHeader->m_size = size;
+	pHeader->m_tag = (unsigned int)s_currentTag;
+	pHeader->m_magic = MEMORY_TRACKER_MAGIC;
+	MemoryTracker::RecordAlloc((MemoryTag)pHeader->m_tag, size);
+
+	return pBlock + MEMORY_TRACKER_HEADER_SIZE;
+}
+
+static void TrackedFree(void* pMem)
+{
+	if (!pMem) {
+		return;
+	}
+
+	unsigned char* pBlock = (unsigned char*)pMem - MEMORY_TRACKER_HEADER_SIZE;
+	AllocationHeader* pHeader = (AllocationHeader*)pBlock;
+	//Nv_ASSERT(pHeader->m_magic == MEMORY_TRACKER_MAGIC);
+	MemoryTracker::RecordFree((MemoryTag)pHeader->m_tag, pHeader->m_size);
+	pHeader->m_magic = 0;
+
+	free(pBlock);
+}
+
+// ==============================================================
+// global operator new & delete
+// ==============================================================
+void* operator new(size_t size)
+{
+	void* pMem = TrackedAlloc(size > 0 ? size : 1);
+	if (!pMem) {
+		throw std::bad_alloc();
+	}
+	return pMem;
+}
+
+void* operator new[](size_t size)
+{
+	return operator new(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) throw()
+{
+	return TrackedAlloc(size > 0 ? size : 1);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) throw()
+{
+	return TrackedAlloc(size > 0 ? size : 1);
+}
+
+void operator delete(void* pMem) throw()
+{
+	TrackedFree(pMem);
+}
+
+void operator delete[](void* pMem) throw()
+{
+	TrackedFree(pMem);
+}
+
+void operator delete(void* pMem, size_t) throw()
+{
+	TrackedFree(pMem);
+}
+
+void operator delete[](void* pMem, size_t) throw()
+{
+	TrackedFree(pMem);
+}
+
+void operator delete(void* pMem, const std::nothrow_t&) throw()
+{
+	TrackedFree(pMem);
+}
+
+void operator delete[](void* pMem, const std::nothrow_t&) throw()
+{
+	TrackedFree(pMem);
+}
+
+// ==============================================================
+// MemoryTracker
+// ==============================================================
+MemoryTag MemoryTracker::GetTag(void)
+{
+	return (MemoryTag)s_currentTag;
+}
+
+MemoryTag MemoryTracker::SetTag(MemoryTag tag)
+{
+	MemoryTag previous = (MemoryTag)s_currentTag;
+	s_currentTag = tag;
+	return previous;
+}
+
+void MemoryTracker::RecordAlloc(MemoryTag tag, size_t size)
+{
+	ThreadCounters* pCounters = GetThreadCounters();
+	AddToCounter(pCounters->m_allocs[tag], 1);
+	AddToCounter(pCounters->m_bytesAllocated[tag], size);
+}
+
+void MemoryTracker::RecordFree(MemoryTag tag, size_t size)
+{
+	ThreadCounters* pCounters = GetThreadCounters();
+	AddToCounter(pCounters->m_frees[tag], 1);
+	AddToCounter(pCounters->m_bytesFreed[tag], size);
+}
+
+void MemoryTracker::Update(void)
+{
+	MemorySnapshot snapshot;
+	TakeSnapshot(snapshot);
+}
+
+void MemoryTracker::TakeSnapshot(MemorySnapshot& snapshot)
+{
+	memset(&snapshot, 0, sizeof(snapshot));
+	snapshot.m_timeMs = timeGetTime();
+
+	for (ThreadCounters* pCounters = s_pAllThreadCounters.load(std::memory_order_acquire); pCounters; pCounters = pCounters->m_pNext)
+	{
+		for (int tag = 0; tag < MEMTAG_COUNT; ++tag)
+		{
+			MemoryTagStats& stats = snapshot.m_tags[tag];
+			stats.m_allocs += pCounters->m_allocs[tag].load(std::memory_order_relaxed);
+			stats.m_frees += pCounters->m_frees[tag].load(std::memory_order_relaxed);
+			stats.m_bytesAllocated += pCounters->m_bytesAllocated[tag].load(std::memory_order_relaxed);
+			stats.m_bytesFreed += pCounters->m_bytesFreed[tag].load(std::memory_order_relaxed);
+		}
+	}
+
+	for (int tag = 0; tag < MEMTAG_COUNT; ++tag)
+	{
+		// a block freed on another thread than the one that allocated it can be counted as freed
+		// before it's counted as allocated, so live bytes can briefly look lower than they are
+		MemoryTagStats& stats = snapshot.m_tags[tag];
+		stats.m_liveBytes = (__int64)(stats.m_bytesAllocated - stats.m_bytesFreed);
+
+		__int64 peak = s_peakLiveBytes[tag].load(std::memory_order_relaxed);
+		while (stats.m_liveBytes > peak && !s_peakLiveBytes[tag].compare_exchange_weak(peak, stats.m_liveBytes, std::memory_order_relaxed))
+		{
+		}
+		stats.m_peakLiveBytes = std::max(peak, stats.m_liveBytes);
+	}
+}
+
+void MemoryTracker::DumpSnapshot(const MemorySnapshot& snapshot)
+{
+	// formatted on the stack so the dump doesn't show up in what it's dumping
+	char line[256];
+	::OutputDebugStringA("Memory snapshot:\n");
+	for (int tag = 0; tag < MEMTAG_COUNT; ++tag)
+	{
+		const MemoryTagStats& stats = snapshot.m_tags[tag];
+		sprintf_s(line, "  %-14s live %12lld bytes  peak %12lld bytes  allocs %10llu  frees %10llu\n",
+			GetTagName((MemoryTag)tag), stats.m_liveBytes, stats.m_peakLiveBytes, stats.m_allocs, stats.m_frees);
+		::OutputDebugStringA(line);
+	}
+}
+
+void MemoryTracker::DumpDiff(const MemorySnapshot& before, const MemorySnapshot& after)
+{
+	char line[256];
+	unsigned long elapsedMs = after.m_timeMs - before.m_timeMs;
+	double seconds = (elapsedMs > 0) ? elapsedMs / 1000.0 : 1.0;
+
+	sprintf_s(line, "Memory over %lu ms:\n", elapsedMs);
+	::OutputDebugStringA(line);
+	for (int tag = 0; tag < MEMTAG_COUNT; ++tag)
+	{
+		const MemoryTagStats& statsBefore = before.m_tags[tag];
+		const MemoryTagStats& statsAfter = after.m_tags[tag];
+		unsigned __int64 allocs = statsAfter.m_allocs - statsBefore.m_allocs;
+		unsigned __int64 frees = statsAfter.m_frees - statsBefore.m_frees;
+		if (allocs == 0 && frees == 0) {
+			continue;
+		}
+
+		// live bytes going up is a leak if the game is back where it was; allocations per second is the churn
+		sprintf_s(line, "  %-14s live %+12lld bytes  allocs %10llu (%.0f/s)  frees %10llu  churn %12llu bytes\n",
+			GetTagName((MemoryTag)tag), statsAfter.m_liveBytes - statsBefore.m_liveBytes, allocs, allocs / seconds, frees,
+			statsAfter.m_bytesAllocated - statsBefore.m_bytesAllocated);
+		::OutputDebugStringA(line);
+	}
+}
+
+const char* MemoryTracker::GetTagName(MemoryTag tag)
+{
+	return (tag >= 0 && tag < MEMTAG_COUNT) ? s_tagNames[tag] : "<Unknown>";
+}
+
+#endif
@@ -0,0 +1,113 @@
+#pragma once
+
+// ================================================================
+// MemoryTracker.h : Opt-in allocation tracking by subsystem
+// ================================================================
+
+// -----------------------------------------------------------------------------------------------
+// Define ENABLE_MEMORY_TRACKING for the whole build to find out where the memory goes. The tracker
+// then replaces the global operator new and delete, puts a small header in front of every block
+// and counts allocations, frees and bytes per tag. Without it the macros below compile to nothing.
+//
+// Which tag an allocation gets is up to the thread that makes it: Nv_MEMORY_TAG_SCOPE() sets the
+// tag until the end of the scope, and scopes nest, so a subsystem called from another one's code
+// can tag itself. Everything outside a scope counts as MEMTAG_GENERAL. Memory that pools and arenas
+// get straight from malloc() is reported as MEMTAG_POOLS.
+//
+// The counters are per thread, so counting an allocation is a couple of uncontended stores. Taking
+// a snapshot adds up every thread's counters; the difference between two snapshots shows what leaked
+// (live bytes that went up) and what churned (allocations per second) in between:
+//
+//		MemorySnapshot before, after;
+//		MemoryTracker::TakeSnapshot(before);
+//		...
+//		MemoryTracker::TakeSnapshot(after);
+//		MemoryTracker::DumpDiff(before, after);
+// -----------------------------------------------------------------------------------------------
+
+enum MemoryTag
+{
+	MEMTAG_GENERAL,
+	MEMTAG_RESOURCE_CACHE,
+	MEMTAG_EVENTS,
+	MEMTAG_PHYSICS,
+	MEMTAG_SCRIPTING,
+	MEMTAG_POOLS,
+	MEMTAG_AI,
+	MEMTAG_NETWORK,
+
+	MEMTAG_COUNT
+};
+
+#ifdef ENABLE_MEMORY_TRACKING
+
+//
+// struct MemoryTagStats						- not described in the book
+//
+struct MemoryTagStats
+{
+	unsigned __int64 m_allocs;
+	unsigned __int64 m_frees;
+	unsigned __int64 m_bytesAllocated;
+	unsigned __int64 m_bytesFreed;
+	__int64 m_liveBytes;
+	__int64 m_peakLiveBytes;			// highest live bytes seen by Update() or TakeSnapshot()
+};
+
+//
+// struct MemorySnapshot						- not described in the book
+//
+struct MemorySnapshot
+{
+	unsigned long m_timeMs;
+	MemoryTagStats m_tags[MEMTAG_COUNT];
+};
+
+//
+// class MemoryTracker							- not described in the book
+//
+class MemoryTracker
+{
+public:
+	static MemoryTag GetTag(void);
+	static MemoryTag SetTag(MemoryTag tag);		// returns the tag it replaces
+
+	// for memory that doesn't come from operator new
+	static void RecordAlloc(MemoryTag tag, size_t size);
+	static void RecordFree(MemoryTag tag, size_t size);
+
+	// Samples the live bytes to keep the peaks up to date. Call it once a frame.
+	static void Update(void);
+
+	static void TakeSnapshot(MemorySnapshot& snapshot);
+	static void DumpSnapshot(const MemorySnapshot& snapshot);
+	static void DumpDiff(const MemorySnapshot& before, const MemorySnapshot& after);
+
+	static const char* GetTagName(MemoryTag tag);
+};
+
+//
+// class MemoryTagScope							- not described in the book
+//
+class MemoryTagScope
+{
+	MemoryTag m_previous;
+
+public:
+	explicit MemoryTagScope(MemoryTag tag) { m_previous = MemoryTracker::SetTag(tag); }
+	~MemoryTagScope(void) { MemoryTracker::SetTag(m_previous); }
+};
+
+#	define Nv_MEMORY_TAG_SCOPE(_tag_) MemoryTagScope Nv_memoryTagScope(_tag_)
+#	define Nv_MEMORY_TRACKER_UPDATE() MemoryTracker::Update()
+#	define Nv_MEMORY_RECORD_ALLOC(_tag_, _size_) MemoryTracker::RecordAlloc(_tag_, _size_)
+#	define Nv_MEMORY_RECORD_FREE(_tag_, _size_) MemoryTracker::RecordFree(_tag_, _size_)
+
+#else
+
+#	define Nv_MEMORY_TAG_SCOPE(_tag_)
+#	define Nv_MEMORY_TRACKER_UPDATE()
+#	define Nv_MEMORY_RECORD_ALLOC(_tag_, _size_)
+#	define Nv_MEMORY_RECORD_FREE(_tag_, _size_)
+
+#endif
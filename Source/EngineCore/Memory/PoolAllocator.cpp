@@ -0,0 +1,229 @@
+// ================================================================
+// PoolAllocator.cpp : Thread safe, size-classed allocator built on MemoryPool
+// ================================================================
+
+#include "../Common/CommonStd.h"
+#include "PoolAllocator.h"
+
+// a thread cache gives a batch back once it holds this many batches' worth of one size class
+const unsigned int POOL_THREAD_CACHE_MAX_BATCHES = 2;
+
+//
+// class PoolThreadCache						- not described in the book
+//
+// The free chunks one thread holds on to, a list per size class. When the thread exits they all go
+// back to the depots.
+//
+class PoolThreadCache
+{
+	PoolAllocator::Batch m_lists[POOL_ALLOCATOR_NUM_SIZE_CLASSES];
+
+public:
+	PoolThreadCache(void)
+	{
+		for (unsigned int i = 0; i < POOL_ALLOCATOR_NUM_SIZE_CLASSES; ++i)
+		{
+			m_lists[i].m_pHead = NULL;
+			m_lists[i].m_count = 0;
+		}
+	}
+
+	~PoolThreadCache(void)
+	{
+		for (unsigned int i = 0; i < POOL_ALLOCATOR_NUM_SIZE_CLASSES; ++i)
+		{
+			if (m_lists[i].m_count > 0) {
+				PoolAllocator::Get().ReturnBatch(i, m_lists[i]);
+			}
+		}
+	}
+
+	PoolAllocator::Batch& GetList(unsigned int sizeClass) { return m_lists[sizeClass]; }
+};
+
+static thread_local PoolThreadCache s_threadCache;
+
+PoolAllocator& PoolAllocator::Get(void)
+{
+	// function statics are thread safe to initialize, and threads exiting before the allocator is
+	// destroyed can still hand their caches back
+	static PoolAllocator s_allocator;
+	return s_allocator;
+}
+
+PoolAllocator::PoolAllocator(void)
+{
+	// four size classes per doubling, starting at 16 bytes
+	unsigned int chunkSize = 16;
+	unsigned int step = 16;
+	for (unsigned int i = 0; i < POOL_ALLOCATOR_NUM_SIZE_CLASSES; ++i)
+	{
+		if (i >= 8 && (i % 4) == 0) {
+			step *= 2;
+		}
+		if (i > 0) {
+			chunkSize += step;
+		}
+
+		SizeClass& sizeClass = m_sizeClasses[i];
+		sizeClass.m_chunkSize = chunkSize;
+		sizeClass.m_batchSize = std::min(std::max(8192 / chunkSize, 8u), 64u);
+		sizeClass.m_depotChunks = 0;
+		sizeClass.m_fetches = 0;
+		sizeClass.m_returns = 0;
+		sizeClass.m_pool.Init(chunkSize, POOL_ALLOCATOR_BLOCK_SIZE / (chunkSize + sizeof(void*)));
+		sizeClass.m_pool.SetDebugName("PoolAllocator");
+	}
+	//Nv_ASSERT(m_sizeClasses[POOL_ALLOCATOR_NUM_SIZE_CLASSES - 1].m_chunkSize == POOL_ALLOCATOR_MAX_SIZE);
+
+	unsigned int sizeClass = 0;
+	for (unsigned int i = 0; i <= POOL_ALLOCATOR_MAX_SIZE / POOL_ALLOCATOR_ALIGNMENT; ++i)
+	{
+		while (m_sizeClasses[sizeClass].m_chunkSize < i * POOL_ALLOCATOR_ALIGNMENT) {
+			++sizeClass;
+		}
+		m_sizeClassLookup[i] = (unsigned char)sizeClass;
+	}
+}
+
+PoolAllocator::~PoolAllocator(void)
+{
+	// the MemoryPools free their blocks, and every chunk with them
+}
+
+void* PoolAllocator::Alloc(size_t size)
+{
+	// big blocks go through operator new so the memory tracker sees them
+	if (size > POOL_ALLOCATOR_MAX_SIZE) {
+		return ::operator new(size, std::nothrow);
+	}
+
+	unsigned int sizeClass = GetSizeClass(size);
+	Batch& list = s_threadCache.GetList(sizeClass);
+	if (!list.m_pHead)
+	{
+		list = FetchBatch(sizeClass);
+		if (!list.m_pHead) {
+			return NULL;
+		}
+	}
+
+	FreeChunk* pChunk = list.m_pHead;
+	list.m_pHead = pChunk->m_pNext;
+	--list.m_count;
+	return pChunk;
+}
+
+void PoolAllocator::Free(void* pMem, size_t size)
+{
+	if (pMem == NULL) {
+		return;
+	}
+
+	if (size > POOL_ALLOCATOR_MAX_SIZE)
+	{
+		::operator delete(pMem);
+		return;
+	}
+
+	unsigned int sizeClass = GetSizeClass(size);
+	Batch& list = s_threadCache.GetList(sizeClass);
+
+	FreeChunk* pChunk = (FreeChunk*)pMem;
+	pChunk->m_pNext = list.m_pHead;
+	list.m_pHead = pChunk;
+	++list.m_count;
+
+	// hand a batch back so threads that free more than they allocate don't hoard memory
+	unsigned int batchSize = m_sizeClasses[sizeClass].m_batchSize;
+	if (list.m_count >= batchSize * POOL_THREAD_CACHE_MAX_BATCHES)
+	{
+		Batch batch;
+		batch.m_pHead = list.m_pHead;
+		batch.m_count = batchSize;
+
+		FreeChunk* pLast = list.m_pHead;
+		for (unsigned int i = 1; i < batchSize; ++i)
+		{
+			pLast = pLast->m_pNext;
+		}
+		list.m_pHead = pLast->m_pNext;
+		list.m_count -= batchSize;
+		pLast->m_pNext = NULL;
+
+		ReturnBatch(sizeClass, batch);
+	}
+}
+
+bool PoolAllocator::SetUseLargePages(bool toUseLargePages)
+{
+	if (toUseLargePages && !MemoryPool::EnableLargePages()) {
+		return false;
+	}
+
+	for (unsigned int i = 0; i < POOL_ALLOCATOR_NUM_SIZE_CLASSES; ++i)
+	{
+		ScopedCriticalSection locker(m_sizeClasses[i].m_cs);
+		m_sizeClasses[i].m_pool.SetUseLargePages(toUseLargePages);
+	}
+	return true;
+}
+
+void PoolAllocator::GetStats(std::vector<PoolAllocatorStats>& stats)
+{
+	stats.resize(POOL_ALLOCATOR_NUM_SIZE_CLASSES);
+	for (unsigned int i = 0; i < POOL_ALLOCATOR_NUM_SIZE_CLASSES; ++i)
+	{
+		SizeClass& sizeClass = m_sizeClasses[i];
+		ScopedCriticalSection locker(sizeClass.m_cs);
+		stats[i].m_chunkSize = sizeClass.m_chunkSize;
+		stats[i].m_batchSize = sizeClass.m_batchSize;
+		stats[i].m_heapBlocks = sizeClass.m_pool.GetNumBlocks();
+		stats[i].m_depotChunks = sizeClass.m_depotChunks;
+		stats[i].m_fetches = sizeClass.m_fetches;
+		stats[i].m_returns = sizeClass.m_returns;
+	}
+}
+
+PoolAllocator::Batch PoolAllocator::FetchBatch(unsigned int sizeClassIndex)
+{
+	SizeClass& sizeClass = m_sizeClasses[sizeClassIndex];
+	ScopedCriticalSection locker(sizeClass.m_cs);
+	++sizeClass.m_fetches;
+
+	if (!sizeClass.m_batches.empty())
+	{
+		Batch batch = sizeClass.m_batches.back();
+		sizeClass.m_batches.pop_back();
+		sizeClass.m_depotChunks -= batch.m_count;
+		return batch;
+	}
+
+	// The depot is empty, so carve a fresh batch out of the pool. The pool grows a block at a time
+	// when it has to, and the chunks never go back to it: from then on they move between the depot
+	// and the thread caches.
+	Batch batch;
+	batch.m_pHead = NULL;
+	batch.m_count = 0;
+	for (unsigned int i = 0; i < sizeClass.m_batchSize; ++i)
+	{
+		FreeChunk* pChunk = (FreeChunk*)sizeClass.m_pool.Alloc();
+		if (!pChunk) {
+			break;
+		}
+		pChunk->m_pNext = batch.m_pHead;
+		batch.m_pHead = pChunk;
+		++batch.m_count;
+	}
+	return batch;
+}
+
+void PoolAllocator::ReturnBatch(unsigned int sizeClassIndex, const Batch& batch)
+{
+	SizeClass& sizeClass = m_sizeClasses[sizeClassIndex];
+	ScopedCriticalSection locker(sizeClass.m_cs);
+	++sizeClass.m_returns;
+
+	sizeClass.m_batches.push_back(batch);
+	sizeClass.m_depotChunks += batch.m_count;
+}
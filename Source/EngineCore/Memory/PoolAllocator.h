@@ -0,0 +1,124 @@
+#pragma once
+
+// ================================================================
+// PoolAllocator.h : Thread safe, size-classed allocator built on MemoryPool
+// ================================================================
+
+#include "../Common/CommonStd.h"
+#include "MemoryPool.h"
+#include "../Multicore/CriticalSection.h"
+
+const unsigned int POOL_ALLOCATOR_NUM_SIZE_CLASSES = 20;
+const unsigned int POOL_ALLOCATOR_MAX_SIZE = 1024;			// anything bigger goes straight to the heap
+const unsigned int POOL_ALLOCATOR_ALIGNMENT = 8;			// what every chunk is aligned to
+const unsigned int POOL_ALLOCATOR_BLOCK_SIZE = 64 * 1024;	// bytes a size class asks its MemoryPool for at a time
+
+//
+// struct PoolAllocatorStats						- not described in the book
+//
+struct PoolAllocatorStats
+{
+	unsigned int m_chunkSize;
+	unsigned int m_batchSize;
+	unsigned int m_heapBlocks;		// blocks the size class's MemoryPool has allocated so far
+	unsigned int m_depotChunks;		// free chunks waiting in the depot, not counting the thread caches
+	unsigned __int64 m_fetches;		// batches handed to thread caches
+	unsigned __int64 m_returns;		// batches handed back
+};
+
+//
+// class PoolAllocator							- not described in the book
+//
+// A general purpose allocator for small objects. Sizes up to POOL_ALLOCATOR_MAX_SIZE are rounded up to
+// one of a few size classes, four per doubling, so no more than a quarter of a chunk is wasted. Each
+// size class has a MemoryPool behind a lock - the depot - and every thread keeps a cache of free chunks
+// per class on top of it. Alloc() and Free() only touch the calling thread's cache; a cache that runs
+// dry takes a whole batch of chunks from the depot under one lock, and one that grows too big gives a
+// batch back, so the lock is taken once every few dozen calls rather than every call.
+//
+// Chunks carry no header, so Free() has to be told the size that was allocated, like sized delete.
+// A chunk may be freed on a different thread than the one that allocated it.
+//
+// Use it through Nv_MEMORYPOOL_SIZECLASS_DEFINITION (see MemoryMacros.h) or PoolStlAllocator.
+//
+class PoolAllocator : public Nv_noncopyable
+{
+	friend class PoolThreadCache;
+
+	struct FreeChunk
+	{
+		FreeChunk* m_pNext;
+	};
+
+	struct Batch
+	{
+		FreeChunk* m_pHead;
+		unsigned int m_count;
+	};
+
+	struct SizeClass
+	{
+		CriticalSection m_cs;
+		MemoryPool m_pool;
+		std::vector<Batch> m_batches;	// the depot: free chunks, a batch at a time
+		unsigned int m_depotChunks;
+		unsigned int m_chunkSize;
+		unsigned int m_batchSize;
+		unsigned __int64 m_fetches;
+		unsigned __int64 m_returns;
+	};
+
+	SizeClass m_sizeClasses[POOL_ALLOCATOR_NUM_SIZE_CLASSES];
+	unsigned char m_sizeClassLookup[POOL_ALLOCATOR_MAX_SIZE / POOL_ALLOCATOR_ALIGNMENT + 1];	// (size + 7) / 8 -> size class
+
+public:
+	static PoolAllocator& Get(void);
+
+	void* Alloc(size_t size);
+	void Free(void* pMem, size_t size);
+
+	// Backs the blocks the depots allocate from now on with large pages, if the OS lets us. Returns
+	// false, and leaves things as they were, when it doesn't.
+	bool SetUseLargePages(bool toUseLargePages);
+
+	void GetStats(std::vector<PoolAllocatorStats>& stats);
+
+private:
+	PoolAllocator(void);
+	~PoolAllocator(void);
+
+	unsigned int GetSizeClass(size_t size) const { return m_sizeClassLookup[(size + POOL_ALLOCATOR_ALIGNMENT - 1) / POOL_ALLOCATOR_ALIGNMENT]; }
+	Batch FetchBatch(unsigned int sizeClass);
+	void ReturnBatch(unsigned int sizeClass, const Batch& batch);
+};
+
+//
+// class PoolStlAllocator						- not described in the book
+//
+// Puts the elements of an STL container in the PoolAllocator, which suits node based containers:
+//
+//		std::list<PathingNode*, PoolStlAllocator<PathingNode*> > openNodes;
+//
+template<typename T>
+class PoolStlAllocator
+{
+public:
+	typedef T value_type;
+
+	PoolStlAllocator(void) { }
+	template<typename U> PoolStlAllocator(const PoolStlAllocator<U>&) { }
+
+	T* allocate(size_t n)
+	{
+		static_assert(__alignof(T) <= POOL_ALLOCATOR_ALIGNMENT, "PoolAllocator chunks aren't aligned enough for this type");
+		return static_cast<T*>(PoolAllocator::Get().Alloc(n * sizeof(T)));
+	}
+
+	void deallocate(T* p, size_t n)
+	{
+		PoolAllocator::Get().Free(p, n * sizeof(T));
+	}
+
+	template<typename U> bool operator==(const PoolStlAllocator<U>&) const { return true; }
+	template<typename U> bool operator!=(const PoolStlAllocator<U>&) const { return false; }
+};
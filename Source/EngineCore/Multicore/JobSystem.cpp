@@ -0,0 +1,326 @@
+//========================================================================
+// JobSystem.cpp : Work stealing pool of worker threads
+//========================================================================
+
+#include "Common/CommonStd.h"
+#include "JobSystem.h"
+
+// index of the worker the current thread is, -1 for threads outside the pool
+static thread_local int s_workerIndex = -1;
+static thread_local JobSystem* s_pWorkerJobSystem = nullptr;
+
+JobSystem::JobSystem(unsigned int numWorkers)
+{
+	if (numWorkers == 0)
+	{
+		unsigned int numCores = std::thread::hardware_concurrency();
+		numWorkers = (numCores > 1) ? (numCores - 1) : 1;
+	}
+
+	m_queuedJobs.store(0);
+	m_injectedCount.store(0);
+	m_quit.store(false);
+	m_idleLongRunningThreads = 0;
+
+	// all the deques have to exist before any worker starts stealing from them
+	for (unsigned int i = 0; i < numWorkers; ++i)
+	{
+		Worker* pWorker = Nv_NEW Worker;
+		pWorker->m_mailboxSize.store(0);
+		m_workers.push_back(pWorker);
+	}
+	for (unsigned int i = 0; i < numWorkers; ++i)
+	{
+		m_workers[i]->m_thread = std::thread(WorkerThreadProc, this, (int)i);
+	}
+}
+
+JobSystem::~JobSystem()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_sleepLock);
+		m_quit.store(true);
+	}
+	m_wakeUp.notify_all();
+
+	{
+		std::lock_guard<std::mutex> lock(m_longRunningLock);
+		_ASSERTE(m_longRunningJobs.empty() && m_idleLongRunningThreads == m_longRunningThreads.size() && "A long running job is still running");
+	}
+	m_longRunningWakeUp.notify_all();
+
+	for (size_t i = 0; i < m_workers.size(); ++i)
+	{
+		m_workers[i]->m_thread.join();
+	}
+	for (size_t i = 0; i < m_longRunningThreads.size(); ++i)
+	{
+		m_longRunningThreads[i].join();
+	}
+
+	// anything still queued is dropped - its counters are never going to reach zero
+	for (size_t i = 0; i < m_workers.size(); ++i)
+	{
+		SAFE_DELETE(m_workers[i]);
+	}
+	m_workers.clear();
+}
+
+void JobSystem::Run(JobFunction function, void* pData, JobCounter* pCounter, JobPriority priority, int affinity)
+{
+	Job job = { function, pData, pCounter };
+	Run(job, priority, affinity);
+}
+
+void JobSystem::Run(const Job& job, JobPriority priority, int affinity)
+{
+	if (job.m_pCounter)
+	{
+		job.m_pCounter->m_pending.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	int workerIndex = (s_pWorkerJobSystem == this) ? s_workerIndex : -1;
+
+	if (affinity != JOB_AFFINITY_ANY)
+	{
+		Worker& worker = *m_workers[affinity % m_workers.size()];
+		{
+			std::lock_guard<std::mutex> lock(worker.m_mailboxLock);
+			worker.m_mailbox.push_back(job);
+		}
+		worker.m_mailboxSize.fetch_add(1, std::memory_order_release);
+
+		// the right worker might be the one that stays asleep otherwise
+		WakeWorkers(true);
+		return;
+	}
+
+	if (workerIndex >= 0)
+	{
+		// a worker keeps the jobs it spawns
+		m_workers[workerIndex]->m_jobs[priority].Push(job);
+	}
+	else
+	{
+		std::lock_guard<std::mutex> lock(m_injectLock);
+		m_injected[priority].push_back(job);
+		m_injectedCount.fetch_add(1, std::memory_order_release);
+	}
+	m_queuedJobs.fetch_add(1, std::memory_order_release);
+
+	WakeWorkers(false);
+}
+
+void JobSystem::RunLongRunning(const Job& job, int threadPriority)
+{
+	if (job.m_pCounter)
+	{
+		job.m_pCounter->m_pending.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	LongRunningJob longRunningJob = { job, threadPriority };
+
+	std::lock_guard<std::mutex> lock(m_longRunningLock);
+	m_longRunningJobs.push_back(longRunningJob);
+	if (m_idleLongRunningThreads < m_longRunningJobs.size())
+	{
+		// every idle thread already has a job waiting for it
+		++m_idleLongRunningThreads;
+		m_longRunningThreads.push_back(std::thread(LongRunningThreadProc, this));
+	}
+	else
+	{
+		m_longRunningWakeUp.notify_one();
+	}
+}
+
+void JobSystem::Wait(JobCounter& counter)
+{
+	int workerIndex = (s_pWorkerJobSystem == this) ? s_workerIndex : -1;
+
+	while (!counter.IsDone())
+	{
+		Job job;
+		if (FindJob(workerIndex, job))
+		{
+			Execute(job);
+		}
+		else
+		{
+			// the last jobs are running on other threads
+			std::this_thread::yield();
+		}
+	}
+}
+
+void JobSystem::WorkerThreadProc(JobSystem* pJobSystem, int workerIndex)
+{
+	s_workerIndex = workerIndex;
+	s_pWorkerJobSystem = pJobSystem;
+	pJobSystem->WorkerLoop(workerIndex);
+}
+
+void JobSystem::WorkerLoop(int workerIndex)
+{
+	Worker& worker = *m_workers[workerIndex];
+	while (!m_quit.load(std::memory_order_acquire))
+	{
+		Job job;
+		if (FindJob(workerIndex, job))
+		{
+			Execute(job);
+			continue;
+		}
+
+		// another worker's mailbox is no reason to wake up, only this one's
+		std::unique_lock<std::mutex> lock(m_sleepLock);
+		m_wakeUp.wait(lock, [this, &worker]() { return m_quit.load() || m_queuedJobs.load() > 0 || worker.m_mailboxSize.load() > 0; });
+	}
+}
+
+void JobSystem::WakeWorkers(bool all)
+{
+	// taking the lock means a worker can't miss the wake up between checking and going to sleep
+	{
+		std::lock_guard<std::mutex> lock(m_sleepLock);
+	}
+
+	if (all)
+	{
+		m_wakeUp.notify_all();
+	}
+	else
+	{
+		m_wakeUp.notify_one();
+	}
+}
+
+bool JobSystem::FindJob(int workerIndex, Job& job)
+{
+	if (workerIndex >= 0 && PopMailbox(workerIndex, job))
+	{
+		return true;
+	}
+
+	for (int priority = 0; priority < JOB_PRIORITY_COUNT; ++priority)
+	{
+		if (workerIndex >= 0 && m_workers[workerIndex]->m_jobs[priority].Pop(job))
+		{
+			m_queuedJobs.fetch_sub(1, std::memory_order_relaxed);
+			return true;
+		}
+		if (PopInjected(priority, job) || StealJob(workerIndex, priority, job))
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+bool JobSystem::PopMailbox(int workerIndex, Job& job)
+{
+	Worker& worker = *m_workers[workerIndex];
+	if (worker.m_mailboxSize.load(std::memory_order_acquire) == 0)
+	{
+		return false;
+	}
+
+	std::lock_guard<std::mutex> lock(worker.m_mailboxLock);
+	if (worker.m_mailbox.empty())
+	{
+		return false;
+	}
+
+	job = worker.m_mailbox.front();
+	worker.m_mailbox.pop_front();
+	worker.m_mailboxSize.fetch_sub(1, std::memory_order_relaxed);
+	return true;
+}
+
+bool JobSystem::PopInjected(int priority, Job& job)
+{
+	// skip the lock when nothing came from outside the pool, which is the common case
+	if (m_injectedCount.load(std::memory_order_acquire) == 0)
+	{
+		return false;
+	}
+
+	std::lock_guard<std::mutex> lock(m_injectLock);
+	if (m_injected[priority].empty())
+	{
+		return false;
+	}
+
+	job = m_injected[priority].front();
+	m_injected[priority].pop_front();
+	m_injectedCount.fetch_sub(1, std::memory_order_relaxed);
+	m_queuedJobs.fetch_sub(1, std::memory_order_relaxed);
+	return true;
+}
+
+bool JobSystem::StealJob(int thiefIndex, int priority, Job& job)
+{
+	// start right after the thief so the victims are spread out
+	size_t numWorkers = m_workers.size();
+	size_t first = (thiefIndex < 0) ? 0 : (size_t)thiefIndex + 1;
+	for (size_t i = 0; i < numWorkers; ++i)
+	{
+		int victimIndex = (int)((first + i) % numWorkers);
+		if (victimIndex == thiefIndex)
+		{
+			continue;
+		}
+
+		// a lost race with the owner or another thief just moves on to the next victim
+		if (m_workers[victimIndex]->m_jobs[priority].Steal(job))
+		{
+			m_queuedJobs.fetch_sub(1, std::memory_order_relaxed);
+			return true;
+		}
+	}
+	return false;
+}
+
+void JobSystem::Execute(const Job& job)
+{
+	job.m_function(job.m_pData);
+
+	if (job.m_pCounter)
+	{
+		job.m_pCounter->m_pending.fetch_sub(1, std::memory_order_release);
+	}
+}
+
+void JobSystem::LongRunningThreadProc(JobSystem* pJobSystem)
+{
+	pJobSystem->LongRunningLoop();
+}
+
+void JobSystem::LongRunningLoop()
+{
+	std::unique_lock<std::mutex> lock(m_longRunningLock);
+	for (;;)
+	{
+		m_longRunningWakeUp.wait(lock, [this]() { return m_quit.load() || !m_longRunningJobs.empty(); });
+		if (m_longRunningJobs.empty())
+		{
+			return;
+		}
+
+		LongRunningJob longRunningJob = m_longRunningJobs.front();
+		m_longRunningJobs.pop_front();
+		--m_idleLongRunningThreads;
+		lock.unlock();
+
+#ifdef _WIN32
+		SetThreadPriority(GetCurrentThread(), longRunningJob.m_threadPriority);
+#endif
+		Execute(longRunningJob.m_job);
+#ifdef _WIN32
+		SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_NORMAL);
+#endif
+
+		lock.lock();
+		++m_idleLongRunningThreads;
+	}
+}
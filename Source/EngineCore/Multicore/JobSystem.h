@@ -0,0 +1,127 @@
+#pragma once
+
+//========================================================================
+// JobSystem.h : Work stealing pool of worker threads
+//========================================================================
+
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include "Common/CommonStd.h"
+#include "WorkStealingDeque.h"
+
+//
+// class JobCounter							- not described in the book
+//
+// Counts the jobs of a group that haven't finished yet. Hand the same counter to every job of
+// a fork and JobSystem::Wait() on it to join.
+//
+class JobCounter : public Nv_noncopyable
+{
+	friend class JobSystem;
+
+	std::atomic<int> m_pending;
+
+public:
+	JobCounter() { m_pending.store(0, std::memory_order_relaxed); }
+
+	bool IsDone() const { return m_pending.load(std::memory_order_acquire) == 0; }
+};
+
+// every worker looks for high priority work anywhere in the pool before it runs a normal job
+enum JobPriority
+{
+	JOB_PRIORITY_HIGH,
+	JOB_PRIORITY_NORMAL,
+	JOB_PRIORITY_LOW,
+
+	JOB_PRIORITY_COUNT
+};
+
+const int JOB_AFFINITY_ANY = -1;
+
+//
+// class JobSystem								- not described in the book
+//
+// Every worker thread has a lock free deque of jobs per priority. A worker takes its newest job
+// first, which is usually still in its cache, and when it runs dry it steals the oldest job of
+// another worker. Only a worker may push onto its own deques, so jobs queued from outside the
+// pool go through a locked injection queue that the workers drain before they steal.
+//
+// A job with an affinity only ever runs on that worker - use it for work that touches state
+// owned by one thread. Nobody steals it, so keep it rare.
+//
+// Wait() doesn't just block - the waiting thread runs queued jobs until the counter drops to
+// zero, so the game thread helps out instead of idling.
+//
+// Jobs that run for as long as a process lives (see RealtimeProcess) would starve the workers,
+// so RunLongRunning() hands them to a separate set of threads that is only as big as the number
+// of long running jobs ever running at once. Those threads are reused, not created per job.
+//
+class JobSystem : public Nv_noncopyable
+{
+	struct Worker
+	{
+		WorkStealingDeque m_jobs[JOB_PRIORITY_COUNT];
+		std::mutex m_mailboxLock;
+		std::deque<Job> m_mailbox;				// jobs with an affinity for this worker, nobody steals them
+		std::atomic<int> m_mailboxSize;
+		std::thread m_thread;
+	};
+
+	struct LongRunningJob
+	{
+		Job m_job;
+		int m_threadPriority;
+	};
+
+	std::vector<Worker*> m_workers;
+	std::atomic<int> m_queuedJobs;				// in all the deques and injection queues together - mailboxes count their own
+	std::atomic<bool> m_quit;
+
+	std::mutex m_injectLock;
+	std::deque<Job> m_injected[JOB_PRIORITY_COUNT];	// from threads outside the pool
+	std::atomic<int> m_injectedCount;
+
+	std::mutex m_sleepLock;
+	std::condition_variable m_wakeUp;
+
+	std::mutex m_longRunningLock;
+	std::condition_variable m_longRunningWakeUp;
+	std::deque<LongRunningJob> m_longRunningJobs;
+	std::vector<std::thread> m_longRunningThreads;
+	unsigned int m_idleLongRunningThreads;
+
+public:
+	// 0 workers means one per hardware thread, less one for the thread that owns the pool
+	explicit JobSystem(unsigned int numWorkers = 0);
+	~JobSystem();
+
+	unsigned int GetNumWorkers() const { return (unsigned int)m_workers.size(); }
+
+	void Run(const Job& job, JobPriority priority = JOB_PRIORITY_NORMAL, int affinity = JOB_AFFINITY_ANY);
+	void Run(JobFunction function, void* pData, JobCounter* pCounter, JobPriority priority = JOB_PRIORITY_NORMAL, int affinity = JOB_AFFINITY_ANY);
+
+	// For jobs that loop until told to stop. threadPriority is a THREAD_PRIORITY_* value, applied
+	// while the job runs on Windows and ignored elsewhere. Every long running job has to have
+	// returned before the job system is destroyed.
+	void RunLongRunning(const Job& job, int threadPriority = 0);
+
+	// Runs jobs on the calling thread until every job counted by the counter has finished.
+	void Wait(JobCounter& counter);
+
+private:
+	static void WorkerThreadProc(JobSystem* pJobSystem, int workerIndex);
+	static void LongRunningThreadProc(JobSystem* pJobSystem);
+	void WorkerLoop(int workerIndex);
+	void LongRunningLoop();
+	void WakeWorkers(bool all);
+
+	bool FindJob(int workerIndex, Job& job);
+	bool PopMailbox(int workerIndex, Job& job);
+	bool PopInjected(int priority, Job& job);
+	bool StealJob(int thiefIndex, int priority, Job& job);
+	void Execute(const Job& job);
+};
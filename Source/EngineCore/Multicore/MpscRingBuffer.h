@@ -0,0 +1,220 @@
+#pragma once
+
+//========================================================================
+// MpscRingBuffer.h : Bounded lock-free queue, many producers, one consumer
+//========================================================================
+
+#include <atomic>
+#include <deque>
+#include "Common/CommonStd.h"
+#include "CriticalSection.h"
+
+//
+// class MpscRingBuffer						- not described in the book
+//
+// Replaces concurrent_queue for events sent from other threads. Every slot carries a sequence
+// number that tells producers and the consumer whose turn it is, so a push is a single
+// compare-exchange on the write position and a pop touches no shared counter at all. Nothing
+// blocks: TryPush() fails when the ring is full and TryPop() when it's empty.
+//
+// Push() never fails. When the ring is full it puts the entry on a spill list behind a lock, and
+// every push after it goes there too until the consumer has caught up, so each producer's entries
+// still come out in the order they went in. The consumer only takes from the spill list once the
+// ring is empty.
+//
+// Any number of threads may push, but only one thread may pop - for the event manager that's
+// the game thread in VUpdate().
+//
+template<typename Data>
+class MpscRingBuffer : public Nv_noncopyable
+{
+	struct Slot
+	{
+		std::atomic<size_t> m_sequence;		// == position: free to write, == position + 1: ready to read
+		Data m_data;
+	};
+
+	enum { CACHE_LINE_SIZE = 64 };
+
+	Slot* m_pSlots;
+	size_t m_mask;							// capacity - 1, the capacity is a power of two
+	char m_pad0[CACHE_LINE_SIZE];
+
+	std::atomic<size_t> m_writePos;			// shared by the producers
+	char m_pad1[CACHE_LINE_SIZE];
+
+	size_t m_readPos;						// only touched by the consumer
+	char m_pad2[CACHE_LINE_SIZE];
+
+	CriticalSection m_spillCs;
+	std::deque<Data> m_spill;				// overflow of a full ring, guarded by m_spillCs
+	std::atomic<size_t> m_spillCount;		// m_spill.size(), readable without the lock
+
+public:
+	// the capacity is rounded up to a power of two
+	explicit MpscRingBuffer(size_t capacity = 4096)
+	{
+		size_t size = 2;
+		while (size < capacity)
+		{
+			size <<= 1;
+		}
+
+		m_pSlots = Nv_NEW Slot[size];
+		m_mask = size - 1;
+		for (size_t i = 0; i < size; ++i)
+		{
+			m_pSlots[i].m_sequence.store(i, std::memory_order_relaxed);
+		}
+
+		m_writePos.store(0, std::memory_order_relaxed);
+		m_readPos = 0;
+		m_spillCount.store(0, std::memory_order_relaxed);
+	}
+
+	~MpscRingBuffer()
+	{
+		SAFE_DELETE_ARRAY(m_pSlots);
+	}
+
+	size_t Capacity() const { return m_mask + 1; }
+
+	bool TryPush(const Data& data)
+	{
+		size_t pos = m_writePos.load(std::memory_order_relaxed);
+		for (;;)
+		{
+			Slot& slot = m_pSlots[pos & m_mask];
+			size_t sequence = slot.m_sequence.load(std::memory_order_acquire);
+			intptr_t diff = (intptr_t)sequence - (intptr_t)pos;
+
+			if (diff == 0)
+			{
+				// the slot is free - claim it, on failure pos is reloaded for us
+				if (m_writePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+				{
+					slot.m_data = data;
+					slot.m_sequence.store(pos + 1, std::memory_order_release);
+					return true;
+				}
+			}
+			else if (diff < 0)
+			{
+				// the consumer hasn't emptied this slot from the previous lap yet
+				return false;
+			}
+			else
+			{
+				// another producer got here first
+				pos = m_writePos.load(std::memory_order_relaxed);
+			}
+		}
+	}
+
+	// Returns false if the entry had to be spilled.
+	bool Push(const Data& data)
+	{
+		if (m_spillCount.load(std::memory_order_acquire) == 0 && TryPush(data))
+		{
+			return true;
+		}
+
+		ScopedCriticalSection locker(m_spillCs);
+		m_spill.push_back(data);
+		m_spillCount.store(m_spill.size(), std::memory_order_release);
+		return false;
+	}
+
+	bool TryPop(Data& popped)
+	{
+		Slot& slot = m_pSlots[m_readPos & m_mask];
+		if (slot.m_sequence.load(std::memory_order_acquire) != m_readPos + 1)
+		{
+			return PopSpilled(popped);
+		}
+
+		popped = std::move(slot.m_data);
+		slot.m_data = Data();
+		slot.m_sequence.store(m_readPos + m_mask + 1, std::memory_order_release);
+		++m_readPos;
+		return true;
+	}
+
+	// Hands every ready entry to func(Data&), stopping at the first slot a producer hasn't
+	// finished yet or after maxCount entries, whichever comes first. A full drain is bounded by
+	// the capacity so producers refilling the ring can't keep the consumer in here forever. If
+	// that empties the ring, whatever had been spilled by then follows it.
+	template<typename Func>
+	size_t PopBatch(Func func, size_t maxCount = 0)
+	{
+		if (maxCount == 0 || maxCount > Capacity())
+		{
+			maxCount = Capacity();
+		}
+
+		size_t count = 0;
+		while (count < maxCount)
+		{
+			Slot& slot = m_pSlots[m_readPos & m_mask];
+			if (slot.m_sequence.load(std::memory_order_acquire) != m_readPos + 1)
+			{
+				break;
+			}
+
+			func(slot.m_data);
+			slot.m_data = Data();
+			slot.m_sequence.store(m_readPos + m_mask + 1, std::memory_order_release);
+			++m_readPos;
+			++count;
+		}
+
+		if (m_spillCount.load(std::memory_order_acquire) != 0 && RingDrained())
+		{
+			std::deque<Data> spilled;
+			{
+				ScopedCriticalSection locker(m_spillCs);
+				spilled.swap(m_spill);
+				m_spillCount.store(0, std::memory_order_release);
+			}
+			for (typename std::deque<Data>::iterator it = spilled.begin(); it != spilled.end(); ++it)
+			{
+				func(*it);
+				++count;
+			}
+		}
+		return count;
+	}
+
+	// only meaningful on the consumer thread, and even then a producer may be mid-push
+	bool Empty() const
+	{
+		return m_pSlots[m_readPos & m_mask].m_sequence.load(std::memory_order_acquire) != m_readPos + 1
+			&& m_spillCount.load(std::memory_order_acquire) == 0;
+	}
+
+private:
+	// Nothing left in the ring and no slot claimed by a producer that's still writing it - a
+	// producer's spilled entries can't be ahead of one of its own in the ring.
+	bool RingDrained() const
+	{
+		return m_writePos.load(std::memory_order_acquire) == m_readPos;
+	}
+
+	bool PopSpilled(Data& popped)
+	{
+		if (m_spillCount.load(std::memory_order_acquire) == 0 || !RingDrained())
+		{
+			return false;
+		}
+
+		ScopedCriticalSection locker(m_spillCs);
+		if (m_spill.empty())
+		{
+			return false;
+		}
+		popped = std::move(m_spill.front());
+		m_spill.pop_front();
+		m_spillCount.store(m_spill.size(), std::memory_order_release);
+		return true;
+	}
+};
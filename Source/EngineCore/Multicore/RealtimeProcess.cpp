@@ -6,54 +6,61 @@
 
 #include "RealtimeProcess.h"
 #include "../EventManager/EventManager.h"
+#include "../App/App.h"
 
 DWORD g_maxLoops = 100000;
 DWORD g_ProtectedTotal = 0;
-CRITICAL_SECTION g_criticalSection;
+CriticalSection g_criticalSection;
 
-DWORD WINAPI ThreadProc(LPVOID lpParam)
+void ProtectedLoopJob(void* pData)
 {
-	DWORD maxLoops = *static_cast<DWORD*>(lpParam);
+	DWORD maxLoops = *static_cast<DWORD*>(pData);
 	DWORD dwCount = 0;
 	
 	while (dwCount < maxLoops)
 	{
 		++dwCount;
 
-		EnterCriticalSection(&g_criticalSection);
+		ScopedCriticalSection locker(g_criticalSection);
 		++g_ProtectedTotal;
-		LeaveCriticalSection(&g_criticalSection);
 	}
-	return TRUE;
 }
 
-void CreateThreads()
+//
+// The loops used to get a CreateThread() each - now they're jobs, and the caller joins them with
+// pJobSystem->Wait(counter).
+//
+void CreateThreads(JobSystem* pJobSystem, JobCounter& counter)
 {
-	InitializeCriticalSection(&g_criticalSection);
-
 	for (int i = 0; i < 20; i++)
 	{
-		HANDLE m_hThread = CreateThread(
-										NULL,				// default security attributes
-										0,					// default stack size
-										(LPTHREAD_START_ROUTINE)ThreadProc,
-										&g_maxLoops,		// thrad parameter is how many loops
-										0,					// default creation flags
-										NULL);				// receive thread identifier
+		pJobSystem->Run(ProtectedLoopJob, &g_maxLoops, &counter);
 	}
 }
 
-RealtimeProcess::RealtimeProcess(int priority)
+RealtimeProcess::RealtimeProcess(int priority, JobSystem* pJobSystem)
 {
-	m_ThreadID = 0;
 	m_ThreadPriority = priority;
+	m_pJobSystem = pJobSystem;
+	m_stopRequested.store(false);
+	m_hWakeUp = CreateEvent(NULL, FALSE, FALSE, NULL);
+}
+
+RealtimeProcess::~RealtimeProcess(void)
+{
+	// VThreadProc() still has a pointer to us
+	if (m_pJobSystem && !m_running.IsDone())
+	{
+		RequestStop();
+		m_pJobSystem->Wait(m_running);
+	}
+	CloseHandle(m_hWakeUp);
 }
 
-DWORD WINAPI RealtimeProcess::ThreadProc(LPVOID lpParam)
+void RealtimeProcess::ThreadProc(void* pData)
 {
-	RealtimeProcess* proc = static_cast<RealtimeProcess*>(lpParam);
+	RealtimeProcess* proc = static_cast<RealtimeProcess*>(pData);
 	proc->VThreadProc();
-	return TRUE;
 }
 
 // -----------------------------------------------------------------------------------
@@ -62,22 +69,20 @@ DWORD WINAPI RealtimeProcess::ThreadProc(LPVOID lpParam)
 void RealtimeProcess::VOnInit(void)
 {
 	Process::VOnInit();
-	m_hThread = CreateThread(
-							NULL,				// default security attributes
-							0,					// default stack size
-							ThreadProc,			// thread process
-							this,				// thread parameter is a pointer to the process
-							0,					// default creation flags
-							&m_ThreadID);		// receive thread identifier
-
-	if (m_hThread == NULL)
+
+	if (!m_pJobSystem)
 	{
-		//Nv_ERROR("Could not create thread!");
+		m_pJobSystem = g_pApp->m_pJobSystem;
+	}
+	if (!m_pJobSystem)
+	{
+		//Nv_ERROR("No job system to run the process on!");
 		Fail();
 		return;
 	}
 
-	SetThreadPriority(m_hThread, m_ThreadPriority);
+	Job job = { ThreadProc, this, &m_running };
+	m_pJobSystem->RunLongRunning(job, m_ThreadPriority);
 }
 
 class ProtectedProcess : public RealtimeProcess
@@ -189,6 +194,7 @@ const int THREADS_COUNT = 20;
 const int WRITES_PER_THREAD = 500;
 
 LONG nRemainingThreads = THREADS_COUNT;
+HANDLE g_hSendersDone = NULL;					// manual reset, set by the last EventSenderProcess
 
 #include "../EventManager/Events.h"
 
@@ -210,16 +216,21 @@ void EventSenderProcess::VThreadProc(void)
 {
 	DWORD dwCount = 0;
 
-	while (dwCount < m_MaxLoops)
+	while (dwCount < m_MaxLoops && !IsStopRequested())
 	{
 		IEventDataPtr e(Nv_NEW EvtData_Update_Tick(timeGetTime()));
-		IEventManager::Get()->VThreadSafeQueueEvent(e);
-		Sleep(10);
-		dwCount++;
+		if (IEventManager::Get()->VThreadSafeQueueEvent(e)) {
+			dwCount++;
+		}
+
+		// a tick every 10ms, but a stop request doesn't have to wait them out
+		WaitForWakeUp(10);
 	}
 
 	Succeed();
-	InterlockedDecrement(&nRemainingThreads);
+	if (InterlockedDecrement(&nRemainingThreads) == 0) {
+		SetEvent(g_hSendersDone);
+	}
 }
 
 
@@ -240,24 +251,23 @@ public:
 
 void EventReaderProcess::UpdateTickDelegate(IEventDataPtr pEventData)
 {
-	// Need to do something here.
-	m_RealtimeEventQueue.push(pEventData);
+	// spilled rather than dropped if the reader has fallen a whole ring behind
+	m_RealtimeEventQueue.Push(pEventData);
+	WakeUp();
 }
 
 void EventReaderProcess::VThreadProc(void)
 {
-	// wait for all threads to end
-	while (true)
+	// read until all the senders are done, blocking while there's nothing to read
+	HANDLE handles[] = { m_hWakeUp, g_hSendersDone };
+	while (!IsStopRequested())
 	{
 		IEventDataPtr e;
-		if (m_RealtimeEventQueue.try_pop(e)) {
+		if (m_RealtimeEventQueue.TryPop(e)) {
 			++m_EventsRead;
 		}
-		else {
-			InterlockedIncrement(&nRemainingThreads);
-			if (InterlockedDecrement(&nRemainingThreads) == 0) {
-				break;
-			}
+		else if (WaitForMultipleObjects(2, handles, FALSE, INFINITE) == WAIT_OBJECT_0 + 1 && m_RealtimeEventQueue.Empty()) {
+			break;
 		}
 	}
 
@@ -267,6 +277,12 @@ void EventReaderProcess::VThreadProc(void)
 
 void testRealtimeEvents(ProcessManager* procMgr)
 {
+	nRemainingThreads = THREADS_COUNT;
+	if (!g_hSendersDone) {
+		g_hSendersDone = CreateEvent(NULL, TRUE, FALSE, NULL);
+	}
+	ResetEvent(g_hSendersDone);
+
 	for (int idx = 0; idx < THREADS_COUNT; ++idx)
 	{
 		std::shared_ptr<Process> proc(Nv_NEW EventSenderProcess(g_ThreadLoops));
@@ -295,7 +311,8 @@ public:
 	void DecompressRequestDelegate(IEventDataPtr pEventData)
 	{
 		IEventDataPtr pEventClone = pEventData->VCopy();
-		m_RealtimeEventQueue.push(pEventClone);
+		m_RealtimeEventQueue.Push(pEventClone);
+		WakeUp();
 	}
 
 	virtual void VThreadProc(void);
@@ -314,11 +331,11 @@ DecompressionProcess::~DecompressionProcess()
 
 void DecompressionProcess::VThreadProc()
 {
-	while (1)
+	while (!IsStopRequested())
 	{
 		// check the queue for events we should consume
 		IEventDataPtr e;
-		if (m_RealtimeEventQueue.try_pop(e))
+		if (m_RealtimeEventQueue.TryPop(e))
 		{
 			// there's an event! Something to do...
 			if (EvtData_Decompress_Request::sk_EventType == e->VGetEventType())
@@ -335,8 +352,10 @@ void DecompressionProcess::VThreadProc()
 					int resourceNum = zipFile.Find(decomp->GetFilename().c_str());
 					if (resourceNum >= 0)
 					{
-						// size = zipFile.GetFileLen(*resourceNum);
+						size = zipFile.GetFileLen(resourceNum);
 						char* buffer = Nv_NEW char[size];
+
+						// entries packed with ZipWriter chunking are inflated as jobs on the job system
 						zipFile.ReadFile(resourceNum, buffer);
 
 						// send decompression result event
@@ -347,7 +366,8 @@ void DecompressionProcess::VThreadProc()
 		}
 		else
 		{
-			Sleep(10);
+			// until the delegate queues a request, or the process is stopped
+			WaitForWakeUp();
 		}
 	}
 
@@ -7,13 +7,28 @@
 
 #include "../Common/CommonStd.h"
 #include "../MainLoop/Process.h"
+#include "JobSystem.h"
 
+//
+// class RealtimeProcess
+//
+// VThreadProc() runs as a long running job on the job system rather than on a thread of its
+// own, so starting a realtime process no longer costs a CreateThread() and the threads are
+// reused once the process is done. VThreadProc() should check IsStopRequested() every so often -
+// aborting the process or destroying it sets it, and the destructor waits for VThreadProc() to
+// return.
+//
+// A process with nothing to do blocks in WaitForWakeUp() rather than sleeping and polling.
+// WakeUp() - from a delegate that queued it some work, say - and RequestStop() both release it.
+//
 class RealtimeProcess : public Process
 {
 protected:
-	HANDLE m_hThread;
-	DWORD m_ThreadID;
 	int m_ThreadPriority;
+	JobSystem* m_pJobSystem;
+	JobCounter m_running;
+	std::atomic<bool> m_stopRequested;
+	HANDLE m_hWakeUp;							// auto reset
 
 public:
 	// Other priorities can be:
@@ -24,13 +39,23 @@ public:
 	// THREAD_PRIORITY_IDLE
 	// THREAD_PRIORITY_TIME_CRITICAL
 	//
+	// A NULL job system means the application's.
 	//
-	RealtimeProcess(int priority = THREAD_PRIORITY_NORMAL);
-	virtual ~RealtimeProcess(void) { CloseHandle(m_hThread); }
-	static DWORD WINAPI ThreadProc(LPVOID lpParam);
+	RealtimeProcess(int priority = THREAD_PRIORITY_NORMAL, JobSystem* pJobSystem = nullptr);
+	virtual ~RealtimeProcess(void);
+	static void ThreadProc(void* pData);
+
+	bool IsStopRequested(void) const { return m_stopRequested.load(std::memory_order_acquire); }
+	void RequestStop(void) { m_stopRequested.store(true, std::memory_order_release); WakeUp(); }
+
+	void WakeUp(void) { SetEvent(m_hWakeUp); }
+
+	// false if it timed out
+	bool WaitForWakeUp(DWORD milliseconds = INFINITE) { return WaitForSingleObject(m_hWakeUp, milliseconds) == WAIT_OBJECT_0; }
 
 protected:
 	virtual void VOnInit(void);
 	virtual void VOnUpdate(unsigned long deltaMs) override { } // do nothing
+	virtual void VOnAbort(void) override { RequestStop(); }
 	virtual void VThreadProc(void) = 0;
 };
@@ -0,0 +1,175 @@
+#pragma once
+
+//========================================================================
+// WorkStealingDeque.h : Chase-Lev deque of jobs
+//========================================================================
+
+#include <atomic>
+#include <vector>
+#include "Common/CommonStd.h"
+
+typedef void (*JobFunction)(void* pData);
+class JobCounter;
+
+//
+// struct Job									- not described in the book
+//
+// Plain data so jobs can be queued without allocating. m_pData has to stay valid until the
+// job has run.
+//
+struct Job
+{
+	JobFunction m_function;
+	void* m_pData;
+	JobCounter* m_pCounter;						// may be NULL
+};
+
+//
+// class WorkStealingDeque						- not described in the book
+//
+// The lock free deque from "Dynamic Circular Work-Stealing Deque" (Chase & Lev), with the memory
+// orderings of "Correct and Efficient Work-Stealing for Weak Memory Models" (Le et al.). The
+// owning worker pushes and pops at the bottom without any atomic read-modify-write unless the
+// deque is down to its last job; thieves take from the top with a single compare-exchange.
+//
+// Only the owner may call Push() and Pop(). Any thread may call Steal().
+//
+class WorkStealingDeque : public Nv_noncopyable
+{
+	// the fields are atomics so a thief reading a slot the owner is writing isn't a data race -
+	// it just loses the compare-exchange on m_top and throws what it read away
+	struct Slot
+	{
+		std::atomic<JobFunction> m_function;
+		std::atomic<void*> m_pData;
+		std::atomic<JobCounter*> m_pCounter;
+	};
+
+	struct Ring
+	{
+		long long m_capacity;					// a power of two
+		Slot* m_pSlots;
+
+		explicit Ring(long long capacity) : m_capacity(capacity) { m_pSlots = Nv_NEW Slot[(size_t)capacity]; }
+		~Ring() { SAFE_DELETE_ARRAY(m_pSlots); }
+
+		void Put(long long index, const Job& job)
+		{
+			Slot& slot = m_pSlots[index & (m_capacity - 1)];
+			slot.m_function.store(job.m_function, std::memory_order_relaxed);
+			slot.m_pData.store(job.m_pData, std::memory_order_relaxed);
+			slot.m_pCounter.store(job.m_pCounter, std::memory_order_relaxed);
+		}
+
+		void Get(long long index, Job& job) const
+		{
+			const Slot& slot = m_pSlots[index & (m_capacity - 1)];
+			job.m_function = slot.m_function.load(std::memory_order_relaxed);
+			job.m_pData = slot.m_pData.load(std::memory_order_relaxed);
+			job.m_pCounter = slot.m_pCounter.load(std::memory_order_relaxed);
+		}
+	};
+
+	std::atomic<long long> m_top;				// thieves steal here
+	char m_pad[64];
+	std::atomic<long long> m_bottom;			// the owner works here
+	std::atomic<Ring*> m_pRing;
+	std::vector<Ring*> m_oldRings;				// a thief may still be reading one, so they live as long as the deque
+
+public:
+	explicit WorkStealingDeque(long long capacity = 256)
+	{
+		m_top.store(0, std::memory_order_relaxed);
+		m_bottom.store(0, std::memory_order_relaxed);
+		m_pRing.store(Nv_NEW Ring(capacity), std::memory_order_relaxed);
+	}
+
+	~WorkStealingDeque()
+	{
+		Ring* pRing = m_pRing.load(std::memory_order_relaxed);
+		SAFE_DELETE(pRing);
+		for (size_t i = 0; i < m_oldRings.size(); ++i)
+		{
+			SAFE_DELETE(m_oldRings[i]);
+		}
+	}
+
+	void Push(const Job& job)
+	{
+		long long bottom = m_bottom.load(std::memory_order_relaxed);
+		long long top = m_top.load(std::memory_order_acquire);
+		Ring* pRing = m_pRing.load(std::memory_order_relaxed);
+
+		if (bottom - top > pRing->m_capacity - 1)
+		{
+			pRing = Grow(pRing, top, bottom);
+		}
+
+		pRing->Put(bottom, job);
+		std::atomic_thread_fence(std::memory_order_release);
+		m_bottom.store(bottom + 1, std::memory_order_relaxed);
+	}
+
+	bool Pop(Job& job)
+	{
+		long long bottom = m_bottom.load(std::memory_order_relaxed) - 1;
+		Ring* pRing = m_pRing.load(std::memory_order_relaxed);
+		m_bottom.store(bottom, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		long long top = m_top.load(std::memory_order_relaxed);
+
+		if (top > bottom)
+		{
+			// empty
+			m_bottom.store(bottom + 1, std::memory_order_relaxed);
+			return false;
+		}
+
+		pRing->Get(bottom, job);
+		if (top == bottom)
+		{
+			// the last job - race the thieves for it
+			bool won = m_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+			m_bottom.store(bottom + 1, std::memory_order_relaxed);
+			return won;
+		}
+		return true;
+	}
+
+	bool Steal(Job& job)
+	{
+		long long top = m_top.load(std::memory_order_acquire);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		long long bottom = m_bottom.load(std::memory_order_acquire);
+
+		if (top >= bottom)
+		{
+			return false;
+		}
+
+		Ring* pRing = m_pRing.load(std::memory_order_acquire);
+		pRing->Get(top, job);
+		return m_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+	}
+
+	// only a hint when called from a thief
+	bool Empty() const
+	{
+		return m_bottom.load(std::memory_order_relaxed) <= m_top.load(std::memory_order_relaxed);
+	}
+
+private:
+	Ring* Grow(Ring* pOld, long long top, long long bottom)
+	{
+		Ring* pNew = Nv_NEW Ring(pOld->m_capacity * 2);
+		Job job;
+		for (long long i = top; i < bottom; ++i)
+		{
+			pOld->Get(i, job);
+			pNew->Put(i, job);
+		}
+		m_oldRings.push_back(pOld);
+		m_pRing.store(pNew, std::memory_order_release);
+		return pNew;
+	}
+};
@@ -0,0 +1,187 @@
+// ================================================================
+// EpollSocketManager.cpp : A socket manager for servers with lots of connections, on Linux
+// ================================================================
+
+#include "../Common/CommonStd.h"
+#include "EpollSocketManager.h"
+
+#ifdef __linux__
+
+EpollSocketManager::EpollSocketManager(unsigned int maxEventsPerPoll)
+{
+	m_events.resize(std::max(maxEventsPerPoll, 1u));
+
+	m_epollFd = epoll_create1(EPOLL_CLOEXEC);
+	if (m_epollFd == SOCKET_ERROR) {
+		// VPoll() falls back on select()
+		PrintError();
+	}
+}
+
+EpollSocketManager::~EpollSocketManager()
+{
+	// the sockets themselves go in ~BaseSocketManager()
+	m_pendingOutput.clear();
+	m_pendingInput.clear();
+	if (m_epollFd != SOCKET_ERROR)
+	{
+		close(m_epollFd);
+		m_epollFd = SOCKET_ERROR;
+	}
+}
+
+//
+// EpollSocketManager::VPoll						- not described in the book
+//
+void EpollSocketManager::VPoll(int pauseMicroSecs, bool handleInput)
+{
+	if (m_epollFd == SOCKET_ERROR)
+	{
+		BaseSocketManager::VPoll(pauseMicroSecs, handleInput);
+		return;
+	}
+
+	// input that came in while it was being left alone - epoll won't mention it again
+	if (handleInput && !m_pendingInput.empty())
+	{
+		for (std::unordered_set<NetSocket*>::iterator it = m_pendingInput.begin(); it != m_pendingInput.end(); ++it)
+		{
+			HandleInput(*it);
+		}
+		m_pendingInput.clear();
+	}
+
+	// whatever was queued since the last poll goes out before we wait
+	FlushOutput();
+
+	// epoll_wait() counts in milliseconds; a short pause rounds up rather than turning into a spin
+	int timeoutMs = (pauseMicroSecs + 999) / 1000;
+	int numEvents = epoll_wait(m_epollFd, &m_events[0], (int)m_events.size(), timeoutMs);
+	if (numEvents == SOCKET_ERROR)
+	{
+		if (errno != EINTR) {
+			PrintError();
+		}
+		return;
+	}
+
+	for (int i = 0; i < numEvents; ++i)
+	{
+		NetSocket* pSock = static_cast<NetSocket*>(m_events[i].data.ptr);
+		unsigned int events = m_events[i].events;
+
+		if ((pSock->m_deleteFlag & 1) || pSock->m_sock == INVALID_SOCKET)
+		{
+			continue;
+		}
+
+		if (pSock->m_bConnecting)
+		{
+			if (events & (EPOLLOUT | EPOLLERR | EPOLLHUP)) {
+				pSock->FinishConnect();
+			}
+			if (pSock->m_bConnecting || (pSock->m_deleteFlag & 1)) {
+				continue;
+			}
+		}
+
+		if (events & EPOLLOUT) {
+			pSock->m_bWriteBlocked = false;
+		}
+
+		// a peer that hung up may still have sent something first, so read before dealing with the hang up -
+		// recv() returning 0 at the end flags the socket for deletion
+		if (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+		{
+			if (handleInput) {
+				HandleInput(pSock);
+			}
+			else {
+				m_pendingInput.insert(pSock);
+			}
+		}
+
+		if (events & EPOLLERR) {
+			pSock->HandleException();
+		}
+	}
+
+	// sockets that just became writable, and replies queued while handling input
+	FlushOutput();
+}
+
+void EpollSocketManager::HandleInput(NetSocket* pSocket)
+{
+	// NetSocket::VHandleInput() reads once; keep going until it finds nothing. Sockets that don't
+	// read that way (listen sockets) never set m_bMoreInput and get called the once.
+	do
+	{
+		pSocket->m_bMoreInput = false;
+		pSocket->VHandleInput();
+	} while (pSocket->m_bMoreInput && !(pSocket->m_deleteFlag & 1));
+}
+
+void EpollSocketManager::FlushOutput(void)
+{
+	std::unordered_set<NetSocket*>::iterator it = m_pendingOutput.begin();
+	while (it != m_pendingOutput.end())
+	{
+		NetSocket* pSock = *it;
+		bool alive = !(pSock->m_deleteFlag & 1) && pSock->m_sock != INVALID_SOCKET;
+
+		if (alive && !pSock->m_bConnecting && !pSock->m_bWriteBlocked && pSock->VHasOutput()) {
+			pSock->VHandleOutput();
+		}
+
+		if (!alive || !pSock->VHasOutput()) {
+			it = m_pendingOutput.erase(it);
+		}
+		else {
+			++it;
+		}
+	}
+}
+
+void EpollSocketManager::VWatchSocket(NetSocket* pSocket)
+{
+	if (m_epollFd == SOCKET_ERROR || pSocket->m_sock == INVALID_SOCKET) {
+		return;
+	}
+
+	// edge-triggered reads and writes have to be able to run until they'd block
+	pSocket->SetBlocking(false);
+
+	epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+	ev.data.ptr = pSocket;
+	if (epoll_ctl(m_epollFd, EPOLL_CTL_ADD, pSocket->m_sock, &ev) == SOCKET_ERROR)
+	{
+		PrintError();
+		pSocket->HandleException();
+		return;
+	}
+
+	if (pSocket->VHasOutput()) {
+		m_pendingOutput.insert(pSocket);
+	}
+}
+
+void EpollSocketManager::VUnwatchSocket(NetSocket* pSocket)
+{
+	m_pendingOutput.erase(pSocket);
+	m_pendingInput.erase(pSocket);
+
+	if (m_epollFd != SOCKET_ERROR && pSocket->m_sock != INVALID_SOCKET) {
+		epoll_ctl(m_epollFd, EPOLL_CTL_DEL, pSocket->m_sock, NULL);
+	}
+}
+
+void EpollSocketManager::VOnOutputQueued(NetSocket* pSocket)
+{
+	if (m_epollFd != SOCKET_ERROR) {
+		m_pendingOutput.insert(pSocket);
+	}
+}
+
+#endif
@@ -0,0 +1,48 @@
+#pragma once
+
+// ================================================================
+// EpollSocketManager.h : A socket manager for servers with lots of connections, on Linux
+// ================================================================
+
+#ifdef __linux__
+
+#include <sys/epoll.h>
+#include <unordered_set>
+#include "Network.h"
+
+#define EPOLL_DEFAULT_EVENTS_PER_POLL (256)
+
+//
+// class EpollSocketManager							- not described in the book
+//
+// BaseSocketManager::VPoll() fills its fd_sets from every socket and select() scans them all again,
+// every tick, and can't take more than FD_SETSIZE of them. This one registers each socket with epoll
+// once, when it's added, so a poll only touches the sockets that have something going on.
+//
+// The sockets are watched edge-triggered - epoll reports each change once - so input is read until
+// recv() would block, and sockets with output that couldn't all go out wait for epoll to say they're
+// writable again. Sockets are switched to non-blocking when they're added.
+//
+class EpollSocketManager : public BaseSocketManager
+{
+	int m_epollFd;
+	std::vector<epoll_event> m_events;
+	std::unordered_set<NetSocket*> m_pendingOutput;		// sockets with packets queued
+	std::unordered_set<NetSocket*> m_pendingInput;		// sockets that had input while DoSelect() was told to leave it
+
+public:
+	explicit EpollSocketManager(unsigned int maxEventsPerPoll = EPOLL_DEFAULT_EVENTS_PER_POLL);
+	virtual ~EpollSocketManager();
+
+protected:
+	virtual void VPoll(int pauseMicroSecs, bool handleInput) override;
+	virtual void VWatchSocket(NetSocket* pSocket) override;
+	virtual void VUnwatchSocket(NetSocket* pSocket) override;
+	virtual void VOnOutputQueued(NetSocket* pSocket) override;
+
+private:
+	void HandleInput(NetSocket* pSocket);
+	void FlushOutput(void);
+};
+
+#endif
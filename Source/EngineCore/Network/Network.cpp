@@ -11,15 +11,19 @@
 #include "../EventManager/Events.h"
 #include "../EventManager/EventManagerImpl.h"
 #include "../Utilities/String.h"
+#include "UdpSocket.h"
+#include "Snapshot.h"
 
+#ifdef _WIN32
 #pragma comment(lib, "Ws2_32")
+#endif
 
 //#define EXIT_ASSERT Nv_ASSERT(0);
 
 const char* BinaryPacket::g_Type = "BinaryPacket";
 const char* TextPacket::g_Type = "TextPacket";
 
-//BaseSocketManager* g_pSocketManager = NULL;
+BaseSocketManager* g_pSocketManager = NULL;
 
 /*******************************************************
 
@@ -67,11 +71,11 @@ void testCode()
 // TextPacket::TextPacket						- not described in the book
 //
 TextPacket::TextPacket(char const* const text)
-	: BinaryPacket(static_cast<u_long>(strlen(text) + 2))
+	: BinaryPacket(static_cast<PacketSize>(strlen(text) + 2))
 {
 	MemCpy(text, strlen(text), 0);
 	MemCpy("\r\n", 2, 2);
-	*(u_long*)m_Data = 0;
+	*(PacketSize*)m_Data = 0;
 }
 
 // ------------------------------------------------------------------------
@@ -87,9 +91,14 @@ NetSocket::NetSocket()
 	m_sendOfs = 0;
 	m_timeOut = 0;
 
+	m_pRecvBuffer = NULL;
 	m_recvOfs = m_recvBegin = 0;
 	m_internal = 0;
 	m_bBinaryProtocol = 1;
+
+	m_bMoreInput = false;
+	m_bWriteBlocked = false;
+	m_bConnecting = false;
 }
 
 //
@@ -103,6 +112,7 @@ NetSocket::NetSocket(SOCKET new_sock, unsigned int hostIP)
 
 	m_bBinaryProtocol = 1;
 
+	m_pRecvBuffer = NULL;
 	m_recvOfs = m_recvBegin = 0;
 	m_internal = 0;
 
@@ -113,7 +123,15 @@ NetSocket::NetSocket(SOCKET new_sock, unsigned int hostIP)
 
 	m_internal = g_pSocketManager->IsInternal(m_ipaddr);
 
-	setsockopt(m_sock, SOL_SOCKET, SO_DONTLINGER, NULL, 0);
+	m_bMoreInput = false;
+	m_bWriteBlocked = false;
+	m_bConnecting = false;
+
+	Nv_SetDontLinger(m_sock);
+
+	// VHandleOutput() expects send() to return rather than wait, and an edge-triggered manager
+	// reads until there's nothing left
+	SetBlocking(false);
 
 	/***
 	// Here's how to find the host address of the connection. It is very slow, however.
@@ -141,12 +159,19 @@ NetSocket::~NetSocket()
 		closesocket(m_sock);
 		m_sock = INVALID_SOCKET;
 	}
+
+	// packets still holding on to it keep it going until they're done
+	if (m_pRecvBuffer)
+	{
+		m_pRecvBuffer->Release();
+		m_pRecvBuffer = NULL;
+	}
 }
 
 //
 // NetSocket::Connect							- Chapter 19, page 669
 //
-bool NetSocket::Connect(unsigned int ip, unsigned int port, bool forceCoalesce)
+bool NetSocket::Connect(unsigned int ip, unsigned int port, bool forceCoalesce, bool wait)
 {
 	struct sockaddr_in sa;
 	int x = 1;
@@ -165,8 +190,18 @@ bool NetSocket::Connect(unsigned int ip, unsigned int port, bool forceCoalesce)
 	sa.sin_addr.s_addr = htonl(ip);
 	sa.sin_port = htons(port);
 
+	if (!wait) {
+		SetBlocking(false);
+	}
+
 	if (connect(m_sock, (struct sockaddr*)&sa, sizeof(sa)))
 	{
+		if (!wait && Nv_SocketConnectPending(Nv_GetSocketError()))
+		{
+			m_bConnecting = true;
+			return true;
+		}
+
 		closesocket(m_sock);
 		m_sock = INVALID_SOCKET;
 		return false;
@@ -175,6 +210,22 @@ bool NetSocket::Connect(unsigned int ip, unsigned int port, bool forceCoalesce)
 	return true;
 }
 
+//
+// NetSocket::FinishConnect						- not described in the book
+//
+// Called once a socket with a connect in progress turns writable (or reports an error).
+//
+void NetSocket::FinishConnect()
+{
+	m_bConnecting = false;
+
+	int error = 0;
+	socklen_t size = sizeof(error);
+	if (getsockopt(m_sock, SOL_SOCKET, SO_ERROR, (char*)&error, &size) == SOCKET_ERROR || error != 0) {
+		HandleException();
+	}
+}
+
 //
 // NetSocket::Send								- Chapter 19, page 670
 //
@@ -210,68 +261,138 @@ void NetSocket::SetBlocking(bool blocking)
 //
 // NetSocket::VHandleOutput						- Chapter 19, page 670
 //
+// Not as described in the book: rather than a send() per packet, the queued packets are gathered into
+// one call, and packets that sit side by side in a PacketBuffer go as a single piece.
+//
 void NetSocket::VHandleOutput()
 {
-	int fSent = 0;
-	do
+	while (!m_OutList.empty())
 	{
-		//Nv_ASSERT(!m_OutList.empty());
-		PacketList::iterator i = m_OutList.begin();
+		SocketSendBuffer buffers[MAX_SEND_BUFFERS_PER_CALL];
+		unsigned int count = 0;
+		const char* pStart = NULL;
+		const char* pEnd = NULL;
+		int total = 0;
+
+		int ofs = m_sendOfs;
+		for (PacketList::iterator i = m_OutList.begin(); i != m_OutList.end(); ++i)
+		{
+			const char* buf = (*i)->VGetData();
+			const char* bufEnd = buf + (*i)->VGetSize();
+			buf += ofs;
+			ofs = 0;
 
-		std::shared_ptr<IPacket> pkt = *i;
-		const char* buf = pkt->VGetData();
-		int len = static_cast<int>(pkt->VGetSize());
+			if (pStart && buf == pEnd)
+			{
+				// right behind the last one in the same buffer
+				total += static_cast<int>(bufEnd - buf);
+				pEnd = bufEnd;
+				continue;
+			}
 
-		int rc = send(m_sock, buf + m_sendOfs, len - m_sendOfs, 0);
-		if (rc > 0)
-		{
-			g_pSocketManager->AddToOutbound(rc);
-			m_sendOfs += rc;
-			fSent = 1;
+			if (pStart)
+			{
+				Nv_SetSendBuffer(buffers[count++], pStart, pEnd - pStart);
+				pStart = NULL;
+				if (count == MAX_SEND_BUFFERS_PER_CALL) {
+					break;
+				}
+			}
+
+			total += static_cast<int>(bufEnd - buf);
+			pStart = buf;
+			pEnd = bufEnd;
+		}
+
+		if (pStart) {
+			Nv_SetSendBuffer(buffers[count++], pStart, pEnd - pStart);
 		}
-		else if (WSAGetLastError() != WSAEWOULDBLOCK)
+
+		int rc = Nv_SendGather(m_sock, buffers, count);
+		if (rc == SOCKET_ERROR)
 		{
-			HandleException();
-			fSent = 0;
+			if (Nv_SocketWouldBlock(Nv_GetSocketError())) {
+				m_bWriteBlocked = true;
+			}
+			else {
+				HandleException();
+			}
+			return;
 		}
-		else
+
+		if (rc == 0 && total > 0)
 		{
-			fSent = 0;
+			m_bWriteBlocked = true;
+			return;
 		}
 
-		if (m_sendOfs == pkt->VGetSize())
+		g_pSocketManager->AddToOutbound(rc);
+
+		// take off whatever went - the last packet may only have gone part of the way
+		while (!m_OutList.empty())
 		{
+			int left = static_cast<int>(m_OutList.front()->VGetSize()) - m_sendOfs;
+			if (rc < left)
+			{
+				m_sendOfs += rc;
+				break;
+			}
+
+			rc -= left;
 			m_OutList.pop_front();
 			m_sendOfs = 0;
 		}
-	} while (fSent && !m_OutList.empty());
+	}
 }
 
 //
 // NetSocket::VHandleInput						- Chapter 19. page 671 
 //
+// Binary packets aren't copied out of the receive buffer; the packets put on m_InList are PooledPackets
+// pointing into it.
+//
 void NetSocket::VHandleInput()
 {
-	bool bPktReceived = false;
-	u_long packetSize = 0;
-	int rc = recv(m_sock, m_recvBuf + m_recvBegin + m_recvOfs, RECV_BUFFER_SIZE - (m_recvBegin + m_recvOfs), 0);
+	PacketSize packetSize = 0;
+	m_bMoreInput = false;
 
-	char metrics[1024];
-	sprintf_s(metrics, 1024, "Incoming: %6d bytes. Begin %6d Offset %4d\n", rc, m_recvBegin, m_recvOfs);
+	if (!PrepareRecvBuffer())
+	{
+		HandleException();
+		return;
+	}
+
+	char* recvBuf = m_pRecvBuffer->GetData();
+	int rc = recv(m_sock, recvBuf + m_recvBegin + m_recvOfs, RECV_BUFFER_SIZE - (m_recvBegin + m_recvOfs), 0);
+
+	//char metrics[1024];
+	//sprintf_s(metrics, 1024, "Incoming: %6d bytes. Begin %6d Offset %4d\n", rc, m_recvBegin, m_recvOfs);
 	//Nv_LOG("Network", metrics);
 
 	if (rc == 0)
 	{
+		// the other end closed the connection
+		HandleException();
 		return;
 	}
 
 	if (rc == SOCKET_ERROR)
 	{
-		m_deleteFlag = 1;
+		if (!Nv_SocketWouldBlock(Nv_GetSocketError())) {
+			m_deleteFlag = 1;
+		}
+		else if (m_recvOfs == 0)
+		{
+			// drained, with nothing left over - no need to hang on to the buffer until more turns up
+			m_pRecvBuffer->Release();
+			m_pRecvBuffer = NULL;
+		}
 		return;
 	}
 
-	const int hdrSize = sizeof(u_long);
+	m_bMoreInput = true;
+
+	const int hdrSize = sizeof(PacketSize);
 	unsigned int newData = m_recvOfs + rc;
 	int processedData = 0;
 
@@ -281,53 +402,47 @@ void NetSocket::VHandleInput()
 		// BinaryPacket - Sends the size as a positive 4 byte integer.
 		// TextPacket - Sends 0 for the size, the parser will search for a CR
 
-		packetSize = *(reinterpret_cast<u_long*>(m_recvBuf + m_recvBegin));
+		memcpy(&packetSize, recvBuf + m_recvBegin, sizeof(packetSize));		// may not be aligned
 		packetSize = ntohl(packetSize);
 
 		if (m_bBinaryProtocol)
 		{
-			// we don't have enough new data to grab the next packet
-			if (newData < packetSize) {
-				break;
-			}
-			
-			if (packetSize > MAX_PACKET_SIZE)
+			if (packetSize > MAX_PACKET_SIZE || packetSize < (PacketSize)hdrSize)
 			{
 				// prevent nasty buffer overruns!
 				HandleException();
 				return;
 			}
 
-			if (newData >= packetSize)
-			{
-				// we know how big the packet is... and we have the whole thing
-				//
-				// [mrmike] - a little code to aid debugging network packets here!
-				//char test[1024];
-				//memcpy(test, &m_recvBuf[m_recvBegin+hdrSize], packetSize);
-				//test[packetSize+1] = '\r';
-				//test[packetSize+2] = '\n';
-				//test[packetSize+3] = 0;
-				//Nv_LOG("Network", test);
-				std::shared_ptr<BinaryPacket> pkt(Nv_NEW BinaryPacket(&m_recvBuf[m_recvBegin + hdrSize], packetSize - hdrSize));
-				m_InList.push_back(pkt);
-				bPktReceived = true;
-				processedData += packetSize;
-				newData -= packetSize;
-				m_recvBegin += packetSize;
+			// we don't have enough new data to grab the next packet
+			if (newData < packetSize) {
+				break;
 			}
+
+			// we know how big the packet is... and we have the whole thing
+			//
+			// [mrmike] - a little code to aid debugging network packets here!
+			//char test[1024];
+			//memcpy(test, &recvBuf[m_recvBegin+hdrSize], packetSize);
+			//test[packetSize+1] = '\r';
+			//test[packetSize+2] = '\n';
+			//test[packetSize+3] = 0;
+			//Nv_LOG("Network", test);
+			m_InList.push_back(MakePooledPacket(m_pRecvBuffer, m_recvBegin));
+			processedData += packetSize;
+			newData -= packetSize;
+			m_recvBegin += packetSize;
 		}
 		else
 		{
 			// the text protocol waits for a carriage return and creates a string
-			char* cr = static_cast<char*>(memchr(&m_recvBuf[m_recvBegin], 0x0a, rc));
+			char* cr = static_cast<char*>(memchr(&recvBuf[m_recvBegin], 0x0a, rc));
 			if (cr)
 			{
 				*(cr + 1) = 0;
-				std::shared_ptr<TextPacket> pkt(Nv_NEW TextPacket(&m_recvBuf[m_recvBegin]));
+				std::shared_ptr<TextPacket> pkt(Nv_NEW TextPacket(&recvBuf[m_recvBegin]));
 				m_InList.push_back(pkt);
-				packetSize = cr - &m_recvBuf[m_recvBegin];
-				bPktReceived = true;
+				packetSize = cr - &recvBuf[m_recvBegin];
 
 				processedData += packetSize;
 				newData -= packetSize;
@@ -338,22 +453,54 @@ void NetSocket::VHandleInput()
 
 	g_pSocketManager->AddToInbound(rc);
 	m_recvOfs = newData;
+}
 
-	if (bPktReceived)
+//
+// NetSocket::PrepareRecvBuffer					- not described in the book
+//
+// Makes sure there's a receive buffer with room for at least a whole packet behind what's already in it,
+// without writing over anything a PooledPacket still points at.
+//
+bool NetSocket::PrepareRecvBuffer()
+{
+	if (!m_pRecvBuffer)
 	{
-		if (m_recvOfs == 0)
-		{
-			m_recvBegin = 0;
-		}
-		else if (m_recvBegin + m_recvOfs + MAX_PACKET_SIZE > RECV_BUFFER_SIZE)
-		{
-			// we don't want to overrun the buffer - so we copy the leftover bits
-			// to the beginning of the received buffer and start over
-			int leftover = m_recvOfs;
-			memcpy(m_recvBuf, &m_recvBuf[m_recvBegin], m_recvOfs);
-			m_recvBegin = 0;
+		m_pRecvBuffer = PacketBuffer::Create(RECV_BUFFER_SIZE);
+		m_recvBegin = 0;
+		m_recvOfs = 0;
+		return m_pRecvBuffer != NULL;
+	}
+
+	// The packets handed out last time have usually been dealt with and let go by now. If so, and there's
+	// no partial packet to keep, start again at the front while the buffer is still in the cache.
+	if (m_recvOfs == 0 && !m_pRecvBuffer->IsShared()) {
+		m_recvBegin = 0;
+	}
+
+	if (m_recvBegin == 0 || m_recvBegin + m_recvOfs + MAX_PACKET_SIZE <= RECV_BUFFER_SIZE) {
+		return true;
+	}
+
+	// we don't want to overrun the buffer - so the leftover bits of a partial packet go to the
+	// beginning of a buffer and we start over
+	if (m_pRecvBuffer->IsShared())
+	{
+		// packets received earlier still point into this one, so it can't be written over
+		PacketBuffer* pBuffer = PacketBuffer::Create(RECV_BUFFER_SIZE);
+		if (!pBuffer) {
+			return false;
 		}
+
+		memcpy(pBuffer->GetData(), m_pRecvBuffer->GetData() + m_recvBegin, m_recvOfs);
+		m_pRecvBuffer->Release();
+		m_pRecvBuffer = pBuffer;
 	}
+	else
+	{
+		memmove(m_pRecvBuffer->GetData(), m_pRecvBuffer->GetData() + m_recvBegin, m_recvOfs);
+	}
+	m_recvBegin = 0;
+	return true;
 }
 
 // ----------------------------------------------------------------------------
@@ -389,7 +536,7 @@ void NetListenSocket::Init(int portnum)
 
 	memset(&sa, 0, sizeof(sa));
 	sa.sin_family = AF_INET;
-	sa.sin_addr.s_addr = ADDR_ANY;
+	sa.sin_addr.s_addr = htonl(INADDR_ANY);
 	sa.sin_port = htons(portnum);
 
 	// bind to port
@@ -479,7 +626,7 @@ SOCKET NetListenSocket::AcceptConnection(unsigned int* pAddr)
 {
 	SOCKET new_sock;
 	struct sockaddr_in sock;
-	int size = sizeof(sock);
+	socklen_t size = sizeof(sock);
 
 	if ((new_sock = accept(m_sock, (struct sockaddr*)&sock, &size)) == INVALID_SOCKET)
 	{
@@ -508,7 +655,9 @@ BaseSocketManager::BaseSocketManager()
 	m_NextSocketId = 0;
 
 	g_pSocketManager = this;
+#ifdef _WIN32
 	ZeroMemory(&m_WsaData, sizeof(WSADATA));
+#endif
 }
 
 //
@@ -516,6 +665,7 @@ BaseSocketManager::BaseSocketManager()
 //
 bool BaseSocketManager::Init()
 {
+#ifdef _WIN32
 	if (WSAStartup(0x0202, &m_WsaData) == 0)
 	{
 		return true;
@@ -525,6 +675,9 @@ bool BaseSocketManager::Init()
 		//Nv_ERROR("WSAStartup failure!");
 		return false;
 	}
+#else
+	return true;
+#endif
 }
 
 //
@@ -535,11 +688,15 @@ void BaseSocketManager::Shutdown()
 	// Get rid of all those pesky kids
 	while (!m_SockList.empty())
 	{
+		VUnwatchSocket(*m_SockList.begin());
 		delete *m_SockList.begin();
 		m_SockList.pop_front();
 	}
+	m_SockMap.clear();
 
+#ifdef _WIN32
 	WSACleanup();
+#endif
 }
 
 //
@@ -557,6 +714,8 @@ int BaseSocketManager::AddSocket(NetSocket* socket)
 		++m_MaxOpenSockets;
 	}
 
+	VWatchSocket(socket);
+
 	return socket->m_id;
 }
 
@@ -567,6 +726,7 @@ int BaseSocketManager::AddSocket(NetSocket* socket)
 //
 void BaseSocketManager::RemoveSocket(NetSocket* socket)
 {
+	VUnwatchSocket(socket);
 	m_SockList.remove(socket);
 	m_SockMap.erase(socket->m_id);
 	SAFE_DELETE(socket);
@@ -608,6 +768,7 @@ bool BaseSocketManager::Send(int sockId, std::shared_ptr<IPacket> packet)
 		return false;
 	}
 	sock->Send(packet);
+	VOnOutputQueued(sock);
 	return true;
 }
 
@@ -615,6 +776,62 @@ bool BaseSocketManager::Send(int sockId, std::shared_ptr<IPacket> packet)
 // BaseSocketManager::DoSelect				- Chapter 19, page 679
 //
 void BaseSocketManager::DoSelect(int pauseMicroSecs, bool handleInput)
+{
+	Nv_MEMORY_TAG_SCOPE(MEMTAG_NETWORK);
+
+	VPoll(pauseMicroSecs, handleInput);
+
+	unsigned int timeNow = timeGetTime();
+
+	// update and time out the sockets, and handle deleting any
+	SocketList::iterator i = m_SockList.begin();
+	while (i != m_SockList.end())
+	{
+		NetSocket* pSock = *i;
+		SocketList::iterator next = i;
+		++next;
+
+		if (!(pSock->m_deleteFlag & 1)) {
+			pSock->VUpdate(timeNow);
+		}
+
+		if (pSock->m_timeOut)
+		{
+			if (pSock->m_timeOut < timeNow)
+			{
+				pSock->VTimeOut();
+			}
+		}
+
+		if (pSock->m_deleteFlag & 1)
+		{
+			switch (pSock->m_deleteFlag)
+			{
+				case 1:
+					g_pSocketManager->RemoveSocket(pSock);
+					break;
+				case 3:
+					pSock->m_deleteFlag = 2;
+					if (pSock->m_sock != INVALID_SOCKET)
+					{
+						VUnwatchSocket(pSock);
+						closesocket(pSock->m_sock);
+						pSock->m_sock = INVALID_SOCKET;
+					}
+					break;
+			}
+		}
+
+		i = next;
+	}
+}
+
+//
+// BaseSocketManager::VPoll					- Chapter 19, page 679
+//
+// This is the select() half of DoSelect() from the book.
+//
+void BaseSocketManager::VPoll(int pauseMicroSecs, bool handleInput)
 {
 	timeval tv;
 	tv.tv_sec = 0;
@@ -638,13 +855,14 @@ void BaseSocketManager::DoSelect(int pauseMicroSecs, bool handleInput)
 			continue;
 		}
 
-		if (handleInput) {
+		if (handleInput && !pSock->m_bConnecting) {
 			FD_SET(pSock->m_sock, &inp_set);
 		}
 
 		FD_SET(pSock->m_sock, &exc_set);
 
-		if (pSock->VHasOutput()) {
+		// a connect finishing shows up as the socket turning writable
+		if (pSock->VHasOutput() || pSock->m_bConnecting) {
 			FD_SET(pSock->m_sock, &out_set);
 		}
 
@@ -676,6 +894,14 @@ void BaseSocketManager::DoSelect(int pauseMicroSecs, bool handleInput)
 				continue;
 			}
 
+			if (pSock->m_bConnecting)
+			{
+				if (FD_ISSET(pSock->m_sock, &out_set) || FD_ISSET(pSock->m_sock, &exc_set)) {
+					pSock->FinishConnect();
+				}
+				continue;
+			}
+
 			if (FD_ISSET(pSock->m_sock, &exc_set))
 			{
 				pSock->HandleException();
@@ -693,44 +919,6 @@ void BaseSocketManager::DoSelect(int pauseMicroSecs, bool handleInput)
 			}
 		}
 	}
-
-	unsigned int timeNow = timeGetTime();
-
-	// handle deleting any sockets
-	SocketList::iterator i = m_SockList.begin();
-	while (i != m_SockList.end())
-	{
-		NetSocket* pSock = *i;
-		if (pSock->m_timeOut)
-		{
-			if (pSock->m_timeOut < timeNow)
-			{
-				pSock->VTimeOut();
-			}
-		}
-
-		if (pSock->m_deleteFlag & 1)
-		{
-			switch (pSock->m_deleteFlag)
-			{
-				case 1:
-					g_pSocketManager->RemoveSocket(pSock);
-					i = m_SockList.begin();
-					break;
-				case 3:
-					pSock->m_deleteFlag = 2;
-					if (pSock->m_sock != INVALID_SOCKET)
-					{
-						closesocket(pSock->m_sock);
-						pSock->m_sock = INVALID_SOCKET;
-					}
-					break;
-			}
-		}
-
-		++i;
-
-	}
 }
 
 //
@@ -780,7 +968,8 @@ const char* BaseSocketManager::GetHostByAddr(unsigned int ip)
 
 	if (lpHostEnt)
 	{
-		strcpy_s(host, 256, lpHostEnt->h_name);
+		strncpy(host, lpHostEnt->h_name, sizeof(host) - 1);
+		host[sizeof(host) - 1] = 0;
 		return host;
 	}
 	return NULL;
@@ -788,9 +977,10 @@ const char* BaseSocketManager::GetHostByAddr(unsigned int ip)
 
 void BaseSocketManager::PrintError()
 {
-	int realError = WSAGetLastError();
+	int realError = Nv_GetSocketError();
 	const char* reason;
 
+#ifdef _WIN32
 	switch (realError)
 	{
 		case WSANOTINITIALISED: 
@@ -817,6 +1007,9 @@ void BaseSocketManager::PrintError()
 		default:
 			reason = "Unknown.";
 	}
+#else
+	reason = strerror(realError);
+#endif
 
 	char buffer[256];
 	sprintf(buffer, "SOCKET error: %s", reason);
@@ -850,13 +1043,11 @@ bool ClientSocketManager::Connect()
 //
 void GameServerListenSocket::VHandleInput()
 {
+	// The listen socket is non-blocking, so take everyone who is waiting - an edge-triggered manager
+	// won't say so again until somebody new turns up.
 	unsigned int theipaddr;
-	SOCKET new_sock = AcceptConnection(&theipaddr);
-
-	int value = 1;
-	setsockopt(new_sock, SOL_SOCKET, SO_DONTLINGER, (char*)&value, sizeof(value));
-
-	if (new_sock != INVALID_SOCKET)
+	SOCKET new_sock;
+	while ((new_sock = AcceptConnection(&theipaddr)) != INVALID_SOCKET)
 	{
 		RemoteEventSocket* sock = Nv_NEW RemoteEventSocket(new_sock, theipaddr);
 		int sockId = g_pSocketManager->AddSocket(sock);
@@ -883,20 +1074,38 @@ void RemoteEventSocket::VHandleInput()
 			const char* buf = packet->VGetData();
 			int size = static_cast<int>(packet->VGetSize());
 
-			std::istrstream in(buf + sizeof(u_long), (size - sizeof(u_long)));
+			if (size > (int)sizeof(PacketSize) && (unsigned char)buf[sizeof(PacketSize)] == BINARY_EVENT_MESSAGE_TAG)
+			{
+				CreateBinaryEvent(buf + sizeof(PacketSize), size - sizeof(PacketSize), &m_deltaCache);
+				continue;
+			}
+
+			std::istrstream in(buf + sizeof(PacketSize), (size - sizeof(PacketSize)));
 
 			int type;
 			in >> type;
 			switch (type)
 			{
 				case NetMsg_Event:
+					CreateEvent(in);
+					break;
 
 				case NetMsg_PlayerLoginOk:
 				{
 					int serverSockId, actorId;
+					unsigned int udpToken = 0;
 					in >> serverSockId;
 					in >> actorId;
+					in >> udpToken;
 					in >> g_pApp->m_Options.m_Level;			// [mrmike] - This was the best spot to set the level!
+
+					// the server sends snapshots if it gave us a token for them, on its TCP port number
+					if (udpToken && g_pApp->m_pGame)
+					{
+						unsigned int serverIp = g_pSocketManager->GetHostByName(g_pApp->m_Options.m_gameHost);
+						g_pApp->m_pGame->StartSnapshotClient(serverIp, (unsigned short)g_pApp->m_Options.m_listenPort, udpToken);
+					}
+
 					std::shared_ptr<EvtData_Network_Player_Actor_Assignment> pEvent(Nv_NEW EvtData_Network_Player_Actor_Assignment(actorId, serverSockId));
 					IEventManager::Get()->VQueueEvent(pEvent);
 					break;
@@ -904,12 +1113,12 @@ void RemoteEventSocket::VHandleInput()
 
 				default:
 					//Nv_ERROR("Unknown message type.");
-
+					break;
 			}
 		}
 		else if (!strcmp(packet->VGetType(), TextPacket::g_Type))
 		{
-			//Nv_LOG("Network", packet->VGetData() + sizeof(u_long));
+			//Nv_LOG("Network", packet->VGetData() + sizeof(PacketSize));
 		}
 	}
 }
@@ -936,21 +1145,199 @@ void RemoteEventSocket::CreateEvent(std::istrstream& in)
 	}
 }
 
+//
+// RemoteEventSocket::CreateBinaryEvent					- not described in the book
+//
+void RemoteEventSocket::CreateBinaryEvent(const char* pData, size_t size, EventDeltaCache* pDeltaCache)
+{
+	BinaryReader in(pData, size, pDeltaCache);
+	in.ReadU8();									// BINARY_EVENT_MESSAGE_TAG
+	EventType eventType = in.ReadVarUInt();
+
+	IEventDataPtr pEvent(CREATE_EVENT(eventType));
+	if (pEvent)
+	{
+		if (pEvent->VDeserializeBinary(in) && !in.Failed()) {
+			IEventManager::Get()->VQueueEvent(pEvent);
+		}
+		else {
+			//Nv_ERROR("ERROR Malformed binary event from remote: 0x" + ToStr(eventType, 16));
+		}
+	}
+	else
+	{
+		//Nv_ERROR("ERROR Unknown event type from remote: 0x" + ToStr(eventType, 16));
+	}
+}
+
+NetworkEventForwarder::NetworkEventForwarder(int sockId, bool textEvents)
+{
+	m_SockId = sockId;
+	m_textEvents = textEvents;
+	m_pSendBuffer = NULL;
+	m_sendUsed = 0;
+	m_pUdpSocket = NULL;
+	m_udpToken = 0;
+	m_udpConnId = INVALID_SOCKET_ID;
+}
+
 //
 // NetworkEventForwarder::ForwardEvent					- Chapter 19, page 690
 //
 void NetworkEventForwarder::ForwardEvent(IEventDataPtr pEventData)
 {
+	if (m_pUdpSocket && !m_textEvents && ForwardEventUdp(pEventData)) {
+		return;
+	}
+
+	// Serialize straight into the send buffer, leaving room in front for the packet's size. Anything
+	// too big for what's left of it goes through the heap and takes a copy.
+	unsigned int room = 0;
+	char* pBuffer = PrepareSendBuffer(room);
+
+	if (!m_textEvents)
+	{
+		BinaryWriter out(pBuffer, room, &m_deltaCache);
+		out.WriteU8(BINARY_EVENT_MESSAGE_TAG);
+		out.WriteVarUInt((unsigned int)pEventData->VGetEventType());
+		if (pEventData->VSerializeBinary(out))
+		{
+			if (pBuffer && out.GetData() == pBuffer) {
+				SendFromBuffer((PacketSize)out.GetSize());
+			}
+			else {
+				g_pSocketManager->Send(m_SockId, std::shared_ptr<BinaryPacket>(Nv_NEW BinaryPacket(out.GetData(), (PacketSize)out.GetSize())));
+			}
+			return;
+		}
+
+		// no binary codec for this one, it goes as text
+	}
+
+	if (pBuffer)
+	{
+		std::ostrstream out(pBuffer, room);
+		WriteEventMessage(out, pEventData);
+		if (!out.fail())
+		{
+			SendFromBuffer((PacketSize)out.pcount());
+			return;
+		}
+	}
+
+	// too big for the buffer
 	std::ostrstream out;
+	WriteEventMessage(out, pEventData);
+
+	std::shared_ptr<BinaryPacket> eventMsg(Nv_NEW BinaryPacket(out.rdbuf()->str(), (PacketSize)out.pcount()));
+	out.freeze(false);
+
+	g_pSocketManager->Send(m_SockId, eventMsg);
+}
+
+//
+// NetworkEventForwarder::ForwardEventUdp				- not described in the book
+//
+// Returns false when the event has to go over TCP after all.
+//
+bool NetworkEventForwarder::ForwardEventUdp(IEventDataPtr pEventData)
+{
+	EventChannelMap::iterator findIt = m_eventChannels.find(pEventData->VGetEventType());
+	if (findIt == m_eventChannels.end()) {
+		return false;
+	}
 
+	int connId = m_pUdpSocket->FindConnectionByToken(m_udpToken);
+	if (connId == INVALID_SOCKET_ID) {
+		return false;
+	}
+
+	if (connId != m_udpConnId)
+	{
+		// the other end of a new connection has nothing to take deltas from
+		m_udpConnId = connId;
+		m_udpDeltaCache.Clear();
+	}
+
+	UdpChannel channel = findIt->second;
+	EventDeltaCache* pDeltaCache = (channel == UdpChannel_ReliableOrdered) ? &m_udpDeltaCache : NULL;
+
+	char buffer[UDP_MAX_MESSAGE_SIZE];
+	BinaryWriter out(buffer, sizeof(buffer), pDeltaCache);
+	out.WriteU8(BINARY_EVENT_MESSAGE_TAG);
+	out.WriteVarUInt((unsigned int)pEventData->VGetEventType());
+	if (!pEventData->VSerializeBinary(out)) {
+		return false;
+	}
+
+	if (!m_pUdpSocket->Send(connId, channel, out.GetData(), (unsigned int)out.GetSize()))
+	{
+		// The cache has been told about something that never went. Forgetting everything costs a few
+		// whole transforms but keeps the two ends agreeing.
+		if (pDeltaCache) {
+			pDeltaCache->Clear();
+		}
+		return false;
+	}
+	return true;
+}
+
+//
+// NetworkEventForwarder::PrepareSendBuffer				- not described in the book
+//
+// Returns where the next event can be serialized to, and how much room there is.
+//
+char* NetworkEventForwarder::PrepareSendBuffer(unsigned int& room)
+{
+	// once the packets sent from it have all gone out it can be reused from the front
+	if (m_pSendBuffer && !m_pSendBuffer->IsShared()) {
+		m_sendUsed = 0;
+	}
+
+	// a packet the other end will take has to fit
+	if (m_pSendBuffer && m_sendUsed + MAX_PACKET_SIZE > m_pSendBuffer->GetCapacity())
+	{
+		m_pSendBuffer->Release();
+		m_pSendBuffer = NULL;
+	}
+
+	if (!m_pSendBuffer)
+	{
+		m_pSendBuffer = PacketBuffer::Create(NETWORK_SEND_BUFFER_SIZE);
+		m_sendUsed = 0;
+		if (!m_pSendBuffer)
+		{
+			room = 0;
+			return NULL;
+		}
+	}
+
+	room = m_pSendBuffer->GetCapacity() - m_sendUsed - sizeof(PacketSize);
+	return m_pSendBuffer->GetData() + m_sendUsed + sizeof(PacketSize);
+}
+
+//
+// NetworkEventForwarder::SendFromBuffer				- not described in the book
+//
+// Sends the size bytes just serialized at the end of the send buffer.
+//
+void NetworkEventForwarder::SendFromBuffer(PacketSize size)
+{
+	PacketSize header = htonl(size + sizeof(PacketSize));
+	memcpy(m_pSendBuffer->GetData() + m_sendUsed, &header, sizeof(header));
+
+	std::shared_ptr<PooledPacket> pPacket = MakePooledPacket(m_pSendBuffer, m_sendUsed);
+	m_sendUsed += size + sizeof(PacketSize);
+
+	g_pSocketManager->Send(m_SockId, pPacket);
+}
+
+void NetworkEventForwarder::WriteEventMessage(std::ostrstream& out, IEventDataPtr pEventData)
+{
 	out << static_cast<int>(RemoteEventSocket::NetMsg_Event) << " ";
 	out << pEventData->VGetEventType() << " ";
 	pEventData->VSerialize(out);
 	out << "\r\n";
-
-	std::shared_ptr<BinaryPacket> eventMsg(Nv_NEW BinaryPacket(out.rdbuf()->str(), (u_long)out.pcount()));
-
-	g_pSocketManager->Send(m_SockId, eventMsg);
 }
 
 //
@@ -960,9 +1347,21 @@ NetworkGameView::NetworkGameView()
 {
 	m_SockId = INVALID_SOCKET_ID;
 	m_ActorId = INVALID_ACTOR_ID;
+	m_udpToken = 0;
 	IEventManager::Get()->VAddListener(fastdelegate::MakeDelegate(this, &NetworkGameView::NewActorDelegate), EvtData_New_Actor::sk_EventType);
 }
 
+NetworkGameView::~NetworkGameView()
+{
+	// the game logic outlives its views, but may have stopped its snapshots already
+	BaseAppLogic* pGame = g_pApp->m_pGame;
+	if (m_udpToken && pGame && pGame->GetSnapshotReplicator())
+	{
+		pGame->GetSnapshotReplicator()->RemoveClient(m_udpToken);
+		pGame->GetSnapshotSocket()->RevokeToken(m_udpToken);
+	}
+}
+
 //
 // NetworkGameView::AttachRemotePlayer				- Chapter 19, page 692
 //
@@ -974,15 +1373,23 @@ void NetworkGameView::AttachRemotePlayer(int sockID)
 	// which is how each client can be uniquely identified from other
 	// clients attached to the server.
 
+	SnapshotReplicator* pReplicator = g_pApp->m_pGame ? g_pApp->m_pGame->GetSnapshotReplicator() : NULL;
+	if (pReplicator)
+	{
+		m_udpToken = g_pApp->m_pGame->GetSnapshotSocket()->IssueToken();
+		pReplicator->AddClient(m_udpToken, m_ActorId);
+	}
+
 	std::ostrstream out;
 
 	out << static_cast<int>(RemoteEventSocket::NetMsg_PlayerLoginOk) << " ";
 	out << m_SockId << " ";
 	out << m_ActorId << " ";
+	out << m_udpToken << " ";
 	out << g_pApp->m_Options.m_Level << " ";
 	out << "\r\n";
 
-	std::shared_ptr<BinaryPacket> gvidMsg(Nv_NEW BinaryPacket(out.rdbuf()->str(), (u_long)out.pcount()));
+	std::shared_ptr<BinaryPacket> gvidMsg(Nv_NEW BinaryPacket(out.rdbuf()->str(), (PacketSize)out.pcount()));
 	g_pSocketManager->Send(m_SockId, gvidMsg);
 }
 
@@ -1016,6 +1423,9 @@ void NetworkGameView::NewActorDelegate(IEventDataPtr pEventData)
 		if (pCastEventData->GetViewId() == m_ViewId)
 		{
 			m_ActorId = actorId;
+			if (m_udpToken && g_pApp->m_pGame->GetSnapshotReplicator()) {
+				g_pApp->m_pGame->GetSnapshotReplicator()->SetViewer(m_udpToken, m_ActorId);
+			}
 			std::shared_ptr<EvtData_Network_Player_Actor_Assignment> pEvent(Nv_NEW EvtData_Network_Player_Actor_Assignment(m_ActorId, m_SockId));
 			IEventManager::Get()->VQueueEvent(pEvent);
 		}
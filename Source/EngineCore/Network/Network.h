@@ -4,21 +4,28 @@
 // Network.h : The core classes for creating a multiplayer game
 // ================================================================
 
-#include <sys/types.h>
-#include <Winsock2.h>
+#include "SocketPlatform.h"
+#include "PacketBuffer.h"
 #include "../EventManager/EventManager.h"
+#include "../EventManager/EventCodec.h"
 
 
 #define MAX_PACKET_SIZE (256)
-#define RECV_BUFFER_SIZE (MAX_PACKET_SIZE * 512)
+#define RECV_BUFFER_SIZE (MAX_PACKET_SIZE * 128)		// the PacketBuffer a socket receives into
 #define MAX_QUEUE_PER_PLAYER (10000)
+#define NETWORK_SEND_BUFFER_SIZE (4 * 1024)			// the PacketBuffer a NetworkEventForwarder serializes into
+#define MAX_SEND_BUFFERS_PER_CALL (64)				// packets VHandleOutput() gathers into one send
 
 #define MAGIC_NUMBER		( 0x1f2e3d4c)
+#define BINARY_EVENT_MESSAGE_TAG (0xbe)				// first byte of a binary event message - text messages always start with a digit
 #define IPMANGLE(a,b,c,d) (((a)<<24)|((b)<<16)|((c)<<8)|((d)))
 #define INVALID_SOCKET_ID (-1)
 
 class NetSocket;
 
+// The length at the front of every packet. It's four bytes on the wire whatever size u_long is on the platform.
+typedef unsigned int PacketSize;
+
 // ------------------------------------------------
 //
 // IPacket Description
@@ -35,7 +42,7 @@ class IPacket
 public:
 	virtual char const* const VGetType() const = 0;
 	virtual char const* const VGetData() const = 0;
-	virtual u_long VGetSize() const = 0;
+	virtual PacketSize VGetSize() const = 0;
 	virtual ~IPacket() { }
 };
 
@@ -54,12 +61,12 @@ protected:
 	char* m_Data;
 
 public:
-	inline BinaryPacket(char const* const data, u_long size);
-	inline BinaryPacket(u_long size);
-	virtual ~BinaryPacket() { SAFE_DELETE(m_Data); }
+	inline BinaryPacket(char const* const data, PacketSize size);
+	inline BinaryPacket(PacketSize size);
+	virtual ~BinaryPacket() { SAFE_DELETE_ARRAY(m_Data); }
 	virtual char const * const VGetType() const { return g_Type; }
 	virtual char const * const VGetData() const { return m_Data; }
-	virtual u_long VGetSize() const { return ntohl(*(u_long *)m_Data); }
+	virtual PacketSize VGetSize() const { return ntohl(*(PacketSize *)m_Data); }
 	inline void MemCpy(char const * const data, size_t size, int destOffset);
 
 	static const char* g_Type;
@@ -68,19 +75,19 @@ public:
 // ----------------------------------------------------------
 // BinaryPacket::BinaryPacket		  - Chapter 19, page 666
 // ----------------------------------------------------------
-inline BinaryPacket::BinaryPacket(char const* const data, u_long size)
+inline BinaryPacket::BinaryPacket(char const* const data, PacketSize size)
 {
-	m_Data = Nv_NEW char[size + sizeof(u_long)];
+	m_Data = Nv_NEW char[size + sizeof(PacketSize)];
 	//Nv_ASSERT(m_Data);
-	*(u_long*)m_Data = htonl(size + sizeof(u_long));
-	memcpy(m_Data + sizeof(u_long), data, size);
+	*(PacketSize*)m_Data = htonl(size + sizeof(PacketSize));
+	memcpy(m_Data + sizeof(PacketSize), data, size);
 }
 
-inline BinaryPacket::BinaryPacket(u_long size)
+inline BinaryPacket::BinaryPacket(PacketSize size)
 {
-	m_Data = Nv_NEW char[size + sizeof(u_long)];
+	m_Data = Nv_NEW char[size + sizeof(PacketSize)];
 	//Nv_ASSERT(m_Data);
-	*(u_long*)m_Data = htonl(size + sizeof(u_long));
+	*(PacketSize*)m_Data = htonl(size + sizeof(PacketSize));
 }
 
 // ----------------------------------------------------------
@@ -88,8 +95,8 @@ inline BinaryPacket::BinaryPacket(u_long size)
 // ----------------------------------------------------------
 inline void BinaryPacket::MemCpy(char const* const data, size_t size, int destOffset)
 {
-	//Nv_ASSERT(size + destOffset <= VGetSize() - sizeof(u_long));
-	memcpy(m_Data + destOffset + sizeof(u_long), data, size);
+	//Nv_ASSERT(size + destOffset <= VGetSize() - sizeof(PacketSize));
+	memcpy(m_Data + destOffset + sizeof(PacketSize), data, size);
 }
 
 // ----------------------------------------------------------
@@ -107,6 +114,45 @@ public:
 	static const char* g_Type;
 };
 
+// ----------------------------------------------------------
+// PooledPacket Description		  - not described in the book
+//
+// A binary packet that lives in a PacketBuffer along with
+// others, rather than in memory of its own. Received packets
+// point into the buffer the socket received them into, so
+// nothing gets copied on the way in. Make them with
+// MakePooledPacket().
+//
+// ----------------------------------------------------------
+class PooledPacket : public IPacket
+{
+	PacketBuffer* m_pBuffer;
+	unsigned int m_offset;			// of the size at the front of the packet
+
+public:
+	PooledPacket(PacketBuffer* pBuffer, unsigned int offset) { m_pBuffer = pBuffer; m_offset = offset; m_pBuffer->AddRef(); }
+	virtual ~PooledPacket() { m_pBuffer->Release(); }
+
+	// it's a BinaryPacket as far as anyone reading it is concerned
+	virtual char const * const VGetType() const { return BinaryPacket::g_Type; }
+	virtual char const * const VGetData() const { return m_pBuffer->GetData() + m_offset; }
+	inline virtual PacketSize VGetSize() const;
+};
+
+inline PacketSize PooledPacket::VGetSize() const
+{
+	// packets are packed back to back, so the size may not be aligned
+	PacketSize size;
+	memcpy(&size, VGetData(), sizeof(size));
+	return ntohl(size);
+}
+
+// the packet and its shared_ptr control block come from an EventPool together
+inline std::shared_ptr<PooledPacket> MakePooledPacket(PacketBuffer* pBuffer, unsigned int offset)
+{
+	return std::allocate_shared<PooledPacket>(PooledEventAllocator<PooledPacket, PooledPacket>(), pBuffer, offset);
+}
+
 // -------------------------------------------------------------------
 // NetSocket Description						- Chapter 19, page 666
 //
@@ -116,6 +162,7 @@ public:
 class NetSocket
 {
 	friend class BaseSocketManager;
+	friend class EpollSocketManager;
 	typedef std::list<std::shared_ptr<IPacket>> PacketList;
 
 public:
@@ -123,15 +170,21 @@ public:
 	NetSocket(SOCKET new_sock, unsigned int hostIP);
 	virtual ~NetSocket();
 
-	bool Connect(unsigned int ip, unsigned int port, bool foarceCoalesce = 0);
+	// With wait false the connect is started and left to finish in the background - the socket manager
+	// picks up the result once the socket turns writable.
+	bool Connect(unsigned int ip, unsigned int port, bool foarceCoalesce = 0, bool wait = true);
 	void SetBlocking(bool blocking);
 	void Send(std::shared_ptr<IPacket> pkt, bool clearTimeOut = 1);
 
 	virtual int VHasOutput() { return !m_OutList.empty(); }
+	bool IsConnecting() const { return m_bConnecting; }
 	virtual void VHandleOutput();
 	virtual void VHandleInput();
 	virtual void VTimeOut() { m_timeOut = 0; }
 
+	// called from every DoSelect(), for sockets that keep timers of their own
+	virtual void VUpdate(unsigned int timeNow) { }
+
 	void HandleException() { m_deleteFlag |= 1; }
 	
 	void SetTimeOut(unsigned int ms = 45 * 1000) { m_timeOut = timeGetTime() + ms; }
@@ -149,7 +202,7 @@ protected:
 	PacketList m_OutList;			// packets to send
 	PacketList m_InList;			// packets just received
 
-	char m_recvBuf[RECV_BUFFER_SIZE];			// receive buffer
+	PacketBuffer* m_pRecvBuffer;				// receive buffer, shared with the PooledPackets received into it
 	unsigned int m_recvOfs, m_recvBegin;		// tracking the read head of the buffer
 	bool m_bBinaryProtocol;
 
@@ -159,6 +212,16 @@ protected:
 
 	int m_internal;					// is the remote IP internal or external
 	int m_timeCreated;				// when the socket was created
+
+	// for sockets managed edge-triggered, which have to be drained until the OS says there's no more
+	bool m_bMoreInput;				// the last VHandleInput() read something, so there may be more waiting
+	bool m_bWriteBlocked;			// the last send would have blocked; wait for the socket to turn writable
+	bool m_bConnecting;				// a non-blocking connect is still in progress
+
+	void FinishConnect();
+
+private:
+	bool PrepareRecvBuffer();
 };
 
 //
@@ -167,7 +230,9 @@ protected:
 class BaseSocketManager
 {
 protected:
+#ifdef _WIN32
 	WSADATA m_WsaData;
+#endif
 
 	typedef std::list<NetSocket*> SocketList;
 	typedef std::map<int, NetSocket*> SocketIdMap;
@@ -184,6 +249,15 @@ protected:
 
 	NetSocket* FindSocket(int sockId);
 
+	// Waits for and handles socket input, output and exceptions. The default uses select(), which is fine for
+	// a client's couple of sockets; see EpollSocketManager for a server with lots of them. Not described in the book.
+	virtual void VPoll(int pauseMicroSecs, bool handleInput);
+
+	// let a manager that registers sockets with the OS keep track of them
+	virtual void VWatchSocket(NetSocket* pSocket) { }
+	virtual void VUnwatchSocket(NetSocket* pSocket) { }
+	virtual void VOnOutputQueued(NetSocket* pSocket) { }
+
 public:
 	BaseSocketManager();
 	virtual ~BaseSocketManager() { Shutdown(); }
@@ -214,6 +288,8 @@ public:
 
 	void AddToOutbound(int rc) { m_Outbound += rc; }
 	void AddToInbound(int rc) { m_Inbound += rc; }
+	unsigned int GetOutbound(void) const { return m_Outbound; }
+	unsigned int GetInbound(void) const { return m_Inbound; }
 };
 
 extern BaseSocketManager* g_pSocketManager;
@@ -289,10 +365,32 @@ public:
 
 	virtual void VHandleInput();
 
+	// queues the event in a binary event message; UdpEventSocket uses it too
+	static void CreateBinaryEvent(const char* pData, size_t size, EventDeltaCache* pDeltaCache);
+
 protected:
 	void CreateEvent(std::istrstream& in);
+
+	EventDeltaCache m_deltaCache;				// what the other end's NetworkEventForwarder has sent us so far
+};
+
+//
+// enum UdpChannel									- not described in the book
+//
+// How a UdpSocket delivers a message.
+//
+enum UdpChannel
+{
+	UdpChannel_UnreliableSequenced,		// may be lost; anything older than the newest one received is dropped - latest wins
+	UdpChannel_ReliableOrdered,			// always arrives, in the order sent
+	UdpChannel_ReliableUnordered,		// always arrives, as soon as it does
+	UdpChannel_Unreliable,				// may be lost; the rest arrive as they come, in whatever order
+
+	UdpChannel_Count
 };
 
+class UdpSocket;
+
 //
 // class NetworkEventForwarder							- Chapter 19, page 690
 //
@@ -301,18 +399,56 @@ protected:
 // it listens to thes same messages as a game view
 // and sends them along TCP/IP
 //
-class NetworkEventForwarder
+// Events with a binary codec go out in binary, the rest as text. Text can be forced for every event,
+// which is easier to read on the wire while debugging. Both ends of a socket keep delta state for the
+// binary path, so there must be only one forwarder per socket.
+//
+// Events are serialized straight into a PacketBuffer, one after the other, and the packets sent are
+// PooledPackets pointing at them - so there's no copy on the way out, and packets queued together sit
+// side by side for VHandleOutput() to send in one piece.
+//
+// Event types given a UdpChannel go over a UdpSocket instead, once the remote end has connected to
+// it with the token given to SetUdpSocket(); until then they keep going over TCP. Moves are the
+// obvious ones for UdpChannel_UnreliableSequenced - a lost one doesn't hold up the next.
+//
+class NetworkEventForwarder : public Nv_noncopyable
 {
+	typedef std::map<EventType, UdpChannel> EventChannelMap;
+
 public:
-	NetworkEventForwarder(int sockId) { m_SockId = sockId; }
+	NetworkEventForwarder(int sockId, bool textEvents = false);
+	~NetworkEventForwarder() { if (m_pSendBuffer) { m_pSendBuffer->Release(); } }
 
 	// Delegate that forwards events through the network. The game layer must register objects of this class for
 	// the events it wants. See TeapotWarsApp::VCreateGameAndView() and TeapotWarsLogic::RemoteClientDelegate()
 	// for examples of this happening.
 	void ForwardEvent(IEventDataPtr pEventData);
 
+	void SetTextEvents(bool textEvents) { m_textEvents = textEvents; }
+
+	void SetUdpSocket(UdpSocket* pUdpSocket, unsigned int token) { m_pUdpSocket = pUdpSocket; m_udpToken = token; m_udpConnId = INVALID_SOCKET_ID; }
+	void SetEventChannel(EventType eventType, UdpChannel channel) { m_eventChannels[eventType] = channel; }
+	void ClearEventChannel(EventType eventType) { m_eventChannels.erase(eventType); }
+
 protected:
 	int m_SockId;
+	bool m_textEvents;
+	EventDeltaCache m_deltaCache;				// what we've sent the other end so far
+
+	PacketBuffer* m_pSendBuffer;
+	unsigned int m_sendUsed;
+
+	UdpSocket* m_pUdpSocket;
+	unsigned int m_udpToken;
+	int m_udpConnId;							// the connection m_udpDeltaCache is for
+	EventDeltaCache m_udpDeltaCache;			// for UdpChannel_ReliableOrdered
+	EventChannelMap m_eventChannels;
+
+private:
+	bool ForwardEventUdp(IEventDataPtr pEventData);
+	char* PrepareSendBuffer(unsigned int& room);
+	void SendFromBuffer(PacketSize size);
+	static void WriteEventMessage(std::ostrstream& out, IEventDataPtr pEventData);
 };
 
 
@@ -320,6 +456,9 @@ protected:
 //
 // class NetworkGameView					- Chapter 19, page 691
 //
+// If the game logic is sending snapshots, the view gets its remote player a UDP token at login and
+// keeps the player's actor as the client's viewer for interest management.
+//
 class NetworkGameView : public IGameView
 {
 public:
@@ -341,9 +480,11 @@ public:
 	int HasRemotePlayerAttached() { return m_SockId != INVALID_SOCKET_ID; }
 
 	NetworkGameView();
+	virtual ~NetworkGameView();
 
 protected:
 	GameViewId m_ViewId;
 	ActorId m_ActorId;
 	int m_SockId;
+	unsigned int m_udpToken;					// 0 without snapshots
 };
\ No newline at end of file
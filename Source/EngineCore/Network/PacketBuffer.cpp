@@ -0,0 +1,104 @@
+// ================================================================
+// PacketBuffer.cpp : Reference counted, pooled buffers for packets to point into
+// ================================================================
+
+#include "../Common/CommonStd.h"
+#include "PacketBuffer.h"
+
+//
+// struct PacketBufferPools							- not described in the book
+//
+// One EventPool per pooled size. Built on first use, since packets can be created on any thread.
+//
+struct PacketBufferPools
+{
+	EventPool* m_pPools[PACKET_BUFFER_NUM_POOLS];
+
+	PacketBufferPools(void)
+	{
+		for (unsigned int i = 0; i < PACKET_BUFFER_NUM_POOLS; ++i)
+		{
+			unsigned int capacity = PACKET_BUFFER_MIN_POOLED_SIZE << i;
+			unsigned int chunksPerBlock = std::max(PACKET_BUFFER_POOL_BLOCK_SIZE / capacity, 1u);
+
+			char name[64];
+			sprintf(name, "PacketBuffer %uk", capacity / 1024);
+			m_pPools[i] = Nv_NEW EventPool(name, sizeof(PacketBuffer) + capacity, chunksPerBlock);
+		}
+	}
+
+	~PacketBufferPools(void)
+	{
+		for (unsigned int i = 0; i < PACKET_BUFFER_NUM_POOLS; ++i)
+		{
+			SAFE_DELETE(m_pPools[i]);
+		}
+	}
+};
+
+static PacketBufferPools& GetPools(void)
+{
+	static PacketBufferPools s_pools;
+	return s_pools;
+}
+
+// the pool for a rounded up capacity, or -1 for the heap
+static int GetPoolIndex(unsigned int capacity)
+{
+	int index = 0;
+	for (unsigned int size = PACKET_BUFFER_MIN_POOLED_SIZE; size <= PACKET_BUFFER_MAX_POOLED_SIZE; size <<= 1, ++index)
+	{
+		if (size == capacity) {
+			return index;
+		}
+	}
+	return -1;
+}
+
+PacketBuffer::PacketBuffer(unsigned int capacity)
+	: m_refCount(1)
+{
+	m_capacity = capacity;
+}
+
+//
+// PacketBuffer::Create								- not described in the book
+//
+PacketBuffer* PacketBuffer::Create(unsigned int capacity)
+{
+	if (capacity <= PACKET_BUFFER_MAX_POOLED_SIZE)
+	{
+		unsigned int rounded = PACKET_BUFFER_MIN_POOLED_SIZE;
+		while (rounded < capacity) {
+			rounded <<= 1;
+		}
+		capacity = rounded;
+	}
+
+	int poolIndex = GetPoolIndex(capacity);
+	void* pMem = (poolIndex >= 0) ? GetPools().m_pPools[poolIndex]->Alloc() : ::operator new(sizeof(PacketBuffer) + capacity);
+	if (!pMem) {
+		return NULL;
+	}
+
+	return new(pMem) PacketBuffer(capacity);
+}
+
+//
+// PacketBuffer::Release							- not described in the book
+//
+void PacketBuffer::Release(void)
+{
+	if (m_refCount.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+		return;
+	}
+
+	int poolIndex = GetPoolIndex(m_capacity);
+	this->~PacketBuffer();
+	if (poolIndex >= 0) {
+		GetPools().m_pPools[poolIndex]->Free(this);
+	}
+	else {
+		::operator delete(this);
+	}
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+// ================================================================
+// PacketBuffer.h : Reference counted, pooled buffers for packets to point into
+// ================================================================
+
+#include <atomic>
+#include "../EventManager/EventPool.h"
+
+const unsigned int PACKET_BUFFER_MIN_POOLED_SIZE = 1024;			// smaller buffers are rounded up to this
+const unsigned int PACKET_BUFFER_MAX_POOLED_SIZE = 32 * 1024;		// bigger ones come from the heap
+const unsigned int PACKET_BUFFER_NUM_POOLS = 6;						// one per power of two from the min to the max
+const unsigned int PACKET_BUFFER_POOL_BLOCK_SIZE = 256 * 1024;		// bytes each pool grows by
+
+//
+// class PacketBuffer								- not described in the book
+//
+// A block of memory that packets can be views into - a socket receives many packets into one, and a
+// NetworkEventForwarder serializes many events into one. Each view holds a reference, and the buffer
+// goes back to its pool when the last one is released, on whichever thread that happens.
+//
+// The data sits right behind the header, so a buffer is a single allocation. Capacities are rounded
+// up to a power of two so each size has a pool to come from. The pools are EventPools, so they show
+// up in EventPool::GetAllStats().
+//
+class PacketBuffer : public Nv_noncopyable
+{
+	std::atomic<int> m_refCount;
+	unsigned int m_capacity;
+
+public:
+	// comes with one reference, for the caller
+	static PacketBuffer* Create(unsigned int capacity);
+
+	void AddRef(void) { m_refCount.fetch_add(1, std::memory_order_relaxed); }
+	void Release(void);
+
+	// true while somebody besides the caller has a reference, so data already handed out mustn't be written over
+	bool IsShared(void) const { return m_refCount.load(std::memory_order_acquire) > 1; }
+
+	char* GetData(void) { return reinterpret_cast<char*>(this + 1); }
+	const char* GetData(void) const { return reinterpret_cast<const char*>(this + 1); }
+	unsigned int GetCapacity(void) const { return m_capacity; }
+
+private:
+	explicit PacketBuffer(unsigned int capacity);
+	~PacketBuffer(void) { }
+};
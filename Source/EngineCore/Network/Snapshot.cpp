@@ -0,0 +1,765 @@
+// ================================================================
+// Snapshot.cpp : Delta compressed snapshots of the world, for replicating actor state to clients
+// ================================================================
+
+#include "../Common/CommonStd.h"
+#include "../Actors/ComponentStore.h"
+#include "../EventManager/Events.h"
+#include "Snapshot.h"
+
+//
+// A snapshot goes out in one or more parts, each one message:
+//
+//		tick (varuint)  ticks back to the baseline, 0 for none (varuint)  part (1)  part count (1)  actors...
+//
+// The actors, in id order across the parts, are only the ones that differ from the baseline:
+//
+//		id, less the one before (varuint)  flags (1)  position (3 varints)  rotation (4)  fields (varuints)
+//
+// and each of position, rotation and fields only if its flag is set. Positions are deltas from the
+// baseline, or whole for an actor the baseline doesn't have. Actors in the baseline that aren't in
+// the snapshot have only the removed flag.
+//
+enum
+{
+	SnapshotFlag_Removed = 1 << 0,
+	SnapshotFlag_Position = 1 << 1,
+	SnapshotFlag_Rotation = 1 << 2,
+	SnapshotFlag_FirstField = 1 << 3,				// one flag per field from here up
+};
+
+static const unsigned int SNAPSHOT_MAX_ACTOR_SIZE = 64;	// the most one actor can take up
+
+// ==============================================================
+// WorldSnapshot
+// ==============================================================
+const SnapshotActor* WorldSnapshot::Find(ActorId id) const
+{
+	SnapshotActor key;
+	key.m_id = id;
+	Actors::const_iterator findIt = std::lower_bound(m_actors.begin(), m_actors.end(), key);
+	return (findIt != m_actors.end() && findIt->m_id == id) ? &*findIt : NULL;
+}
+
+// ==============================================================
+// SnapshotFields
+// ==============================================================
+SnapshotFields::Field SnapshotFields::s_fields[SNAPSHOT_MAX_FIELDS];
+unsigned int SnapshotFields::s_count = 0;
+
+bool SnapshotFields::Register(SnapshotFieldGetter getter, SnapshotFieldSetter setter)
+{
+	if (s_count >= SNAPSHOT_MAX_FIELDS) {
+		return false;
+	}
+
+	s_fields[s_count].m_getter = getter;
+	s_fields[s_count].m_setter = setter;
+	++s_count;
+	return true;
+}
+
+// ==============================================================
+// SnapshotReplicator
+// ==============================================================
+SnapshotReplicator::SnapshotReplicator(UdpSocket* pSocket, ComponentStore* pStore)
+{
+	m_pSocket = pSocket;
+	m_pStore = pStore;
+	m_tick = 0;
+	m_lastCaptureTime = 0;
+	m_interestRadius = SNAPSHOT_DEFAULT_INTEREST_RADIUS;
+	m_maxActors = SNAPSHOT_DEFAULT_MAX_ACTORS;
+}
+
+void SnapshotReplicator::AddClient(unsigned int token, ActorId viewerId)
+{
+	if (FindClient(token)) {
+		return;
+	}
+
+	m_clients.push_back(Client());
+	Client& client = m_clients.back();
+	client.m_token = token;
+	client.m_connId = INVALID_SOCKET_ID;
+	client.m_viewerId = viewerId;
+	client.m_ackedTick = 0;
+	for (unsigned int i = 0; i < SNAPSHOT_HISTORY; ++i)
+	{
+		client.m_sent[i].m_tick = 0;
+	}
+}
+
+void SnapshotReplicator::RemoveClient(unsigned int token)
+{
+	for (ClientList::iterator it = m_clients.begin(); it != m_clients.end(); ++it)
+	{
+		if (it->m_token == token)
+		{
+			m_clients.erase(it);
+			return;
+		}
+	}
+}
+
+void SnapshotReplicator::SetViewer(unsigned int token, ActorId viewerId)
+{
+	Client* pClient = FindClient(token);
+	if (pClient) {
+		pClient->m_viewerId = viewerId;
+	}
+}
+
+SnapshotReplicator::Client* SnapshotReplicator::FindClient(unsigned int token)
+{
+	for (ClientList::iterator it = m_clients.begin(); it != m_clients.end(); ++it)
+	{
+		if (it->m_token == token) {
+			return &*it;
+		}
+	}
+	return NULL;
+}
+
+//
+// SnapshotReplicator::Update						- not described in the book
+//
+void SnapshotReplicator::Update(unsigned int timeNow)
+{
+	if (m_tick > 0 && timeNow - m_lastCaptureTime < SNAPSHOT_INTERVAL) {
+		return;
+	}
+	m_lastCaptureTime = timeNow;
+
+	Capture();
+
+	for (ClientList::iterator it = m_clients.begin(); it != m_clients.end(); ++it)
+	{
+		SendSnapshot(*it);
+	}
+}
+
+//
+// SnapshotReplicator::Capture						- not described in the book
+//
+// Reads the store's transform arrays straight through - the actors themselves are only visited
+// for their fields, if any are registered.
+//
+void SnapshotReplicator::Capture(void)
+{
+	++m_tick;
+	WorldSnapshot& snapshot = m_snapshots[m_tick & (SNAPSHOT_HISTORY - 1)];
+	snapshot.m_tick = m_tick;
+
+	unsigned int count = m_pStore->GetNumTransforms();
+	const Mat4x4* pTransforms = m_pStore->GetTransforms();
+	const ActorId* pIds = m_pStore->GetTransformActorIds();
+	const unsigned int* pActorIndices = m_pStore->GetTransformActorIndices();
+	unsigned int fieldCount = SnapshotFields::GetCount();
+
+	snapshot.m_actors.resize(count);
+	for (unsigned int i = 0; i < count; ++i)
+	{
+		SnapshotActor& actor = snapshot.m_actors[i];
+		actor.m_id = pIds[i];
+		actor.m_transform.Quantize(pTransforms[i]);
+
+		Actor* pActor = fieldCount ? m_pStore->GetActor(pActorIndices[i]) : NULL;
+		for (unsigned int field = 0; field < SNAPSHOT_MAX_FIELDS; ++field)
+		{
+			actor.m_fields[field] = (pActor && field < fieldCount) ? SnapshotFields::Get(field, pActor) : 0;
+		}
+	}
+
+	std::sort(snapshot.m_actors.begin(), snapshot.m_actors.end());
+}
+
+//
+// SnapshotReplicator::ChooseActors					- not described in the book
+//
+// Interest management: the actors within m_interestRadius of the client's viewer, the nearest
+// m_maxActors of them if there are more, as indices into the current snapshot in id order. Until
+// the client has a viewer, distances are from the origin.
+//
+void SnapshotReplicator::ChooseActors(const Client& client, std::vector<unsigned int>& actors)
+{
+	const WorldSnapshot& snapshot = m_snapshots[m_tick & (SNAPSHOT_HISTORY - 1)];
+
+	float viewer[3] = { 0.0f, 0.0f, 0.0f };
+	const SnapshotActor* pViewer = snapshot.Find(client.m_viewerId);
+	if (pViewer)
+	{
+		for (unsigned int axis = 0; axis < 3; ++axis)
+		{
+			viewer[axis] = (float)pViewer->m_transform.m_position[axis];
+		}
+	}
+
+	// compared in quantized units, to save converting every position
+	float radius = m_interestRadius * EVENT_CODEC_POSITION_SCALE;
+	float radiusSquared = radius * radius;
+
+	m_candidates.clear();
+	for (unsigned int i = 0; i < snapshot.m_actors.size(); ++i)
+	{
+		const int* pPosition = snapshot.m_actors[i].m_transform.m_position;
+		float dx = (float)pPosition[0] - viewer[0];
+		float dy = (float)pPosition[1] - viewer[1];
+		float dz = (float)pPosition[2] - viewer[2];
+		float distanceSquared = dx * dx + dy * dy + dz * dz;
+		if (distanceSquared <= radiusSquared) {
+			m_candidates.push_back(std::make_pair(distanceSquared, i));
+		}
+	}
+
+	if (m_candidates.size() > m_maxActors)
+	{
+		std::nth_element(m_candidates.begin(), m_candidates.begin() + m_maxActors, m_candidates.end());
+		m_candidates.resize(m_maxActors);
+	}
+
+	actors.resize(m_candidates.size());
+	for (unsigned int i = 0; i < m_candidates.size(); ++i)
+	{
+		actors[i] = m_candidates[i].second;
+	}
+	std::sort(actors.begin(), actors.end());
+}
+
+//
+// Writes one actor's entry - what's changed since pBase, or all of it without one. Returns false
+// if nothing has.
+//
+static bool WriteSnapshotActor(BinaryWriter& out, ActorId previousId, const SnapshotActor& actor, const SnapshotActor* pBase)
+{
+	unsigned int fieldCount = SnapshotFields::GetCount();
+	unsigned char flags = 0;
+	if (!pBase)
+	{
+		flags = SnapshotFlag_Position | SnapshotFlag_Rotation;
+		for (unsigned int field = 0; field < fieldCount; ++field)
+		{
+			flags |= SnapshotFlag_FirstField << field;
+		}
+	}
+	else
+	{
+		if (memcmp(actor.m_transform.m_position, pBase->m_transform.m_position, sizeof(actor.m_transform.m_position)) != 0) {
+			flags |= SnapshotFlag_Position;
+		}
+		if (actor.m_transform.m_rotation != pBase->m_transform.m_rotation) {
+			flags |= SnapshotFlag_Rotation;
+		}
+		for (unsigned int field = 0; field < fieldCount; ++field)
+		{
+			if (actor.m_fields[field] != pBase->m_fields[field]) {
+				flags |= SnapshotFlag_FirstField << field;
+			}
+		}
+
+		if (!flags) {
+			return false;
+		}
+	}
+
+	out.WriteVarUInt(actor.m_id - previousId);
+	out.WriteU8(flags);
+	if (flags & SnapshotFlag_Position)
+	{
+		for (unsigned int axis = 0; axis < 3; ++axis)
+		{
+			out.WriteVarInt(actor.m_transform.m_position[axis] - (pBase ? pBase->m_transform.m_position[axis] : 0));
+		}
+	}
+	if (flags & SnapshotFlag_Rotation) {
+		out.WriteU32(actor.m_transform.m_rotation);
+	}
+	for (unsigned int field = 0; field < fieldCount; ++field)
+	{
+		if (flags & (SnapshotFlag_FirstField << field)) {
+			out.WriteVarUInt(actor.m_fields[field]);
+		}
+	}
+	return true;
+}
+
+//
+// SnapshotReplicator::SendSnapshot					- not described in the book
+//
+void SnapshotReplicator::SendSnapshot(Client& client)
+{
+	int connId = m_pSocket->FindConnectionByToken(client.m_token);
+	if (connId == INVALID_SOCKET_ID) {
+		return;
+	}
+
+	if (connId != client.m_connId)
+	{
+		// a new connection has nothing to delta against
+		client.m_connId = connId;
+		client.m_ackedTick = 0;
+	}
+
+	// the baseline is the last snapshot the client acked, if we still have it
+	const WorldSnapshot* pBase = NULL;
+	const SentSnapshot* pBaseSent = NULL;
+	if (client.m_ackedTick && m_tick - client.m_ackedTick < SNAPSHOT_HISTORY)
+	{
+		unsigned int baseSlot = client.m_ackedTick & (SNAPSHOT_HISTORY - 1);
+		if (client.m_sent[baseSlot].m_tick == client.m_ackedTick)
+		{
+			pBase = &m_snapshots[baseSlot];
+			pBaseSent = &client.m_sent[baseSlot];
+		}
+	}
+
+	SentSnapshot& sent = client.m_sent[m_tick & (SNAPSHOT_HISTORY - 1)];
+	sent.m_tick = m_tick;
+	ChooseActors(client, sent.m_actors);
+
+	const WorldSnapshot& snapshot = m_snapshots[m_tick & (SNAPSHOT_HISTORY - 1)];
+	unsigned int partCount = 0;
+	size_t partCountOffset = 0;
+
+	// walk the snapshot and the baseline side by side, both in id order
+	ActorId previousId = 0;
+	size_t current = 0, base = 0;
+	size_t baseCount = pBaseSent ? pBaseSent->m_actors.size() : 0;
+	bool firstPart = true;
+	while (firstPart || current < sent.m_actors.size() || base < baseCount)
+	{
+		char entryBuffer[SNAPSHOT_MAX_ACTOR_SIZE];
+		BinaryWriter entry(entryBuffer, sizeof(entryBuffer));
+
+		const SnapshotActor* pActor = (current < sent.m_actors.size()) ? &snapshot.m_actors[sent.m_actors[current]] : NULL;
+		const SnapshotActor* pBaseActor = (base < baseCount) ? &pBase->m_actors[pBaseSent->m_actors[base]] : NULL;
+		ActorId entryId = 0;
+		if (pActor && (!pBaseActor || pActor->m_id < pBaseActor->m_id))
+		{
+			// come into the client's interest
+			entryId = pActor->m_id;
+			WriteSnapshotActor(entry, previousId, *pActor, NULL);
+			++current;
+		}
+		else if (pBaseActor && (!pActor || pBaseActor->m_id < pActor->m_id))
+		{
+			// gone out of it
+			entryId = pBaseActor->m_id;
+			entry.WriteVarUInt(entryId - previousId);
+			entry.WriteU8(SnapshotFlag_Removed);
+			++base;
+		}
+		else if (pActor)
+		{
+			entryId = pActor->m_id;
+			WriteSnapshotActor(entry, previousId, *pActor, pBaseActor);
+			++current;
+			++base;
+		}
+
+		// start a new part when this one can't take the entry - or for the first one, which has to
+		// go even if nothing has changed, so the client has something to ack
+		if (firstPart || m_parts[partCount - 1].size() + entry.GetSize() > UDP_MAX_MESSAGE_SIZE)
+		{
+			if (partCount == SNAPSHOT_MAX_PARTS) {
+				return;
+			}
+			if (m_parts.size() <= partCount) {
+				m_parts.resize(partCount + 1);
+			}
+
+			char headerBuffer[16];
+			BinaryWriter header(headerBuffer, sizeof(headerBuffer));
+			header.WriteU8(SNAPSHOT_MESSAGE_TAG);
+			header.WriteVarUInt(m_tick);
+			header.WriteVarUInt(pBase ? m_tick - pBase->m_tick : 0);
+			header.WriteU8((unsigned char)partCount);
+			partCountOffset = header.GetSize();
+			header.WriteU8(0);										// the count, once it's known
+
+			m_parts[partCount].assign(header.GetData(), header.GetData() + header.GetSize());
+			++partCount;
+			firstPart = false;
+		}
+
+		if (entry.GetSize() > 0)
+		{
+			std::vector<char>& part = m_parts[partCount - 1];
+			part.insert(part.end(), entry.GetData(), entry.GetData() + entry.GetSize());
+			previousId = entryId;
+		}
+	}
+
+	for (unsigned int i = 0; i < partCount; ++i)
+	{
+		m_parts[i][partCountOffset] = (char)partCount;
+		m_pSocket->Send(connId, UdpChannel_Unreliable, &m_parts[i][0], (unsigned int)m_parts[i].size());
+	}
+}
+
+//
+// SnapshotReplicator::HandleAck					- not described in the book
+//
+void SnapshotReplicator::HandleAck(int connId, const char* pData, unsigned int size)
+{
+	BinaryReader in(pData, size);
+	in.ReadU8();									// SNAPSHOT_ACK_MESSAGE_TAG
+	unsigned int tick = in.ReadVarUInt();
+	if (in.Failed()) {
+		return;
+	}
+
+	for (ClientList::iterator it = m_clients.begin(); it != m_clients.end(); ++it)
+	{
+		Client& client = *it;
+		if (client.m_connId != connId) {
+			continue;
+		}
+
+		// only a snapshot we remember sending - acks arrive out of order, and may be forged
+		if (tick > client.m_ackedTick && tick <= m_tick && client.m_sent[tick & (SNAPSHOT_HISTORY - 1)].m_tick == tick) {
+			client.m_ackedTick = tick;
+		}
+		return;
+	}
+}
+
+// ==============================================================
+// SnapshotReceiver
+// ==============================================================
+SnapshotReceiver::SnapshotReceiver(UdpSocket* pSocket, ComponentStore* pStore)
+{
+	m_pSocket = pSocket;
+	m_pStore = pStore;
+	m_latestTick = 0;
+	for (unsigned int i = 0; i < SNAPSHOT_ASSEMBLY_SLOTS; ++i)
+	{
+		m_partial[i].m_tick = 0;
+		m_partial[i].m_baseTick = 0;
+		m_partial[i].m_received = 0;
+	}
+	m_renderTime = 0.0f;
+	m_lastUpdateTime = 0;
+	m_bClockStarted = false;
+}
+
+//
+// SnapshotReceiver::HandleSnapshot					- not described in the book
+//
+// Holds on to the parts until they've all come in, in whatever order. A few snapshots can be put
+// together at once, so one with a part still on the way isn't lost to the next one starting; a slot
+// only goes to a newer snapshot, and one older than the newest decoded is of no use.
+//
+void SnapshotReceiver::HandleSnapshot(int connId, const char* pData, unsigned int size)
+{
+	BinaryReader in(pData, size);
+	in.ReadU8();									// SNAPSHOT_MESSAGE_TAG
+	unsigned int tick = in.ReadVarUInt();
+	unsigned int baseTicksBack = in.ReadVarUInt();
+	unsigned int part = in.ReadU8();
+	unsigned int partCount = in.ReadU8();
+	if (in.Failed() || partCount == 0 || part >= partCount || tick <= m_latestTick || baseTicksBack >= SNAPSHOT_HISTORY || baseTicksBack > tick) {
+		return;
+	}
+
+	PartialSnapshot& partial = m_partial[tick & (SNAPSHOT_ASSEMBLY_SLOTS - 1)];
+	if (tick != partial.m_tick)
+	{
+		if (tick < partial.m_tick) {
+			return;
+		}
+
+		partial.m_tick = tick;
+		partial.m_baseTick = baseTicksBack ? tick - baseTicksBack : 0;
+		partial.m_received = 0;
+		partial.m_parts.resize(partCount);
+		for (unsigned int i = 0; i < partCount; ++i)
+		{
+			partial.m_parts[i].clear();
+		}
+	}
+	else if (partCount != partial.m_parts.size() || partial.m_baseTick != (baseTicksBack ? tick - baseTicksBack : 0))
+	{
+		return;
+	}
+
+	// a part is never empty - it has its header
+	if (!partial.m_parts[part].empty()) {
+		return;
+	}
+	partial.m_parts[part].assign(pData, pData + size);
+	if (++partial.m_received < partCount) {
+		return;
+	}
+
+	// done with the slot either way
+	partial.m_tick = 0;
+
+	const WorldSnapshot* pBase = NULL;
+	if (partial.m_baseTick)
+	{
+		pBase = &m_snapshots[partial.m_baseTick & (SNAPSHOT_HISTORY - 1)];
+		if (pBase->m_tick != partial.m_baseTick) {
+			return;
+		}
+	}
+
+	WorldSnapshot snapshot;
+	snapshot.m_tick = tick;
+	if (!Decode(pBase, partial, snapshot)) {
+		return;
+	}
+
+	m_snapshots[tick & (SNAPSHOT_HISTORY - 1)].m_actors.swap(snapshot.m_actors);
+	m_snapshots[tick & (SNAPSHOT_HISTORY - 1)].m_tick = tick;
+	m_latestTick = tick;
+
+	char ack[8];
+	BinaryWriter out(ack, sizeof(ack));
+	out.WriteU8(SNAPSHOT_ACK_MESSAGE_TAG);
+	out.WriteVarUInt(tick);
+	m_pSocket->Send(connId, UdpChannel_UnreliableSequenced, out.GetData(), (unsigned int)out.GetSize());
+}
+
+//
+// SnapshotReceiver::Decode							- not described in the book
+//
+// The baseline with the parts' changes applied, or false if they don't make sense against it.
+//
+bool SnapshotReceiver::Decode(const WorldSnapshot* pBase, const PartialSnapshot& partial, WorldSnapshot& snapshot)
+{
+	unsigned int fieldCount = SnapshotFields::GetCount();
+	size_t baseCount = pBase ? pBase->m_actors.size() : 0;
+	size_t base = 0;
+	ActorId previousId = 0;
+	bool firstEntry = true;
+
+	snapshot.m_actors.clear();
+	snapshot.m_actors.reserve(baseCount);
+	for (size_t part = 0; part < partial.m_parts.size(); ++part)
+	{
+		BinaryReader in(&partial.m_parts[part][0], partial.m_parts[part].size());
+		in.ReadU8();
+		in.ReadVarUInt();
+		in.ReadVarUInt();
+		in.ReadU8();
+		in.ReadU8();
+
+		while (!in.Failed() && in.GetRemaining() > 0)
+		{
+			unsigned int idDelta = in.ReadVarUInt();
+			if (!firstEntry && idDelta == 0) {
+				return false;
+			}
+			ActorId id = previousId + idDelta;
+			previousId = id;
+			firstEntry = false;
+
+			// everything in the baseline before this one hasn't changed
+			while (base < baseCount && pBase->m_actors[base].m_id < id) {
+				snapshot.m_actors.push_back(pBase->m_actors[base++]);
+			}
+
+			const SnapshotActor* pBaseActor = (base < baseCount && pBase->m_actors[base].m_id == id) ? &pBase->m_actors[base++] : NULL;
+			unsigned char flags = in.ReadU8();
+			if (flags & SnapshotFlag_Removed)
+			{
+				if (!pBaseActor) {
+					return false;
+				}
+				continue;
+			}
+
+			SnapshotActor actor;
+			if (pBaseActor) {
+				actor = *pBaseActor;
+			}
+			else {
+				memset(&actor, 0, sizeof(actor));
+			}
+			actor.m_id = id;
+
+			if (flags & SnapshotFlag_Position)
+			{
+				for (unsigned int axis = 0; axis < 3; ++axis)
+				{
+					actor.m_transform.m_position[axis] += in.ReadVarInt();
+				}
+			}
+			if (flags & SnapshotFlag_Rotation) {
+				actor.m_transform.m_rotation = in.ReadU32();
+			}
+			for (unsigned int field = 0; field < fieldCount; ++field)
+			{
+				if (flags & (SnapshotFlag_FirstField << field)) {
+					actor.m_fields[field] = in.ReadVarUInt();
+				}
+			}
+			snapshot.m_actors.push_back(actor);
+		}
+
+		if (in.Failed()) {
+			return false;
+		}
+	}
+
+	while (base < baseCount) {
+		snapshot.m_actors.push_back(pBase->m_actors[base++]);
+	}
+	return true;
+}
+
+//
+// SnapshotReceiver::Update							- not described in the book
+//
+// The render clock runs at the local rate, nudged toward SNAPSHOT_INTERPOLATION_DELAY behind the newest
+// snapshot so it follows the server without jumping about with every late or early one. It never
+// runs past the newest snapshot - an actor holds still rather than be guessed at.
+//
+void SnapshotReceiver::Update(unsigned int timeNow)
+{
+	if (!m_latestTick) {
+		return;
+	}
+
+	float latestTime = (float)m_latestTick * SNAPSHOT_INTERVAL;
+	float targetTime = latestTime - SNAPSHOT_INTERPOLATION_DELAY;
+	if (!m_bClockStarted || fabsf(m_renderTime - targetTime) > SNAPSHOT_MAX_CLOCK_ERROR)
+	{
+		m_renderTime = targetTime;
+		m_bClockStarted = true;
+	}
+	else
+	{
+		m_renderTime += (float)(timeNow - m_lastUpdateTime);
+		m_renderTime += (targetTime - m_renderTime) * 0.05f;
+	}
+	m_renderTime = std::min(m_renderTime, latestTime);
+	m_lastUpdateTime = timeNow;
+
+	// the newest snapshot at or before the render time, and the oldest after it
+	const WorldSnapshot* pFrom = NULL;
+	const WorldSnapshot* pTo = NULL;
+	for (unsigned int i = 0; i < SNAPSHOT_HISTORY; ++i)
+	{
+		const WorldSnapshot& snapshot = m_snapshots[i];
+		if (!snapshot.m_tick) {
+			continue;
+		}
+
+		float time = (float)snapshot.m_tick * SNAPSHOT_INTERVAL;
+		if (time <= m_renderTime)
+		{
+			if (!pFrom || snapshot.m_tick > pFrom->m_tick) {
+				pFrom = &snapshot;
+			}
+		}
+		else if (!pTo || snapshot.m_tick < pTo->m_tick)
+		{
+			pTo = &snapshot;
+		}
+	}
+
+	if (!pFrom) {
+		return;
+	}
+
+	float t = 0.0f;
+	if (pTo) {
+		t = (m_renderTime - (float)pFrom->m_tick * SNAPSHOT_INTERVAL) / ((float)(pTo->m_tick - pFrom->m_tick) * SNAPSHOT_INTERVAL);
+	}
+
+	// walk both in id order; actors that aren't in the later one hold where they were
+	size_t to = 0;
+	size_t toCount = pTo ? pTo->m_actors.size() : 0;
+	for (size_t from = 0; from < pFrom->m_actors.size(); ++from)
+	{
+		const SnapshotActor& fromActor = pFrom->m_actors[from];
+		while (to < toCount && pTo->m_actors[to].m_id < fromActor.m_id) {
+			++to;
+		}
+
+		Mat4x4 transform;
+		if (to < toCount && pTo->m_actors[to].m_id == fromActor.m_id && t > 0.0f)
+		{
+			const SnapshotActor& toActor = pTo->m_actors[to];
+
+			Quaternion rotation;
+			fromActor.m_transform.DequantizeRotation(rotation);
+			if (toActor.m_transform.m_rotation != fromActor.m_transform.m_rotation)
+			{
+				Quaternion toRotation;
+				toActor.m_transform.DequantizeRotation(toRotation);
+				Quaternion fromRotation = rotation;
+				rotation.Slerp(fromRotation, toRotation, t);
+			}
+
+			float position[3];
+			for (unsigned int axis = 0; axis < 3; ++axis)
+			{
+				float fromPosition = (float)fromActor.m_transform.m_position[axis];
+				float toPosition = (float)toActor.m_transform.m_position[axis];
+				position[axis] = (fromPosition + (toPosition - fromPosition) * t) / EVENT_CODEC_POSITION_SCALE;
+			}
+
+			transform.BuildRotationQuat(rotation);
+			transform.SetPosition(Vec3(position[0], position[1], position[2]));
+		}
+		else
+		{
+			fromActor.m_transform.Dequantize(transform);
+		}
+
+		Apply(pFrom->m_tick, fromActor.m_id, transform, fromActor.m_fields);
+	}
+
+	// actors that have gone out of the client's interest, or been destroyed, needn't be remembered -
+	// if one comes back it's passed on whole
+	if (m_applied.size() > pFrom->m_actors.size())
+	{
+		for (AppliedMap::iterator it = m_applied.begin(); it != m_applied.end(); )
+		{
+			if (it->second.m_tick != pFrom->m_tick) {
+				it = m_applied.erase(it);
+			}
+			else {
+				++it;
+			}
+		}
+	}
+}
+
+//
+// SnapshotReceiver::Apply							- not described in the book
+//
+void SnapshotReceiver::Apply(unsigned int tick, ActorId id, const Mat4x4& transform, const unsigned int* pFields)
+{
+	// an actor whose creation hasn't arrived yet gets it all once it has
+	Actor* pActor = m_pStore->GetActor(m_pStore->FindActorIndex(id));
+	if (!pActor)
+	{
+		m_applied.erase(id);
+		return;
+	}
+
+	unsigned int fieldCount = SnapshotFields::GetCount();
+	std::pair<AppliedMap::iterator, bool> inserted = m_applied.insert(std::make_pair(id, AppliedState()));
+	AppliedState& applied = inserted.first->second;
+	applied.m_tick = tick;
+
+	if (inserted.second || applied.m_transform != transform)
+	{
+		applied.m_transform = transform;
+		std::shared_ptr<EvtData_Move_Actor> pEvent(MakePooledEvent<EvtData_Move_Actor>(id, transform));
+		IEventManager::Get()->VQueueEvent(pEvent);
+	}
+
+	for (unsigned int field = 0; field < fieldCount; ++field)
+	{
+		if (inserted.second || applied.m_fields[field] != pFields[field])
+		{
+			applied.m_fields[field] = pFields[field];
+			SnapshotFields::Set(field, pActor, pFields[field]);
+		}
+	}
+}
@@ -0,0 +1,211 @@
+#pragma once
+
+// ================================================================
+// Snapshot.h : Delta compressed snapshots of the world, for replicating actor state to clients
+// ================================================================
+
+#include "UdpSocket.h"
+
+class Actor;
+class ComponentStore;
+
+#define SNAPSHOT_MESSAGE_TAG (0x5a)					// first byte of a snapshot message
+#define SNAPSHOT_ACK_MESSAGE_TAG (0x5b)				// first byte of a snapshot ack
+
+#define SNAPSHOT_INTERVAL (50)						// ms between snapshots - 20 a second
+#define SNAPSHOT_HISTORY (32)						// snapshots kept to delta against; must be a power of two
+#define SNAPSHOT_MAX_FIELDS (4)						// replicated component fields per actor
+#define SNAPSHOT_MAX_PARTS (255)					// messages one snapshot can be split into
+#define SNAPSHOT_ASSEMBLY_SLOTS (4)					// snapshots the client puts together at once; must be a power of two
+
+#define SNAPSHOT_DEFAULT_INTEREST_RADIUS (100.0f)	// actors further than this from a client's viewer aren't sent
+#define SNAPSHOT_DEFAULT_MAX_ACTORS (512)			// nor more than this many, nearest first
+
+#define SNAPSHOT_INTERPOLATION_DELAY (100)			// ms the client renders behind the newest snapshot
+#define SNAPSHOT_MAX_CLOCK_ERROR (250)				// ms off before the client's clock jumps rather than drifts
+
+// a component field the snapshots carry, read on the server and written on the client
+typedef unsigned int (*SnapshotFieldGetter)(Actor* pActor);
+typedef void (*SnapshotFieldSetter)(Actor* pActor, unsigned int value);
+
+//
+// struct SnapshotActor								- not described in the book
+//
+struct SnapshotActor
+{
+	ActorId m_id;
+	QuantizedTransform m_transform;
+	unsigned int m_fields[SNAPSHOT_MAX_FIELDS];
+
+	bool operator<(const SnapshotActor& other) const { return m_id < other.m_id; }
+};
+
+//
+// class WorldSnapshot								- not described in the book
+//
+// The replicated state of actors at one tick, quantized the way it goes over the wire and sorted by
+// id, so two snapshots can be compared by walking them side by side.
+//
+class WorldSnapshot
+{
+public:
+	typedef std::vector<SnapshotActor> Actors;
+
+	unsigned int m_tick;						// 0 for none
+	Actors m_actors;
+
+	WorldSnapshot(void) { m_tick = 0; }
+	const SnapshotActor* Find(ActorId id) const;
+};
+
+//
+// class SnapshotFields								- not described in the book
+//
+// The component fields snapshots carry besides the transform - health, say, or an animation state.
+// Each is an unsigned int that a getter reads off an actor on the server and a setter writes back on
+// the client. Both ends have to register the same ones in the same order.
+//
+class SnapshotFields
+{
+	struct Field
+	{
+		SnapshotFieldGetter m_getter;
+		SnapshotFieldSetter m_setter;
+	};
+
+	static Field s_fields[SNAPSHOT_MAX_FIELDS];
+	static unsigned int s_count;
+
+public:
+	static bool Register(SnapshotFieldGetter getter, SnapshotFieldSetter setter);
+	static unsigned int GetCount(void) { return s_count; }
+	static unsigned int Get(unsigned int field, Actor* pActor) { return s_fields[field].m_getter(pActor); }
+	static void Set(unsigned int field, Actor* pActor, unsigned int value) { s_fields[field].m_setter(pActor, value); }
+};
+
+//
+// class SnapshotReplicator							- not described in the book
+//
+// Instead of one EvtData_Move_Actor per moving actor per client, the server captures every actor's
+// transform and fields into a WorldSnapshot each SNAPSHOT_INTERVAL, once for all clients. Each client
+// is then sent the actors nearest its viewer, as a delta against the last snapshot it acked: actors
+// that haven't changed cost nothing, moved ones their position delta, and actors entering or leaving
+// its interest come or go whole. A snapshot that's lost is simply superseded by the next one, so the
+// snapshots go unreliable and the client acks what it gets. The parts of a big snapshot go on
+// UdpChannel_Unreliable rather than UdpChannel_UnreliableSequenced, which would drop any part that
+// arrived after a later one.
+//
+// Clients are known by the token they gave the UdpSocket, as NetworkEventForwarder does it. Actors
+// are still created and destroyed by events; with snapshots running, EvtData_Move_Actor shouldn't be
+// forwarded as well.
+//
+class SnapshotReplicator : public Nv_noncopyable
+{
+	struct SentSnapshot
+	{
+		unsigned int m_tick;
+		std::vector<unsigned int> m_actors;		// what the client was sent, as indices into that tick's WorldSnapshot
+	};
+
+	struct Client
+	{
+		unsigned int m_token;
+		int m_connId;
+		ActorId m_viewerId;
+		unsigned int m_ackedTick;
+		SentSnapshot m_sent[SNAPSHOT_HISTORY];
+	};
+
+	typedef std::list<Client> ClientList;
+
+	UdpSocket* m_pSocket;
+	ComponentStore* m_pStore;
+	ClientList m_clients;
+
+	WorldSnapshot m_snapshots[SNAPSHOT_HISTORY];
+	unsigned int m_tick;
+	unsigned int m_lastCaptureTime;
+
+	float m_interestRadius;
+	unsigned int m_maxActors;
+
+	// scratch, kept to save allocating every snapshot
+	std::vector<std::pair<float, unsigned int> > m_candidates;
+	std::vector<std::vector<char> > m_parts;
+
+public:
+	SnapshotReplicator(UdpSocket* pSocket, ComponentStore* pStore);
+
+	void AddClient(unsigned int token, ActorId viewerId);
+	void RemoveClient(unsigned int token);
+	void SetViewer(unsigned int token, ActorId viewerId);
+	void SetInterest(float radius, unsigned int maxActors) { m_interestRadius = radius; m_maxActors = maxActors; }
+
+	// captures and sends a snapshot once SNAPSHOT_INTERVAL has gone by
+	void Update(unsigned int timeNow);
+	unsigned int GetTick(void) const { return m_tick; }
+
+	void HandleAck(int connId, const char* pData, unsigned int size);
+
+private:
+	void Capture(void);
+	void SendSnapshot(Client& client);
+	void ChooseActors(const Client& client, std::vector<unsigned int>& actors);
+	Client* FindClient(unsigned int token);
+};
+
+//
+// class SnapshotReceiver							- not described in the book
+//
+// The client end. Puts snapshots back together from the last one acked and acks them in turn, then
+// plays them back SNAPSHOT_INTERPOLATION_DELAY behind the newest, interpolating between the two
+// either side of the render time. Moves come out as EvtData_Move_Actor events, queued locally, so the
+// scene and the game logic see them just as they did when they came over the network one by one.
+//
+class SnapshotReceiver : public Nv_noncopyable
+{
+	struct AppliedState
+	{
+		Mat4x4 m_transform;
+		unsigned int m_fields[SNAPSHOT_MAX_FIELDS];
+		unsigned int m_tick;					// the snapshot it was last in
+	};
+
+	// a snapshot being put back together, its parts arriving in any order
+	struct PartialSnapshot
+	{
+		unsigned int m_tick;					// 0 for none
+		unsigned int m_baseTick;
+		unsigned int m_received;
+		std::vector<std::vector<char> > m_parts;
+	};
+
+	typedef std::unordered_map<ActorId, AppliedState> AppliedMap;
+
+	UdpSocket* m_pSocket;
+	ComponentStore* m_pStore;
+
+	WorldSnapshot m_snapshots[SNAPSHOT_HISTORY];
+	unsigned int m_latestTick;
+
+	PartialSnapshot m_partial[SNAPSHOT_ASSEMBLY_SLOTS];	// by tick
+
+	float m_renderTime;							// ms, on the server's snapshot clock
+	unsigned int m_lastUpdateTime;
+	bool m_bClockStarted;
+	AppliedMap m_applied;						// what's been passed on for the actors being played back, so unchanged ones aren't again
+
+public:
+	SnapshotReceiver(UdpSocket* pSocket, ComponentStore* pStore);
+
+	void HandleSnapshot(int connId, const char* pData, unsigned int size);
+
+	// interpolates to the render time and applies what's changed
+	void Update(unsigned int timeNow);
+
+	unsigned int GetLatestTick(void) const { return m_latestTick; }
+
+private:
+	bool Decode(const WorldSnapshot* pBase, const PartialSnapshot& partial, WorldSnapshot& snapshot);
+	void Apply(unsigned int tick, ActorId id, const Mat4x4& transform, const unsigned int* pFields);
+};
@@ -0,0 +1,110 @@
+#pragma once
+
+// ================================================================
+// SocketPlatform.h : The few socket calls that differ between WinSock and BSD sockets
+// ================================================================
+//
+// The network code is written against WinSock names (SOCKET, INVALID_SOCKET, closesocket...).
+// Everywhere else they're mapped onto BSD sockets here, along with the error checks that
+// are spelled differently on each side.
+//
+
+#ifdef _WIN32
+
+// select() takes no more than FD_SETSIZE sockets, and WinSock's default of 64 is too few for a
+// server. It only counts if it's set before WinSock2.h is first included.
+#ifndef FD_SETSIZE
+#define FD_SETSIZE (2048)
+#endif
+
+#include <Winsock2.h>
+#include <ws2tcpip.h>
+
+#define Nv_SEND_FLAGS (0)
+
+inline int Nv_GetSocketError(void) { return WSAGetLastError(); }
+inline bool Nv_SocketWouldBlock(int error) { return error == WSAEWOULDBLOCK; }
+inline bool Nv_SocketConnectPending(int error) { return error == WSAEWOULDBLOCK || error == WSAEINPROGRESS; }
+
+inline void Nv_SetDontLinger(SOCKET sock)
+{
+	int value = 1;
+	setsockopt(sock, SOL_SOCKET, SO_DONTLINGER, (char*)&value, sizeof(value));
+}
+
+// one piece of a gathered send
+typedef WSABUF SocketSendBuffer;
+
+inline void Nv_SetSendBuffer(SocketSendBuffer& buffer, const char* pData, size_t size)
+{
+	buffer.buf = const_cast<CHAR*>(pData);
+	buffer.len = (ULONG)size;
+}
+
+// sends count buffers one after the other in one call; returns the bytes sent or SOCKET_ERROR
+inline int Nv_SendGather(SOCKET sock, SocketSendBuffer* pBuffers, unsigned int count)
+{
+	DWORD sent = 0;
+	if (WSASend(sock, pBuffers, count, &sent, 0, NULL, NULL) == SOCKET_ERROR) {
+		return SOCKET_ERROR;
+	}
+	return (int)sent;
+}
+
+#else
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+
+typedef int SOCKET;
+#define INVALID_SOCKET (-1)
+#define SOCKET_ERROR (-1)
+
+// a peer that has gone away shouldn't take the server down with SIGPIPE
+#define Nv_SEND_FLAGS (MSG_NOSIGNAL)
+
+inline int closesocket(SOCKET sock) { return close(sock); }
+
+inline unsigned int timeGetTime(void)
+{
+	timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (unsigned int)(now.tv_sec * 1000 + now.tv_nsec / 1000000);
+}
+
+inline int Nv_GetSocketError(void) { return errno; }
+inline bool Nv_SocketWouldBlock(int error) { return error == EAGAIN || error == EWOULDBLOCK; }
+inline bool Nv_SocketConnectPending(int error) { return error == EINPROGRESS; }
+
+// closing without lingering is already the default
+inline void Nv_SetDontLinger(SOCKET sock) { }
+
+typedef iovec SocketSendBuffer;
+
+inline void Nv_SetSendBuffer(SocketSendBuffer& buffer, const char* pData, size_t size)
+{
+	buffer.iov_base = const_cast<char*>(pData);
+	buffer.iov_len = size;
+}
+
+// sendmsg() rather than writev() for the MSG_NOSIGNAL
+inline int Nv_SendGather(SOCKET sock, SocketSendBuffer* pBuffers, unsigned int count)
+{
+	msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = pBuffers;
+	msg.msg_iovlen = count;
+	return (int)sendmsg(sock, &msg, Nv_SEND_FLAGS);
+}
+
+#endif
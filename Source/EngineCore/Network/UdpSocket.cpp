@@ -0,0 +1,1048 @@
+// ================================================================
+// UdpSocket.cpp : Datagram transport with reliability channels
+// ================================================================
+
+#include "../Common/CommonStd.h"
+#include "../Memory/PoolAllocator.h"
+#include "UdpSocket.h"
+#include "Snapshot.h"
+
+#include <deque>
+#include <random>
+
+//
+// A datagram is a header followed by messages back to back:
+//
+//		header:		protocol id (4)  sequence (2)  ack (2)  ack bits (4)
+//		message:	channel and flags (1)  message sequence (2)  size (2)  data (size)
+//
+// The ack is the newest sequence received from the other end; bit n of the ack bits says whether
+// ack - n was received too. No bits set means nothing has been received yet. Everything is
+// little-endian.
+//
+enum
+{
+	UdpMessage_ChannelMask = 0x03,
+	UdpMessage_Hello = 0x80,				// the client's token, on UdpChannel_ReliableUnordered - checked before the datagram is taken in
+};
+
+static const unsigned int UDP_ACK_BITS = 32;
+static const unsigned int UDP_LOSS_REORDER = 3;		// newer datagrams acked before one still missing is taken as lost
+static const unsigned int UDP_DEFAULT_RESEND_TIME = 200;	// ms, until there's a round trip time to go on
+static const unsigned int UDP_MAX_DATAGRAMS_PER_INPUT = 1024;
+
+typedef std::vector<char, PoolStlAllocator<char> > UdpMessageData;
+
+static inline bool SeqGreater(unsigned short a, unsigned short b) { return (short)(a - b) > 0; }
+static inline bool IsReliable(unsigned int channel) { return channel == UdpChannel_ReliableOrdered || channel == UdpChannel_ReliableUnordered; }
+
+static inline void PutU16(char* p, unsigned short value)
+{
+	p[0] = (char)value;
+	p[1] = (char)(value >> 8);
+}
+
+static inline void PutU32(char* p, unsigned int value)
+{
+	p[0] = (char)value;
+	p[1] = (char)(value >> 8);
+	p[2] = (char)(value >> 16);
+	p[3] = (char)(value >> 24);
+}
+
+static inline unsigned short GetU16(const char* p)
+{
+	const unsigned char* b = reinterpret_cast<const unsigned char*>(p);
+	return (unsigned short)(b[0] | (b[1] << 8));
+}
+
+static inline unsigned int GetU32(const char* p)
+{
+	const unsigned char* b = reinterpret_cast<const unsigned char*>(p);
+	return (unsigned int)b[0] | ((unsigned int)b[1] << 8) | ((unsigned int)b[2] << 16) | ((unsigned int)b[3] << 24);
+}
+
+static inline unsigned long long AddressKey(const sockaddr_in& addr)
+{
+	return ((unsigned long long)ntohl(addr.sin_addr.s_addr) << 16) | ntohs(addr.sin_port);
+}
+
+// ==============================================================
+// UdpConnection
+// ==============================================================
+//
+// class UdpConnection								- not described in the book
+//
+// Everything one end of a connection knows: what it has sent and what was acked, what it has
+// received, the round trip time and the send rate.
+//
+class UdpConnection
+{
+	struct OutgoingMessage
+	{
+		unsigned int m_id;						// counts up across the reliable channels, so the queue is in order
+		unsigned short m_seq;					// counts up per channel
+		unsigned char m_header;
+		UdpMessageData m_data;
+		unsigned int m_lastSendTime;
+		unsigned int m_sendCount;
+		bool m_bAcked;
+		bool m_bResendNow;						// the datagram it went in was lost
+	};
+
+	struct SentDatagram
+	{
+		unsigned short m_seq;
+		bool m_bValid, m_bAcked, m_bLost;
+		unsigned int m_sendTime;
+		std::vector<unsigned int> m_messageIds;	// the reliable messages in it
+	};
+
+	typedef std::deque<OutgoingMessage> MessageQueue;
+
+public:
+	int m_id;
+	sockaddr_in m_addr;
+	unsigned int m_token;
+	bool m_bClosed;
+	unsigned int m_lastReceiveTime;
+
+	UdpConnectionStats m_stats;
+
+	UdpConnection(int id, const sockaddr_in& addr, unsigned int token, unsigned int timeNow);
+
+	bool QueueMessage(UdpChannel channel, unsigned char flags, const char* pData, unsigned int size);
+	void HandleDatagram(UdpSocket* pSocket, const char* pData, unsigned int size, unsigned int timeNow);
+	void Update(UdpSocket* pSocket, unsigned int timeNow);
+
+	unsigned int GetRtt(void) const { return m_bHaveRtt ? (unsigned int)m_srtt : 0; }
+	unsigned int GetSendRate(void) const { return (unsigned int)m_sendRate; }
+	unsigned int GetReliablePending(void) const { return (unsigned int)m_reliable.size(); }
+
+private:
+	void HandleAcks(unsigned short ack, unsigned int ackBits, unsigned int timeNow);
+	void AckDatagram(unsigned short seq, unsigned int timeNow);
+	void DatagramLost(SentDatagram& sent);
+	OutgoingMessage* FindReliable(unsigned int id);
+
+	void AddToDatagram(UdpSocket* pSocket, OutgoingMessage& message, unsigned int timeNow);
+	bool SendDatagram(UdpSocket* pSocket, unsigned int timeNow, bool force);
+	float GetBurst(void) const;
+	unsigned int GetResendTime(void) const;
+
+	void Deliver(UdpSocket* pSocket, unsigned char header, const char* pData, unsigned int size);
+
+	// sending
+	unsigned short m_nextDatagramSeq;
+	unsigned short m_nextMessageSeq[UdpChannel_Count];
+	unsigned int m_nextMessageId;
+	MessageQueue m_reliable;					// sent or not, until acked
+	MessageQueue m_unreliable;					// this tick's
+	SentDatagram m_sent[UDP_SENT_HISTORY];
+	unsigned short m_lossCheckSeq;				// the oldest datagram that could still be acked
+	unsigned int m_lastSendTime;
+
+	// the datagram being put together
+	char m_datagram[UDP_MTU];
+	unsigned int m_datagramSize;
+	std::vector<OutgoingMessage*> m_datagramMessages;
+
+	// receiving
+	bool m_bReceivedAny;
+	unsigned short m_remoteSeq;
+	unsigned int m_remoteAckBits;
+	bool m_bAckOwed;
+
+	bool m_bReceivedUnreliable;
+	unsigned short m_lastUnreliableSeq;
+	unsigned int m_nextOrderedSeq;
+	std::map<unsigned int, UdpMessageData> m_orderedWaiting;	// arrived ahead of m_nextOrderedSeq
+	unsigned int m_nextUnorderedSeq;
+	std::set<unsigned int> m_unorderedReceived;				// arrived ahead of m_nextUnorderedSeq
+
+	// round trip time and rate
+	bool m_bHaveRtt;
+	float m_srtt, m_rttVar;
+	float m_sendRate, m_budget;
+	unsigned int m_budgetTime;
+	unsigned int m_rateWindowStart;
+	unsigned int m_windowSent, m_windowLost;
+	float m_lossRate;							// smoothed fraction of datagrams lost per round trip
+	bool m_bRateLimited;
+};
+
+UdpConnection::UdpConnection(int id, const sockaddr_in& addr, unsigned int token, unsigned int timeNow)
+{
+	m_id = id;
+	m_addr = addr;
+	m_token = token;
+	m_bClosed = false;
+	m_lastReceiveTime = timeNow;
+	memset(&m_stats, 0, sizeof(m_stats));
+
+	m_nextDatagramSeq = 0;
+	memset(m_nextMessageSeq, 0, sizeof(m_nextMessageSeq));
+	m_nextMessageId = 0;
+	for (unsigned int i = 0; i < UDP_SENT_HISTORY; ++i)
+	{
+		m_sent[i].m_bValid = false;
+	}
+	m_lossCheckSeq = 0;
+	m_lastSendTime = 0;
+	m_datagramSize = UDP_HEADER_SIZE;
+
+	m_bReceivedAny = false;
+	m_remoteSeq = 0;
+	m_remoteAckBits = 0;
+	m_bAckOwed = false;
+
+	m_bReceivedUnreliable = false;
+	m_lastUnreliableSeq = 0;
+	m_nextOrderedSeq = 0;
+	m_nextUnorderedSeq = 0;
+
+	m_bHaveRtt = false;
+	m_srtt = 0.0f;
+	m_rttVar = 0.0f;
+	m_sendRate = (float)UDP_DEFAULT_SEND_RATE;
+	m_budget = (float)UDP_MTU;
+	m_budgetTime = timeNow;
+	m_rateWindowStart = timeNow;
+	m_windowSent = 0;
+	m_windowLost = 0;
+	m_lossRate = 0.0f;
+	m_bRateLimited = false;
+}
+
+bool UdpConnection::QueueMessage(UdpChannel channel, unsigned char flags, const char* pData, unsigned int size)
+{
+	bool reliable = IsReliable(channel);
+	if (reliable && m_reliable.size() >= UDP_MAX_RELIABLE_PENDING) {
+		return false;
+	}
+
+	MessageQueue& queue = reliable ? m_reliable : m_unreliable;
+	queue.push_back(OutgoingMessage());
+	OutgoingMessage& message = queue.back();
+	message.m_id = reliable ? m_nextMessageId++ : 0;
+	message.m_seq = m_nextMessageSeq[channel]++;
+	message.m_header = (unsigned char)channel | flags;
+	message.m_data.assign(pData, pData + size);
+	message.m_lastSendTime = 0;
+	message.m_sendCount = 0;
+	message.m_bAcked = false;
+	message.m_bResendNow = false;
+	return true;
+}
+
+//
+// UdpConnection::HandleDatagram					- not described in the book
+//
+void UdpConnection::HandleDatagram(UdpSocket* pSocket, const char* pData, unsigned int size, unsigned int timeNow)
+{
+	unsigned short seq = GetU16(pData + 4);
+	unsigned short ack = GetU16(pData + 6);
+	unsigned int ackBits = GetU32(pData + 8);
+
+	// note it among the ones to ack, and drop it if it's been seen before
+	if (!m_bReceivedAny)
+	{
+		m_bReceivedAny = true;
+		m_remoteSeq = seq;
+		m_remoteAckBits = 1;
+	}
+	else if (SeqGreater(seq, m_remoteSeq))
+	{
+		unsigned int shift = (unsigned short)(seq - m_remoteSeq);
+		m_remoteAckBits = (shift < UDP_ACK_BITS) ? (m_remoteAckBits << shift) | 1 : 1;
+		m_remoteSeq = seq;
+	}
+	else
+	{
+		unsigned int age = (unsigned short)(m_remoteSeq - seq);
+		if (age >= UDP_ACK_BITS || (m_remoteAckBits & (1u << age))) {
+			return;
+		}
+		m_remoteAckBits |= 1u << age;
+	}
+
+	// one with nothing but acks in it needn't be acked - doing that would have the two ends ack
+	// each other's acks for as long as the connection lasts
+	m_lastReceiveTime = timeNow;
+	if (size > UDP_HEADER_SIZE) {
+		m_bAckOwed = true;
+	}
+	++m_stats.m_datagramsReceived;
+
+	HandleAcks(ack, ackBits, timeNow);
+
+	unsigned int offset = UDP_HEADER_SIZE;
+	while (offset + UDP_MESSAGE_HEADER_SIZE <= size)
+	{
+		unsigned char header = (unsigned char)pData[offset];
+		unsigned short messageSeq = GetU16(pData + offset + 1);
+		unsigned int messageSize = GetU16(pData + offset + 3);
+		const char* pMessage = pData + offset + UDP_MESSAGE_HEADER_SIZE;
+		offset += UDP_MESSAGE_HEADER_SIZE + messageSize;
+
+		UdpChannel channel = (UdpChannel)(header & UdpMessage_ChannelMask);
+		if (offset > size || channel >= UdpChannel_Count)
+		{
+			// malformed - whatever's left can't be trusted
+			return;
+		}
+
+		switch (channel)
+		{
+			case UdpChannel_UnreliableSequenced:
+			{
+				if (!m_bReceivedUnreliable || SeqGreater(messageSeq, m_lastUnreliableSeq))
+				{
+					m_bReceivedUnreliable = true;
+					m_lastUnreliableSeq = messageSeq;
+					Deliver(pSocket, header, pMessage, messageSize);
+				}
+				break;
+			}
+
+			case UdpChannel_ReliableOrdered:
+			{
+				int ahead = (short)(messageSeq - (unsigned short)m_nextOrderedSeq);
+				if (ahead < 0 || ahead >= UDP_RECEIVE_WINDOW) {
+					break;
+				}
+
+				if (ahead > 0)
+				{
+					// hold on to it until the ones before it turn up
+					unsigned int fullSeq = m_nextOrderedSeq + ahead;
+					if (m_orderedWaiting.find(fullSeq) == m_orderedWaiting.end()) {
+						m_orderedWaiting[fullSeq].assign(pMessage, pMessage + messageSize);
+					}
+					break;
+				}
+
+				Deliver(pSocket, header, pMessage, messageSize);
+				++m_nextOrderedSeq;
+
+				std::map<unsigned int, UdpMessageData>::iterator waitingIt = m_orderedWaiting.begin();
+				while (waitingIt != m_orderedWaiting.end() && waitingIt->first == m_nextOrderedSeq)
+				{
+					const UdpMessageData& waiting = waitingIt->second;
+					Deliver(pSocket, header, waiting.empty() ? NULL : &waiting[0], (unsigned int)waiting.size());
+					++m_nextOrderedSeq;
+					waitingIt = m_orderedWaiting.erase(waitingIt);
+				}
+				break;
+			}
+
+			case UdpChannel_ReliableUnordered:
+			{
+				int ahead = (short)(messageSeq - (unsigned short)m_nextUnorderedSeq);
+				if (ahead < 0 || ahead >= UDP_RECEIVE_WINDOW) {
+					break;
+				}
+
+				unsigned int fullSeq = m_nextUnorderedSeq + ahead;
+				if (ahead > 0 && !m_unorderedReceived.insert(fullSeq).second) {
+					break;
+				}
+
+				Deliver(pSocket, header, pMessage, messageSize);
+
+				if (ahead == 0)
+				{
+					++m_nextUnorderedSeq;
+					while (m_unorderedReceived.erase(m_nextUnorderedSeq)) {
+						++m_nextUnorderedSeq;
+					}
+				}
+				break;
+			}
+
+			case UdpChannel_Unreliable:
+			{
+				// a repeated datagram has already been dropped, so there's nothing to check
+				Deliver(pSocket, header, pMessage, messageSize);
+				break;
+			}
+
+			default:
+				break;
+		}
+	}
+}
+
+void UdpConnection::Deliver(UdpSocket* pSocket, unsigned char header, const char* pData, unsigned int size)
+{
+	pSocket->HandleMessage(this, header, pData, size);
+}
+
+//
+// UdpConnection::HandleAcks						- not described in the book
+//
+void UdpConnection::HandleAcks(unsigned short ack, unsigned int ackBits, unsigned int timeNow)
+{
+	if (!ackBits) {
+		return;
+	}
+
+	for (unsigned int i = 0; i < UDP_ACK_BITS; ++i)
+	{
+		if (ackBits & (1u << i)) {
+			AckDatagram((unsigned short)(ack - i), timeNow);
+		}
+	}
+
+	// A datagram still missing when a few sent after it have been acked most likely won't turn up.
+	// One that has dropped out of the ack bits can't be acked any more at all.
+	for (unsigned int i = UDP_LOSS_REORDER; i < UDP_ACK_BITS; ++i)
+	{
+		if (!(ackBits & (1u << i)))
+		{
+			SentDatagram& sent = m_sent[(unsigned short)(ack - i) & (UDP_SENT_HISTORY - 1)];
+			if (sent.m_bValid && sent.m_seq == (unsigned short)(ack - i) && !sent.m_bAcked && !sent.m_bLost) {
+				DatagramLost(sent);
+			}
+		}
+	}
+
+	unsigned short oldestAckable = (unsigned short)(ack - (UDP_ACK_BITS - 1));
+	while (SeqGreater(oldestAckable, m_lossCheckSeq))
+	{
+		SentDatagram& sent = m_sent[m_lossCheckSeq & (UDP_SENT_HISTORY - 1)];
+		if (sent.m_bValid && sent.m_seq == m_lossCheckSeq && !sent.m_bAcked && !sent.m_bLost) {
+			DatagramLost(sent);
+		}
+		++m_lossCheckSeq;
+	}
+}
+
+void UdpConnection::AckDatagram(unsigned short seq, unsigned int timeNow)
+{
+	SentDatagram& sent = m_sent[seq & (UDP_SENT_HISTORY - 1)];
+	if (!sent.m_bValid || sent.m_seq != seq || sent.m_bAcked) {
+		return;
+	}
+	sent.m_bAcked = true;
+
+	if (sent.m_bLost)
+	{
+		// only held up - don't count it against the rate
+		--m_stats.m_datagramsLost;
+		if (m_windowLost > 0) {
+			--m_windowLost;
+		}
+	}
+	else
+	{
+		// Jacobson/Karels, as TCP does it
+		float sample = (float)(timeNow - sent.m_sendTime);
+		if (!m_bHaveRtt)
+		{
+			m_bHaveRtt = true;
+			m_srtt = sample;
+			m_rttVar = sample * 0.5f;
+		}
+		else
+		{
+			m_rttVar = 0.75f * m_rttVar + 0.25f * fabsf(m_srtt - sample);
+			m_srtt = 0.875f * m_srtt + 0.125f * sample;
+		}
+	}
+
+	// a datagram taken for lost may turn up late; what was in it still got there
+	for (size_t i = 0; i < sent.m_messageIds.size(); ++i)
+	{
+		OutgoingMessage* pMessage = FindReliable(sent.m_messageIds[i]);
+		if (pMessage) {
+			pMessage->m_bAcked = true;
+		}
+	}
+
+	while (!m_reliable.empty() && m_reliable.front().m_bAcked) {
+		m_reliable.pop_front();
+	}
+}
+
+void UdpConnection::DatagramLost(SentDatagram& sent)
+{
+	sent.m_bLost = true;
+	++m_stats.m_datagramsLost;
+	++m_windowLost;
+
+	for (size_t i = 0; i < sent.m_messageIds.size(); ++i)
+	{
+		OutgoingMessage* pMessage = FindReliable(sent.m_messageIds[i]);
+		if (pMessage && !pMessage->m_bAcked) {
+			pMessage->m_bResendNow = true;
+		}
+	}
+}
+
+UdpConnection::OutgoingMessage* UdpConnection::FindReliable(unsigned int id)
+{
+	// ids count up one at a time and are only ever taken off the front
+	if (m_reliable.empty()) {
+		return NULL;
+	}
+
+	unsigned int index = id - m_reliable.front().m_id;
+	return (index < m_reliable.size()) ? &m_reliable[index] : NULL;
+}
+
+float UdpConnection::GetBurst(void) const
+{
+	return m_sendRate * UDP_SEND_BURST_TIME / 1000.0f + UDP_MTU;
+}
+
+unsigned int UdpConnection::GetResendTime(void) const
+{
+	if (!m_bHaveRtt) {
+		return UDP_DEFAULT_RESEND_TIME;
+	}
+
+	unsigned int resendTime = (unsigned int)(m_srtt + 4.0f * m_rttVar);
+	return std::min(std::max(resendTime, (unsigned int)UDP_MIN_RESEND_TIME), (unsigned int)UDP_MAX_RESEND_TIME);
+}
+
+//
+// UdpConnection::Update							- not described in the book
+//
+// Puts what's due into datagrams and sends as many as the send rate allows.
+//
+void UdpConnection::Update(UdpSocket* pSocket, unsigned int timeNow)
+{
+	// Once a round trip: back off if loss has been more than the odd datagram, otherwise, if the
+	// rate was all used, raise it. Some loss is just the network, and backing off for it gets nothing back.
+	unsigned int rateWindow = std::max(GetRtt(), (unsigned int)UDP_MIN_RESEND_TIME);
+	if (timeNow - m_rateWindowStart >= rateWindow)
+	{
+		if (m_windowSent > 0) {
+			m_lossRate += 0.125f * ((float)std::min(m_windowLost, m_windowSent) / m_windowSent - m_lossRate);
+		}
+
+		if (m_lossRate > UDP_LOSS_TOLERANCE) {
+			m_sendRate = std::max(m_sendRate * 0.75f, (float)UDP_MIN_SEND_RATE);
+		}
+		else if (m_bRateLimited) {
+			m_sendRate = std::min(m_sendRate + UDP_SEND_RATE_STEP, (float)UDP_MAX_SEND_RATE);
+		}
+		m_windowSent = 0;
+		m_windowLost = 0;
+		m_bRateLimited = false;
+		m_rateWindowStart = timeNow;
+	}
+
+	m_budget = std::min(m_budget + m_sendRate * (timeNow - m_budgetTime) / 1000.0f, GetBurst());
+	m_budgetTime = timeNow;
+
+	// Unreliable messages go first, being the newest state there is. Due reliable messages - new ones,
+	// and ones that have waited too long or were in a lost datagram - fill in behind them.
+	unsigned int resendTime = GetResendTime();
+	bool blocked = false;
+	for (MessageQueue::iterator it = m_unreliable.begin(); it != m_unreliable.end() && !blocked; ++it)
+	{
+		if (m_datagramSize + UDP_MESSAGE_HEADER_SIZE + it->m_data.size() > UDP_MTU) {
+			blocked = !SendDatagram(pSocket, timeNow, false);
+		}
+		if (!blocked) {
+			AddToDatagram(pSocket, *it, timeNow);
+		}
+	}
+
+	for (MessageQueue::iterator it = m_reliable.begin(); it != m_reliable.end() && !blocked; ++it)
+	{
+		OutgoingMessage& message = *it;
+		if (message.m_bAcked) {
+			continue;
+		}
+
+		if (message.m_sendCount == 0 || message.m_bResendNow || timeNow - message.m_lastSendTime >= resendTime)
+		{
+			if (m_datagramSize + UDP_MESSAGE_HEADER_SIZE + message.m_data.size() > UDP_MTU) {
+				blocked = !SendDatagram(pSocket, timeNow, false);
+			}
+			if (!blocked) {
+				AddToDatagram(pSocket, message, timeNow);
+			}
+		}
+	}
+
+	// Whatever's been put together goes if the rate allows. Acks go regardless - without them the
+	// other end can't send anything either.
+	bool ackDue = m_bAckOwed || timeNow - m_lastSendTime >= UDP_KEEPALIVE_INTERVAL;
+	if (!blocked && m_datagramSize > UDP_HEADER_SIZE) {
+		blocked = !SendDatagram(pSocket, timeNow, false);
+	}
+	if (blocked)
+	{
+		// reliable messages left out wait for the next update
+		m_datagramSize = UDP_HEADER_SIZE;
+		m_datagramMessages.clear();
+	}
+	if (ackDue && m_lastSendTime != timeNow) {
+		SendDatagram(pSocket, timeNow, true);
+	}
+
+	// unreliable messages that didn't make it are stale by the next update
+	for (MessageQueue::iterator it = m_unreliable.begin(); it != m_unreliable.end(); ++it)
+	{
+		if (it->m_sendCount == 0) {
+			++m_stats.m_messagesDropped;
+		}
+	}
+	m_unreliable.clear();
+}
+
+void UdpConnection::AddToDatagram(UdpSocket* pSocket, OutgoingMessage& message, unsigned int timeNow)
+{
+	char* p = m_datagram + m_datagramSize;
+	p[0] = (char)message.m_header;
+	PutU16(p + 1, message.m_seq);
+	PutU16(p + 3, (unsigned short)message.m_data.size());
+	if (!message.m_data.empty()) {
+		memcpy(p + UDP_MESSAGE_HEADER_SIZE, &message.m_data[0], message.m_data.size());
+	}
+	m_datagramSize += UDP_MESSAGE_HEADER_SIZE + (unsigned int)message.m_data.size();
+	m_datagramMessages.push_back(&message);
+}
+
+//
+// UdpConnection::SendDatagram						- not described in the book
+//
+// Sends the datagram put together so far, unless the send rate is used up. Forced sends always go.
+// Reliable messages can wait, so a datagram of nothing else leaves half the burst for the next
+// update's unreliable ones.
+//
+bool UdpConnection::SendDatagram(UdpSocket* pSocket, unsigned int timeNow, bool force)
+{
+	bool anyUnreliable = false;
+	for (size_t i = 0; i < m_datagramMessages.size() && !anyUnreliable; ++i)
+	{
+		anyUnreliable = !IsReliable(m_datagramMessages[i]->m_header & UdpMessage_ChannelMask);
+	}
+
+	float reserve = anyUnreliable ? 0.0f : GetBurst() * 0.5f;
+	if (!force && m_budget <= reserve)
+	{
+		m_bRateLimited = true;
+		return false;
+	}
+
+	unsigned short seq = m_nextDatagramSeq++;
+	PutU32(m_datagram, MAGIC_NUMBER);
+	PutU16(m_datagram + 4, seq);
+	PutU16(m_datagram + 6, m_remoteSeq);
+	PutU32(m_datagram + 8, m_bReceivedAny ? m_remoteAckBits : 0);
+
+	SentDatagram& sent = m_sent[seq & (UDP_SENT_HISTORY - 1)];
+	if (sent.m_bValid && !sent.m_bAcked && !sent.m_bLost)
+	{
+		// a whole history's worth of datagrams has gone since, so it isn't coming back
+		DatagramLost(sent);
+	}
+
+	// the other end doesn't ack a datagram of nothing but acks, so there's nothing to track
+	bool ackOnly = m_datagramMessages.empty();
+	sent.m_seq = seq;
+	sent.m_bValid = !ackOnly;
+	sent.m_bAcked = false;
+	sent.m_bLost = false;
+	sent.m_sendTime = timeNow;
+	sent.m_messageIds.clear();
+
+	for (size_t i = 0; i < m_datagramMessages.size(); ++i)
+	{
+		OutgoingMessage* pMessage = m_datagramMessages[i];
+		if (IsReliable(pMessage->m_header & UdpMessage_ChannelMask))
+		{
+			if (pMessage->m_sendCount > 0) {
+				++m_stats.m_messagesResent;
+			}
+			sent.m_messageIds.push_back(pMessage->m_id);
+		}
+		pMessage->m_lastSendTime = timeNow;
+		pMessage->m_bResendNow = false;
+		++pMessage->m_sendCount;
+	}
+
+	pSocket->SendDatagram(m_addr, m_datagram, m_datagramSize, timeNow);
+
+	m_budget -= (float)m_datagramSize;
+	m_lastSendTime = timeNow;
+	m_bAckOwed = false;
+	if (!ackOnly) {
+		++m_windowSent;
+	}
+	++m_stats.m_datagramsSent;
+
+	m_datagramSize = UDP_HEADER_SIZE;
+	m_datagramMessages.clear();
+	return true;
+}
+
+// ==============================================================
+// UdpSocket
+// ==============================================================
+UdpSocket::UdpSocket()
+{
+	m_nextConnectionId = 0;
+	m_bAcceptConnections = false;
+	m_simLossRate = 0.0f;
+	m_simLatency = 0;
+	m_simJitter = 0;
+}
+
+UdpSocket::~UdpSocket()
+{
+	for (ConnectionMap::iterator it = m_connections.begin(); it != m_connections.end(); ++it)
+	{
+		SAFE_DELETE(it->second);
+	}
+	m_connections.clear();
+}
+
+//
+// UdpSocket::Init									- not described in the book
+//
+bool UdpSocket::Init(unsigned short port)
+{
+	if ((m_sock = socket(PF_INET, SOCK_DGRAM, IPPROTO_UDP)) == INVALID_SOCKET) {
+		return false;
+	}
+
+	struct sockaddr_in sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sin_family = AF_INET;
+	sa.sin_addr.s_addr = htonl(INADDR_ANY);
+	sa.sin_port = htons(port);
+
+	if (bind(m_sock, (struct sockaddr*)&sa, sizeof(sa)) == SOCKET_ERROR)
+	{
+		closesocket(m_sock);
+		m_sock = INVALID_SOCKET;
+		return false;
+	}
+
+	SetBlocking(false);
+	return true;
+}
+
+//
+// UdpSocket::Connect								- not described in the book
+//
+// There's no handshake to wait for - messages can be sent on the connection straight away. The token
+// goes ahead of them, reliably, and the server takes nothing in until it has it.
+//
+int UdpSocket::Connect(unsigned int ip, unsigned short port, unsigned int token)
+{
+	struct sockaddr_in sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sin_family = AF_INET;
+	sa.sin_addr.s_addr = htonl(ip);
+	sa.sin_port = htons(port);
+
+	int connId = AddConnection(sa, token);
+	char tokenData[4];
+	PutU32(tokenData, token);
+	FindConnection(connId)->QueueMessage(UdpChannel_ReliableUnordered, UdpMessage_Hello, tokenData, sizeof(tokenData));
+	return connId;
+}
+
+//
+// UdpSocket::IssueToken								- not described in the book
+//
+// Random, so one client's token says nothing about another's.
+//
+unsigned int UdpSocket::IssueToken(void)
+{
+	std::random_device random;
+	unsigned int token;
+	do
+	{
+		token = (unsigned int)random();
+	} while (token == 0 || m_issuedTokens.find(token) != m_issuedTokens.end());
+
+	m_issuedTokens.insert(token);
+	return token;
+}
+
+void UdpSocket::RevokeToken(unsigned int token)
+{
+	m_issuedTokens.erase(token);
+	Disconnect(FindConnectionByToken(token));
+}
+
+void UdpSocket::Disconnect(int connId)
+{
+	UdpConnection* pConnection = FindConnection(connId);
+	if (pConnection) {
+		pConnection->m_bClosed = true;
+	}
+}
+
+bool UdpSocket::Send(int connId, UdpChannel channel, const char* pData, unsigned int size)
+{
+	UdpConnection* pConnection = FindConnection(connId);
+	if (!pConnection || pConnection->m_bClosed || size > UDP_MAX_MESSAGE_SIZE || channel >= UdpChannel_Count) {
+		return false;
+	}
+	return pConnection->QueueMessage(channel, 0, pData, size);
+}
+
+int UdpSocket::FindConnectionByToken(unsigned int token) const
+{
+	TokenMap::const_iterator findIt = m_tokens.find(token);
+	return (findIt != m_tokens.end()) ? findIt->second : INVALID_SOCKET_ID;
+}
+
+bool UdpSocket::GetStats(int connId, UdpConnectionStats& stats) const
+{
+	UdpConnection* pConnection = FindConnection(connId);
+	if (!pConnection) {
+		return false;
+	}
+
+	stats = pConnection->m_stats;
+	stats.m_rtt = pConnection->GetRtt();
+	stats.m_sendRate = pConnection->GetSendRate();
+	stats.m_reliablePending = pConnection->GetReliablePending();
+	return true;
+}
+
+void UdpSocket::SetNetworkSimulation(float lossRate, unsigned int latencyMs, unsigned int jitterMs)
+{
+	m_simLossRate = lossRate;
+	m_simLatency = latencyMs;
+	m_simJitter = jitterMs;
+}
+
+UdpConnection* UdpSocket::FindConnection(int connId) const
+{
+	ConnectionMap::const_iterator findIt = m_connections.find(connId);
+	return (findIt != m_connections.end()) ? findIt->second : NULL;
+}
+
+int UdpSocket::AddConnection(const sockaddr_in& addr, unsigned int token)
+{
+	int connId = m_nextConnectionId++;
+	m_connections[connId] = Nv_NEW UdpConnection(connId, addr, token, timeGetTime());
+	m_addresses[AddressKey(addr)] = connId;
+	m_tokens[token] = connId;
+	VOnConnect(connId);
+	return connId;
+}
+
+void UdpSocket::RemoveConnection(ConnectionMap::iterator it)
+{
+	UdpConnection* pConnection = it->second;
+	m_addresses.erase(AddressKey(pConnection->m_addr));
+
+	TokenMap::iterator tokenIt = m_tokens.find(pConnection->m_token);
+	if (tokenIt != m_tokens.end() && tokenIt->second == pConnection->m_id) {
+		m_tokens.erase(tokenIt);
+	}
+
+	m_connections.erase(it);
+	VOnDisconnect(pConnection->m_id);
+	SAFE_DELETE(pConnection);
+}
+
+//
+// UdpSocket::VHandleInput							- not described in the book
+//
+// Reads datagrams until there are no more, or enough for one go.
+//
+void UdpSocket::VHandleInput()
+{
+	char buffer[UDP_MTU];
+	unsigned int timeNow = timeGetTime();
+	m_bMoreInput = false;
+
+	for (unsigned int i = 0; i < UDP_MAX_DATAGRAMS_PER_INPUT; ++i)
+	{
+		struct sockaddr_in from;
+		socklen_t fromSize = sizeof(from);
+		int rc = recvfrom(m_sock, buffer, sizeof(buffer), 0, (struct sockaddr*)&from, &fromSize);
+		if (rc == SOCKET_ERROR)
+		{
+			if (Nv_SocketWouldBlock(Nv_GetSocketError())) {
+				return;
+			}
+
+			// WinSock reports an ICMP port unreachable for an earlier send this way - it's no
+			// reason to stop reading from everyone else
+			continue;
+		}
+
+		g_pSocketManager->AddToInbound(rc);
+		if (rc >= UDP_HEADER_SIZE && GetU32(buffer) == MAGIC_NUMBER) {
+			HandleDatagram(from, buffer, rc, timeNow);
+		}
+	}
+
+	m_bMoreInput = true;
+}
+
+void UdpSocket::HandleDatagram(const sockaddr_in& addr, const char* pData, unsigned int size, unsigned int timeNow)
+{
+	UdpConnection* pConnection = NULL;
+
+	AddressMap::iterator findIt = m_addresses.find(AddressKey(addr));
+	if (findIt != m_addresses.end())
+	{
+		pConnection = FindConnection(findIt->second);
+	}
+	else if (m_bAcceptConnections)
+	{
+		pConnection = FindConnection(AcceptConnection(addr, pData, size));
+	}
+
+	if (pConnection && !pConnection->m_bClosed) {
+		pConnection->HandleDatagram(this, pData, size, timeNow);
+	}
+}
+
+//
+// UdpSocket::AcceptConnection						- not described in the book
+//
+// Looks for the hello in a datagram from a new address. Without one, or with a token that wasn't
+// issued or is held by another live connection, the datagram is dropped unacked: a client whose
+// hello was lost resends it with whatever else it hasn't had acked.
+//
+int UdpSocket::AcceptConnection(const sockaddr_in& addr, const char* pData, unsigned int size)
+{
+	unsigned int offset = UDP_HEADER_SIZE;
+	while (offset + UDP_MESSAGE_HEADER_SIZE <= size)
+	{
+		unsigned char header = (unsigned char)pData[offset];
+		unsigned int messageSize = GetU16(pData + offset + 3);
+		const char* pMessage = pData + offset + UDP_MESSAGE_HEADER_SIZE;
+		offset += UDP_MESSAGE_HEADER_SIZE + messageSize;
+		if (offset > size) {
+			break;
+		}
+
+		if ((header & UdpMessage_Hello) && messageSize == 4)
+		{
+			unsigned int token = GetU32(pMessage);
+			if (m_issuedTokens.find(token) == m_issuedTokens.end() || m_tokens.find(token) != m_tokens.end()) {
+				break;
+			}
+			return AddConnection(addr, token);
+		}
+	}
+	return INVALID_SOCKET_ID;
+}
+
+void UdpSocket::HandleMessage(UdpConnection* pConnection, unsigned char header, const char* pData, unsigned int size)
+{
+	// AcceptConnection() already had it, and a connection's token never changes
+	if (header & UdpMessage_Hello) {
+		return;
+	}
+
+	VOnReceive(pConnection->m_id, (UdpChannel)(header & UdpMessage_ChannelMask), pData, size);
+}
+
+//
+// UdpSocket::VUpdate								- not described in the book
+//
+void UdpSocket::VUpdate(unsigned int timeNow)
+{
+	ConnectionMap::iterator it = m_connections.begin();
+	while (it != m_connections.end())
+	{
+		ConnectionMap::iterator next = it;
+		++next;
+
+		UdpConnection* pConnection = it->second;
+		if (pConnection->m_bClosed || timeNow - pConnection->m_lastReceiveTime > UDP_CONNECTION_TIMEOUT) {
+			RemoveConnection(it);
+		}
+		else {
+			pConnection->Update(this, timeNow);
+		}
+
+		it = next;
+	}
+
+	// datagrams the network simulation has been holding back
+	std::list<DelayedDatagram>::iterator delayedIt = m_delayed.begin();
+	while (delayedIt != m_delayed.end())
+	{
+		if ((int)(timeNow - delayedIt->m_sendTime) >= 0)
+		{
+			sendto(m_sock, &delayedIt->m_data[0], (int)delayedIt->m_data.size(), Nv_SEND_FLAGS, (struct sockaddr*)&delayedIt->m_addr, sizeof(delayedIt->m_addr));
+			delayedIt = m_delayed.erase(delayedIt);
+		}
+		else {
+			++delayedIt;
+		}
+	}
+}
+
+//
+// UdpSocket::SendDatagram							- not described in the book
+//
+// A datagram that won't go because the socket's buffer is full is just lost, as it might be anywhere else
+// along the way.
+//
+void UdpSocket::SendDatagram(const sockaddr_in& addr, const char* pData, unsigned int size, unsigned int timeNow)
+{
+	g_pSocketManager->AddToOutbound(size);
+
+	if (m_simLossRate > 0.0f || m_simLatency > 0 || m_simJitter > 0)
+	{
+		if (m_random.Random() < m_simLossRate) {
+			return;
+		}
+
+		if (m_simLatency > 0 || m_simJitter > 0)
+		{
+			m_delayed.push_back(DelayedDatagram());
+			DelayedDatagram& delayed = m_delayed.back();
+			delayed.m_sendTime = timeNow + m_simLatency + (m_simJitter ? m_random.Random(m_simJitter + 1) : 0);
+			delayed.m_addr = addr;
+			delayed.m_data.assign(pData, pData + size);
+			return;
+		}
+	}
+
+	sendto(m_sock, pData, (int)size, Nv_SEND_FLAGS, (const struct sockaddr*)&addr, sizeof(addr));
+}
+
+// ==============================================================
+// UdpEventSocket
+// ==============================================================
+void UdpEventSocket::VOnReceive(int connId, UdpChannel channel, const char* pData, unsigned int size)
+{
+	if (size < 1) {
+		return;
+	}
+
+	switch ((unsigned char)pData[0])
+	{
+		case BINARY_EVENT_MESSAGE_TAG:
+			break;
+
+		case SNAPSHOT_MESSAGE_TAG:
+			if (m_pSnapshotReceiver) {
+				m_pSnapshotReceiver->HandleSnapshot(connId, pData, size);
+			}
+			return;
+
+		case SNAPSHOT_ACK_MESSAGE_TAG:
+			if (m_pSnapshotReplicator) {
+				m_pSnapshotReplicator->HandleAck(connId, pData, size);
+			}
+			return;
+
+		default:
+			return;
+	}
+
+	EventDeltaCache* pDeltaCache = (channel == UdpChannel_ReliableOrdered) ? &m_deltaCaches[connId] : NULL;
+	RemoteEventSocket::CreateBinaryEvent(pData, size, pDeltaCache);
+}
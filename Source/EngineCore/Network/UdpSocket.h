@@ -0,0 +1,174 @@
+#pragma once
+
+// ================================================================
+// UdpSocket.h : Datagram transport with reliability channels, for state that shouldn't wait on TCP
+// ================================================================
+
+#include "Network.h"
+#include "../Utilities/Math.h"
+#include <set>
+
+#define UDP_MTU (1200)								// biggest datagram sent - stays clear of fragmentation on any sane path
+#define UDP_HEADER_SIZE (12)						// protocol id, sequence, ack, ack bits
+#define UDP_MESSAGE_HEADER_SIZE (5)					// channel, message sequence, size
+#define UDP_MAX_MESSAGE_SIZE (UDP_MTU - UDP_HEADER_SIZE - UDP_MESSAGE_HEADER_SIZE)
+#define UDP_SENT_HISTORY (256)						// datagrams remembered for acks; must be a power of two
+#define UDP_MAX_RELIABLE_PENDING (4096)				// messages waiting on an ack before Send() refuses more
+#define UDP_RECEIVE_WINDOW (1024)					// how far ahead of the next expected message a reliable one may be
+
+#define UDP_CONNECTION_TIMEOUT (10 * 1000)			// ms without hearing anything before a connection is dropped
+#define UDP_KEEPALIVE_INTERVAL (250)				// ms without sending anything before a bare ack goes out anyway
+#define UDP_MIN_RESEND_TIME (30)					// ms before a reliable message may be sent again
+#define UDP_MAX_RESEND_TIME (1000)
+
+#define UDP_DEFAULT_SEND_RATE (64 * 1024)			// bytes/sec a connection starts out allowed
+#define UDP_MIN_SEND_RATE (8 * 1024)
+#define UDP_MAX_SEND_RATE (2 * 1024 * 1024)
+#define UDP_SEND_RATE_STEP (8 * 1024)				// added each round trip the rate was all used and loss stayed low
+#define UDP_SEND_BURST_TIME (50)					// ms of the send rate that can build up unspent
+#define UDP_LOSS_TOLERANCE (0.15f)					// smoothed loss the rate doesn't back off for
+
+//
+// struct UdpConnectionStats						- not described in the book
+//
+struct UdpConnectionStats
+{
+	unsigned int m_rtt;					// smoothed round trip time, ms
+	unsigned int m_sendRate;			// bytes/sec the connection is allowed right now
+	unsigned int m_datagramsSent;
+	unsigned int m_datagramsReceived;
+	unsigned int m_datagramsLost;		// sent and never acked
+	unsigned int m_messagesResent;
+	unsigned int m_messagesDropped;		// unreliable messages the send rate had no room for
+	unsigned int m_reliablePending;		// reliable messages not acked yet
+};
+
+class UdpConnection;
+class SnapshotReplicator;
+class SnapshotReceiver;
+
+//
+// class UdpSocket									- not described in the book
+//
+// One datagram socket carrying any number of connections, each to a remote address. A connection's
+// messages go out in three channels (see UdpChannel) and every datagram carries acks for the last 32
+// datagrams received, so reliable messages are resent - as messages, in whatever datagram goes next -
+// only once the datagram they were in is known to be lost, or goes unacked for too long.
+//
+// Messages sent during a tick are gathered into datagrams of up to UDP_MTU bytes when VUpdate() runs,
+// which the socket manager calls from DoSelect(). The bytes a connection may send are metered by a
+// rate that creeps up while it's all used and loss is low, and backs off while loss stays high;
+// reliable messages wait for the rate, unreliable ones left over are dropped since a newer one will
+// be along.
+//
+// Connections are made by Connect() on the client. The server gets a random token from IssueToken()
+// for each TCP session and sends it to the client over TCP; the client gives it to Connect(), which
+// sends it ahead of everything else in a hello. With SetAcceptConnections() on, the server makes a
+// connection for a new address only once a datagram from it brings a hello with an issued token that
+// no live connection holds - anything else from an address it doesn't know is dropped without an ack,
+// so there are no half-made connections to time out or run out of. FindConnectionByToken() looks the
+// connection up by its token, which ties it to the TCP session at both ends. RevokeToken() when the
+// TCP session ends closes the connection, and the token can't be used again.
+//
+class UdpSocket : public NetSocket
+{
+	typedef std::map<int, UdpConnection*> ConnectionMap;
+	typedef std::map<unsigned long long, int> AddressMap;
+	typedef std::map<unsigned int, int> TokenMap;
+
+	struct DelayedDatagram
+	{
+		unsigned int m_sendTime;
+		sockaddr_in m_addr;
+		std::vector<char> m_data;
+	};
+
+public:
+	UdpSocket();
+	virtual ~UdpSocket();
+
+	// port 0 binds to whatever the OS picks, which is all a client needs
+	bool Init(unsigned short port = 0);
+
+	int Connect(unsigned int ip, unsigned short port, unsigned int token);
+	void Disconnect(int connId);
+	void SetAcceptConnections(bool accept) { m_bAcceptConnections = accept; }
+
+	// server side - the tokens accepted connections have to give
+	unsigned int IssueToken(void);
+	void RevokeToken(unsigned int token);
+
+	// Copies the message to go out at the next VUpdate(). Fails for a message over UDP_MAX_MESSAGE_SIZE,
+	// an unknown connection, or one with UDP_MAX_RELIABLE_PENDING reliable messages unacked.
+	bool Send(int connId, UdpChannel channel, const char* pData, unsigned int size);
+
+	int FindConnectionByToken(unsigned int token) const;
+	bool GetStats(int connId, UdpConnectionStats& stats) const;
+
+	// For testing over loopback: drops the given fraction of outgoing datagrams and holds the rest
+	// back for latency ms, give or take up to jitter ms. Zeros turn it off.
+	void SetNetworkSimulation(float lossRate, unsigned int latencyMs, unsigned int jitterMs);
+
+	virtual void VHandleInput();
+	virtual void VUpdate(unsigned int timeNow);
+
+protected:
+	// Disconnect() is fine from in here; the connection goes at the next VUpdate().
+	virtual void VOnConnect(int connId) { }
+	virtual void VOnDisconnect(int connId) { }
+	virtual void VOnReceive(int connId, UdpChannel channel, const char* pData, unsigned int size) { }
+
+private:
+	UdpConnection* FindConnection(int connId) const;
+	int AddConnection(const sockaddr_in& addr, unsigned int token);
+	void RemoveConnection(ConnectionMap::iterator it);
+
+	void HandleDatagram(const sockaddr_in& addr, const char* pData, unsigned int size, unsigned int timeNow);
+	int AcceptConnection(const sockaddr_in& addr, const char* pData, unsigned int size);
+	void HandleMessage(UdpConnection* pConnection, unsigned char header, const char* pData, unsigned int size);
+	void SendDatagram(const sockaddr_in& addr, const char* pData, unsigned int size, unsigned int timeNow);
+
+	ConnectionMap m_connections;
+	AddressMap m_addresses;
+	TokenMap m_tokens;								// tokens bound to a live connection
+	std::set<unsigned int> m_issuedTokens;
+	int m_nextConnectionId;
+	bool m_bAcceptConnections;
+
+	float m_simLossRate;
+	unsigned int m_simLatency, m_simJitter;
+	std::list<DelayedDatagram> m_delayed;
+	NvRandom m_random;
+
+	friend class UdpConnection;
+};
+
+//
+// class UdpEventSocket								- not described in the book
+//
+// Turns messages into events the way RemoteEventSocket does for TCP - a NetworkEventForwarder with
+// SetUdpSocket() called on it sends them. Only the binary codec goes over UDP. Reliable ordered
+// messages can be delta coded like TCP ones, since they can't be lost or reordered; the other
+// channels always carry whole events.
+//
+// Snapshots and their acks come in here too, and are handed to whichever of a SnapshotReplicator
+// (on the server) or a SnapshotReceiver (on the client) has been set.
+//
+class UdpEventSocket : public UdpSocket
+{
+	typedef std::map<int, EventDeltaCache> DeltaCacheMap;
+	DeltaCacheMap m_deltaCaches;					// per connection, for UdpChannel_ReliableOrdered
+
+	SnapshotReplicator* m_pSnapshotReplicator;
+	SnapshotReceiver* m_pSnapshotReceiver;
+
+public:
+	UdpEventSocket() { m_pSnapshotReplicator = NULL; m_pSnapshotReceiver = NULL; }
+
+	void SetSnapshotReplicator(SnapshotReplicator* pReplicator) { m_pSnapshotReplicator = pReplicator; }
+	void SetSnapshotReceiver(SnapshotReceiver* pReceiver) { m_pSnapshotReceiver = pReceiver; }
+
+protected:
+	virtual void VOnDisconnect(int connId) { m_deltaCaches.erase(connId); }
+	virtual void VOnReceive(int connId, UdpChannel channel, const char* pData, unsigned int size);
+};
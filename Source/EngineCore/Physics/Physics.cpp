@@ -7,8 +7,10 @@
 #include "Physics.h"
 #include "../Actors/Actor.h"
 #include "../Actors/TransformComponent.h"
+#include "../Actors/ComponentStore.h"
 #include "../ResourceCache/XmlResource.h"
 #include "../EventManager/EventManager.h"
+#include "../Memory/FrameArena.h"
 
 // ==============================================================
 // g_Materials Description
@@ -236,8 +238,11 @@ class BulletPhysics : public IGamePhysics, Nv_noncopyable
 	//  they are added to m_previousTickCollisionPairs and an event is sent.
 	//  When the pair is no longer detected, they are removed and another event
 	//  is sent.
+	//  The pairs are kept sorted in a vector, which holds on to its memory from
+	//  tick to tick; the per tick working sets live in the frame arena.
 	typedef std::pair<btRigidBody const *, btRigidBody const *> CollisionPair;
-	typedef std::set<CollisionPair> CollisionPairs;
+	typedef std::vector<CollisionPair> CollisionPairs;
+	typedef FrameVector<CollisionPair>::type FrameCollisionPairs;
 	CollisionPairs m_previousTickCollisionPairs;
 
 	// helpers for sending events relating to collision pairs.
@@ -363,6 +368,8 @@ void BulletPhysics::LoadXml()
 // ==============================================================================
 bool BulletPhysics::VInitialize()
 {
+	Nv_MEMORY_TAG_SCOPE(MEMTAG_PHYSICS);
+
 	LoadXml();
 
 	// this controls how Bullet does internal memory management during the collision pass
@@ -410,6 +417,8 @@ bool BulletPhysics::VInitialize()
 // ==============================================================================
 void BulletPhysics::VOnUpdate(float const deltaSeconds)
 {
+	Nv_MEMORY_TAG_SCOPE(MEMTAG_PHYSICS);
+
 	// Bullet uses an internal fixed timestep (default 1/60th of a second)
 	//  We pass in 4 as a max number of sub steps. Bullet will run the simulation
 	//	in increments of the fixed timestep until "deltaSeconds" amount of time has
@@ -426,6 +435,7 @@ void BulletPhysics::VSyncVisibleScene()
 
 	// check all the existing actor's bodies for changes.
 	// If there is a change, send the appropriate event for the game system.
+	ComponentStore* pStore = g_pApp->m_pGame->GetComponentStore();
 	for (ActorIDToBulletRigidBodyMap::const_iterator it = m_actorIdToRigidBody.begin();
 		it != m_actorIdToRigidBody.end();
 		++it)
@@ -438,6 +448,19 @@ void BulletPhysics::VSyncVisibleScene()
 		ActorMotionState const* const actorMotionState = static_cast<ActorMotionState*>(it->second->getMotionState());
 		//Nv_ASSERT(actorMotionState);
 
+		// the transform array is reached straight from the id, without going through the actor at all
+		Mat4x4* pTransform = pStore ? pStore->FindTransformById(id) : NULL;
+		if (pTransform && actorMotionState)
+		{
+			if (*pTransform != actorMotionState->m_worldToPositionTransform)
+			{
+				*pTransform = actorMotionState->m_worldToPositionTransform;
+				std::shared_ptr<EvtData_Move_Actor> pEvent(MakePooledEvent<EvtData_Move_Actor>(id, actorMotionState->m_worldToPositionTransform));
+				IEventManager::Get()->VQueueEvent(pEvent);
+			}
+			continue;
+		}
+
 		StrongActorPtr pGameActor = MakeStrongPtr(g_pApp->m_pGame->VGetActor(id));
 		if (pGameActor && actorMotionState)
 		{
@@ -448,7 +471,8 @@ void BulletPhysics::VSyncVisibleScene()
 				{
 					// Bullet has moved the actor's physics object. Sync the transform and inform the game an actor has moved.
 					pTransformComponent->SetTransform(actorMotionState->m_worldToPositionTransform);
-					std::shared_ptr<EvtData_Move_Actor> pEvent(Nv_NEW EvtData_Move_Actor(id, actorMotionState->m_worldToPositionTransform));
+					// one of these per moving actor per frame - pooled, so it doesn't touch the heap
+					std::shared_ptr<EvtData_Move_Actor> pEvent(MakePooledEvent<EvtData_Move_Actor>(id, actorMotionState->m_worldToPositionTransform));
 					IEventManager::Get()->VQueueEvent(pEvent);
 				}
 			}
@@ -518,20 +542,20 @@ void BulletPhysics::RemoveCollisionObject(btCollisionObject* const removeMe)
 	m_dynamicsWorld->removeCollisionObject(removeMe);
 
 	// then remove the pointer from the ongoing contacts list.
+	CollisionPairs::iterator keepIt = m_previousTickCollisionPairs.begin();
 	for (CollisionPairs::iterator it = m_previousTickCollisionPairs.begin();
-		it != m_previousTickCollisionPairs.end(); )
+		it != m_previousTickCollisionPairs.end(); ++it)
 	{
-		CollisionPairs::iterator next = it;
-		++next;
-
 		if (it->first == removeMe || it->second == removeMe)
 		{
 			SendCollisionPairRemoveEvent(it->first, it->second);
-			m_previousTickCollisionPairs.erase(it);
 		}
-
-		it = next;
+		else
+		{
+			*keepIt++ = *it;
+		}
 	}
+	m_previousTickCollisionPairs.erase(keepIt, m_previousTickCollisionPairs.end());
 
 	// if the object is a RigidBody (all of ours are RigidBodies, but it's good to be safe)
 	if (btRigidBody * const body = btRigidBody::upcast(removeMe))
@@ -926,10 +950,13 @@ void BulletPhysics::BulletInternalTickCallback(btDynamicsWorld* const world, btS
 	//Nv_ASSERT(world->getWorldUserInfo());
 	BulletPhysics* const bulletPhysics = static_cast<BulletPhysics*>(world->getWorldUserInfo());
 
-	CollisionPairs currentTickCollisionPairs;
+	// there can be several internal ticks a frame, so give the working sets back after each one
+	ScopedFrameArena frameScope;
+	FrameCollisionPairs currentTickCollisionPairs;
 
 	// look at all existing contacts
 	btDispatcher* const dispatcher = world->getDispatcher();
+	currentTickCollisionPairs.reserve(dispatcher->getNumManifolds());
 	for (int manifoldIdx = 0; manifoldIdx < dispatcher->getNumManifolds(); ++manifoldIdx)
 	{
 		// get the "manifold", which is the set of data corresponding to a contact point
@@ -951,23 +978,27 @@ void BulletPhysics::BulletInternalTickCallback(btDynamicsWorld* const world, btS
 		btRigidBody const * const sortedBodyB = swapped ? body0 : body1;
 
 		CollisionPair const thisPair = std::make_pair(sortedBodyA, sortedBodyB);
-		currentTickCollisionPairs.insert(thisPair);
+		currentTickCollisionPairs.push_back(thisPair);
 
-		if (bulletPhysics->m_previousTickCollisionPairs.find(thisPair) == bulletPhysics->m_previousTickCollisionPairs.end())
+		if (!std::binary_search(bulletPhysics->m_previousTickCollisionPairs.begin(), bulletPhysics->m_previousTickCollisionPairs.end(), thisPair))
 		{
 			// this is a new contact, which wasn't in our list before. send an event to the game.
 			bulletPhysics->SendCollisionPairAddEvent(manifold, body0, body1);
 		}
 	}
 
-	CollisionPairs removedCollisionPairs;
+	// sort the pairs and drop duplicates, which is what the set used to do
+	std::sort(currentTickCollisionPairs.begin(), currentTickCollisionPairs.end());
+	currentTickCollisionPairs.erase(std::unique(currentTickCollisionPairs.begin(), currentTickCollisionPairs.end()), currentTickCollisionPairs.end());
+
+	FrameCollisionPairs removedCollisionPairs;
 
 	// use the STL set difference function to find collision pairs that existed during the previous tick but not any more
 	std::set_difference(bulletPhysics->m_previousTickCollisionPairs.begin(), bulletPhysics->m_previousTickCollisionPairs.end(),
 						currentTickCollisionPairs.begin(), currentTickCollisionPairs.end(),
-						std::inserter(removedCollisionPairs, removedCollisionPairs.begin()));
+						std::back_inserter(removedCollisionPairs));
 
-	for (CollisionPairs::const_iterator it = removedCollisionPairs.begin(),
+	for (FrameCollisionPairs::const_iterator it = removedCollisionPairs.begin(),
 		end = removedCollisionPairs.end(); it != end; ++it)
 	{
 		btRigidBody const * const body0 = it->first;
@@ -977,7 +1008,7 @@ void BulletPhysics::BulletInternalTickCallback(btDynamicsWorld* const world, btS
 	}
 
 	// the current tick becomes the previous tick. this is the way of all things.
-	bulletPhysics->m_previousTickCollisionPairs = currentTickCollisionPairs;
+	bulletPhysics->m_previousTickCollisionPairs.assign(currentTickCollisionPairs.begin(), currentTickCollisionPairs.end());
 }
 
 void BulletPhysics::SendCollisionPairAddEvent(btPersistentManifold const * manifold, btRigidBody const * const body0, btRigidBody const * const body1)
@@ -1002,7 +1033,7 @@ void BulletPhysics::SendCollisionPairAddEvent(btPersistentManifold const * manif
 
 		// send the trigger event.
 		int const triggerId = *static_cast<int*>(triggerBody->getUserPointer());
-		std::shared_ptr<EvtData_PhysTrigger_Enter> pEvent(Nv_NEW EvtData_PhysTrigger_Enter(triggerId, FindActorID(otherBody)));
+		std::shared_ptr<EvtData_PhysTrigger_Enter> pEvent(MakePooledEvent<EvtData_PhysTrigger_Enter>(triggerId, FindActorID(otherBody)));
 		IEventManager::Get()->VQueueEvent(pEvent);
 	}
 	else
@@ -1057,7 +1088,7 @@ void BulletPhysics::SendCollisionPairRemoveEvent(btRigidBody const * const body0
 
 		// send the trigger event.
 		int const triggerId = *static_cast<int*>(triggerBody->getUserPointer());
-		std::shared_ptr<EvtData_PhysTrigger_Leave> pEvent(Nv_NEW EvtData_PhysTrigger_Leave(triggerId, FindActorID(otherBody)));
+		std::shared_ptr<EvtData_PhysTrigger_Leave> pEvent(MakePooledEvent<EvtData_PhysTrigger_Leave>(triggerId, FindActorID(otherBody)));
 		IEventManager::Get()->VQueueEvent(pEvent);
 	}
 	else
@@ -1071,7 +1102,7 @@ void BulletPhysics::SendCollisionPairRemoveEvent(btRigidBody const * const body0
 			return;
 		}
 
-		std::shared_ptr<EvtData_PhysSeparation> pEvent(Nv_NEW EvtData_PhysSeparation(id0, id1));
+		std::shared_ptr<EvtData_PhysSeparation> pEvent(MakePooledEvent<EvtData_PhysSeparation>(id0, id1));
 		IEventManager::Get()->VQueueEvent(pEvent);
 	}
 }
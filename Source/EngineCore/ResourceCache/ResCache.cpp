@@ -5,6 +5,7 @@
 #include "ResCache.h"
 
 #include "Utilities/String.h"
+#include "../EventManager/Events.h"
 #include <optional>
 #include <functional>
 
@@ -32,14 +33,14 @@ bool ResourceZipFile::VOpen()
 	m_pZipFile = Nv_NEW ZipFile;
 	if (m_pZipFile)
 	{
-		return m_pZipFile->Init(m_resFileName.c_str());
+		return m_pZipFile->Init(m_resFileName.c_str(), m_useMemoryMapping);
 	}
 	return false;
 }
 
 int ResourceZipFile::VGetRawResourceSize(const Resource& r)
 {
-	int resourceNum = m_pZipFile->Find(r.m_name.c_str());
+	int resourceNum = m_pZipFile->Find(r.m_name);
 	if (resourceNum == -1)
 		return -1;
 
@@ -50,7 +51,7 @@ int ResourceZipFile::VGetRawResource(const Resource& r, char* buffer)
 {
 	int size = 0;
 	// Original, used optional<int> resourceNum
-	int resourceNum = m_pZipFile->Find(r.m_name.c_str());
+	int resourceNum = m_pZipFile->Find(r.m_name);
 	if (resourceNum != -1)
 	{
 		size = m_pZipFile->GetFileLen(resourceNum);
@@ -59,6 +60,35 @@ int ResourceZipFile::VGetRawResource(const Resource& r, char* buffer)
 	return size;
 }
 
+const char* ResourceZipFile::VGetRawResourceView(const Resource& r)
+{
+	if (m_pZipFile == nullptr || !m_pZipFile->IsMemoryMapped())
+		return nullptr;
+
+	int resourceNum = m_pZipFile->Find(r.m_name);
+	if (resourceNum == -1)
+		return nullptr;
+
+	return m_pZipFile->GetFileView(resourceNum);
+}
+
+IResourceStream* ResourceZipFile::VOpenResourceStream(const Resource& r)
+{
+	if (m_pZipFile == nullptr)
+		return nullptr;
+
+	int resourceNum = m_pZipFile->Find(r.m_name);
+	if (resourceNum == -1)
+		return nullptr;
+
+	ZipReadStream* pStream = Nv_NEW ZipReadStream(m_pZipFile);
+	if (!pStream->Open(resourceNum))
+	{
+		SAFE_DELETE(pStream);
+	}
+	return pStream;
+}
+
 int ResourceZipFile::VGetNumResources() const
 {
 	return (m_pZipFile == nullptr) ? 0 : m_pZipFile->GetNumFiles();
@@ -96,13 +126,7 @@ DevelopmentResourceZipFile::DevelopmentResourceZipFile(const std::wstring resFil
 
 int DevelopmentResourceZipFile::Find(const std::string &name)
 {
-	std::string lowerCase = name;
-	std::transform(lowerCase.begin(), lowerCase.end(), lowerCase.begin(), (int(*)(int))std::tolower);
-	ZipContentsMap::const_iterator i = m_DirectoryContentsMap.find(lowerCase);
-	if (i == m_DirectoryContentsMap.end())
-		return -1;
-
-	return i->second;
+	return m_DirectoryContentsIndex.Find(name);
 }
 
 bool DevelopmentResourceZipFile::VOpen()
@@ -209,7 +233,8 @@ void DevelopmentResourceZipFile::ReadAssetsDirectory(std::wstring fileSpec)
 				std::wstring lower = fileName;
 				std::transform(lower.begin(), lower.end(), lower.begin(), (int(*)(int))std::tolower);
 				wcscpy_s(&findData.cFileName[0], MAX_PATH, lower.c_str());
-				m_DirectoryContentsMap[ws2s(lower)] = m_AssetFileInfo.size();
+				std::string path = ws2s(lower);
+				m_DirectoryContentsIndex.Insert(path.c_str(), path.length(), (int)m_AssetFileInfo.size());
 				m_AssetFileInfo.push_back(findData);
 			}
 		}
@@ -221,39 +246,289 @@ void DevelopmentResourceZipFile::ReadAssetsDirectory(std::wstring fileSpec)
 //
 // ResHandle::ResHandle					-Chapter 8, page 223
 //
-ResHandle::ResHandle(Resource& resource, char* buffer, unsigned int size, ResCache* pResCache)
+ResHandle::ResHandle(Resource& resource, char* buffer, unsigned int size, ResCache* pResCache, bool ownsBuffer)
 	: m_resource(resource)
 {
 	m_buffer = buffer;
 	m_size = size;
+	m_ownsBuffer = ownsBuffer;
+	m_streaming = false;
 	m_extra = nullptr;
 	m_pResCache = pResCache;
+
+	m_pLruPrev = nullptr;
+	m_pLruNext = nullptr;
+	m_shard = pResCache->ShardIndex(resource.m_name);
+	m_category = pResCache->CategoryIndex(resource.m_name);
+	m_pinCount = 0;
 }
 
 ResHandle::~ResHandle()
 {
-	SAFE_DELETE_ARRAY(m_buffer);
-	m_pResCache->MemoryHasBeenFreed(m_size);
+	// a view into a mapped resource file was never charged to the cache
+	if (m_ownsBuffer)
+	{
+		SAFE_DELETE_ARRAY(m_buffer);
+		m_pResCache->MemoryHasBeenFreed(m_shard, m_category, m_size);
+	}
+}
+
+IResourceStream* ResHandle::OpenStream()
+{
+	return m_streaming ? m_pResCache->OpenStream(m_resource) : nullptr;
+}
+
+//
+// ResHandleLru								- not described in the book
+//
+void ResHandleLru::PushFront(ResHandle* pHandle)
+{
+	pHandle->m_pLruPrev = nullptr;
+	pHandle->m_pLruNext = m_pHead;
+	if (m_pHead)
+		m_pHead->m_pLruPrev = pHandle;
+	else
+		m_pTail = pHandle;
+	m_pHead = pHandle;
+	++m_size;
+}
+
+void ResHandleLru::Remove(ResHandle* pHandle)
+{
+	if (pHandle->m_pLruPrev)
+		pHandle->m_pLruPrev->m_pLruNext = pHandle->m_pLruNext;
+	else
+		m_pHead = pHandle->m_pLruNext;
+
+	if (pHandle->m_pLruNext)
+		pHandle->m_pLruNext->m_pLruPrev = pHandle->m_pLruPrev;
+	else
+		m_pTail = pHandle->m_pLruPrev;
+
+	pHandle->m_pLruPrev = nullptr;
+	pHandle->m_pLruNext = nullptr;
+	--m_size;
+}
+
+void ResHandleLru::MoveToFront(ResHandle* pHandle)
+{
+	if (pHandle == m_pHead)
+		return;
+
+	Remove(pHandle);
+	PushFront(pHandle);
+}
+
+void ResHandleLru::Clear()
+{
+	// handles can outlive the cache, so leave none of them pointing into the list
+	ResHandle* pHandle = m_pHead;
+	while (pHandle)
+	{
+		ResHandle* pNext = pHandle->m_pLruNext;
+		pHandle->m_pLruPrev = nullptr;
+		pHandle->m_pLruNext = nullptr;
+		pHandle = pNext;
+	}
+
+	m_pHead = nullptr;
+	m_pTail = nullptr;
+	m_size = 0;
+}
+
+//
+// ResLoadTicket							- not described in the book
+//
+ResLoadTicket::ResLoadTicket(const Resource& resource, int priority)
+	: m_resource(resource)
+{
+	m_priority = priority;
+	m_taken = false;
+	m_state = Pending;
+	m_hDone = CreateEvent(NULL, TRUE, FALSE, NULL);
+
+	m_pCache = nullptr;
+	m_pRawBuffer = nullptr;
+	m_rawSize = 0;
+	m_bRawView = false;
+	m_hRead = CreateEvent(NULL, TRUE, FALSE, NULL);
+}
+
+ResLoadTicket::~ResLoadTicket()
+{
+	if (!m_bRawView)
+	{
+		SAFE_DELETE_ARRAY(m_pRawBuffer);
+	}
+	CloseHandle(m_hRead);
+	CloseHandle(m_hDone);
+}
+
+std::shared_ptr<ResHandle> ResLoadTicket::Wait()
+{
+	// m_hDone comes first, so once the load is done it's all WaitForMultipleObjects() sees
+	HANDLE handles[] = { m_hDone, m_hRead };
+	while (!IsReady())
+	{
+		if (WaitForMultipleObjects(_countof(handles), handles, FALSE, INFINITE) == WAIT_OBJECT_0 + 1)
+		{
+			// read, and waiting for its loader to run on the game thread - which is this one
+			m_pCache->FinishGameThreadLoad(GetName());
+		}
+	}
+	return m_handle;
+}
+
+void ResLoadTicket::Complete(std::shared_ptr<ResHandle> handle)
+{
+	// the handle has to be visible before the state flips, IsReady() doesn't take a lock
+	m_handle = handle;
+	InterlockedExchange(&m_state, handle ? Loaded : Failed);
+	SetEvent(m_hDone);
+}
+
+//
+// ResCacheCategory							- not described in the book
+//
+ResCacheCategory::ResCacheCategory(const std::string& name, unsigned __int64 softLimit, unsigned __int64 hardLimit)
+	: m_name(name)
+{
+	m_softLimit = softLimit;
+	m_hardLimit = hardLimit;
+
+	m_allocated = 0;
+	m_peakAllocated = 0;
+	m_pinned = 0;
+	m_hits = 0;
+	m_misses = 0;
+	m_evictions = 0;
+	m_loads = 0;
+	m_failedLoads = 0;
+	m_bytesLoaded = 0;
+	for (int i = 0; i < ResCacheCategoryStats::LOAD_TIME_BUCKETS; ++i)
+	{
+		m_loadTimeHistogram[i] = 0;
+	}
+}
+
+bool ResCacheCategory::Matches(const std::string& name) const
+{
+	for (size_t i = 0; i < m_patterns.size(); ++i)
+	{
+		if (WildcardMatch(m_patterns[i].c_str(), name.c_str()))
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+void ResCacheCategory::AddAllocated(LONG64 size)
+{
+	LONG64 allocated = InterlockedExchangeAdd64(&m_allocated, size) + size;
+
+	LONG64 peak = m_peakAllocated;
+	while (allocated > peak)
+	{
+		LONG64 seen = InterlockedCompareExchange64(&m_peakAllocated, allocated, peak);
+		if (seen == peak)
+		{
+			break;
+		}
+		peak = seen;
+	}
+}
+
+void ResCacheCategory::AddLoad(unsigned __int64 bytes, double milliseconds)
+{
+	InterlockedIncrement64(&m_loads);
+	InterlockedExchangeAdd64(&m_bytesLoaded, (LONG64)bytes);
+
+	// bucket i holds the loads that took less than 2^i ms, the last one everything slower
+	int bucket = 0;
+	for (double limit = 1.0; bucket < ResCacheCategoryStats::LOAD_TIME_BUCKETS - 1 && milliseconds >= limit; limit *= 2.0)
+	{
+		++bucket;
+	}
+	InterlockedIncrement64(&m_loadTimeHistogram[bucket]);
+}
+
+// a 64 bit read isn't atomic on 32 bit builds
+static unsigned __int64 ReadCounter(const volatile LONG64& counter)
+{
+	return (unsigned __int64)InterlockedCompareExchange64(const_cast<volatile LONG64*>(&counter), 0, 0);
+}
+
+void ResCacheCategory::GetStats(ResCacheCategoryStats& stats) const
+{
+	stats.m_name = m_name;
+	stats.m_softLimit = m_softLimit;
+	stats.m_hardLimit = m_hardLimit;
+	stats.m_allocated = ReadCounter(m_allocated);
+	stats.m_peakAllocated = ReadCounter(m_peakAllocated);
+	stats.m_pinned = ReadCounter(m_pinned);
+	stats.m_hits = ReadCounter(m_hits);
+	stats.m_misses = ReadCounter(m_misses);
+	stats.m_evictions = ReadCounter(m_evictions);
+	stats.m_loads = ReadCounter(m_loads);
+	stats.m_failedLoads = ReadCounter(m_failedLoads);
+	stats.m_bytesLoaded = ReadCounter(m_bytesLoaded);
+	for (int i = 0; i < ResCacheCategoryStats::LOAD_TIME_BUCKETS; ++i)
+	{
+		stats.m_loadTimeHistogram[i] = ReadCounter(m_loadTimeHistogram[i]);
+	}
 }
 
 //
 // ResCache
 //
-ResCache::ResCache(const unsigned int sizeInMb, IResourceFile* resFile)
+ResCache::ResCache(const unsigned int sizeInMb, IResourceFile* resFile, unsigned int numShards)
 {
-	m_cacheSize = sizeInMb * 1024 * 1024;					// total memory size
-	m_allocated = 0;										// total memory allocated
+	m_cacheSize = (unsigned __int64)sizeInMb * 1024 * 1024;	// total memory size
+	m_allocated = 0;
 	m_file = resFile;
+
+	LARGE_INTEGER frequency;
+	QueryPerformanceFrequency(&frequency);
+	m_ticksPerMs = (double)frequency.QuadPart / 1000.0;
+
+	// everything no other category claims
+	m_categories.push_back(Nv_NEW ResCacheCategory("default", 0, 0));
+
+	if (numShards == 0)
+	{
+		numShards = 1;
+	}
+
+	for (unsigned int i = 0; i < numShards; ++i)
+	{
+		m_shards.push_back(Nv_NEW ResCacheShard);
+	}
+
+	m_loadSequence = 0;
+	m_hLoadsQueued = NULL;
+	m_stopLoaders = 0;
 }
 
 
 ResCache::~ResCache()
 {
-	while (!m_lru.empty())
+	StopAsyncLoading();
+
+	Flush();
+	SAFE_DELETE(m_file);
+
+	for (size_t i = 0; i < m_shards.size(); ++i)
 	{
-		FreeOneResource();
+		SAFE_DELETE(m_shards[i]);
 	}
-	SAFE_DELETE(m_file);
+	m_shards.clear();
+
+	for (size_t i = 0; i < m_categories.size(); ++i)
+	{
+		SAFE_DELETE(m_categories[i]);
+	}
+	m_categories.clear();
 }
 
 bool ResCache::Init()
@@ -278,205 +553,954 @@ void ResCache::RegisterLoader(std::shared_ptr<IResourceLoader> loader)
 	m_resourceLoaders.push_front(loader);
 }
 
-std::shared_ptr<ResHandle> ResCache::GetHandle(Resource* r)
+//
+// ResCache::AddCategory							- not described in the book
+//
+int ResCache::AddCategory(const std::string& name, const std::string& pattern, unsigned __int64 softLimit, unsigned __int64 hardLimit)
 {
-	std::shared_ptr<ResHandle> handle(Find(r));
-	if (handle == nullptr)
+	if (m_categories.size() >= ResCacheShard::MAX_CATEGORIES || FindCategory(name) != -1)
 	{
-		handle = Load(r);
-		//Nv_ASSERT(handle);
-	}
-	else
-	{
-		Update(handle);
+		return -1;
 	}
-	return handle;
+
+	ResCacheCategory* pCategory = Nv_NEW ResCacheCategory(name, softLimit, hardLimit);
+	m_categories.push_back(pCategory);
+
+	int category = (int)m_categories.size() - 1;
+	AddCategoryPattern(category, pattern);
+	return category;
 }
 
-std::shared_ptr<ResHandle> ResCache::Load(Resource* r)
+bool ResCache::AddCategoryPattern(int category, const std::string& pattern)
 {
-	// Create a new resource and add it to the lru list and map
+	// the default category catches whatever is left, it doesn't match anything itself
+	if (category <= 0 || category >= (int)m_categories.size())
+	{
+		return false;
+	}
 
-	std::shared_ptr<IResourceLoader> loader;
-	std::shared_ptr<ResHandle> handle;
+	// resource names are lower case
+	std::string lower = pattern;
+	std::transform(lower.begin(), lower.end(), lower.begin(), (int(*)(int))std::tolower);
+	m_categories[category]->m_patterns.push_back(lower);
+	return true;
+}
 
-	for (ResourceLoaders::iterator it = m_resourceLoaders.begin(); it != m_resourceLoaders.end(); ++it)
+int ResCache::FindCategory(const std::string& name) const
+{
+	for (size_t i = 0; i < m_categories.size(); ++i)
 	{
-		std::shared_ptr<IResourceLoader> testLoader = *it;
+		if (m_categories[i]->m_name == name)
+		{
+			return (int)i;
+		}
+	}
+	return -1;
+}
 
-		if (WildcardMatch(testLoader->VGetPattern().c_str(), r->m_name.c_str()))
+unsigned int ResCache::CategoryIndex(const std::string& name) const
+{
+	for (size_t i = 1; i < m_categories.size(); ++i)
+	{
+		if (m_categories[i]->Matches(name))
 		{
-			loader = testLoader;
-			break;
+			return (unsigned int)i;
 		}
 	}
+	return 0;
+}
 
-	if (!loader)
+std::shared_ptr<ResHandle> ResCache::GetHandle(Resource* r)
+{
+	// a hit only takes the lock of the shard the resource lives in
+	std::shared_ptr<ResHandle> handle = Find(r);
+	if (handle)
 	{
-		//Nv_ASSERT(loader && _T("Default resource loader not found!"));
-		return handle;			// Resource not loaded!!
+		InterlockedIncrement64(&m_categories[handle->m_category]->m_hits);
+		return handle;
 	}
 
-	int rawSize = m_file->VGetRawResourceSize(*r);
-	if (rawSize < 0)
+	ResLoadTicketPtr pendingTicket;
+	bool stolen = false;
 	{
-		//Nv_ASSERT(rawSize > 0 && "Resource size returned -1 - Resource not found");
-		return std::shared_ptr<ResHandle>();
+		// Look again with the load lock held - a loader thread publishes the handle before it
+		// drops the pending entry, so one of the two is always visible here.
+		ScopedCriticalSection locker(m_loadCs);
+		handle = Find(r);
+		if (handle)
+		{
+			InterlockedIncrement64(&m_categories[handle->m_category]->m_hits);
+			return handle;
+		}
+
+		// If the resource is already in the async queue, don't read it a second time. A loader
+		// thread that is working on it gets waited on, otherwise we steal the request.
+		ResLoadTicketMap::iterator pendingIt = m_pendingLoads.find(r->m_name);
+		if (pendingIt != m_pendingLoads.end())
+		{
+			pendingTicket = pendingIt->second;
+			if (pendingTicket->m_taken)
+			{
+				stolen = false;
+			}
+			else
+			{
+				pendingTicket->m_taken = true;
+				stolen = true;
+			}
+		}
 	}
 
-	int allocSize = rawSize + ((loader->VAddNullZero()) ? (1) : (0));
-	char* rawBuffer = loader->VUseRawFile() ? Allocate(allocSize) : Nv_NEW char[allocSize];
-	memset(rawBuffer, 0, allocSize);
+	InterlockedIncrement64(&m_categories[CategoryIndex(r->m_name)]->m_misses);
 
-	if (rawBuffer == nullptr || m_file->VGetRawResource(*r, rawBuffer) == 0)
+	if (pendingTicket && !stolen)
 	{
-		// resource cache out of memory
-		return std::shared_ptr<ResHandle>();
+		return pendingTicket->Wait();
 	}
 
-	char *buffer = nullptr;
-	unsigned int size = 0;
+	handle = Load(r);
+	//Nv_ASSERT(handle);
 
-	if (loader->VUseRawFile())
+	if (pendingTicket)
 	{
-		buffer = rawBuffer;
-		handle = std::shared_ptr<ResHandle>(Nv_NEW ResHandle(*r, buffer, rawSize, this));
+		CompleteLoadRequest(pendingTicket, handle);
 	}
-	else
+	return handle;
+}
+
+//
+// ResCache::GetHandleAsync							- not described in the book
+//
+ResLoadTicketPtr ResCache::GetHandleAsync(Resource* r, int priority)
+{
+	ResLoadTicketPtr ticket;
+	bool loadNow = false;
 	{
-		size = loader->VGetLoadedResourceSize(rawBuffer, rawSize);
-		buffer = Allocate(size);
-		if (rawBuffer == nullptr || buffer == nullptr)
+		ScopedCriticalSection locker(m_loadCs);
+
+		ResLoadTicketMap::iterator pendingIt = m_pendingLoads.find(r->m_name);
+		if (pendingIt != m_pendingLoads.end())
 		{
-			// resource cache out of memory
-			return std::shared_ptr<ResHandle>();
+			// deduplicate - everyone asking for the same resource shares one ticket. If the new
+			// request is more urgent the ticket is queued again at the higher priority.
+			InterlockedIncrement64(&m_categories[CategoryIndex(r->m_name)]->m_misses);
+			ticket = pendingIt->second;
+			if (priority > ticket->m_priority && !ticket->m_taken)
+			{
+				ticket->m_priority = priority;
+				ResLoadRequest request = { priority, m_loadSequence++, ticket };
+				m_loadQueue.push(request);
+				ReleaseSemaphore(m_hLoadsQueued, 1, NULL);
+			}
+			return ticket;
 		}
-		handle = std::shared_ptr<ResHandle>(Nv_NEW ResHandle(*r, buffer, size, this));
-		bool success = loader->VLoadResource(rawBuffer, rawSize, handle);
 
-		// [mrmike] - This was added after the chapter went to copy edit. It is used for those
-		//			  resource that are converted to a useable format upon load, such as a compressed
-		//			  file. If the raw buffer from the resource files isn't needed, it shouldn't take up
-		//			  any additional memory, so we release it.
-		if (loader->VDiscardRawBufferAfterLoad())
+		ticket.reset(Nv_NEW ResLoadTicket(*r, priority));
+		ticket->m_pCache = this;
+
+		std::shared_ptr<ResHandle> handle = Find(r);
+		if (handle)
 		{
-			SAFE_DELETE_ARRAY(rawBuffer);
+			InterlockedIncrement64(&m_categories[handle->m_category]->m_hits);
+			ticket->Complete(handle);
+			return ticket;
 		}
+		InterlockedIncrement64(&m_categories[CategoryIndex(r->m_name)]->m_misses);
 
-		if (!success)
+		if (m_loaderThreads.empty())
 		{
-			// resource cache out of memory
-			return std::shared_ptr<ResHandle>();
+			// no loader threads running, so this degrades to a synchronous load
+			loadNow = true;
+		}
+		else
+		{
+			m_pendingLoads[r->m_name] = ticket;
+			ResLoadRequest request = { priority, m_loadSequence++, ticket };
+			m_loadQueue.push(request);
+			ReleaseSemaphore(m_hLoadsQueued, 1, NULL);
 		}
 	}
 
-	if (handle)
+	if (loadNow)
 	{
-		m_lru.push_front(handle);
-		m_resources[r->m_name] = handle;
+		ticket->Complete(Load(r));
 	}
 
-	//Nv_ASSERT(loader && _T("Default resource loader not found!!"));
-	return handle;		// ResCache is out of memory!!
+	return ticket;
 }
 
 //
-// ResCache::Find
+// ResCache::StartAsyncLoading						- not described in the book
 //
-std::shared_ptr<ResHandle> ResCache::Find(Resource* r)
+bool ResCache::StartAsyncLoading(unsigned int numThreads)
 {
-	ResHandleMap::iterator i = m_resources.find(r->m_name);
-	if (i == m_resources.end()) {
-		return std::shared_ptr<ResHandle>();
+	if (!m_loaderThreads.empty() || numThreads == 0)
+	{
+		return false;
 	}
 
-	return i->second;
+	m_stopLoaders = 0;
+	m_hLoadsQueued = CreateSemaphore(NULL, 0, LONG_MAX, NULL);
+	if (m_hLoadsQueued == NULL)
+	{
+		return false;
+	}
+
+	for (unsigned int i = 0; i < numThreads; ++i)
+	{
+		HANDLE hThread = CreateThread(
+							NULL,				// default security attributes
+							0,					// default stack size
+							LoaderThreadProc,	// thread process
+							this,				// thread parameter is a pointer to the cache
+							0,					// default creation flags
+							NULL);				// don't need the thread identifier
+		if (hThread == NULL)
+		{
+			//Nv_ERROR("Could not create resource loader thread!");
+			break;
+		}
+
+		SetThreadPriority(hThread, THREAD_PRIORITY_BELOW_NORMAL);
+		m_loaderThreads.push_back(hThread);
+	}
+
+	return !m_loaderThreads.empty();
 }
 
 //
-// ResCache::Update
+// ResCache::StopAsyncLoading						- not described in the book
 //
-void ResCache::Update(std::shared_ptr<ResHandle> handle)
-{
-	m_lru.remove(handle);
-	m_lru.push_front(handle);
-}
-
-
-char* ResCache::Allocate(unsigned int size)
+//		Waits for the requests already being loaded, fails everything still queued and shuts the
+//		loader threads down.
+//
+void ResCache::StopAsyncLoading()
 {
-	if (!MakeRoom(size)) {
-		return nullptr;
+	if (m_loaderThreads.empty())
+	{
+		return;
 	}
 
-	char* mem = Nv_NEW char[size];
-	if (mem) {
-		m_allocated += size;
-	}
+	InterlockedExchange(&m_stopLoaders, 1);
+	ReleaseSemaphore(m_hLoadsQueued, (LONG)m_loaderThreads.size(), NULL);
+	WaitForMultipleObjects((DWORD)m_loaderThreads.size(), &m_loaderThreads[0], TRUE, INFINITE);
 
-	return mem;
-}
+	for (size_t i = 0; i < m_loaderThreads.size(); ++i)
+	{
+		CloseHandle(m_loaderThreads[i]);
+	}
+	m_loaderThreads.clear();
 
-void ResCache::FreeOneResource()
-{
-	ResHandleList::iterator gonner = m_lru.end();
-	gonner--;
+	CloseHandle(m_hLoadsQueued);
+	m_hLoadsQueued = NULL;
 
-	shared_ptr<ResHandle> handle = *gonner;
+	ResLoadTicketMap abandoned;
+	{
+		ScopedCriticalSection locker(m_loadCs);
+		abandoned.swap(m_pendingLoads);
+		m_gameThreadLoads.clear();
+		m_loadQueue = ResLoadQueue();
+	}
 
-	m_lru.pop_back();
-	m_resources.erase(handle->m_resource.m_name);
-	// Note - you can't change the resource cache size yet - the resource bits could still actually be
-	// used by some subsystem holding onto the ResHandle. Only when it goes out of scope can the memory
-	// be actually free again.
+	for (ResLoadTicketMap::iterator it = abandoned.begin(); it != abandoned.end(); ++it)
+	{
+		it->second->Complete(std::shared_ptr<ResHandle>());
+	}
 }
 
-
 //
-// ResCache::Flush										-not described in the book
+// class ScopedResourceFileLock						- not described in the book
 //
-//		Frees every handle in the cache - this would be good to call if you are loading a new
-//		level, or if you wanted to force a refresh of all the data in the cache - which might be
-//		good in a development environment.
+//		Serializes reads only for resource files that can't be read from several threads at once.
 //
-void ResCache::Flush()
+class ScopedResourceFileLock : public Nv_noncopyable
 {
-	while (!m_lru.empty())
+	CriticalSection* m_pCs;
+
+public:
+	ScopedResourceFileLock(CriticalSection& cs, IResourceFile* pFile)
 	{
-		std::shared_ptr<ResHandle> handle = *(m_lru.begin());
-		Free(handle);
-		m_lru.pop_front();
+		m_pCs = pFile->VSupportsConcurrentReads() ? nullptr : &cs;
+		if (m_pCs)
+			m_pCs->Lock();
 	}
-}
 
-bool ResCache::MakeRoom(unsigned int size)
-{
-	if (size > m_cacheSize)
+	~ScopedResourceFileLock()
 	{
-		return false;
+		if (m_pCs)
+			m_pCs->Unlock();
 	}
+};
+
+DWORD WINAPI ResCache::LoaderThreadProc(LPVOID lpParam)
+{
+	ResCache* pCache = static_cast<ResCache*>(lpParam);
+	pCache->LoaderThreadLoop();
+	return TRUE;
+}
+
+ResLoadTicketPtr ResCache::PopLoadRequest()
+{
+	ScopedCriticalSection locker(m_loadCs);
 
-	// return null if there's no possible way to allocate the memory
-	while (size > (m_cacheSize - m_allocated))
+	while (!m_loadQueue.empty())
 	{
-		// The cahe is empty, and there's still not enough room.
-		if (m_lru.empty()) {
-			return false;
+		ResLoadTicketPtr ticket = m_loadQueue.top().m_ticket;
+		m_loadQueue.pop();
+
+		// stale entry left behind by a priority bump
+		if (ticket->m_taken)
+		{
+			continue;
 		}
 
-		FreeOneResource();
+		ticket->m_taken = true;
+		return ticket;
 	}
 
-	return true;
+	return ResLoadTicketPtr();
 }
 
-//
+void ResCache::LoaderThreadLoop()
+{
+	Nv_MEMORY_TAG_SCOPE(MEMTAG_RESOURCE_CACHE);
+
+	for (;;)
+	{
+		WaitForSingleObject(m_hLoadsQueued, INFINITE);
+		if (m_stopLoaders)
+		{
+			break;
+		}
+
+		ResLoadTicketPtr ticket = PopLoadRequest();
+		if (!ticket)
+		{
+			continue;
+		}
+
+		std::shared_ptr<IResourceLoader> loader = FindLoader(&ticket->m_resource);
+		if (loader && !loader->VSupportsAsyncLoad() && !loader->VUseRawFile())
+		{
+			ReadForGameThread(ticket, loader);
+			continue;
+		}
+
+		// The raw read, the inflate and the loader's VLoadResource() all happen right here, off the
+		// game thread. Load() takes the cache lock only to account memory and publish the handle.
+		std::shared_ptr<ResHandle> handle = Load(&ticket->m_resource);
+		CompleteLoadRequest(ticket, handle);
+	}
+}
+
+//
+// ResCache::ReadForGameThread						- not described in the book
+//
+//		The loader thread's half of a load whose loader has to run on the game thread: the raw read
+//		and the inflate. The ticket keeps the bytes until FinishGameThreadLoad().
+//
+void ResCache::ReadForGameThread(ResLoadTicketPtr ticket, std::shared_ptr<IResourceLoader> loader)
+{
+	int rawSize = 0;
+	{
+		ScopedResourceFileLock fileLocker(m_fileCs, m_file);
+		rawSize = m_file->VGetRawResourceSize(ticket->m_resource);
+	}
+
+	bool rawView = false;
+	char* rawBuffer = (rawSize < 0) ? nullptr : ReadRawResource(&ticket->m_resource, loader, rawSize, rawView);
+	if (rawBuffer == nullptr)
+	{
+		InterlockedIncrement64(&m_categories[CategoryIndex(ticket->GetName())]->m_failedLoads);
+		CompleteLoadRequest(ticket, std::shared_ptr<ResHandle>());
+		return;
+	}
+
+	ticket->m_pRawBuffer = rawBuffer;
+	ticket->m_rawSize = rawSize;
+	ticket->m_bRawView = rawView;
+	{
+		ScopedCriticalSection locker(m_loadCs);
+		m_gameThreadLoads[ticket->GetName()] = ticket;
+	}
+	SetEvent(ticket->m_hRead);
+}
+
+//
+// ResCache::FinishGameThreadLoad					- not described in the book
+//
+//		Runs the loader of a load ReadForGameThread() has read, if it's still waiting. Returns false
+//		if it isn't.
+//
+bool ResCache::FinishGameThreadLoad(const std::string& name)
+{
+	ResLoadTicketPtr ticket;
+	{
+		ScopedCriticalSection locker(m_loadCs);
+		ResLoadTicketMap::iterator findIt = m_gameThreadLoads.find(name);
+		if (findIt == m_gameThreadLoads.end())
+		{
+			return false;
+		}
+		ticket = findIt->second;
+		m_gameThreadLoads.erase(findIt);
+	}
+
+	Nv_MEMORY_TAG_SCOPE(MEMTAG_RESOURCE_CACHE);
+	Resource* r = &ticket->m_resource;
+	unsigned int category = CategoryIndex(r->m_name);
+
+	// LoadRawResource() takes the raw buffer over
+	char* rawBuffer = ticket->m_pRawBuffer;
+	ticket->m_pRawBuffer = nullptr;
+
+	LARGE_INTEGER start;
+	QueryPerformanceCounter(&start);
+	std::shared_ptr<ResHandle> handle = LoadRawResource(r, category, FindLoader(r), rawBuffer, ticket->m_rawSize, ticket->m_bRawView);
+	RecordLoad(category, handle, start);
+
+	CompleteLoadRequest(ticket, handle);
+	return true;
+}
+
+//
+// ResCache::FinishGameThreadLoads					- not described in the book
+//
+void ResCache::FinishGameThreadLoads()
+{
+	std::vector<std::string> names;
+	{
+		ScopedCriticalSection locker(m_loadCs);
+		for (ResLoadTicketMap::iterator it = m_gameThreadLoads.begin(); it != m_gameThreadLoads.end(); ++it)
+		{
+			names.push_back(it->first);
+		}
+	}
+
+	for (size_t i = 0; i < names.size(); ++i)
+	{
+		FinishGameThreadLoad(names[i]);
+	}
+}
+
+void ResCache::CompleteLoadRequest(ResLoadTicketPtr ticket, std::shared_ptr<ResHandle> handle)
+{
+	{
+		ScopedCriticalSection locker(m_loadCs);
+		m_pendingLoads.erase(ticket->GetName());
+	}
+	ticket->Complete(handle);
+
+	IEventManager* pEventManager = IEventManager::Get();
+	if (pEventManager)
+	{
+		std::shared_ptr<EvtData_Resource_Loaded> pEvent(Nv_NEW EvtData_Resource_Loaded(ticket->GetName(), handle));
+		if (!pEventManager->VThreadSafeQueueEvent(pEvent))
+		{
+			// nobody hears about it, but the ticket has the result for anyone polling or waiting
+			OutputDebugStringA("ResCache: couldn't queue EvtData_Resource_Loaded\n");
+		}
+	}
+}
+
+//
+// ResCache::FindLoader							- not described in the book
+//
+std::shared_ptr<IResourceLoader> ResCache::FindLoader(Resource* r)
+{
+	for (ResourceLoaders::iterator it = m_resourceLoaders.begin(); it != m_resourceLoaders.end(); ++it)
+	{
+		std::shared_ptr<IResourceLoader> testLoader = *it;
+
+		if (WildcardMatch(testLoader->VGetPattern().c_str(), r->m_name.c_str()))
+		{
+			return testLoader;
+		}
+	}
+	return std::shared_ptr<IResourceLoader>();
+}
+
+//
+// ResCache::Load
+//
+//		Times the load for the stats of the resource's category - ReadAndLoad() does the work.
+//
+std::shared_ptr<ResHandle> ResCache::Load(Resource* r)
+{
+	Nv_MEMORY_TAG_SCOPE(MEMTAG_RESOURCE_CACHE);
+	unsigned int category = CategoryIndex(r->m_name);
+
+	LARGE_INTEGER start;
+	QueryPerformanceCounter(&start);
+	std::shared_ptr<ResHandle> handle = ReadAndLoad(r, category);
+	RecordLoad(category, handle, start);
+	return handle;
+}
+
+void ResCache::RecordLoad(unsigned int category, std::shared_ptr<ResHandle> handle, const LARGE_INTEGER& start)
+{
+	LARGE_INTEGER end;
+	QueryPerformanceCounter(&end);
+
+	ResCacheCategory* pCategory = m_categories[category];
+	if (handle)
+	{
+		pCategory->AddLoad(handle->Size(), (double)(end.QuadPart - start.QuadPart) / m_ticksPerMs);
+	}
+	else
+	{
+		InterlockedIncrement64(&pCategory->m_failedLoads);
+	}
+}
+
+std::shared_ptr<ResHandle> ResCache::ReadAndLoad(Resource* r, unsigned int category)
+{
+	// Create a new resource and add it to the lru list and map
+
+	std::shared_ptr<IResourceLoader> loader = FindLoader(r);
+	std::shared_ptr<ResHandle> handle;
+
+	if (!loader)
+	{
+		//Nv_ASSERT(loader && _T("Default resource loader not found!"));
+		return handle;			// Resource not loaded!!
+	}
+
+	unsigned int shardIndex = ShardIndex(r->m_name);
+	ResCacheShard& shard = *m_shards[shardIndex];
+
+	int rawSize = 0;
+	{
+		ScopedResourceFileLock fileLocker(m_fileCs, m_file);
+		rawSize = m_file->VGetRawResourceSize(*r);
+	}
+	if (rawSize < 0)
+	{
+		//Nv_ASSERT(rawSize > 0 && "Resource size returned -1 - Resource not found");
+		return std::shared_ptr<ResHandle>();
+	}
+
+	// Big resources the loader wants streamed aren't read here at all. The loader gets a stream to
+	// pull a header from, and the handle owns no buffer, so nothing is charged to the cache.
+	if (loader->VStreamResource(rawSize))
+	{
+		IResourceStream* pStream = OpenStream(*r);
+		if (pStream)
+		{
+			handle = std::shared_ptr<ResHandle>(Nv_NEW ResHandle(*r, nullptr, 0, this, false));
+			handle->m_streaming = true;
+
+			bool success = loader->VLoadStreamingResource(pStream, handle);
+			SAFE_DELETE(pStream);
+			if (!success)
+			{
+				return std::shared_ptr<ResHandle>();
+			}
+			return Insert(shard, r, handle);
+		}
+		// the resource file can't stream, so load it the usual way
+	}
+
+	if (!loader->VUseRawFile())
+	{
+		bool rawView = false;
+		char* rawBuffer = ReadRawResource(r, loader, rawSize, rawView);
+		if (rawBuffer == nullptr)
+		{
+			return std::shared_ptr<ResHandle>();
+		}
+		return LoadRawResource(r, category, loader, rawBuffer, rawSize, rawView);
+	}
+
+	// The raw file is the resource. Stored entries of a memory mapped zip can be used in place;
+	// loaders that need a trailing zero still get a copy.
+	char* rawView = loader->VAddNullZero() ? nullptr : const_cast<char*>(m_file->VGetRawResourceView(*r));
+
+	char* rawBuffer = rawView;
+	int allocSize = rawSize + ((loader->VAddNullZero()) ? (1) : (0));
+	if (rawView == nullptr)
+	{
+		rawBuffer = Allocate(shard, category, allocSize);
+		if (rawBuffer == nullptr)
+		{
+			// resource cache out of memory
+			return std::shared_ptr<ResHandle>();
+		}
+		memset(rawBuffer, 0, allocSize);
+
+		int bytesRead = 0;
+		{
+			ScopedResourceFileLock fileLocker(m_fileCs, m_file);
+			bytesRead = m_file->VGetRawResource(*r, rawBuffer);
+		}
+		if (bytesRead == 0)
+		{
+			SAFE_DELETE_ARRAY(rawBuffer);
+			MemoryHasBeenFreed(shardIndex, category, allocSize);
+			return std::shared_ptr<ResHandle>();
+		}
+	}
+
+	handle = std::shared_ptr<ResHandle>(Nv_NEW ResHandle(*r, rawBuffer, rawSize, this, rawView == nullptr));
+	return Insert(shard, r, handle);
+}
+
+//
+// ResCache::ReadRawResource						- not described in the book
+//
+//		The raw bytes of a resource whose loader doesn't use the raw file, for LoadRawResource(). A
+//		stored entry of a memory mapped zip comes back in place, with outView set; anything else is
+//		read into a buffer of its own, outside the cache's budget. NULL if the read fails.
+//
+char* ResCache::ReadRawResource(Resource* r, std::shared_ptr<IResourceLoader> loader, int rawSize, bool& outView)
+{
+	// loaders that need a trailing zero always get a copy
+	outView = false;
+	if (!loader->VAddNullZero())
+	{
+		const char* rawView = m_file->VGetRawResourceView(*r);
+		if (rawView)
+		{
+			outView = true;
+			return const_cast<char*>(rawView);
+		}
+	}
+
+	int allocSize = rawSize + ((loader->VAddNullZero()) ? (1) : (0));
+	char* rawBuffer = Nv_NEW char[allocSize];
+	memset(rawBuffer, 0, allocSize);
+
+	int bytesRead = 0;
+	{
+		ScopedResourceFileLock fileLocker(m_fileCs, m_file);
+		bytesRead = m_file->VGetRawResource(*r, rawBuffer);
+	}
+	if (bytesRead == 0)
+	{
+		SAFE_DELETE_ARRAY(rawBuffer);
+	}
+	return rawBuffer;
+}
+
+//
+// ResCache::LoadRawResource						- not described in the book
+//
+//		Runs the loader over what ReadRawResource() read, into a buffer charged to the cache, and
+//		puts the handle in the cache. Frees the raw buffer, if it isn't a view and the loader doesn't
+//		want it kept.
+//
+std::shared_ptr<ResHandle> ResCache::LoadRawResource(Resource* r, unsigned int category, std::shared_ptr<IResourceLoader> loader, char* rawBuffer, int rawSize, bool rawView)
+{
+	if (!loader)
+	{
+		if (!rawView)
+		{
+			SAFE_DELETE_ARRAY(rawBuffer);
+		}
+		return std::shared_ptr<ResHandle>();
+	}
+
+	ResCacheShard& shard = *m_shards[ShardIndex(r->m_name)];
+	unsigned int size = loader->VGetLoadedResourceSize(rawBuffer, rawSize);
+	char* buffer = Allocate(shard, category, size);
+	if (buffer == nullptr)
+	{
+		// resource cache out of memory
+		if (!rawView)
+		{
+			SAFE_DELETE_ARRAY(rawBuffer);
+		}
+		return std::shared_ptr<ResHandle>();
+	}
+
+	std::shared_ptr<ResHandle> handle(Nv_NEW ResHandle(*r, buffer, size, this));
+	bool success = loader->VLoadResource(rawBuffer, rawSize, handle);
+
+	// [mrmike] - This was added after the chapter went to copy edit. It is used for those
+	//			  resource that are converted to a useable format upon load, such as a compressed
+	//			  file. If the raw buffer from the resource files isn't needed, it shouldn't take up
+	//			  any additional memory, so we release it.
+	if (loader->VDiscardRawBufferAfterLoad() && !rawView)
+	{
+		SAFE_DELETE_ARRAY(rawBuffer);
+	}
+
+	if (!success)
+	{
+		// resource cache out of memory
+		return std::shared_ptr<ResHandle>();
+	}
+
+	return Insert(shard, r, handle);
+}
+
+//
+// ResCache::Insert									- not described in the book
+//
+std::shared_ptr<ResHandle> ResCache::Insert(ResCacheShard& shard, Resource* r, std::shared_ptr<ResHandle> handle)
+{
+	ScopedCriticalSection locker(shard.m_cs);
+
+	// A loader thread and the game thread can race to load the same resource. The first one
+	// to publish wins, the loser's handle is dropped and its memory returned to the cache.
+	ResHandleMap::iterator existing = shard.m_resources.find(r->m_name);
+	if (existing != shard.m_resources.end())
+	{
+		ResHandle* pExisting = existing->second.get();
+		if (!pExisting->IsPinned())
+		{
+			shard.m_lru[pExisting->m_category].MoveToFront(pExisting);
+		}
+		return existing->second;
+	}
+
+	shard.m_lru[handle->m_category].PushFront(handle.get());
+	shard.m_resources[r->m_name] = handle;
+	return handle;
+}
+
+//
+// ResCache::OpenStream								- not described in the book
+//
+IResourceStream* ResCache::OpenStream(const Resource& r)
+{
+	ScopedResourceFileLock fileLocker(m_fileCs, m_file);
+	return m_file->VOpenResourceStream(r);
+}
+
+//
+// ResCache::ShardIndex								- not described in the book
+//
+unsigned int ResCache::ShardIndex(const std::string& name) const
+{
+	if (m_shards.size() == 1)
+	{
+		return 0;
+	}
+	return (unsigned int)(std::hash<std::string>()(name) % m_shards.size());
+}
+
+//
+// ResCache::Find
+//
+std::shared_ptr<ResHandle> ResCache::Find(Resource* r)
+{
+	ResCacheShard& shard = *m_shards[ShardIndex(r->m_name)];
+	ScopedCriticalSection locker(shard.m_cs);
+	ResHandleMap::iterator i = shard.m_resources.find(r->m_name);
+	if (i == shard.m_resources.end()) {
+		return std::shared_ptr<ResHandle>();
+	}
+
+	// [lru] - this used to be a separate Update() that did a linear m_lru.remove()
+	ResHandle* pHandle = i->second.get();
+	if (!pHandle->IsPinned())
+	{
+		shard.m_lru[pHandle->m_category].MoveToFront(pHandle);
+	}
+	return i->second;
+}
+
+
+char* ResCache::Allocate(ResCacheShard& shard, unsigned int category, unsigned int size)
+{
+	if (!MakeRoom(shard, category, size)) {
+		return nullptr;
+	}
+
+	char* mem = Nv_NEW char[size];
+	if (!mem) {
+		InterlockedExchangeAdd64(&m_allocated, -(LONG64)size);
+		return nullptr;
+	}
+
+	ScopedCriticalSection locker(shard.m_cs);
+	shard.m_categoryAllocated[category] += size;
+	m_categories[category]->AddAllocated(size);
+	return mem;
+}
+
+void ResCache::FreeOneResource(ResCacheShard& shard, unsigned int category)
+{
+	ResHandle* pGonner = shard.m_lru[category].Back();
+	shard.m_lru[category].Remove(pGonner);
+	InterlockedIncrement64(&m_categories[category]->m_evictions);
+
+	// erasing may drop the last reference, so don't touch pGonner afterwards
+	shard.m_resources.erase(pGonner->m_resource.m_name);
+	// Note - you can't change the resource cache size yet - the resource bits could still actually be
+	// used by some subsystem holding onto the ResHandle. Only when it goes out of scope can the memory
+	// be actually free again.
+}
+
+
+//
+// ResCache::Flush										-not described in the book
+//
+//		Frees every handle in the cache - this would be good to call if you are loading a new
+//		level, or if you wanted to force a refresh of all the data in the cache - which might be
+//		good in a development environment.
+//
+void ResCache::Flush()
+{
+	for (size_t i = 0; i < m_shards.size(); ++i)
+	{
+		ResCacheShard& shard = *m_shards[i];
+		ScopedCriticalSection locker(shard.m_cs);
+		for (size_t category = 0; category < m_categories.size(); ++category)
+		{
+			shard.m_lru[category].Clear();
+		}
+
+		// handles that outlive the flush don't stay pinned
+		for (ResHandleMap::iterator it = shard.m_resources.begin(); it != shard.m_resources.end(); ++it)
+		{
+			ResHandle* pHandle = it->second.get();
+			if (pHandle->IsPinned())
+			{
+				pHandle->m_pinCount = 0;
+				InterlockedDecrement64(&m_categories[pHandle->m_category]->m_pinned);
+			}
+		}
+
+		// destroying handles calls back into MemoryHasBeenFreed(), so empty the map first
+		ResHandleMap gonners;
+		gonners.swap(shard.m_resources);
+		gonners.clear();
+	}
+}
+
+//
+// ResCache::MakeRoom									- not described in the book
+//
+//		Charges size to the cache, evicting until it fits. Room is made in the resource's own
+//		shard first and taken from the others once that has nothing left to give, so the largest
+//		resource is only limited by the size of the whole cache.
+//
+bool ResCache::MakeRoom(ResCacheShard& shard, unsigned int category, unsigned int size)
+{
+	if (size > m_cacheSize)
+	{
+		return false;
+	}
+
+	// A category never grows past its hard limit - it has to make room out of its own resources
+	// rather than pushing everybody else out. The limit is checked rather than charged, so loads
+	// racing into the same category can overshoot it by a resource each.
+	const ResCacheCategory* pCategory = m_categories[category];
+	if (pCategory->m_hardLimit != 0)
+	{
+		while (ReadCounter(pCategory->m_allocated) + size > pCategory->m_hardLimit)
+		{
+			if (!EvictFromAnyShard(shard, category)) {
+				return false;
+			}
+		}
+	}
+
+	// the budget is charged with a compare and swap, so two shards can't both take the last of it
+	for (;;)
+	{
+		LONG64 allocated = (LONG64)ReadCounter(m_allocated);
+		if ((unsigned __int64)allocated + size <= m_cacheSize)
+		{
+			if (InterlockedCompareExchange64(&m_allocated, allocated + size, allocated) == allocated) {
+				return true;
+			}
+		}
+		else if (!EvictFromAnyShard(shard, -1))
+		{
+			// The cache is empty or everything left is pinned, and there's still not enough room.
+			return false;
+		}
+	}
+}
+
+//
+// ResCache::EvictFromAnyShard							- not described in the book
+//
+//		Evicts one resource of the category, or of the one FindVictim() picks if it's -1. The
+//		first shard goes first; holding one shard lock at a time keeps two shards making room
+//		at once from deadlocking.
+//
+bool ResCache::EvictFromAnyShard(ResCacheShard& first, int category)
+{
+	if (EvictFromShard(first, category)) {
+		return true;
+	}
+
+	for (size_t i = 0; i < m_shards.size(); ++i)
+	{
+		if (m_shards[i] != &first && EvictFromShard(*m_shards[i], category)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+bool ResCache::EvictFromShard(ResCacheShard& shard, int category)
+{
+	ScopedCriticalSection locker(shard.m_cs);
+	if (category < 0) {
+		category = FindVictim(shard);
+	}
+	if (category < 0 || shard.m_lru[category].Empty()) {
+		return false;
+	}
+
+	FreeOneResource(shard, category);
+	return true;
+}
+
+//
+// ResCache::FindVictim								- not described in the book
+//
+//		Picks the category that is furthest over its soft limit. A category without a soft limit
+//		counts all of its bytes as over, so it goes before any category still inside its limit.
+//
+int ResCache::FindVictim(ResCacheShard& shard) const
+{
+	int victim = -1;
+	LONG64 worst = 0;
+	for (size_t i = 0; i < m_categories.size(); ++i)
+	{
+		if (shard.m_lru[i].Empty())
+		{
+			continue;
+		}
+
+		LONG64 softLimit = (LONG64)(m_categories[i]->m_softLimit / m_shards.size());
+		LONG64 over = (LONG64)shard.m_categoryAllocated[i] - softLimit;
+		if (victim < 0 || over > worst)
+		{
+			victim = (int)i;
+			worst = over;
+		}
+	}
+	return victim;
+}
+
+//
 // ResCache::Free
 //
 void ResCache::Free(std::shared_ptr<ResHandle> gonner)
 {
-	m_lru.remove(gonner);
-	m_resources.erase(gonner->m_resource.m_name);
+	ResCacheShard& shard = *m_shards[gonner->m_shard];
+	ScopedCriticalSection locker(shard.m_cs);
+	ResHandleMap::iterator it = shard.m_resources.find(gonner->m_resource.m_name);
+	if (it != shard.m_resources.end() && it->second == gonner)
+	{
+		if (gonner->IsPinned())
+		{
+			gonner->m_pinCount = 0;
+			InterlockedDecrement64(&m_categories[gonner->m_category]->m_pinned);
+		}
+		else
+		{
+			shard.m_lru[gonner->m_category].Remove(gonner.get());
+		}
+		shard.m_resources.erase(it);
+	}
 	// Note - the resource might still be in use by something.
 	// so the cache can't actually count the memory freed until the
 	// ResHandle pointing to it is destroyed.
@@ -490,9 +1514,178 @@ void ResCache::Free(std::shared_ptr<ResHandle> gonner)
 //
 //		This is called whenever the memory associated with a resource is actually freed
 //
-void ResCache::MemoryHasBeenFreed(unsigned int size)
+void ResCache::MemoryHasBeenFreed(unsigned int shard, unsigned int category, unsigned int size)
+{
+	ResCacheShard& cacheShard = *m_shards[shard];
+	ScopedCriticalSection locker(cacheShard.m_cs);
+	cacheShard.m_categoryAllocated[category] -= size;
+	m_categories[category]->AddAllocated(-(LONG64)size);
+	InterlockedExchangeAdd64(&m_allocated, -(LONG64)size);
+}
+
+//
+// ResCache::Pin										-not described in the book
+//
+std::shared_ptr<ResHandle> ResCache::Pin(Resource* r)
 {
-	m_allocated -= size;
+	return PinHandle(r, GetHandle(r));
+}
+
+//
+// ResCache::PinHandle								-not described in the book
+//
+std::shared_ptr<ResHandle> ResCache::PinHandle(Resource* r, std::shared_ptr<ResHandle> handle)
+{
+	if (!handle)
+	{
+		return handle;
+	}
+
+	ResCacheShard& shard = *m_shards[handle->m_shard];
+	ScopedCriticalSection locker(shard.m_cs);
+
+	// The handle may have been evicted since GetHandle() returned. Its memory is still charged
+	// to the cache while we hold it, so it can simply go back in - unless it was loaded again,
+	// in which case the reloaded handle is the one that gets pinned.
+	ResHandleMap::iterator it = shard.m_resources.find(r->m_name);
+	if (it == shard.m_resources.end())
+	{
+		shard.m_resources[r->m_name] = handle;
+	}
+	else
+	{
+		handle = it->second;
+		if (!handle->IsPinned())
+		{
+			shard.m_lru[handle->m_category].Remove(handle.get());
+		}
+	}
+
+	if (handle->m_pinCount++ == 0)
+	{
+		InterlockedIncrement64(&m_categories[handle->m_category]->m_pinned);
+	}
+	return handle;
+}
+
+//
+// ResCache::Unpin									-not described in the book
+//
+void ResCache::Unpin(Resource* r)
+{
+	ResCacheShard& shard = *m_shards[ShardIndex(r->m_name)];
+	ScopedCriticalSection locker(shard.m_cs);
+
+	ResHandleMap::iterator it = shard.m_resources.find(r->m_name);
+	if (it == shard.m_resources.end() || !it->second->IsPinned())
+	{
+		return;
+	}
+
+	ResHandle* pHandle = it->second.get();
+	if (--pHandle->m_pinCount == 0)
+	{
+		shard.m_lru[pHandle->m_category].PushFront(pHandle);
+		InterlockedDecrement64(&m_categories[pHandle->m_category]->m_pinned);
+	}
+}
+
+//
+// ResCache::GetAllocated								-not described in the book
+//
+unsigned __int64 ResCache::GetAllocated() const
+{
+	unsigned __int64 allocated = 0;
+	for (size_t i = 0; i < m_categories.size(); ++i)
+	{
+		allocated += ReadCounter(m_categories[i]->m_allocated);
+	}
+	return allocated;
+}
+
+//
+// ResCache::GetStats									-not described in the book
+//
+//		The counters are read without stopping the loader threads, so a snapshot taken during
+//		a load can be a little out of step with itself.
+//
+void ResCache::GetStats(std::vector<ResCacheCategoryStats>& stats) const
+{
+	stats.resize(m_categories.size());
+	for (size_t i = 0; i < m_categories.size(); ++i)
+	{
+		m_categories[i]->GetStats(stats[i]);
+	}
+}
+
+static void AppendJsonString(std::string& json, const std::string& value)
+{
+	json += '"';
+	for (size_t i = 0; i < value.length(); ++i)
+	{
+		char c = value[i];
+		if (c == '"' || c == '\\')
+		{
+			json += '\\';
+		}
+		json += c;
+	}
+	json += '"';
+}
+
+static void AppendJsonNumber(std::string& json, const char* name, unsigned __int64 value)
+{
+	char buffer[64];
+	sprintf_s(buffer, "\"%s\": %llu, ", name, value);
+	json += buffer;
+}
+
+//
+// ResCache::GetStatsJson								-not described in the book
+//
+//		The stats of every category as a JSON object, for dumping to a file or the log.
+//
+std::string ResCache::GetStatsJson() const
+{
+	std::vector<ResCacheCategoryStats> stats;
+	GetStats(stats);
+
+	std::string json = "{ ";
+	AppendJsonNumber(json, "cacheSize", m_cacheSize);
+	AppendJsonNumber(json, "allocated", GetAllocated());
+	json += "\"categories\": [\n";
+
+	for (size_t i = 0; i < stats.size(); ++i)
+	{
+		const ResCacheCategoryStats& category = stats[i];
+
+		json += "\t{ \"name\": ";
+		AppendJsonString(json, category.m_name);
+		json += ", ";
+		AppendJsonNumber(json, "softLimit", category.m_softLimit);
+		AppendJsonNumber(json, "hardLimit", category.m_hardLimit);
+		AppendJsonNumber(json, "allocated", category.m_allocated);
+		AppendJsonNumber(json, "peakAllocated", category.m_peakAllocated);
+		AppendJsonNumber(json, "pinned", category.m_pinned);
+		AppendJsonNumber(json, "hits", category.m_hits);
+		AppendJsonNumber(json, "misses", category.m_misses);
+		AppendJsonNumber(json, "evictions", category.m_evictions);
+		AppendJsonNumber(json, "loads", category.m_loads);
+		AppendJsonNumber(json, "failedLoads", category.m_failedLoads);
+		AppendJsonNumber(json, "bytesLoaded", category.m_bytesLoaded);
+
+		json += "\"loadTimeHistogramMs\": [";
+		for (int bucket = 0; bucket < ResCacheCategoryStats::LOAD_TIME_BUCKETS; ++bucket)
+		{
+			char buffer[32];
+			sprintf_s(buffer, bucket == 0 ? "%llu" : ", %llu", category.m_loadTimeHistogram[bucket]);
+			json += buffer;
+		}
+		json += (i + 1 < stats.size()) ? "] },\n" : "] }\n";
+	}
+
+	json += "] }";
+	return json;
 }
 
 
@@ -512,7 +1705,11 @@ std::vector<std::string> ResCache::Match(const std::string pattern)
 	int numFiles = m_file->VGetNumResources();
 	for (int i = 0; i < numFiles; ++i)
 	{
-		std::string name = m_file->VGetResourceName(i);
+		std::string name;
+		{
+			ScopedResourceFileLock fileLocker(m_fileCs, m_file);
+			name = m_file->VGetResourceName(i);
+		}
 		std::transform(name.begin(), name.end(), name.begin(), (int(*)(int)) std::tolower);
 		if (WildcardMatch(pattern.c_str(), name.c_str()))
 		{
@@ -7,8 +7,10 @@
 class ResHandle;
 class ResCache;
 
-#include "ZipFile.h"					// needed for ZipContentsMap
+#include "ZipFile.h"					// needed for ZipContentsIndex
+#include "../Multicore/CriticalSection.h"
 #include <map>
+#include <unordered_map>
 
 
 //
@@ -43,9 +45,10 @@ class ResourceZipFile : public IResourceFile
 {
 	std::wstring m_resFileName;
 	ZipFile *m_pZipFile;
+	bool m_useMemoryMapping;
 
 public:
-	ResourceZipFile(const std::wstring resFileName) { m_pZipFile = NULL; m_resFileName = resFileName; }
+	ResourceZipFile(const std::wstring resFileName, bool useMemoryMapping = false) { m_pZipFile = NULL; m_resFileName = resFileName; m_useMemoryMapping = useMemoryMapping; }
 	virtual ~ResourceZipFile();
 
 	virtual bool VOpen();
@@ -54,6 +57,9 @@ public:
 	virtual int VGetNumResources() const;
 	virtual std::string VGetResourceName(int num) const;
 	virtual bool VIsUsingDevelopmentDirectories(void) const { return false; }
+	virtual const char* VGetRawResourceView(const Resource &r);
+	virtual bool VSupportsConcurrentReads(void) const { return m_pZipFile != NULL && m_pZipFile->IsMemoryMapped(); }
+	virtual IResourceStream* VOpenResourceStream(const Resource &r);
 };
 
 //
@@ -74,7 +80,7 @@ public:
 	Mode m_mode;
 	std::wstring m_AssetsDir;
 	std::vector<WIN32_FIND_DATA> m_AssetFileInfo;
-	ZipContentsMap m_DirectoryContentsMap;
+	ZipContentsIndex m_DirectoryContentsIndex;
 
 	DevelopmentResourceZipFile(const std::wstring resFileName, const Mode mode);
 
@@ -84,6 +90,9 @@ public:
 	virtual int VGetNumResources() const;
 	virtual std::string VGetResourceName(int num) const;
 	virtual bool VIsUsingDevelopmentDirectories(void) const { return true; }
+	virtual const char* VGetRawResourceView(const Resource &r) { return (m_mode == Editor) ? nullptr : ResourceZipFile::VGetRawResourceView(r); }
+	virtual bool VSupportsConcurrentReads(void) const { return (m_mode == Editor) ? true : ResourceZipFile::VSupportsConcurrentReads(); }
+	virtual IResourceStream* VOpenResourceStream(const Resource &r) { return (m_mode == Editor) ? nullptr : ResourceZipFile::VOpenResourceStream(r); }
 
 	int Find(const std::string &path);
 
@@ -97,16 +106,26 @@ protected:
 class ResHandle
 {
 	friend class ResCache;
+	friend class ResHandleLru;
 
 protected:
 	Resource m_resource;
 	char* m_buffer;
 	unsigned int m_size;
+	bool m_ownsBuffer;				// false when m_buffer is a view into a memory mapped resource file
+	bool m_streaming;				// no buffer at all, the resource is read through OpenStream()
 	std::shared_ptr<IResourceExtraData> m_extra;
 	ResCache *m_pResCache;
 
+	// [lru] - intrusive links into the lru list of the cache shard this handle belongs to
+	ResHandle* m_pLruPrev;
+	ResHandle* m_pLruNext;
+	unsigned int m_shard;
+	unsigned int m_category;		// budget category, see ResCache::AddCategory()
+	unsigned int m_pinCount;		// pinned handles are kept out of the lru and never evicted
+
 public:
-	ResHandle(Resource &resource, char* buffer, unsigned int size, ResCache *pResCache);
+	ResHandle(Resource &resource, char* buffer, unsigned int size, ResCache *pResCache, bool ownsBuffer = true);
 
 	virtual ~ResHandle();
 
@@ -114,6 +133,14 @@ public:
 	unsigned int Size() const { return m_size; }
 	char* Buffer() const { return m_buffer; }
 	char* WritableBuffer() { return m_buffer; }
+	bool OwnsBuffer() const { return m_ownsBuffer; }
+	unsigned int GetCategory() const { return m_category; }
+	bool IsPinned() const { return m_pinCount > 0; }
+
+	// Streaming handles are made for loaders that ask for it in VStreamResource(). Every call
+	// opens a new, independent reader - the caller deletes it.
+	bool IsStreaming() const { return m_streaming; }
+	IResourceStream* OpenStream();
 
 	std::shared_ptr<IResourceExtraData> GetExtra() { return m_extra; }
 	void SetExtra(std::shared_ptr<IResourceExtraData> extra) { m_extra = extra; }
@@ -133,52 +160,322 @@ public:
 };
 
 
-typedef std::list<std::shared_ptr<ResHandle>> ResHandleList;
-typedef std::map<std::string, std::shared_ptr<ResHandle>> ResHandleMap;
+//
+// class ResLoadTicket						- not described in the book
+//
+// Returned by ResCache::GetHandleAsync(). The ticket is shared by every caller that asked for the
+// same resource while it was in flight, so a resource is only ever read and loaded once. The game
+// thread can poll IsReady(), block on Wait(), or listen for EvtData_Resource_Loaded.
+//
+// A resource whose loader doesn't support async loads is only read on a loader thread. Its ticket
+// then holds the raw bytes until the game thread runs the loader, in
+// ResCache::FinishGameThreadLoads() or in Wait() - whichever comes first.
+//
+class ResLoadTicket : public Nv_noncopyable
+{
+	friend class ResCache;
+
+public:
+	enum State
+	{
+		Pending,
+		Loaded,
+		Failed
+	};
+
+private:
+	Resource m_resource;
+	int m_priority;
+	bool m_taken;									// a loader thread has picked this ticket up
+	volatile LONG m_state;
+	std::shared_ptr<ResHandle> m_handle;
+	HANDLE m_hDone;									// manual reset event, signaled on completion
+
+	// for loaders that have to run on the game thread
+	ResCache* m_pCache;
+	char* m_pRawBuffer;								// read by a loader thread, waiting for the loader
+	int m_rawSize;
+	bool m_bRawView;								// m_pRawBuffer points into the resource file, don't free it
+	HANDLE m_hRead;									// manual reset event, signaled once m_pRawBuffer is read
+
+public:
+	ResLoadTicket(const Resource& resource, int priority);
+	~ResLoadTicket();
+
+	const std::string& GetName() const { return m_resource.m_name; }
+	int GetPriority() const { return m_priority; }
+	State GetState() const { return static_cast<State>(m_state); }
+	bool IsReady() const { return m_state != Pending; }
+
+	// Returns the handle once the load has completed, NULL while pending or if the load failed.
+	std::shared_ptr<ResHandle> GetHandle() const { return IsReady() ? m_handle : std::shared_ptr<ResHandle>(); }
+
+	// Blocks the calling thread until the load has completed. Call it from the game thread - it
+	// finishes a load that's waiting to run its loader there.
+	std::shared_ptr<ResHandle> Wait();
+
+private:
+	void Complete(std::shared_ptr<ResHandle> handle);
+};
+
+typedef std::shared_ptr<ResLoadTicket> ResLoadTicketPtr;
+
+//
+// struct ResLoadRequest						- not described in the book
+//
+// An entry in the load queue. Raising the priority of a pending ticket pushes a second request
+// for it; whichever comes out first does the work and the other is skipped.
+//
+struct ResLoadRequest
+{
+	int m_priority;
+	unsigned int m_sequence;						// keeps requests of the same priority in FIFO order
+	ResLoadTicketPtr m_ticket;
+
+	bool operator<(const ResLoadRequest& other) const
+	{
+		if (m_priority != other.m_priority)
+			return m_priority < other.m_priority;
+		return m_sequence > other.m_sequence;
+	}
+};
+
+//
+// class ResHandleLru							- not described in the book
+//
+// Least recently used list threaded through the handles themselves, so touching or dropping a
+// handle is O(1) instead of a scan of a std::list. The list doesn't hold a reference - the
+// resource map of the shard does.
+//
+class ResHandleLru : public Nv_noncopyable
+{
+	ResHandle* m_pHead;								// most recently used
+	ResHandle* m_pTail;								// least recently used
+	size_t m_size;
+
+public:
+	ResHandleLru() : m_pHead(nullptr), m_pTail(nullptr), m_size(0) { }
+
+	bool Empty() const { return m_pHead == nullptr; }
+	size_t Size() const { return m_size; }
+	ResHandle* Front() const { return m_pHead; }
+	ResHandle* Back() const { return m_pTail; }
+	bool Contains(const ResHandle* pHandle) const { return pHandle->m_pLruPrev != nullptr || pHandle == m_pHead; }
+
+	void PushFront(ResHandle* pHandle);
+	void Remove(ResHandle* pHandle);
+	void MoveToFront(ResHandle* pHandle);
+	void Clear();
+};
+
+typedef std::unordered_map<std::string, std::shared_ptr<ResHandle>> ResHandleMap;
+
+//
+// struct ResCacheCategoryStats				- not described in the book
+//
+// A snapshot of one budget category, filled in by ResCache::GetStats(). Limits of 0 mean the
+// category has none.
+//
+struct ResCacheCategoryStats
+{
+	enum { LOAD_TIME_BUCKETS = 12 };				// [0,1ms) [1,2ms) [2,4ms) ... [512,1024ms) [1024ms,inf)
+
+	std::string m_name;
+	unsigned __int64 m_softLimit;
+	unsigned __int64 m_hardLimit;
+	unsigned __int64 m_allocated;					// bytes resident right now
+	unsigned __int64 m_peakAllocated;
+	unsigned __int64 m_pinned;						// handles currently pinned
+
+	unsigned __int64 m_hits;
+	unsigned __int64 m_misses;
+	unsigned __int64 m_evictions;
+	unsigned __int64 m_loads;
+	unsigned __int64 m_failedLoads;
+	unsigned __int64 m_bytesLoaded;
+	unsigned __int64 m_loadTimeHistogram[LOAD_TIME_BUCKETS];
+};
+
+//
+// class ResCacheCategory						- not described in the book
+//
+// A named slice of the cache budget. Resources are put in the first category with a matching
+// pattern - a loader pattern like "*.dds" or a path prefix like "actors\\*". Going over the soft
+// limit makes a category the first one to lose resources when the cache needs room, and a
+// category never grows past its hard limit. The counters are updated with Interlocked*() so
+// the stats can be read without taking any shard lock.
+//
+class ResCacheCategory : public Nv_noncopyable
+{
+	friend class ResCache;
+
+	std::string m_name;
+	std::vector<std::string> m_patterns;
+	unsigned __int64 m_softLimit;
+	unsigned __int64 m_hardLimit;
+
+	volatile LONG64 m_allocated;
+	volatile LONG64 m_peakAllocated;
+	volatile LONG64 m_pinned;
+	volatile LONG64 m_hits;
+	volatile LONG64 m_misses;
+	volatile LONG64 m_evictions;
+	volatile LONG64 m_loads;
+	volatile LONG64 m_failedLoads;
+	volatile LONG64 m_bytesLoaded;
+	volatile LONG64 m_loadTimeHistogram[ResCacheCategoryStats::LOAD_TIME_BUCKETS];
+
+public:
+	ResCacheCategory(const std::string& name, unsigned __int64 softLimit, unsigned __int64 hardLimit);
+
+	bool Matches(const std::string& name) const;
+
+private:
+	void AddAllocated(LONG64 size);
+	void AddLoad(unsigned __int64 bytes, double milliseconds);
+	void GetStats(ResCacheCategoryStats& stats) const;
+};
+
+//
+// struct ResCacheShard						- not described in the book
+//
+// A slice of the cache with its own lock and lru. Resources are assigned to a shard by the hash
+// of their name, so threads hitting different resources rarely contend. Every category gets its
+// own lru and byte count in every shard. The memory budget isn't split - it belongs to the whole
+// cache, and a shard that runs out of things to evict takes room from the others.
+//
+struct ResCacheShard : public Nv_noncopyable
+{
+	enum { MAX_CATEGORIES = 16 };
+
+	CriticalSection m_cs;							// guards everything below
+	ResHandleMap m_resources;
+	ResHandleLru m_lru[MAX_CATEGORIES];				// unpinned handles only
+	unsigned __int64 m_categoryAllocated[MAX_CATEGORIES];
+
+	ResCacheShard() { memset(m_categoryAllocated, 0, sizeof(m_categoryAllocated)); }
+};
+
 typedef std::list<std::shared_ptr<IResourceLoader>> ResourceLoaders;
+typedef std::map<std::string, ResLoadTicketPtr> ResLoadTicketMap;
+typedef std::priority_queue<ResLoadRequest> ResLoadQueue;
 
 class ResCache
 {
 	friend class ResHandle;
+	friend class ResLoadTicket;
 
-	ResHandleList m_lru;										// least recently used list
-	ResHandleMap m_resources;
+	std::vector<ResCacheShard*> m_shards;						// each with its own lru, resource map and lock
 	ResourceLoaders m_resourceLoaders;
+	std::vector<ResCacheCategory*> m_categories;				// [0] is the default category
 
 	IResourceFile* m_file;
 
 
-	unsigned int m_cacheSize;									// total memory size
-	unsigned int m_allocated;									// total memory allocated
+	unsigned __int64 m_cacheSize;								// total memory size, shared by the shards
+	volatile LONG64 m_allocated;								// charged to m_cacheSize, by MakeRoom() before the memory is allocated
+	double m_ticksPerMs;										// QueryPerformanceFrequency() / 1000
+
+	// [async] - m_loadCs guards the async load queue and the pending loads. It may be held while
+	//			 taking a shard lock, never the other way around. m_fileCs serializes access to
+	//			 resource files that don't support concurrent reads.
+	CriticalSection m_loadCs;
+	CriticalSection m_fileCs;
+
+	// asynchronous loading
+	ResLoadTicketMap m_pendingLoads;							// in flight requests, keyed by resource name
+	ResLoadTicketMap m_gameThreadLoads;							// read, waiting for their loader to run on the game thread
+	ResLoadQueue m_loadQueue;									// highest priority first
+	unsigned int m_loadSequence;
+	std::vector<HANDLE> m_loaderThreads;
+	HANDLE m_hLoadsQueued;										// semaphore, counts entries in m_loadQueue
+	volatile LONG m_stopLoaders;
 		
 protected:
 
-	bool MakeRoom(unsigned int size);
-	char* Allocate(unsigned int size);
+	unsigned int ShardIndex(const std::string& name) const;
+	unsigned int CategoryIndex(const std::string& name) const;
+
+	// the shard lock has to be held for FindVictim() and FreeOneResource(); MakeRoom() and
+	// EvictFromAnyShard() take the shard locks themselves, one at a time
+	bool MakeRoom(ResCacheShard& shard, unsigned int category, unsigned int size);
+	bool EvictFromAnyShard(ResCacheShard& first, int category);
+	bool EvictFromShard(ResCacheShard& shard, int category);
+	int FindVictim(ResCacheShard& shard) const;
+	char* Allocate(ResCacheShard& shard, unsigned int category, unsigned int size);
 	void Free(std::shared_ptr<ResHandle> gonner);
 
 
+	std::shared_ptr<IResourceLoader> FindLoader(Resource* r);
 	std::shared_ptr<ResHandle> Load(Resource* r);
-	std::shared_ptr<ResHandle> Find(Resource* r);
-	void Update(std::shared_ptr<ResHandle> handle);
-
-	void FreeOneResource();
-	void MemoryHasBeenFreed(unsigned int size);
+	std::shared_ptr<ResHandle> ReadAndLoad(Resource* r, unsigned int category);
+	char* ReadRawResource(Resource* r, std::shared_ptr<IResourceLoader> loader, int rawSize, bool& outView);
+	std::shared_ptr<ResHandle> LoadRawResource(Resource* r, unsigned int category, std::shared_ptr<IResourceLoader> loader, char* rawBuffer, int rawSize, bool rawView);
+	void RecordLoad(unsigned int category, std::shared_ptr<ResHandle> handle, const LARGE_INTEGER& start);
+	std::shared_ptr<ResHandle> Find(Resource* r);			// also moves a hit to the front of the lru
+	std::shared_ptr<ResHandle> Insert(ResCacheShard& shard, Resource* r, std::shared_ptr<ResHandle> handle);
+	IResourceStream* OpenStream(const Resource& r);
+
+	// pins handle, a result of GetHandle(r) that may have been evicted or reloaded since
+	std::shared_ptr<ResHandle> PinHandle(Resource* r, std::shared_ptr<ResHandle> handle);
+
+	void FreeOneResource(ResCacheShard& shard, unsigned int category);
+	void MemoryHasBeenFreed(unsigned int shard, unsigned int category, unsigned int size);
+
+	static DWORD WINAPI LoaderThreadProc(LPVOID lpParam);
+	void LoaderThreadLoop();
+	ResLoadTicketPtr PopLoadRequest();
+	void CompleteLoadRequest(ResLoadTicketPtr ticket, std::shared_ptr<ResHandle> handle);
+	void ReadForGameThread(ResLoadTicketPtr ticket, std::shared_ptr<IResourceLoader> loader);
+	bool FinishGameThreadLoad(const std::string& name);
 
 public:
-	ResCache(const unsigned int sizeInMb, IResourceFile* resFile);
+	// numShards > 1 lets several threads call GetHandle() without contending on a single lock.
+	// The shards share one budget, so any resource that fits in the cache can be loaded.
+	ResCache(const unsigned int sizeInMb, IResourceFile* resFile, unsigned int numShards = 1);
 	virtual ~ResCache();
 
 	bool Init();
 
 	void RegisterLoader(std::shared_ptr<IResourceLoader> loader);
 
+	// Budget categories have to be set up before anything is loaded, like the loaders. The first
+	// category with a matching pattern wins, anything else goes to category 0, "default". Limits
+	// are in bytes, 0 for none, and are for the whole cache like its size. Returns
+	// the category index, or -1 if the name is taken or there's no room for another category.
+	int AddCategory(const std::string& name, const std::string& pattern, unsigned __int64 softLimit = 0, unsigned __int64 hardLimit = 0);
+	bool AddCategoryPattern(int category, const std::string& pattern);
+	int FindCategory(const std::string& name) const;
+
+	// Pinned resources stay loaded no matter how much room the cache needs - good for the actor
+	// archetypes that get instanced all the time. Pins nest; Flush() still drops pinned resources.
+	std::shared_ptr<ResHandle> Pin(Resource* r);
+	void Unpin(Resource* r);
+
 	std::shared_ptr<ResHandle> GetHandle(Resource* r);
 
+	// Queues the resource to be read, inflated and run through its loader on a background thread.
+	// Higher priorities are serviced first. Completion is also announced with an
+	// EvtData_Resource_Loaded through IEventManager::VThreadSafeQueueEvent().
+	ResLoadTicketPtr GetHandleAsync(Resource* r, int priority = 0);
+
+	// Loader threads are only started on request - call this once all the loaders are registered.
+	bool StartAsyncLoading(unsigned int numThreads = 2);
+	void StopAsyncLoading();
+
+	// Runs the loaders of async loads that have to run on the game thread, whose raw bytes have been
+	// read since the last call. Call it from the game thread once a frame.
+	void FinishGameThreadLoads();
+
 	int Preload(const std::string pattern, void(*progressCallback)(int, bool &));
 	std::vector<std::string> Match(const std::string pattern);
 
 	void Flush(void);
 
+	unsigned __int64 GetCacheSize() const { return m_cacheSize; }
+	unsigned __int64 GetAllocated() const;
+	void GetStats(std::vector<ResCacheCategoryStats>& stats) const;
+	std::string GetStatsJson() const;
+
 	bool IsUsingDevelopmentDirectories(void) const { /*Nv_ASSERT(m_file);*/ return m_file->VIsUsingDevelopmentDirectories(); }
 };
\ No newline at end of file
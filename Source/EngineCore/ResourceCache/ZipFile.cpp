@@ -4,9 +4,9 @@
 
 #include "Common/CommonStd.h"
 
-#include <cctype>			// for std::tolower
-
 #include "ZipFile.h"
+#include "../Multicore/JobSystem.h"
+#include "../App/App.h"
 
 #include <zlib.h>
 #include <string.h>
@@ -97,17 +97,93 @@ struct ZipFile::TZipDirFileHeader
 	char* GetComment() const { return GetExtra() + xtraLen; }
 };
 
+// ------------------------------------------------------------------------------
+// struct ZipFile::TZipChunkExtra						- not described in the book
+//
+// Extra field ZipWriter adds to chunked entries. The compressed size of each chunk
+// follows the struct.
+// ------------------------------------------------------------------------------
+struct ZipFile::TZipChunkExtra
+{
+	enum
+	{
+		HEADER_ID = 0x564e			// "NV"
+	};
+	word headerId;
+	word dataSize;				// size of the field after headerId and dataSize
+	dword chunkSize;			// uncompressed size of every chunk but the last
+	dword numChunks;
+
+	const dword* GetChunkSizes() const { return (const dword*)(this + 1); }
+};
+
 #pragma pack()
 
 // --------------------------------------------------------------------------
 // Function:      Init
 // Purpose:       Initialize the object and read the zip file directory.
-// Parameters:    A stdio FILE* used for reading.
+// Parameters:    The archive file name, and whether it should be memory mapped.
 // --------------------------------------------------------------------------
-bool ZipFile::Init(const std::wstring &resFileName)
+bool ZipFile::Init(const std::wstring &resFileName, bool useMemoryMapping)
 {
 	End();
 
+	if (useMemoryMapping)
+	{
+		m_hFile = CreateFileW(resFileName.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, NULL);
+		if (m_hFile == INVALID_HANDLE_VALUE)
+			return false;
+
+		LARGE_INTEGER fileSize;
+		if (!GetFileSizeEx(m_hFile, &fileSize) || fileSize.QuadPart < (LONGLONG)sizeof(TZipDirHeader))
+		{
+			End();
+			return false;
+		}
+		m_mappingSize = (size_t)fileSize.QuadPart;
+
+		// Copy-on-write, so the directory can be fixed up in place below and a loader that scribbles
+		// on a zero copy buffer only dirties its own private pages.
+		m_hMapping = CreateFileMapping(m_hFile, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+		if (m_hMapping == NULL)
+		{
+			End();
+			return false;
+		}
+
+		m_pMapping = (char*)MapViewOfFile(m_hMapping, FILE_MAP_COPY, 0, 0, 0);
+		if (m_pMapping == nullptr)
+		{
+			End();
+			return false;
+		}
+
+		// Assuming no extra comment at the end, the end record is the last thing in the file.
+		const TZipDirHeader &dh = *(const TZipDirHeader*)(m_pMapping + m_mappingSize - sizeof(TZipDirHeader));
+		size_t dhOffset = m_mappingSize - sizeof(TZipDirHeader);
+		if (dh.sig != TZipDirHeader::SIGNATURE || dh.dirSize > dhOffset)
+		{
+			End();
+			return false;
+		}
+
+		// Only the entry pointer table is allocated, the directory itself stays in the mapping.
+		m_pDirData = Nv_NEW char[dh.nDirEntries * sizeof(*m_papDir)];
+		if (!m_pDirData)
+		{
+			End();
+			return false;
+		}
+		m_papDir = (const TZipDirFileHeader **)m_pDirData;
+
+		if (!InitDirectory(m_pMapping + dhOffset - dh.dirSize, dh.nDirEntries, dh.dirSize))
+		{
+			End();
+			return false;
+		}
+		return true;
+	}
+
 	_wfopen_s(&m_pFile, resFileName.c_str(), _T("rb"));
 	if (!m_pFile)
 		return false;
@@ -134,21 +210,46 @@ bool ZipFile::Init(const std::wstring &resFileName)
 	memset(m_pDirData, 0, dh.dirSize + dh.nDirEntries * sizeof(*m_papDir));
 	fread(m_pDirData, dh.dirSize, 1, m_pFile);
 
-	// Now process each entry.
-	char *pfh = m_pDirData;
 	m_papDir = (const TZipDirFileHeader **)(m_pDirData + dh.dirSize);
 
+	if (!InitDirectory(m_pDirData, dh.nDirEntries, dh.dirSize))
+	{
+		SAFE_DELETE_ARRAY(m_pDirData);
+		m_papDir = nullptr;
+		return false;
+	}
+
+	return true;
+}
+
+// --------------------------------------------------------------------------
+// Function:      InitDirectory
+// Purpose:       Walk the central directory and build the entry tables.
+// Parameters:    The directory data (writable), the entry count and its size.
+// --------------------------------------------------------------------------
+bool ZipFile::InitDirectory(char* pDirData, int nDirEntries, unsigned long dirSize)
+{
+	// Now process each entry.
+	char *pfh = pDirData;
+	char *pEnd = pDirData + dirSize;
+
+	// the names are a bit smaller than the directory itself, which is close enough
+	m_ZipContentsIndex.Reserve(nDirEntries, dirSize);
+
 	bool success = true;
 
-	for (int i = 0; i < dh.nDirEntries && success; i++)
+	for (int i = 0; i < nDirEntries && success; i++)
 	{
 		TZipDirFileHeader &fh = *(TZipDirFileHeader*)pfh;
 
 		// Store the address of nth file for quicker access.
 		m_papDir[i] = &fh;
 
-		// Check the directory entry integrity.
-		if (fh.sig != TZipDirFileHeader::SIGNATURE)
+		// Check the directory entry integrity - the name, extra and comment fields have to be
+		// inside the directory too, a mapped one ends where the end record starts.
+		if ((size_t)(pEnd - pfh) < sizeof(fh) || fh.sig != TZipDirFileHeader::SIGNATURE)
+			success = false;
+		else if ((size_t)(pEnd - pfh) < sizeof(fh) + fh.fnameLen + fh.xtraLen + fh.cmntLen)
 			success = false;
 		else
 		{
@@ -159,42 +260,22 @@ bool ZipFile::Init(const std::wstring &resFileName)
 				if (pfh[j] == '/')
 					pfh[j] = '\\';
 
-			char fileName[_MAX_PATH];
-			memcpy(fileName, pfh, fh.fnameLen);
-			fileName[fh.fnameLen] = 0;
-			_strlwr_s(fileName, _MAX_PATH);
-			std::string spath = fileName;
-			m_ZipContentsMap[spath] = i;
+			// the index folds the case itself
+			m_ZipContentsIndex.Insert(pfh, fh.fnameLen, i);
 
 			// Skip name, extra and comment fields.
 			pfh += fh.fnameLen + fh.xtraLen + fh.cmntLen;
 		}
 	}
-	if (!success)
-	{
-		SAFE_DELETE_ARRAY(m_pDirData);
-	}
-	else
+
+	if (success)
 	{
-		m_nEntries = dh.nDirEntries;
+		m_nEntries = nDirEntries;
 	}
 
 	return success;
 }
 
-int ZipFile::Find(const std::string &path) const
-{
-	std::string lowerCase = path;
-	std::transform(lowerCase.begin(), lowerCase.end(), lowerCase.begin(), (int(*)(int)) std::tolower);
-	ZipContentsMap::const_iterator i = m_ZipContentsMap.find(lowerCase);
-	if (i == m_ZipContentsMap.end())
-		return -1;
-
-	return i->second;
-}
-
-
-
 // --------------------------------------------------------------------------
 // Function:      End
 // Purpose:       Finish the object
@@ -202,9 +283,33 @@ int ZipFile::Find(const std::string &path) const
 // --------------------------------------------------------------------------
 void ZipFile::End()
 {
-	m_ZipContentsMap.clear();
+	m_ZipContentsIndex.Clear();
 	SAFE_DELETE_ARRAY(m_pDirData);
+	m_papDir = nullptr;
 	m_nEntries = 0;
+
+	if (m_pFile)
+	{
+		fclose(m_pFile);
+		m_pFile = nullptr;
+	}
+
+	if (m_pMapping)
+	{
+		UnmapViewOfFile(m_pMapping);
+		m_pMapping = nullptr;
+	}
+	if (m_hMapping)
+	{
+		CloseHandle(m_hMapping);
+		m_hMapping = NULL;
+	}
+	if (m_hFile != INVALID_HANDLE_VALUE)
+	{
+		CloseHandle(m_hFile);
+		m_hFile = INVALID_HANDLE_VALUE;
+	}
+	m_mappingSize = 0;
 }
 
 // --------------------------------------------------------------------------
@@ -240,57 +345,118 @@ int ZipFile::GetFileLen(int i) const
 }
 
 // --------------------------------------------------------------------------
-// Function:      ReadFile
-// Purpose:       Uncompress a complete file
-// Parameters:    The file index and the pre-allocated buffer
+// Function:      GetMappedData
+// Purpose:       Locate an entry's data inside the mapped archive
+// Parameters:    The file index and where to return the local header
 // --------------------------------------------------------------------------
-bool ZipFile::ReadFile(int i, void *pBuf)
+const char* ZipFile::GetMappedData(int i, const TZipLocalHeader** ppHeader) const
 {
-	if (pBuf == NULL || i < 0 || i >= m_nEntries)
+	if (!m_pMapping || i < 0 || i >= m_nEntries)
+		return nullptr;
+
+	size_t hdrOffset = m_papDir[i]->hdrOffset;
+	if (hdrOffset + sizeof(TZipLocalHeader) > m_mappingSize)
+		return nullptr;
+
+	const TZipLocalHeader* pHeader = (const TZipLocalHeader*)(m_pMapping + hdrOffset);
+	if (pHeader->sig != TZipLocalHeader::SIGNATURE)
+		return nullptr;
+
+	// Skip the header and its name and extra fields
+	size_t dataOffset = hdrOffset + sizeof(TZipLocalHeader) + pHeader->fnameLen + pHeader->xtraLen;
+	if (dataOffset + pHeader->cSize > m_mappingSize)
+		return nullptr;
+
+	*ppHeader = pHeader;
+	return m_pMapping + dataOffset;
+}
+
+// --------------------------------------------------------------------------
+// Function:      GetEntryData
+// Purpose:       Read an entry's local header and find where its data starts
+// Parameters:    The file index, where to return the header and the data offset
+// --------------------------------------------------------------------------
+bool ZipFile::GetEntryData(int i, TZipLocalHeader* pHeader, unsigned long* pDataOffset)
+{
+	if (i < 0 || i >= m_nEntries)
 		return false;
 
-	// Quick'n dirty read, the whole file at once.
-	// Ungood if the ZIP has huge files inside
+	if (m_pMapping)
+	{
+		const TZipLocalHeader* pMappedHeader = nullptr;
+		const char* pData = GetMappedData(i, &pMappedHeader);
+		if (pData == nullptr)
+			return false;
 
-	// Go to the actual file and read the local header.
-	fseek(m_pFile, m_papDir[i]->hdrOffset, SEEK_SET);
-	TZipLocalHeader h;
+		*pHeader = *pMappedHeader;
+		*pDataOffset = (unsigned long)(pData - m_pMapping);
+		return true;
+	}
+
+	ScopedCriticalSection locker(m_fileCs);
 
-	memset(&h, 0, sizeof(h));
-	fread(&h, sizeof(h), 1, m_pFile);
-	if (h.sig != TZipLocalHeader::SIGNATURE)
+	fseek(m_pFile, m_papDir[i]->hdrOffset, SEEK_SET);
+	memset(pHeader, 0, sizeof(*pHeader));
+	fread(pHeader, sizeof(*pHeader), 1, m_pFile);
+	if (pHeader->sig != TZipLocalHeader::SIGNATURE)
 		return false;
 
-	// Skip extra fields
-	fseek(m_pFile, h.fnameLen + h.xtraLen, SEEK_CUR);
+	*pDataOffset = m_papDir[i]->hdrOffset + sizeof(TZipLocalHeader) + pHeader->fnameLen + pHeader->xtraLen;
+	return true;
+}
 
-	if (h.compression == Z_NO_COMPRESSION)
+// --------------------------------------------------------------------------
+// Function:      ReadRaw
+// Purpose:       Read bytes straight out of the archive
+// Parameters:    The offset in the archive, the buffer and the byte count
+// --------------------------------------------------------------------------
+bool ZipFile::ReadRaw(unsigned long offset, void* pBuf, unsigned long size)
+{
+	if (m_pMapping)
 	{
-		// Simply read in raw stored data.
-		fread(pBuf, h.cSize, 1, m_pFile);
+		if ((size_t)offset + size > m_mappingSize)
+			return false;
+
+		memcpy(pBuf, m_pMapping + offset, size);
 		return true;
 	}
-	else if (h.compression != Z_DEFLATED)
-		return false;
 
-	// Alloc compressed data buffer and read the whole stream
-	char *pcData = Nv_NEW char[h.cSize];
-	if (!pcData)
-		return false;
+	ScopedCriticalSection locker(m_fileCs);
 
-	memset(pcData, 0, h.cSize);
-	fread(pcData, h.cSize, 1, m_pFile);
+	fseek(m_pFile, offset, SEEK_SET);
+	return fread(pBuf, size, 1, m_pFile) == 1;
+}
 
-	bool ret = true;
+// --------------------------------------------------------------------------
+// Function:      GetFileView
+// Purpose:       Return a pointer straight into the mapping for a stored file
+// Parameters:    The file index.
+// --------------------------------------------------------------------------
+const char* ZipFile::GetFileView(int i) const
+{
+	const TZipLocalHeader* pHeader = nullptr;
+	const char* pData = GetMappedData(i, &pHeader);
+	if (pData == nullptr || pHeader->compression != Z_NO_COMPRESSION)
+		return nullptr;
 
+	return pData;
+}
+
+// --------------------------------------------------------------------------
+// Function:      Inflate
+// Purpose:       Uncompress a raw deflate stream
+// Parameters:    The compressed data and the pre-allocated destination buffer
+// --------------------------------------------------------------------------
+bool ZipFile::Inflate(const char* pcData, unsigned long cSize, void* pBuf, unsigned long ucSize) const
+{
 	// Setup the inflate stream.
 	z_stream stream;
 	int err;
 
 	stream.next_in = (Bytef*)pcData;
-	stream.avail_in = (uInt)h.cSize;
+	stream.avail_in = (uInt)cSize;
 	stream.next_out = (Bytef*)pBuf;
-	stream.avail_out = h.ucSize;
+	stream.avail_out = ucSize;
 	stream.zalloc = (alloc_func)0;
 	stream.zfree = (free_func)0;
 
@@ -302,10 +468,250 @@ bool ZipFile::ReadFile(int i, void *pBuf)
 		inflateEnd(&stream);
 		if (err == Z_STREAM_END)
 			err = Z_OK;
-		inflateEnd(&stream);
 	}
+
+	return err == Z_OK;
+}
+
+// --------------------------------------------------------------------------
+// Function:      GetChunkExtra
+// Purpose:       Find the chunk table of an entry written by ZipWriter
+// Parameters:    The file index.
+// --------------------------------------------------------------------------
+const ZipFile::TZipChunkExtra* ZipFile::GetChunkExtra(int i) const
+{
+	if (i < 0 || i >= m_nEntries)
+		return nullptr;
+
+	const TZipDirFileHeader* pDir = m_papDir[i];
+	if (pDir->compression != Z_DEFLATED)
+		return nullptr;
+
+	const char* pExtra = pDir->GetExtra();
+	const char* pEnd = pExtra + pDir->xtraLen;
+	while (pExtra + 2 * sizeof(word) <= pEnd)
+	{
+		const TZipChunkExtra* pChunks = (const TZipChunkExtra*)pExtra;
+		const char* pNext = pExtra + 2 * sizeof(word) + pChunks->dataSize;
+		if (pNext > pEnd)
+			break;
+
+		if (pChunks->headerId == TZipChunkExtra::HEADER_ID)
+		{
+			// anything that doesn't add up is treated as an ordinary entry
+			if (pChunks->dataSize < 2 * sizeof(dword) || pChunks->chunkSize == 0 || pChunks->numChunks == 0)
+				return nullptr;
+			if (pChunks->numChunks > (pChunks->dataSize - 2 * sizeof(dword)) / sizeof(dword))
+				return nullptr;
+			if (pChunks->numChunks != pDir->ucSize / pChunks->chunkSize + ((pDir->ucSize % pChunks->chunkSize) ? 1 : 0))
+				return nullptr;
+
+			return pChunks;
+		}
+		pExtra = pNext;
+	}
+	return nullptr;
+}
+
+// ------------------------------------------------------------------------------
+// struct ChunkInflateJob								- not described in the book
+//
+// One chunked entry being inflated. Every job, and the calling thread, grabs the next
+// chunk until they are all done or one of them fails.
+// ------------------------------------------------------------------------------
+struct ChunkInflateJob
+{
+	const char* m_pcData;
+	char* m_pDest;
+	const size_t* m_pOffsets;		// numChunks + 1 offsets of the chunks in m_pcData
+	unsigned long m_ucSize;
+	unsigned long m_chunkSize;
+	LONG m_numChunks;
+
+	volatile LONG m_nextChunk;
+	volatile LONG m_chunksDone;
+	volatile LONG m_failed;
+};
+
+static bool InflateChunk(const ChunkInflateJob& job, LONG chunk)
+{
+	unsigned long destOffset = chunk * job.m_chunkSize;
+	unsigned long destSize = std::min(job.m_chunkSize, job.m_ucSize - destOffset);
+
+	z_stream stream;
+	memset(&stream, 0, sizeof(stream));
+	stream.next_in = (Bytef*)(job.m_pcData + job.m_pOffsets[chunk]);
+	stream.avail_in = (uInt)(job.m_pOffsets[chunk + 1] - job.m_pOffsets[chunk]);
+	stream.next_out = (Bytef*)(job.m_pDest + destOffset);
+	stream.avail_out = destSize;
+
+	int err = inflateInit2(&stream, -MAX_WBITS);
 	if (err != Z_OK)
-		ret = false;
+		return false;
+
+	// Only the last chunk holds the end of the stream, the others stop at a full flush point.
+	err = inflate(&stream, Z_SYNC_FLUSH);
+	inflateEnd(&stream);
+	if (err != Z_OK && err != Z_STREAM_END && err != Z_BUF_ERROR)
+		return false;
+
+	return stream.total_out == destSize;
+}
+
+static void RunChunkInflateJob(ChunkInflateJob& job, void(*progressCallback)(int, bool &))
+{
+	while (!job.m_failed)
+	{
+		LONG chunk = InterlockedIncrement(&job.m_nextChunk) - 1;
+		if (chunk >= job.m_numChunks)
+			break;
+
+		if (!InflateChunk(job, chunk))
+			InterlockedExchange(&job.m_failed, 1);
+
+		LONG done = InterlockedIncrement(&job.m_chunksDone);
+		if (progressCallback)
+		{
+			bool cancel = false;
+			progressCallback(done * 100 / job.m_numChunks, cancel);
+			if (cancel)
+				InterlockedExchange(&job.m_failed, 1);
+		}
+	}
+}
+
+static void ChunkInflateJobProc(void* pData)
+{
+	RunChunkInflateJob(*static_cast<ChunkInflateJob*>(pData), nullptr);
+}
+
+// --------------------------------------------------------------------------
+// Function:      InflateChunks
+// Purpose:       Uncompress a chunked entry as jobs on the job system
+// Parameters:    The chunk table, the compressed data and the pre-allocated buffer.
+//                Progress is only reported from the calling thread.
+// --------------------------------------------------------------------------
+bool ZipFile::InflateChunks(const TZipChunkExtra* pChunks, const char* pcData, unsigned long cSize, void* pBuf, unsigned long ucSize, void(*progressCallback)(int, bool &)) const
+{
+	// Turn the chunk sizes into offsets, and make sure they add up to the entry.
+	std::vector<size_t> offsets(pChunks->numChunks + 1, 0);
+	const dword* pChunkSizes = pChunks->GetChunkSizes();
+	for (dword c = 0; c < pChunks->numChunks; ++c)
+		offsets[c + 1] = offsets[c] + pChunkSizes[c];
+
+	if (offsets.back() != cSize)
+		return false;
+
+	ChunkInflateJob job;
+	job.m_pcData = pcData;
+	job.m_pDest = (char*)pBuf;
+	job.m_pOffsets = &offsets[0];
+	job.m_ucSize = ucSize;
+	job.m_chunkSize = pChunks->chunkSize;
+	job.m_numChunks = (LONG)pChunks->numChunks;
+	job.m_nextChunk = 0;
+	job.m_chunksDone = 0;
+	job.m_failed = 0;
+
+	// Without a job system the calling thread inflates every chunk itself.
+	JobSystem* pJobSystem = m_pJobSystem ? m_pJobSystem : (g_pApp ? g_pApp->m_pJobSystem : nullptr);
+	unsigned int numHelpers = 0;
+	if (pJobSystem)
+	{
+		// the calling thread works on the chunks too, so it only needs one helper less - and
+		// GetChunkExtra() never hands out a table without chunks, so this can't wrap
+		unsigned int numThreads = m_maxInflateThreads ? m_maxInflateThreads : pJobSystem->GetNumWorkers() + 1;
+		numHelpers = std::min<unsigned int>(numThreads, pChunks->numChunks) - 1;
+	}
+
+	// Helpers that get to run after the calling thread has taken the last chunk find nothing left
+	// to do, so a busy job system never holds the entry up.
+	JobCounter helpers;
+	for (unsigned int t = 0; t < numHelpers; ++t)
+		pJobSystem->Run(ChunkInflateJobProc, &job, &helpers);
+
+	RunChunkInflateJob(job, progressCallback);
+
+	if (numHelpers)
+		pJobSystem->Wait(helpers);
+
+	return job.m_failed == 0;
+}
+
+// --------------------------------------------------------------------------
+// Function:      ReadFile
+// Purpose:       Uncompress a complete file
+// Parameters:    The file index and the pre-allocated buffer
+// --------------------------------------------------------------------------
+bool ZipFile::ReadFile(int i, void *pBuf)
+{
+	if (pBuf == NULL || i < 0 || i >= m_nEntries)
+		return false;
+
+	if (m_pMapping)
+	{
+		// Nothing shared is modified here, so any number of threads can read at once.
+		const TZipLocalHeader* pHeader = nullptr;
+		const char* pData = GetMappedData(i, &pHeader);
+		if (pData == nullptr)
+			return false;
+
+		if (pHeader->compression == Z_NO_COMPRESSION)
+		{
+			memcpy(pBuf, pData, pHeader->cSize);
+			return true;
+		}
+		else if (pHeader->compression != Z_DEFLATED)
+			return false;
+
+		// inflate straight out of the mapping, no staging buffer needed
+		const TZipChunkExtra* pChunks = GetChunkExtra(i);
+		if (pChunks)
+			return InflateChunks(pChunks, pData, pHeader->cSize, pBuf, pHeader->ucSize, nullptr);
+
+		return Inflate(pData, pHeader->cSize, pBuf, pHeader->ucSize);
+	}
+
+	// Quick'n dirty read, the whole file at once.
+	// Ungood if the ZIP has huge files inside
+
+	TZipLocalHeader h;
+	char *pcData = nullptr;
+	{
+		ScopedCriticalSection locker(m_fileCs);
+
+		// Go to the actual file and read the local header.
+		fseek(m_pFile, m_papDir[i]->hdrOffset, SEEK_SET);
+
+		memset(&h, 0, sizeof(h));
+		fread(&h, sizeof(h), 1, m_pFile);
+		if (h.sig != TZipLocalHeader::SIGNATURE)
+			return false;
+
+		// Skip extra fields
+		fseek(m_pFile, h.fnameLen + h.xtraLen, SEEK_CUR);
+
+		if (h.compression == Z_NO_COMPRESSION)
+		{
+			// Simply read in raw stored data.
+			fread(pBuf, h.cSize, 1, m_pFile);
+			return true;
+		}
+		else if (h.compression != Z_DEFLATED)
+			return false;
+
+		// Alloc compressed data buffer and read the whole stream
+		pcData = Nv_NEW char[h.cSize];
+		if (!pcData)
+			return false;
+
+		memset(pcData, 0, h.cSize);
+		fread(pcData, h.cSize, 1, m_pFile);
+	}
+
+	// inflating doesn't touch the file, other readers can have it back already
+	const TZipChunkExtra* pChunks = GetChunkExtra(i);
+	bool ret = pChunks ? InflateChunks(pChunks, pcData, h.cSize, pBuf, h.ucSize, nullptr) : Inflate(pcData, h.cSize, pBuf, h.ucSize);
 
 	delete[] pcData;
 	return ret;
@@ -323,83 +729,584 @@ bool ZipFile::ReadLargeFile(int i, void *pBuf, void(*progressCallback)(int, bool
 	if (pBuf == NULL || i < 0 || i >= m_nEntries)
 		return false;
 
-	// Quick'n dirty read, the whole file at once.
-	// Ungood if the ZIP has huge files inside
-
-	// Go to the actual file and read the local header.
-	fseek(m_pFile, m_papDir[i]->hdrOffset, SEEK_SET);
 	TZipLocalHeader h;
+	char *pcData = nullptr;
+	bool ownsData = false;
+
+	if (m_pMapping)
+	{
+		const TZipLocalHeader* pHeader = nullptr;
+		const char* pData = GetMappedData(i, &pHeader);
+		if (pData == nullptr)
+			return false;
+
+		h = *pHeader;
+		if (h.compression == Z_NO_COMPRESSION)
+		{
+			memcpy(pBuf, pData, h.cSize);
+			return true;
+		}
+		else if (h.compression != Z_DEFLATED)
+			return false;
+
+		pcData = const_cast<char*>(pData);
+	}
+	else
+	{
+		// Quick'n dirty read, the whole file at once.
+		// Ungood if the ZIP has huge files inside
+
+		ScopedCriticalSection locker(m_fileCs);
+
+		// Go to the actual file and read the local header.
+		fseek(m_pFile, m_papDir[i]->hdrOffset, SEEK_SET);
+
+		memset(&h, 0, sizeof(h));
+		fread(&h, sizeof(h), 1, m_pFile);
+		if (h.sig != TZipLocalHeader::SIGNATURE)
+			return false;
+
+		// Skip extra fields
+		fseek(m_pFile, h.fnameLen + h.xtraLen, SEEK_CUR);
+
+		if (h.compression == Z_NO_COMPRESSION)
+		{
+			// Simply read in raw stored data.
+			fread(pBuf, h.cSize, 1, m_pFile);
+			return true;
+		}
+		else if (h.compression != Z_DEFLATED)
+			return false;
+
+		// Alloc compressed data buffer and read the whole stream
+		pcData = Nv_NEW char[h.cSize];
+		if (!pcData)
+			return false;
+		ownsData = true;
+
+		memset(pcData, 0, h.cSize);
+		fread(pcData, h.cSize, 1, m_pFile);
+	}
+
+	bool ret = true;
+
+	const TZipChunkExtra* pChunks = GetChunkExtra(i);
+	if (pChunks)
+	{
+		ret = InflateChunks(pChunks, pcData, h.cSize, pBuf, h.ucSize, progressCallback);
+	}
+	else
+	{
+		// Setup the inflate stream.
+		z_stream stream;
+		int err;
+
+		stream.next_in = (Bytef*)pcData;
+		stream.avail_in = (uInt)h.cSize;
+		stream.next_out = (Bytef*)pBuf;
+		stream.avail_out = std::min<uInt>(128 * 1024, h.ucSize); //  read 128k at a time
+		stream.zalloc = (alloc_func)0;
+		stream.zfree = (free_func)0;
+
+		// Perform inflation. wbits < 0 indicates no zlib header inside the data.
+		err = inflateInit2(&stream, -MAX_WBITS);
+		if (err == Z_OK)
+		{
+			bool cancel = false;
+			while (stream.total_in < (uInt)h.cSize && !cancel)
+			{
+				err = inflate(&stream, Z_SYNC_FLUSH);
+				if (err == Z_STREAM_END)
+				{
+					err = Z_OK;
+					break;
+				}
+				else if (err != Z_OK)
+				{
+					//Nv_ASSERT(0 && "Something happened.");
+					break;
+				}
+
+				// inflate() has already moved next_out along
+				stream.avail_out = std::min<uInt>(128 * 1024, h.ucSize - stream.total_out);
+
+				if (progressCallback)
+					progressCallback((int)((unsigned __int64)stream.total_in * 100 / h.cSize), cancel);
+			}
+			inflateEnd(&stream);
+
+			if (cancel)
+				ret = false;
+		}
+		if (err != Z_OK)
+			ret = false;
+	}
+
+	if (ownsData)
+	{
+		delete[] pcData;
+	}
+	return ret;
+}
 
-	memset(&h, 0, sizeof(h));
-	fread(&h, sizeof(h), 1, m_pFile);
-	if (h.sig != TZipLocalHeader::SIGNATURE)
+
+// ------------------------------------------------------------------------------
+// class ZipReadStream
+// ------------------------------------------------------------------------------
+ZipReadStream::ZipReadStream(ZipFile* pZipFile)
+{
+	m_pZipFile = pZipFile;
+	m_pMappedData = nullptr;
+	m_dataOffset = 0;
+	m_cSize = 0;
+	m_ucSize = 0;
+	m_compression = Z_NO_COMPRESSION;
+	m_pStream = nullptr;
+	m_pReadAhead = nullptr;
+	m_compressedRead = 0;
+	m_position = 0;
+	m_finished = false;
+}
+
+ZipReadStream::~ZipReadStream()
+{
+	Close();
+}
+
+void ZipReadStream::Close()
+{
+	if (m_pStream)
+	{
+		inflateEnd(m_pStream);
+		SAFE_DELETE(m_pStream);
+	}
+	SAFE_DELETE_ARRAY(m_pReadAhead);
+}
+
+bool ZipReadStream::Open(int i)
+{
+	Close();
+
+	ZipFile::TZipLocalHeader h;
+	if (!m_pZipFile->GetEntryData(i, &h, &m_dataOffset))
 		return false;
 
-	// Skip extra fields
-	fseek(m_pFile, h.fnameLen + h.xtraLen, SEEK_CUR);
+	if (h.compression != Z_NO_COMPRESSION && h.compression != Z_DEFLATED)
+		return false;
 
-	if (h.compression == Z_NO_COMPRESSION)
+	m_compression = h.compression;
+	m_cSize = h.cSize;
+	m_ucSize = h.ucSize;
+	m_pMappedData = m_pZipFile->IsMemoryMapped() ? m_pZipFile->m_pMapping + m_dataOffset : nullptr;
+
+	if (m_compression == Z_DEFLATED)
 	{
-		// Simply read in raw stored data.
-		fread(pBuf, h.cSize, 1, m_pFile);
+		m_pStream = Nv_NEW z_stream;
+		memset(m_pStream, 0, sizeof(*m_pStream));
+		if (!m_pMappedData)
+			m_pReadAhead = Nv_NEW char[READ_AHEAD_SIZE];
+	}
+
+	return Restart();
+}
+
+bool ZipReadStream::Restart()
+{
+	m_position = 0;
+	m_finished = false;
+	m_compressedRead = 0;
+
+	if (m_compression != Z_DEFLATED)
 		return true;
+
+	inflateEnd(m_pStream);		// harmless on a zeroed stream that never got to inflateInit2()
+	memset(m_pStream, 0, sizeof(*m_pStream));
+
+	// a mapped entry is handed to zlib in one piece, no read-ahead needed
+	if (m_pMappedData)
+	{
+		m_pStream->next_in = (Bytef*)m_pMappedData;
+		m_pStream->avail_in = m_cSize;
+		m_compressedRead = m_cSize;
 	}
-	else if (h.compression != Z_DEFLATED)
+
+	// Perform inflation. wbits < 0 indicates no zlib header inside the data.
+	return inflateInit2(m_pStream, -MAX_WBITS) == Z_OK;
+}
+
+unsigned int ZipReadStream::VRead(void* pBuffer, unsigned int bytes)
+{
+	bytes = std::min<unsigned int>(bytes, m_ucSize - m_position);
+	if (bytes == 0)
+		return 0;
+
+	if (m_compression == Z_NO_COMPRESSION)
+	{
+		if (m_pMappedData)
+			memcpy(pBuffer, m_pMappedData + m_position, bytes);
+		else if (!m_pZipFile->ReadRaw(m_dataOffset + m_position, pBuffer, bytes))
+			return 0;
+
+		m_position += bytes;
+		return bytes;
+	}
+
+	m_pStream->next_out = (Bytef*)pBuffer;
+	m_pStream->avail_out = bytes;
+
+	while (m_pStream->avail_out > 0 && !m_finished)
+	{
+		if (m_pStream->avail_in == 0)
+		{
+			unsigned long readAhead = std::min<unsigned long>(READ_AHEAD_SIZE, m_cSize - m_compressedRead);
+			if (readAhead == 0 || m_pMappedData || !m_pZipFile->ReadRaw(m_dataOffset + m_compressedRead, m_pReadAhead, readAhead))
+				break;
+
+			m_pStream->next_in = (Bytef*)m_pReadAhead;
+			m_pStream->avail_in = readAhead;
+			m_compressedRead += readAhead;
+		}
+
+		int err = inflate(m_pStream, Z_NO_FLUSH);
+		if (err == Z_STREAM_END)
+			m_finished = true;
+		else if (err != Z_OK)
+			break;
+	}
+
+	unsigned int bytesRead = bytes - m_pStream->avail_out;
+	m_position += bytesRead;
+	return bytesRead;
+}
+
+bool ZipReadStream::VSeek(unsigned int offset)
+{
+	if (offset > m_ucSize)
 		return false;
 
-	// Alloc compressed data buffer and read the whole stream
-	char *pcData = Nv_NEW char[h.cSize];
-	if (!pcData)
+	if (m_compression == Z_NO_COMPRESSION)
+	{
+		m_position = offset;
+		return true;
+	}
+
+	// deflate streams can only be walked forwards
+	if (offset < m_position && !Restart())
 		return false;
 
-	memset(pcData, 0, h.cSize);
-	fread(pcData, h.cSize, 1, m_pFile);
+	char discard[4096];
+	while (m_position < offset)
+	{
+		if (VRead(discard, std::min<unsigned int>(sizeof(discard), offset - m_position)) == 0)
+			return false;
+	}
+	return true;
+}
 
-	bool ret = true;
 
-	// Setup the inflate stream.
+// ------------------------------------------------------------------------------
+// class ZipWriter
+// ------------------------------------------------------------------------------
+bool ZipWriter::Open(const std::wstring &zipFileName)
+{
+	Close();
+
+	_wfopen_s(&m_pFile, zipFileName.c_str(), L"wb");
+	return m_pFile != nullptr;
+}
+
+bool ZipWriter::Close()
+{
+	if (!m_pFile)
+		return false;
+
+	ZipFile::TZipDirHeader dh;
+	memset(&dh, 0, sizeof(dh));
+	dh.sig = ZipFile::TZipDirHeader::SIGNATURE;
+	dh.nDirEntries = (word)m_nEntries;
+	dh.totalDirEntries = (word)m_nEntries;
+	dh.dirSize = (dword)m_dirData.size();
+	dh.dirOffset = (dword)ftell(m_pFile);
+
+	bool success = true;
+	if (!m_dirData.empty())
+		success = fwrite(&m_dirData[0], m_dirData.size(), 1, m_pFile) == 1;
+	success = success && fwrite(&dh, sizeof(dh), 1, m_pFile) == 1;
+	success = (fclose(m_pFile) == 0) && success;
+
+	m_pFile = nullptr;
+	m_dirData.clear();
+	m_nEntries = 0;
+	return success;
+}
+
+bool ZipWriter::Deflate(const char* pData, unsigned long size, unsigned long chunkSize, std::vector<char>& compressed, std::vector<unsigned long>& chunkSizes) const
+{
 	z_stream stream;
-	int err;
+	memset(&stream, 0, sizeof(stream));
 
-	stream.next_in = (Bytef*)pcData;
-	stream.avail_in = (uInt)h.cSize;
-	stream.next_out = (Bytef*)pBuf;
-	stream.avail_out = (128 * 1024); //  read 128k at a time h.ucSize;
-	stream.zalloc = (alloc_func)0;
-	stream.zfree = (free_func)0;
+	// wbits < 0 leaves out the zlib header, zip entries are raw deflate streams.
+	if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+		return false;
 
-	// Perform inflation. wbits < 0 indicates no zlib header inside the data.
-	err = inflateInit2(&stream, -MAX_WBITS);
-	if (err == Z_OK)
+	compressed.resize(deflateBound(&stream, size) + 1024);
+	size_t used = 0;
+	bool success = true;
+
+	for (unsigned long offset = 0; offset < size && success; offset += chunkSize)
 	{
-		uInt count = 0;
-		bool cancel = false;
-		while (stream.total_in < (uInt)h.cSize && !cancel)
+		unsigned long length = std::min(chunkSize, size - offset);
+		bool last = (offset + length == size);
+		size_t chunkStart = used;
+
+		stream.next_in = (Bytef*)(pData + offset);
+		stream.avail_in = length;
+
+		// A full flush ends the chunk on a byte boundary and drops the dictionary, so every chunk
+		// can be inflated on its own.
+		int flush = last ? Z_FINISH : Z_FULL_FLUSH;
+		for (;;)
 		{
-			err = inflate(&stream, Z_SYNC_FLUSH);
+			if (compressed.size() - used < 64)
+				compressed.resize(compressed.size() + compressed.size() / 4 + 1024);
+
+			stream.next_out = (Bytef*)&compressed[used];
+			stream.avail_out = (uInt)(compressed.size() - used);
+			int err = deflate(&stream, flush);
+			used = compressed.size() - stream.avail_out;
+
 			if (err == Z_STREAM_END)
-			{
-				err = Z_OK;
 				break;
-			}
-			else if (err != Z_OK)
+			if (err != Z_OK && err != Z_BUF_ERROR)
 			{
-				//Nv_ASSERT(0 && "Something happened.");
+				success = false;
 				break;
 			}
+			if (!last && stream.avail_in == 0 && stream.avail_out != 0)
+				break;
+		}
+
+		chunkSizes.push_back((unsigned long)(used - chunkStart));
+	}
+
+	deflateEnd(&stream);
+	compressed.resize(used);
+	return success;
+}
+
+bool ZipWriter::AddFile(const std::string &path, const void* pData, unsigned long size, bool compress)
+{
+	if (!m_pFile || path.empty() || path.length() > 0xffff || m_nEntries >= 0xffff || (pData == nullptr && size > 0))
+		return false;
 
-			stream.avail_out = (128 * 1024);
-			stream.next_out += stream.total_out;
+	// zip archives use forward slashes
+	std::string name = path;
+	std::replace(name.begin(), name.end(), '\\', '/');
 
-			progressCallback(count * 100 / h.cSize, cancel);
+	const char* pSrc = (const char*)pData;
+	std::vector<char> compressed;
+	std::vector<unsigned long> chunkSizes;
+	unsigned long chunkSize = size;
+	word compression = Z_NO_COMPRESSION;
+
+	if (compress && size > 0)
+	{
+		if (m_chunkThreshold > 0 && size > m_chunkThreshold && m_chunkSize > 0 && m_chunkSize < size)
+		{
+			// the chunk table has to fit in the 64k extra field
+			const unsigned long maxChunks = (0xffff - sizeof(ZipFile::TZipChunkExtra)) / sizeof(dword);
+			chunkSize = std::max(m_chunkSize, size / maxChunks + 1);
 		}
-		inflateEnd(&stream);
+
+		if (Deflate(pSrc, size, chunkSize, compressed, chunkSizes) && compressed.size() < size)
+			compression = Z_DEFLATED;
 	}
-	if (err != Z_OK)
-		ret = false;
 
-	delete[] pcData;
-	return ret;
+	std::vector<char> extra;
+	if (compression == Z_DEFLATED && chunkSizes.size() > 1)
+	{
+		ZipFile::TZipChunkExtra chunks;
+		chunks.headerId = ZipFile::TZipChunkExtra::HEADER_ID;
+		chunks.dataSize = (word)(2 * sizeof(dword) + chunkSizes.size() * sizeof(dword));
+		chunks.chunkSize = chunkSize;
+		chunks.numChunks = (dword)chunkSizes.size();
+
+		extra.resize(sizeof(chunks) + chunkSizes.size() * sizeof(dword));
+		memcpy(&extra[0], &chunks, sizeof(chunks));
+		for (size_t c = 0; c < chunkSizes.size(); ++c)
+		{
+			dword chunkBytes = chunkSizes[c];
+			memcpy(&extra[sizeof(chunks) + c * sizeof(dword)], &chunkBytes, sizeof(dword));
+		}
+	}
+
+	const char* pOut = (compression == Z_DEFLATED) ? &compressed[0] : pSrc;
+	unsigned long outSize = (compression == Z_DEFLATED) ? (unsigned long)compressed.size() : size;
+
+	SYSTEMTIME localTime;
+	FILETIME fileTime;
+	word modDate = 0, modTime = 0;
+	GetLocalTime(&localTime);
+	SystemTimeToFileTime(&localTime, &fileTime);
+	FileTimeToDosDateTime(&fileTime, &modDate, &modTime);
+
+	ZipFile::TZipLocalHeader lh;
+	memset(&lh, 0, sizeof(lh));
+	lh.sig = ZipFile::TZipLocalHeader::SIGNATURE;
+	lh.version = 20;
+	lh.compression = compression;
+	lh.modTime = modTime;
+	lh.modDate = modDate;
+	lh.crc32 = (size > 0) ? ::crc32(0L, (const Bytef*)pSrc, size) : 0;
+	lh.cSize = outSize;
+	lh.ucSize = size;
+	lh.fnameLen = (word)name.length();
+	lh.xtraLen = (word)extra.size();
+
+	long hdrOffset = ftell(m_pFile);
+	bool success = fwrite(&lh, sizeof(lh), 1, m_pFile) == 1;
+	success = success && fwrite(name.c_str(), name.length(), 1, m_pFile) == 1;
+	if (!extra.empty())
+		success = success && fwrite(&extra[0], extra.size(), 1, m_pFile) == 1;
+	if (outSize > 0)
+		success = success && fwrite(pOut, outSize, 1, m_pFile) == 1;
+	if (!success)
+		return false;
+
+	ZipFile::TZipDirFileHeader fh;
+	memset(&fh, 0, sizeof(fh));
+	fh.sig = ZipFile::TZipDirFileHeader::SIGNATURE;
+	fh.verMade = 20;
+	fh.verNeeded = 20;
+	fh.compression = lh.compression;
+	fh.modTime = lh.modTime;
+	fh.modDate = lh.modDate;
+	fh.crc32 = lh.crc32;
+	fh.cSize = lh.cSize;
+	fh.ucSize = lh.ucSize;
+	fh.fnameLen = lh.fnameLen;
+	fh.xtraLen = lh.xtraLen;
+	fh.hdrOffset = (dword)hdrOffset;
+
+	m_dirData.insert(m_dirData.end(), (const char*)&fh, (const char*)&fh + sizeof(fh));
+	m_dirData.insert(m_dirData.end(), name.begin(), name.end());
+	m_dirData.insert(m_dirData.end(), extra.begin(), extra.end());
+	++m_nEntries;
+
+	return true;
+}
+
+
+// ------------------------------------------------------------------------------
+// class ZipContentsIndex
+// ------------------------------------------------------------------------------
+void ZipContentsIndex::Clear()
+{
+	m_names.clear();
+	m_entries.clear();
+	m_slots.clear();
+}
+
+void ZipContentsIndex::Reserve(size_t numEntries, size_t nameBytes)
+{
+	m_names.reserve(nameBytes);
+	m_entries.reserve(numEntries);
+
+	// keep the load factor at or below one half
+	size_t numSlots = 16;
+	while (numSlots < numEntries * 2)
+		numSlots <<= 1;
+
+	if (numSlots > m_slots.size())
+		Rehash(numSlots);
+}
+
+// FNV-1a over the folded characters
+unsigned int ZipContentsIndex::Hash(const char* path, size_t length)
+{
+	unsigned int hash = 2166136261u;
+	for (size_t i = 0; i < length; ++i)
+	{
+		hash ^= (unsigned char)Fold(path[i]);
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+int ZipContentsIndex::FindSlot(const char* path, size_t length, unsigned int hash) const
+{
+	if (m_slots.empty())
+		return -1;
+
+	size_t mask = m_slots.size() - 1;
+	for (size_t slot = hash & mask; ; slot = (slot + 1) & mask)
+	{
+		int entryIndex = m_slots[slot];
+		if (entryIndex < 0)
+			return (int)slot;			// empty - the path isn't in the table
+
+		const Entry& entry = m_entries[entryIndex];
+		if (entry.m_hash != hash || entry.m_nameLen != length)
+			continue;
+
+		const char* name = &m_names[entry.m_nameOffset];
+		size_t i = 0;
+		while (i < length && name[i] == Fold(path[i]))
+			++i;
+
+		if (i == length)
+			return (int)slot;
+	}
+}
+
+void ZipContentsIndex::Rehash(size_t numSlots)
+{
+	m_slots.assign(numSlots, -1);
+
+	size_t mask = numSlots - 1;
+	for (size_t i = 0; i < m_entries.size(); ++i)
+	{
+		size_t slot = m_entries[i].m_hash & mask;
+		while (m_slots[slot] >= 0)
+			slot = (slot + 1) & mask;
+		m_slots[slot] = (int)i;
+	}
+}
+
+void ZipContentsIndex::Insert(const char* path, size_t length, int id)
+{
+	if ((m_entries.size() + 1) * 2 > m_slots.size())
+		Rehash(m_slots.empty() ? 16 : m_slots.size() * 2);
+
+	unsigned int hash = Hash(path, length);
+	int slot = FindSlot(path, length, hash);
+	if (m_slots[slot] >= 0)
+	{
+		m_entries[m_slots[slot]].m_id = id;
+		return;
+	}
+
+	Entry entry;
+	entry.m_hash = hash;
+	entry.m_nameOffset = (unsigned int)m_names.size();
+	entry.m_nameLen = (unsigned int)length;
+	entry.m_id = id;
+
+	for (size_t i = 0; i < length; ++i)
+		m_names.push_back(Fold(path[i]));
+	m_names.push_back('\0');
+
+	m_slots[slot] = (int)m_entries.size();
+	m_entries.push_back(entry);
+}
+
+int ZipContentsIndex::Find(const char* path, size_t length) const
+{
+	int slot = FindSlot(path, length, Hash(path, length));
+	if (slot < 0 || m_slots[slot] < 0)
+		return -1;
+
+	return m_entries[m_slots[slot]].m_id;
 }
 
 
@@ -15,17 +15,67 @@
 // ---------------------------------------------------------------------------------------
 
 #include <stdio.h>
-#include <map>
+#include <vector>
 
-typedef std::map<std::string, int> ZipContentsMap;			// maps path to a zip content id
+#include "../Multicore/CriticalSection.h"
+
+class JobSystem;
+
+// ---------------------------------------------------------------------------------------
+// class ZipContentsIndex - not described in the book
+//
+// Maps a path to a zip content id. Paths are case folded (and '/' treated as '\\') once on
+// Insert(), and all of them are kept in one contiguous string blob. Lookups go through an
+// open-addressed table of precomputed hashes, fold the query on the fly and never allocate.
+// ---------------------------------------------------------------------------------------
+class ZipContentsIndex
+{
+	struct Entry
+	{
+		unsigned int m_hash;
+		unsigned int m_nameOffset;		// into m_names
+		unsigned int m_nameLen;
+		int m_id;
+	};
+
+	std::vector<char> m_names;			// folded names, each followed by a '\0'
+	std::vector<Entry> m_entries;
+	std::vector<int> m_slots;			// index into m_entries, -1 if empty. Size is a power of two.
+
+public:
+	void Clear();
+	void Reserve(size_t numEntries, size_t nameBytes);
+
+	// Adds a path, or replaces the id of a path that is already indexed.
+	void Insert(const char* path, size_t length, int id);
+
+	// Returns the id for the path, or -1.
+	int Find(const char* path, size_t length) const;
+	int Find(const std::string& path) const { return Find(path.c_str(), path.length()); }
+
+	size_t Size() const { return m_entries.size(); }
+
+	static unsigned int Hash(const char* path, size_t length);
+
+private:
+	static char Fold(char c) { return (c == '/') ? '\\' : ((c >= 'A' && c <= 'Z') ? (char)(c - 'A' + 'a') : c); }
+	int FindSlot(const char* path, size_t length, unsigned int hash) const;
+	void Rehash(size_t numSlots);
+};
 
 class ZipFile
 {
+	friend class ZipWriter;
+	friend class ZipReadStream;
+
 public:
-	ZipFile() { m_nEntries = 0; m_pFile = nullptr; m_pDirData = nullptr; }
-	virtual ~ZipFile() { End(); fclose(m_pFile); }
+	ZipFile() { m_nEntries = 0; m_pFile = nullptr; m_pDirData = nullptr; m_papDir = nullptr; m_hFile = INVALID_HANDLE_VALUE; m_hMapping = NULL; m_pMapping = nullptr; m_mappingSize = 0; m_maxInflateThreads = 0; m_pJobSystem = nullptr; }
+	virtual ~ZipFile() { End(); }
 
-	bool Init(const std::wstring &resFileName);
+	// With useMemoryMapping the whole archive is mapped copy-on-write, the directory is parsed in
+	// place and ReadFile() can be called from any number of threads at once. Otherwise entries are
+	// read through a single FILE* and ReadFile() calls are serialized.
+	bool Init(const std::wstring &resFileName, bool useMemoryMapping = false);
 	void End();
 
 	int GetNumFiles() const { return m_nEntries; }
@@ -33,23 +83,139 @@ public:
 	int GetFileLen(int i) const;
 	bool ReadFile(int i, void* pBuf);
 
+	// Zero copy access to a stored (Z_NO_COMPRESSION) entry of a memory mapped archive. Returns
+	// nullptr for compressed entries, or if the archive isn't mapped. The view is valid until End().
+	const char* GetFileView(int i) const;
+	bool IsMemoryMapped() const { return m_pMapping != nullptr; }
+
 	// Added to show multi-threaded decompression
 	bool ReadLargeFile(int i, void* pBuf, void (*progressCallback)(int, bool &));
 
-	int Find(const std::string &path) const;
+	// Entries packed by ZipWriter with chunking enabled are made of independently deflated chunks.
+	// ReadFile() and ReadLargeFile() inflate those as jobs on the job system, straight into pBuf,
+	// or one after the other on the calling thread if there's no job system. Any other entry
+	// takes the single stream path.
+	bool IsChunked(int i) const { return GetChunkExtra(i) != nullptr; }
+	void SetJobSystem(JobSystem* pJobSystem) { m_pJobSystem = pJobSystem; }	// NULL means the application's
+	void SetMaxInflateThreads(unsigned int numThreads) { m_maxInflateThreads = numThreads; }	// 0 is every worker and the calling thread
+
+	int Find(const std::string &path) const { return m_ZipContentsIndex.Find(path); }
+	int Find(const char* path, size_t length) const { return m_ZipContentsIndex.Find(path, length); }
 
-	ZipContentsMap m_ZipContentsMap;
+	ZipContentsIndex m_ZipContentsIndex;
 
 private:
 	struct TZipDirHeader;
 	struct TZipDirFileHeader;
 	struct TZipLocalHeader;
+	struct TZipChunkExtra;
+
+	bool InitDirectory(char* pDirData, int nDirEntries, unsigned long dirSize);
+	const char* GetMappedData(int i, const TZipLocalHeader** ppHeader) const;
+	bool Inflate(const char* pcData, unsigned long cSize, void* pBuf, unsigned long ucSize) const;
+	const TZipChunkExtra* GetChunkExtra(int i) const;
+	bool GetEntryData(int i, TZipLocalHeader* pHeader, unsigned long* pDataOffset);
+	bool ReadRaw(unsigned long offset, void* pBuf, unsigned long size);
+	bool InflateChunks(const TZipChunkExtra* pChunks, const char* pcData, unsigned long cSize, void* pBuf, unsigned long ucSize, void (*progressCallback)(int, bool &)) const;
 
 	FILE* m_pFile;			// Zip file
 	char* m_pDirData;		// Raw data buffer.
 	int m_nEntries;			// Number of entries.
 
+	// memory mapped archive
+	HANDLE m_hFile;
+	HANDLE m_hMapping;
+	char* m_pMapping;
+	size_t m_mappingSize;
+
+	CriticalSection m_fileCs;	// m_pFile has a single read position
+
+	JobSystem* m_pJobSystem;
+	unsigned int m_maxInflateThreads;
+
 	// Pointers to the dir entries in pDirData
 	const TZipDirFileHeader **m_papDir;
 };
 
+// ---------------------------------------------------------------------------------------
+// class ZipReadStream - not described in the book
+//
+// Pull based reader over one entry. Deflated entries are inflated as they are read, so only
+// zlib's window and a small read-ahead are resident, whatever the size of the entry. Seeking
+// backwards in a deflated entry starts inflating again from the top.
+// ---------------------------------------------------------------------------------------
+class ZipReadStream : public IResourceStream
+{
+public:
+	enum
+	{
+		READ_AHEAD_SIZE = 16 * 1024,	// compressed bytes read from the archive at a time
+	};
+
+	ZipReadStream(ZipFile* pZipFile);
+	virtual ~ZipReadStream();
+
+	bool Open(int i);
+
+	virtual unsigned int VRead(void* pBuffer, unsigned int bytes);
+	virtual bool VSeek(unsigned int offset);
+	virtual unsigned int VTell() const { return m_position; }
+	virtual unsigned int VGetSize() const { return m_ucSize; }
+
+private:
+	bool Restart();
+	void Close();
+
+	ZipFile* m_pZipFile;
+	const char* m_pMappedData;		// the entry's data when the archive is memory mapped
+	unsigned long m_dataOffset;		// where the entry's data starts in the archive
+	unsigned long m_cSize;
+	unsigned long m_ucSize;
+	int m_compression;
+
+	struct z_stream_s* m_pStream;	// deflated entries only
+	char* m_pReadAhead;
+	unsigned long m_compressedRead;	// compressed bytes fed to m_pStream so far
+	unsigned int m_position;
+	bool m_finished;
+};
+
+// ---------------------------------------------------------------------------------------
+// class ZipWriter - not described in the book
+//
+// Packs files into a zip archive that ZipFile, and any other unzipper, can read. With
+// EnableChunking() entries above the threshold are deflated as a series of chunks, each one
+// starting with an empty dictionary, and the chunk sizes are written to the entry's extra
+// field. The result is still one valid deflate stream.
+// ---------------------------------------------------------------------------------------
+class ZipWriter
+{
+public:
+	enum
+	{
+		DEFAULT_CHUNK_THRESHOLD = 16 * 1024 * 1024,
+		DEFAULT_CHUNK_SIZE = 1024 * 1024,
+	};
+
+	ZipWriter() { m_pFile = nullptr; m_nEntries = 0; m_chunkThreshold = 0; m_chunkSize = DEFAULT_CHUNK_SIZE; }
+	~ZipWriter() { Close(); }
+
+	bool Open(const std::wstring &zipFileName);
+	bool Close();
+
+	void EnableChunking(unsigned long threshold = DEFAULT_CHUNK_THRESHOLD, unsigned long chunkSize = DEFAULT_CHUNK_SIZE) { m_chunkThreshold = threshold; m_chunkSize = chunkSize; }
+	void DisableChunking() { m_chunkThreshold = 0; }
+
+	// Entries that don't get smaller when deflated are stored.
+	bool AddFile(const std::string &path, const void* pData, unsigned long size, bool compress = true);
+
+private:
+	bool Deflate(const char* pData, unsigned long size, unsigned long chunkSize, std::vector<char>& compressed, std::vector<unsigned long>& chunkSizes) const;
+
+	FILE* m_pFile;
+	std::vector<char> m_dirData;	// central directory, written by Close()
+	int m_nEntries;
+
+	unsigned long m_chunkThreshold;	// 0 turns chunking off
+	unsigned long m_chunkSize;
+};
@@ -0,0 +1,130 @@
+// ================================================================
+// ComponentStoreTests.cpp : Benchmarks for the flat component storage
+// ================================================================
+
+#include "EngineTests.h"
+#include "../EngineCore/Actors/Actor.h"
+#include "../EngineCore/Actors/ComponentStore.h"
+#include "../EngineCore/Actors/TransformComponent.h"
+
+typedef std::map<ActorId, StrongActorPtr> TestActorMap;
+
+// how far an actor moves each frame, made up from its id so every way of updating agrees
+static Vec3 GetTestVelocity(ActorId id)
+{
+	return Vec3((float)(id % 7) * 0.1f, 0.0f, (float)(id % 5) * -0.1f);
+}
+
+static void CreateTestActors(unsigned int numActors, TestActorMap& outActors, ComponentStore* pStore)
+{
+	for (unsigned int i = 0; i < numActors; ++i)
+	{
+		StrongActorPtr pActor(Nv_NEW Actor(i + 1));
+		std::shared_ptr<TransformComponent> pTransform(Nv_NEW TransformComponent);
+		pTransform->SetPosition(Vec3((float)(i % 1000), 0.0f, (float)(i / 1000)));
+		pActor->AddComponent(pTransform);
+		if (pStore) {
+			pStore->AddActor(pActor.get());
+		}
+		outActors[pActor->GetId()] = pActor;
+	}
+}
+
+static void DestroyTestActors(TestActorMap& actors, ComponentStore* pStore)
+{
+	for (TestActorMap::iterator it = actors.begin(); it != actors.end(); ++it)
+	{
+		if (pStore) {
+			pStore->RemoveActor(it->second.get());
+		}
+		it->second->Destroy();
+	}
+	actors.clear();
+}
+
+//
+// A frame's worth of moves for a hundred thousand actors with a transform each: through the actor
+// map and a weak_ptr to the component, as the game logic finds them, through the ComponentStore
+// by actor id, and walking the store's transform array. Reported is the time each frame takes,
+// and each way has to leave every actor in the same place.
+//
+ENGINE_BENCHMARK(ComponentStore_UpdateTransforms)
+{
+	const unsigned int numActors = 100000, numFrames = 20;
+
+	std::vector<ActorId> ids;
+	for (unsigned int i = 0; i < numActors; ++i)
+	{
+		ids.push_back(i + 1);
+	}
+
+	// the map and weak_ptr way, on actors that aren't in a store
+	TestActorMap mapActors;
+	CreateTestActors(numActors, mapActors, NULL);
+
+	BenchmarkTimer timer;
+	for (unsigned int frame = 0; frame < numFrames; ++frame)
+	{
+		for (size_t i = 0; i < ids.size(); ++i)
+		{
+			TestActorMap::iterator findIt = mapActors.find(ids[i]);
+			if (findIt == mapActors.end()) {
+				continue;
+			}
+			std::shared_ptr<TransformComponent> pTransform = MakeStrongPtr(findIt->second->GetComponent<TransformComponent>(TransformComponent::g_Name));
+			if (pTransform) {
+				pTransform->SetPosition(pTransform->GetPosition() + GetTestVelocity(ids[i]));
+			}
+		}
+	}
+	double mapMs = timer.ElapsedMs();
+
+	// the store, by id and then walking the array
+	ComponentStore store;
+	TestActorMap storeActors;
+	CreateTestActors(numActors, storeActors, &store);
+
+	timer.Restart();
+	for (unsigned int frame = 0; frame < numFrames; ++frame)
+	{
+		for (size_t i = 0; i < ids.size(); ++i)
+		{
+			Mat4x4* pTransform = store.FindTransformById(ids[i]);
+			if (pTransform) {
+				pTransform->SetPosition(pTransform->GetPosition() + GetTestVelocity(ids[i]));
+			}
+		}
+	}
+	double storeByIdMs = timer.ElapsedMs();
+
+	timer.Restart();
+	for (unsigned int frame = 0; frame < numFrames; ++frame)
+	{
+		Mat4x4* pTransforms = store.GetTransforms();
+		const ActorId* pIds = store.GetTransformActorIds();
+		for (unsigned int i = 0; i < store.GetNumTransforms(); ++i)
+		{
+			pTransforms[i].SetPosition(pTransforms[i].GetPosition() + GetTestVelocity(pIds[i]));
+		}
+	}
+	double storeArrayMs = timer.ElapsedMs();
+
+	// the store's actors got both lots of moves
+	bool samePlace = true;
+	for (TestActorMap::iterator it = mapActors.begin(); it != mapActors.end(); ++it)
+	{
+		std::shared_ptr<TransformComponent> pMapTransform = MakeStrongPtr(it->second->GetComponent<TransformComponent>(TransformComponent::g_Name));
+		std::shared_ptr<TransformComponent> pStoreTransform = MakeStrongPtr(storeActors[it->first]->GetComponent<TransformComponent>(TransformComponent::g_Name));
+		Vec3 expected = pMapTransform->GetPosition() + (float)numFrames * GetTestVelocity(it->first);
+		Vec3 difference = pStoreTransform->GetPosition() - expected;
+		samePlace = samePlace && (difference.Length() < 0.01f);
+	}
+
+	DestroyTestActors(storeActors, &store);
+	DestroyTestActors(mapActors, NULL);
+	TEST_CHECK(samePlace);
+
+	BenchmarkReport("actor map and weak_ptr, each frame", mapMs / numFrames, "ms");
+	BenchmarkReport("ComponentStore by id, each frame", storeByIdMs / numFrames, "ms");
+	BenchmarkReport("ComponentStore array, each frame", storeArrayMs / numFrames, "ms");
+}
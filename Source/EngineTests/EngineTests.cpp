@@ -0,0 +1,88 @@
+// ================================================================
+// EngineTests.cpp : Runs the tests, or the benchmarks
+// ================================================================
+
+#include "EngineTests.h"
+
+struct EngineTestEntry
+{
+	const char* m_name;
+	EngineTestFunction m_function;
+	bool m_benchmark;
+};
+
+// a function local static, so registrars in other files can't run before it's constructed
+static std::vector<EngineTestEntry>& GetEngineTests(void)
+{
+	static std::vector<EngineTestEntry> s_tests;
+	return s_tests;
+}
+
+static bool s_bCurrentFailed = false;
+
+EngineTestRegistrar::EngineTestRegistrar(const char* name, EngineTestFunction function, bool benchmark)
+{
+	EngineTestEntry entry;
+	entry.m_name = name;
+	entry.m_function = function;
+	entry.m_benchmark = benchmark;
+	GetEngineTests().push_back(entry);
+}
+
+void EngineTestFailed(const char* file, int line, const char* expression)
+{
+	printf("  %s(%d): check failed: %s\n", file, line, expression);
+	s_bCurrentFailed = true;
+}
+
+void BenchmarkReport(const char* name, double value, const char* units)
+{
+	printf("  %-48s %12.3f %s\n", name, value, units);
+}
+
+double BenchmarkPercentile(std::vector<double> samples, double fraction)
+{
+	if (samples.empty()) {
+		return 0.0;
+	}
+
+	size_t index = std::min((size_t)(fraction * samples.size()), samples.size() - 1);
+	std::nth_element(samples.begin(), samples.begin() + index, samples.end());
+	return samples[index];
+}
+
+int main(int argc, char* argv[])
+{
+	bool benchmarks = false;
+	const char* prefix = "";
+	for (int i = 1; i < argc; ++i)
+	{
+		if (strcmp(argv[i], "-bench") == 0) {
+			benchmarks = true;
+		}
+		else {
+			prefix = argv[i];
+		}
+	}
+
+	std::vector<EngineTestEntry>& tests = GetEngineTests();
+	unsigned int run = 0, failed = 0;
+	for (size_t i = 0; i < tests.size(); ++i)
+	{
+		const EngineTestEntry& test = tests[i];
+		if (test.m_benchmark != benchmarks || strncmp(test.m_name, prefix, strlen(prefix)) != 0) {
+			continue;
+		}
+
+		printf("%s\n", test.m_name);
+		s_bCurrentFailed = false;
+		test.m_function();
+		++run;
+		if (s_bCurrentFailed) {
+			++failed;
+		}
+	}
+
+	printf("%u run, %u failed\n", run, failed);
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+// ================================================================
+// EngineTests.h : A minimal harness for the engine's tests and benchmarks
+// ================================================================
+
+#include "../EngineCore/Common/CommonStd.h"
+
+#include <stdio.h>
+
+//
+// Tests and benchmarks are plain functions that register themselves at static init time, so
+// adding one is just a matter of writing it in any file of this project:
+//
+//		ENGINE_TEST(ResCache_PinAfterReload)
+//		{
+//			TEST_CHECK(...);
+//		}
+//
+// EngineTests.exe runs every test; EngineTests.exe -bench runs the benchmarks instead, and either
+// takes a name prefix to run only some of them.
+//
+typedef void (*EngineTestFunction)(void);
+
+class EngineTestRegistrar
+{
+public:
+	EngineTestRegistrar(const char* name, EngineTestFunction function, bool benchmark);
+};
+
+// a failed check reports and returns from the test
+void EngineTestFailed(const char* file, int line, const char* expression);
+
+#define ENGINE_TEST(name) \
+	static void name(void); \
+	static EngineTestRegistrar s_##name##Registrar(#name, name, false); \
+	static void name(void)
+
+#define ENGINE_BENCHMARK(name) \
+	static void name(void); \
+	static EngineTestRegistrar s_##name##Registrar(#name, name, true); \
+	static void name(void)
+
+#define TEST_CHECK(expression) \
+	do { if (!(expression)) { EngineTestFailed(__FILE__, __LINE__, #expression); return; } } while (0)
+
+//
+// class BenchmarkTimer								- not described in the book
+//
+class BenchmarkTimer
+{
+	LARGE_INTEGER m_start;
+
+public:
+	BenchmarkTimer(void) { Restart(); }
+	void Restart(void) { QueryPerformanceCounter(&m_start); }
+	double ElapsedMs(void) const
+	{
+		LARGE_INTEGER now, frequency;
+		QueryPerformanceCounter(&now);
+		QueryPerformanceFrequency(&frequency);
+		return (double)(now.QuadPart - m_start.QuadPart) * 1000.0 / (double)frequency.QuadPart;
+	}
+};
+
+// one line per measurement, so runs can be diffed before and after a change
+void BenchmarkReport(const char* name, double value, const char* units);
+
+// the sample that fraction of them are at or below - 0.5 for the median, 0.99 for the 99th percentile
+double BenchmarkPercentile(std::vector<double> samples, double fraction);
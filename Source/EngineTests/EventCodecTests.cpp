@@ -0,0 +1,285 @@
+// ================================================================
+// EventCodecTests.cpp : Benchmarks for the network event encodings
+// ================================================================
+
+#include "EngineTests.h"
+#include "../EngineCore/EventManager/EventCodec.h"
+#include "../EngineCore/EventManager/Events.h"
+
+enum CodecTestFormat
+{
+	CODEC_TEST_TEXT,				// VSerialize() through std::ostrstream, as the book sends everything
+	CODEC_TEST_BINARY,				// VSerializeBinary() with no delta cache
+	CODEC_TEST_BINARY_DELTA,		// VSerializeBinary() against the last move of each actor, as a connection does
+
+	CODEC_TEST_FORMAT_COUNT
+};
+
+typedef std::vector<std::shared_ptr<EvtData_Move_Actor> > CodecTestMoves;
+
+// Encodes the moves one after the other into outData, each message's size in outSizes, and returns the
+// time it took.
+static double EncodeMoves(CodecTestFormat format, const CodecTestMoves& moves, std::vector<char>& outData, std::vector<unsigned int>& outSizes)
+{
+	char scratch[512];
+	EventDeltaCache cache;
+	EventDeltaCache* pCache = (format == CODEC_TEST_BINARY_DELTA) ? &cache : NULL;
+
+	BenchmarkTimer timer;
+	for (size_t i = 0; i < moves.size(); ++i)
+	{
+		if (format == CODEC_TEST_TEXT)
+		{
+			std::ostrstream out(scratch, sizeof(scratch));
+			moves[i]->VSerialize(out);
+			outData.insert(outData.end(), scratch, scratch + out.pcount());
+			outSizes.push_back((unsigned int)out.pcount());
+		}
+		else
+		{
+			BinaryWriter out(scratch, sizeof(scratch), pCache);
+			moves[i]->VSerializeBinary(out);
+			outData.insert(outData.end(), out.GetData(), out.GetData() + out.GetSize());
+			outSizes.push_back((unsigned int)out.GetSize());
+		}
+	}
+	return timer.ElapsedMs();
+}
+
+// Decodes what EncodeMoves() wrote, keeping where the last move put its actor, and returns the time
+// it took - or a negative time if a message didn't decode.
+static double DecodeMoves(CodecTestFormat format, const std::vector<char>& data, const std::vector<unsigned int>& sizes, ActorId& outLastId, Mat4x4& outLastMatrix)
+{
+	EventDeltaCache cache;
+	EventDeltaCache* pCache = (format == CODEC_TEST_BINARY_DELTA) ? &cache : NULL;
+
+	BenchmarkTimer timer;
+	size_t offset = 0;
+	for (size_t i = 0; i < sizes.size(); ++i)
+	{
+		EvtData_Move_Actor move;
+		if (format == CODEC_TEST_TEXT)
+		{
+			std::istrstream in(&data[offset], sizes[i]);
+			move.VDeserialize(in);
+		}
+		else
+		{
+			BinaryReader in(&data[offset], sizes[i], pCache);
+			if (!move.VDeserializeBinary(in) || in.Failed()) {
+				return -1.0;
+			}
+		}
+		offset += sizes[i];
+
+		outLastId = move.GetId();
+		outLastMatrix = move.GetMatrix();
+	}
+	return timer.ElapsedMs();
+}
+
+//
+// A stream of moves for a few hundred actors walking about and slowly turning, encoded and decoded
+// as text, in binary, and in binary against the last move sent for each actor. Reported are the
+// time each event takes to encode and to decode, and its size - without the packet header and the
+// event type, which are the same for every format.
+//
+ENGINE_BENCHMARK(EventCodec_Moves)
+{
+	const unsigned int numActors = 500, numMoves = 200000;
+	const char* formatNames[CODEC_TEST_FORMAT_COUNT] = { "text", "binary", "binary delta" };
+
+	CodecTestMoves moves;
+	for (unsigned int i = 0; i < numMoves; ++i)
+	{
+		unsigned int actor = i % numActors;
+		float step = (float)(i / numActors);
+
+		Mat4x4 transform;
+		transform.BuildRotationY((float)actor + step * 0.01f);
+		transform.SetPosition(Vec3((float)actor + step * 0.1f, 0.0f, 100.0f - step * 0.05f));
+		moves.push_back(std::shared_ptr<EvtData_Move_Actor>(Nv_NEW EvtData_Move_Actor(actor + 1, transform)));
+	}
+
+	for (unsigned int format = 0; format < CODEC_TEST_FORMAT_COUNT; ++format)
+	{
+		std::vector<char> data;
+		std::vector<unsigned int> sizes;
+		data.reserve(numMoves * 256);
+		sizes.reserve(numMoves);
+
+		double encodeMs = EncodeMoves((CodecTestFormat)format, moves, data, sizes);
+
+		ActorId lastId = INVALID_ACTOR_ID;
+		Mat4x4 lastMatrix;
+		double decodeMs = DecodeMoves((CodecTestFormat)format, data, sizes, lastId, lastMatrix);
+		TEST_CHECK(decodeMs >= 0.0);
+		TEST_CHECK(lastId == moves.back()->GetId());
+		Vec3 difference = lastMatrix.GetPosition() - moves.back()->GetMatrix().GetPosition();
+		TEST_CHECK(difference.Length() < 0.01f);
+
+		char name[64];
+		sprintf_s(name, "%s: encode", formatNames[format]);
+		BenchmarkReport(name, encodeMs * 1000000.0 / numMoves, "ns/event");
+		sprintf_s(name, "%s: decode", formatNames[format]);
+		BenchmarkReport(name, decodeMs * 1000000.0 / numMoves, "ns/event");
+		sprintf_s(name, "%s: size", formatNames[format]);
+		BenchmarkReport(name, (double)data.size() / numMoves, "bytes/event");
+	}
+}
+
+// Encodes each of events in binary, decodes it again into a new event of the same type and checks
+// with same() that it came back as it went out. Reports the time each event takes to encode and to
+// decode, and its size. Returns false if an event didn't survive the trip.
+template<class Event, class SameFunc>
+static bool RoundTripEvents(const std::vector<std::shared_ptr<Event> >& events, SameFunc same)
+{
+	char scratch[512];
+	std::vector<char> data;
+	std::vector<unsigned int> sizes;
+	data.reserve(events.size() * 64);
+	sizes.reserve(events.size());
+
+	BenchmarkTimer timer;
+	for (size_t i = 0; i < events.size(); ++i)
+	{
+		BinaryWriter out(scratch, sizeof(scratch), NULL);
+		if (!events[i]->VSerializeBinary(out)) {
+			return false;
+		}
+		data.insert(data.end(), out.GetData(), out.GetData() + out.GetSize());
+		sizes.push_back((unsigned int)out.GetSize());
+	}
+	double encodeMs = timer.ElapsedMs();
+
+	std::vector<Event> decoded(events.size());
+	timer.Restart();
+	size_t offset = 0;
+	for (size_t i = 0; i < sizes.size(); ++i)
+	{
+		BinaryReader in(data.empty() ? NULL : &data[offset], sizes[i], NULL);
+		if (!decoded[i].VDeserializeBinary(in) || in.Failed() || in.GetRemaining() != 0) {
+			return false;
+		}
+		offset += sizes[i];
+	}
+	double decodeMs = timer.ElapsedMs();
+
+	for (size_t i = 0; i < events.size(); ++i)
+	{
+		if (!same(*events[i], decoded[i])) {
+			return false;
+		}
+	}
+
+	const unsigned int numEvents = (unsigned int)events.size();
+	char name[64];
+	sprintf_s(name, "%s: encode", events[0]->GetName());
+	BenchmarkReport(name, encodeMs * 1000000.0 / numEvents, "ns/event");
+	sprintf_s(name, "%s: decode", events[0]->GetName());
+	BenchmarkReport(name, decodeMs * 1000000.0 / numEvents, "ns/event");
+	sprintf_s(name, "%s: size", events[0]->GetName());
+	BenchmarkReport(name, (double)data.size() / numEvents, "bytes/event");
+	return true;
+}
+
+static bool SamePosition(const Mat4x4& a, const Mat4x4& b)
+{
+	Vec3 difference = a.GetPosition() - b.GetPosition();
+	return difference.Length() < 0.01f;
+}
+
+//
+// Every event that has a binary encoding, encoded and decoded one after the other with no delta
+// cache. Each decoded event is checked against the one that was sent.
+//
+ENGINE_BENCHMARK(EventCodec_AllEvents)
+{
+	const unsigned int numEvents = 100000;
+	unsigned int seed = 12345;
+	auto random = [&seed]() { seed = seed * 1103515245 + 12345; return (seed >> 16) & 0x7fff; };
+
+	std::vector<std::shared_ptr<EvtData_New_Actor> > newActors;
+	std::vector<std::shared_ptr<EvtData_Destroy_Actor> > destroyActors;
+	std::vector<std::shared_ptr<EvtData_Move_Actor> > moves;
+	std::vector<std::shared_ptr<EvtData_Modified_Render_Component> > modifiedRenderComponents;
+	std::vector<std::shared_ptr<EvtData_Environment_Loaded> > environmentsLoaded;
+	std::vector<std::shared_ptr<EvtData_Remote_Client> > remoteClients;
+	std::vector<std::shared_ptr<EvtData_Network_Player_Actor_Assignment> > assignments;
+	std::vector<std::shared_ptr<EvtData_Request_New_Actor> > requestNewActors;
+	std::vector<std::shared_ptr<EvtData_Request_Destroy_Actor> > requestDestroyActors;
+	std::vector<std::shared_ptr<EvtData_PlaySound> > playSounds;
+
+	for (unsigned int i = 0; i < numEvents; ++i)
+	{
+		ActorId actor = 1 + random() * 4;
+		GameViewId view = (i % 4 == 0) ? gc_InvalidGameViewId : random() % 8;
+		int socket = random() % 64;
+		int ip = (int)(0xc0a80000 | random());
+
+		char resource[64];
+		sprintf_s(resource, "actors\\enemy_%u.xml", random() % 32);
+
+		Mat4x4 transform;
+		transform.BuildRotationY((float)random() * 0.001f);
+		transform.SetPosition(Vec3((float)random() * 0.1f, (float)(random() % 64), -(float)random() * 0.1f));
+
+		newActors.push_back(std::shared_ptr<EvtData_New_Actor>(Nv_NEW EvtData_New_Actor(actor, view)));
+		destroyActors.push_back(std::shared_ptr<EvtData_Destroy_Actor>(Nv_NEW EvtData_Destroy_Actor(actor)));
+		moves.push_back(std::shared_ptr<EvtData_Move_Actor>(Nv_NEW EvtData_Move_Actor(actor, transform)));
+		modifiedRenderComponents.push_back(std::shared_ptr<EvtData_Modified_Render_Component>(Nv_NEW EvtData_Modified_Render_Component(actor)));
+		environmentsLoaded.push_back(std::shared_ptr<EvtData_Environment_Loaded>(Nv_NEW EvtData_Environment_Loaded()));
+		remoteClients.push_back(std::shared_ptr<EvtData_Remote_Client>(Nv_NEW EvtData_Remote_Client(socket, ip)));
+		assignments.push_back(std::shared_ptr<EvtData_Network_Player_Actor_Assignment>(Nv_NEW EvtData_Network_Player_Actor_Assignment(actor, socket)));
+		requestNewActors.push_back(std::shared_ptr<EvtData_Request_New_Actor>(Nv_NEW EvtData_Request_New_Actor(resource, (i & 1) ? &transform : NULL, actor, view)));
+		requestDestroyActors.push_back(std::shared_ptr<EvtData_Request_Destroy_Actor>(Nv_NEW EvtData_Request_Destroy_Actor(actor)));
+		playSounds.push_back(std::shared_ptr<EvtData_PlaySound>(Nv_NEW EvtData_PlaySound(resource)));
+	}
+
+	TEST_CHECK(RoundTripEvents(newActors, [](const EvtData_New_Actor& a, const EvtData_New_Actor& b)
+	{
+		return a.GetActorId() == b.GetActorId() && a.GetViewId() == b.GetViewId();
+	}));
+	TEST_CHECK(RoundTripEvents(destroyActors, [](const EvtData_Destroy_Actor& a, const EvtData_Destroy_Actor& b)
+	{
+		return a.GetId() == b.GetId();
+	}));
+	TEST_CHECK(RoundTripEvents(moves, [](const EvtData_Move_Actor& a, const EvtData_Move_Actor& b)
+	{
+		return a.GetId() == b.GetId() && SamePosition(a.GetMatrix(), b.GetMatrix());
+	}));
+	TEST_CHECK(RoundTripEvents(modifiedRenderComponents, [](const EvtData_Modified_Render_Component& a, const EvtData_Modified_Render_Component& b)
+	{
+		return a.GetActorId() == b.GetActorId();
+	}));
+	TEST_CHECK(RoundTripEvents(environmentsLoaded, [](const EvtData_Environment_Loaded& a, const EvtData_Environment_Loaded& b)
+	{
+		return a.VGetEventType() == b.VGetEventType();
+	}));
+	TEST_CHECK(RoundTripEvents(remoteClients, [](const EvtData_Remote_Client& a, const EvtData_Remote_Client& b)
+	{
+		return a.GetSocketId() == b.GetSocketId() && a.GetIpAddress() == b.GetIpAddress();
+	}));
+	TEST_CHECK(RoundTripEvents(assignments, [](const EvtData_Network_Player_Actor_Assignment& a, const EvtData_Network_Player_Actor_Assignment& b)
+	{
+		return a.GetActorId() == b.GetActorId() && a.GetSocketId() == b.GetSocketId();
+	}));
+	TEST_CHECK(RoundTripEvents(requestNewActors, [](const EvtData_Request_New_Actor& a, const EvtData_Request_New_Actor& b)
+	{
+		if (a.GetActorResource() != b.GetActorResource() || a.GetServerActorId() != b.GetServerActorId() || a.GetViewId() != b.GetViewId()) {
+			return false;
+		}
+		if (!a.GetInitialTransform() || !b.GetInitialTransform()) {
+			return !a.GetInitialTransform() && !b.GetInitialTransform();
+		}
+		return SamePosition(*a.GetInitialTransform(), *b.GetInitialTransform());
+	}));
+	TEST_CHECK(RoundTripEvents(requestDestroyActors, [](const EvtData_Request_Destroy_Actor& a, const EvtData_Request_Destroy_Actor& b)
+	{
+		return a.GetActorId() == b.GetActorId();
+	}));
+	TEST_CHECK(RoundTripEvents(playSounds, [](const EvtData_PlaySound& a, const EvtData_PlaySound& b)
+	{
+		return a.GetResource() == b.GetResource();
+	}));
+}
@@ -0,0 +1,414 @@
+// ================================================================
+// EventManagerTests.cpp : Tests for the event manager and its thread safe queue
+// ================================================================
+
+#include "EngineTests.h"
+#include "../EngineCore/EventManager/EventManagerImpl.h"
+#include "../EngineCore/EventManager/Events.h"
+
+#include <typeinfo>
+
+//
+// class EvtData_Test								- not described in the book
+//
+// Says which thread sent it and in what order.
+//
+class EvtData_Test : public BaseEventData
+{
+public:
+	static const EventType sk_EventType;
+
+	unsigned int m_sender;
+	unsigned int m_sequence;
+
+	EvtData_Test(unsigned int sender = 0, unsigned int sequence = 0) : m_sender(sender), m_sequence(sequence) { }
+
+	virtual const EventType& VGetEventType(void) const { return sk_EventType; }
+	virtual IEventDataPtr VCopy(void) const { return IEventDataPtr(Nv_NEW EvtData_Test(m_sender, m_sequence)); }
+	virtual const char* GetName(void) const { return "EvtData_Test"; }
+};
+
+const EventType EvtData_Test::sk_EventType(0x6d1c2f37);
+
+//
+// Thread safe queueing, with the old concurrent_queue for comparison
+//
+static void QueuePush(ThreadSafeEventQueue& queue, const IEventDataPtr& pEvent) { queue.Push(pEvent); }
+static void QueuePush(concurrent_queue<IEventDataPtr>& queue, const IEventDataPtr& pEvent) { queue.push(pEvent); }
+
+static size_t QueueDrain(ThreadSafeEventQueue& queue)
+{
+	return queue.PopBatch([](IEventDataPtr&) { });
+}
+
+static size_t QueueDrain(concurrent_queue<IEventDataPtr>& queue)
+{
+	size_t count = 0;
+	IEventDataPtr pEvent;
+	while (queue.try_pop(pEvent))
+	{
+		++count;
+	}
+	return count;
+}
+
+template<typename Queue>
+struct ProducerParams
+{
+	Queue* m_pQueue;
+	HANDLE m_hStart;
+	IEventDataPtr m_pEvent;
+	unsigned int m_count;
+};
+
+template<typename Queue>
+static DWORD WINAPI ProducerThreadProc(LPVOID lpParam)
+{
+	ProducerParams<Queue>* pParams = static_cast<ProducerParams<Queue>*>(lpParam);
+	WaitForSingleObject(pParams->m_hStart, INFINITE);
+	for (unsigned int i = 0; i < pParams->m_count; ++i)
+	{
+		QueuePush(*pParams->m_pQueue, pParams->m_pEvent);
+	}
+	return 0;
+}
+
+// Events a second through queue, from numProducers threads to this one.
+template<typename Queue>
+static double MeasureProducers(Queue& queue, unsigned int numProducers, unsigned int numEvents)
+{
+	HANDLE hStart = CreateEvent(NULL, TRUE, FALSE, NULL);
+	std::vector<ProducerParams<Queue> > params(numProducers);
+	std::vector<HANDLE> threads(numProducers);
+	for (unsigned int i = 0; i < numProducers; ++i)
+	{
+		params[i].m_pQueue = &queue;
+		params[i].m_hStart = hStart;
+		params[i].m_pEvent.reset(Nv_NEW EvtData_Test(i));
+		params[i].m_count = numEvents / numProducers;
+		threads[i] = CreateThread(NULL, 0, ProducerThreadProc<Queue>, &params[i], 0, NULL);
+	}
+
+	const size_t expected = (size_t)(numEvents / numProducers) * numProducers;
+	size_t received = 0;
+
+	BenchmarkTimer timer;
+	SetEvent(hStart);
+	while (received < expected)
+	{
+		received += QueueDrain(queue);
+	}
+	double ms = timer.ElapsedMs();
+
+	for (unsigned int i = 0; i < numProducers; ++i)
+	{
+		WaitForSingleObject(threads[i], INFINITE);
+		CloseHandle(threads[i]);
+	}
+	CloseHandle(hStart);
+	return expected / (ms / 1000.0);
+}
+
+struct SpillProducerParams
+{
+	ThreadSafeEventQueue* m_pQueue;
+	unsigned int m_sender;
+	unsigned int m_count;
+	volatile LONG* m_pSpilled;
+};
+
+static DWORD WINAPI SpillProducerThreadProc(LPVOID lpParam)
+{
+	SpillProducerParams* pParams = static_cast<SpillProducerParams*>(lpParam);
+	for (unsigned int i = 0; i < pParams->m_count; ++i)
+	{
+		if (!pParams->m_pQueue->Push(IEventDataPtr(Nv_NEW EvtData_Test(pParams->m_sender, i))))
+		{
+			InterlockedIncrement(pParams->m_pSpilled);
+		}
+	}
+	return 0;
+}
+
+//
+// Producers that outrun the consumer spill instead of dropping events, and every producer's
+// events still come out in the order it pushed them.
+//
+ENGINE_TEST(ThreadSafeEventQueue_SpillKeepsEveryEventInOrder)
+{
+	const unsigned int numProducers = 4;
+	const unsigned int numEvents = 20000;
+	ThreadSafeEventQueue queue(16);
+	volatile LONG spilled = 0;
+
+	SpillProducerParams params[numProducers];
+	HANDLE threads[numProducers];
+	for (unsigned int i = 0; i < numProducers; ++i)
+	{
+		params[i].m_pQueue = &queue;
+		params[i].m_sender = i;
+		params[i].m_count = numEvents;
+		params[i].m_pSpilled = &spilled;
+		threads[i] = CreateThread(NULL, 0, SpillProducerThreadProc, &params[i], 0, NULL);
+	}
+
+	// a slow consumer, taking one event or a batch at a time
+	std::vector<unsigned int> nextSequence(numProducers, 0);
+	bool inOrder = true;
+	unsigned int received = 0;
+	auto check = [&](IEventDataPtr& pEvent)
+	{
+		EvtData_Test* pTest = static_cast<EvtData_Test*>(pEvent.get());
+		inOrder = inOrder && (pTest->m_sequence == nextSequence[pTest->m_sender]);
+		nextSequence[pTest->m_sender] = pTest->m_sequence + 1;
+		++received;
+	};
+
+	BenchmarkTimer timer;
+	while (received < numProducers * numEvents && timer.ElapsedMs() < 30000.0)
+	{
+		IEventDataPtr pEvent;
+		if ((received & 1) && queue.TryPop(pEvent))
+		{
+			check(pEvent);
+		}
+		else
+		{
+			queue.PopBatch(check, 8);
+		}
+		if ((received & 255) == 0)
+		{
+			Sleep(0);
+		}
+	}
+
+	for (unsigned int i = 0; i < numProducers; ++i)
+	{
+		WaitForSingleObject(threads[i], INFINITE);
+		CloseHandle(threads[i]);
+	}
+
+	TEST_CHECK(inOrder);
+	TEST_CHECK(received == numProducers * numEvents);
+	TEST_CHECK(queue.Empty());
+	TEST_CHECK(spilled > 0);
+}
+
+//
+// Throughput of the realtime event queue against the old concurrent_queue, 1 to 32 threads
+// sending to the game thread.
+//
+ENGINE_BENCHMARK(ThreadSafeEventQueue_Producers)
+{
+	const unsigned int numEvents = 1 << 20;
+	const unsigned int producerCounts[] = { 1, 2, 4, 8, 16, 32 };
+
+	for (unsigned int i = 0; i < _countof(producerCounts); ++i)
+	{
+		char name[64];
+
+		ThreadSafeEventQueue ring(EVENTMANAGER_REALTIME_QUEUE_SIZE);
+		sprintf_s(name, "ThreadSafeEventQueue, %u producers", producerCounts[i]);
+		BenchmarkReport(name, MeasureProducers(ring, producerCounts[i], numEvents) / 1000000.0, "M events/s");
+
+		concurrent_queue<IEventDataPtr> locked;
+		sprintf_s(name, "concurrent_queue, %u producers", producerCounts[i]);
+		BenchmarkReport(name, MeasureProducers(locked, producerCounts[i], numEvents) / 1000000.0, "M events/s");
+	}
+}
+
+//
+// class DispatchCounter							- not described in the book
+//
+// A listener that only counts what it was sent.
+//
+class DispatchCounter
+{
+public:
+	unsigned int m_count;
+
+	DispatchCounter(void) : m_count(0) { }
+	void OnEvent(IEventDataPtr pEvent) { ++m_count; }
+};
+
+typedef std::map<EventType, std::list<EventListenerDelegate> > OldEventListenerMap;
+
+// what VTriggerEvent() did before the EventListenerTable
+static bool TriggerThroughMap(const OldEventListenerMap& listeners, const IEventDataPtr& pEvent)
+{
+	bool processed = false;
+
+	OldEventListenerMap::const_iterator findIt = listeners.find(pEvent->VGetEventType());
+	if (findIt != listeners.end())
+	{
+		const std::list<EventListenerDelegate>& eventListenerList = findIt->second;
+		for (std::list<EventListenerDelegate>::const_iterator it = eventListenerList.begin(); it != eventListenerList.end(); ++it)
+		{
+			EventListenerDelegate listener = (*it);
+			listener(pEvent);
+			processed = true;
+		}
+	}
+
+	return processed;
+}
+
+//
+// VTriggerEvent() on an event with 10, 100 and 1000 listeners, against the map of lists the
+// event manager used to keep. Thirty other event types have a few listeners each, as a game's
+// would. Reported are the time each dispatch takes and each listener call within it.
+//
+ENGINE_BENCHMARK(EventManager_Dispatch)
+{
+	const unsigned int listenerCounts[] = { 10, 100, 1000 };
+	const unsigned int numCalls = 4000000, numOtherTypes = 30;
+
+	for (unsigned int i = 0; i < _countof(listenerCounts); ++i)
+	{
+		const unsigned int numListeners = listenerCounts[i];
+		std::vector<DispatchCounter> counters(numListeners + numOtherTypes * 4);
+
+		EventManager eventManager("EventManager_Dispatch", false);
+		OldEventListenerMap oldListeners;
+		for (unsigned int j = 0; j < counters.size(); ++j)
+		{
+			EventType type = (j < numListeners) ? EvtData_Test::sk_EventType : EvtData_Test::sk_EventType + 1 + (j % numOtherTypes);
+			EventListenerDelegate listener = fastdelegate::MakeDelegate(&counters[j], &DispatchCounter::OnEvent);
+			eventManager.VAddListener(listener, type);
+			oldListeners[type].push_back(listener);
+		}
+
+		IEventDataPtr pEvent(Nv_NEW EvtData_Test);
+		const unsigned int numDispatches = numCalls / numListeners;
+
+		BenchmarkTimer timer;
+		for (unsigned int j = 0; j < numDispatches; ++j)
+		{
+			eventManager.VTriggerEvent(pEvent);
+		}
+		double tableMs = timer.ElapsedMs();
+
+		timer.Restart();
+		for (unsigned int j = 0; j < numDispatches; ++j)
+		{
+			TriggerThroughMap(oldListeners, pEvent);
+		}
+		double mapMs = timer.ElapsedMs();
+
+		// both reached every listener of the type, every time, and nobody else
+		bool allCalled = true;
+		for (unsigned int j = 0; j < counters.size(); ++j)
+		{
+			allCalled = allCalled && (counters[j].m_count == ((j < numListeners) ? numDispatches * 2 : 0));
+		}
+		TEST_CHECK(allCalled);
+
+		char name[64];
+		sprintf_s(name, "%u listeners: EventListenerTable, each dispatch", numListeners);
+		BenchmarkReport(name, tableMs * 1000000.0 / numDispatches, "ns");
+		sprintf_s(name, "%u listeners: EventListenerTable, each call", numListeners);
+		BenchmarkReport(name, tableMs * 1000000.0 / (numDispatches * numListeners), "ns");
+		sprintf_s(name, "%u listeners: map of lists, each dispatch", numListeners);
+		BenchmarkReport(name, mapMs * 1000000.0 / numDispatches, "ns");
+		sprintf_s(name, "%u listeners: map of lists, each call", numListeners);
+		BenchmarkReport(name, mapMs * 1000000.0 / (numDispatches * numListeners), "ns");
+	}
+}
+
+// the stats of the pool MakePooledEvent<EvtData_Move_Actor>() allocates from, which is named after the class
+static EventPoolStats GetMovePoolStats(void)
+{
+	std::vector<EventPoolStats> stats;
+	EventPool::GetAllStats(stats);
+	for (size_t i = 0; i < stats.size(); ++i)
+	{
+		if (stats[i].m_name == typeid(EvtData_Move_Actor).name()) {
+			return stats[i];
+		}
+	}
+	return EventPoolStats();
+}
+
+// a frame's worth of moves queued and dispatched, the events made with MakePooledEvent() or on the heap
+static void QueueMoveFrame(EventManager& eventManager, unsigned int numMoves, bool pooled)
+{
+	Mat4x4 transform = Mat4x4::g_Identity;
+	for (unsigned int i = 0; i < numMoves; ++i)
+	{
+		if (pooled) {
+			eventManager.VQueueEvent(MakePooledEvent<EvtData_Move_Actor>(i + 1, transform));
+		}
+		else {
+			eventManager.VQueueEvent(IEventDataPtr(Nv_NEW EvtData_Move_Actor(i + 1, transform)));
+		}
+	}
+	eventManager.VUpdate();
+}
+
+//
+// A hundred thousand move events a frame, queued and dispatched to a listener, made with
+// MakePooledEvent() and with Nv_NEW. Reported are the time each frame takes, and for the pooled
+// events how many came out of the pool each frame and how many blocks the pool had to malloc
+// once it had warmed up - that should be none. A build with ENABLE_MEMORY_TRACKING also reports
+// how many allocations each frame made on the heap.
+//
+ENGINE_BENCHMARK(EventManager_PooledMoves)
+{
+	const unsigned int numMoves = 100000, numFrames = 20;
+
+	for (int pooled = 0; pooled < 2; ++pooled)
+	{
+		const char* pSource = pooled ? "MakePooledEvent" : "Nv_NEW";
+		EventManager eventManager("EventManager_PooledMoves", false);
+		DispatchCounter counter;
+		eventManager.VAddListener(fastdelegate::MakeDelegate(&counter, &DispatchCounter::OnEvent), EvtData_Move_Actor::sk_EventType);
+
+		// the first frame grows the queues and the pool
+		QueueMoveFrame(eventManager, numMoves, pooled != 0);
+
+		EventPoolStats before = GetMovePoolStats();
+#ifdef ENABLE_MEMORY_TRACKING
+		MemorySnapshot beforeSnapshot;
+		MemoryTracker::TakeSnapshot(beforeSnapshot);
+#endif
+
+		std::vector<double> frameMs;
+		for (unsigned int frame = 0; frame < numFrames; ++frame)
+		{
+			BenchmarkTimer timer;
+			QueueMoveFrame(eventManager, numMoves, pooled != 0);
+			frameMs.push_back(timer.ElapsedMs());
+		}
+
+#ifdef ENABLE_MEMORY_TRACKING
+		MemorySnapshot afterSnapshot;
+		MemoryTracker::TakeSnapshot(afterSnapshot);
+		unsigned __int64 heapAllocs = 0;
+		for (unsigned int tag = 0; tag < MEMTAG_COUNT; ++tag)
+		{
+			heapAllocs += afterSnapshot.m_tags[tag].m_allocs - beforeSnapshot.m_tags[tag].m_allocs;
+		}
+#endif
+		EventPoolStats after = GetMovePoolStats();
+
+		TEST_CHECK(counter.m_count == (numFrames + 1) * numMoves);
+
+		char name[64];
+		sprintf_s(name, "%s: each frame", pSource);
+		BenchmarkReport(name, BenchmarkPercentile(frameMs, 0.5), "ms");
+		if (pooled)
+		{
+			TEST_CHECK(after.m_allocs - before.m_allocs == numFrames * numMoves);
+			TEST_CHECK(after.m_live == before.m_live);
+			TEST_CHECK(after.m_heapBlocks == before.m_heapBlocks);
+			sprintf_s(name, "%s: pool allocations, each frame", pSource);
+			BenchmarkReport(name, (double)(after.m_allocs - before.m_allocs) / numFrames, "allocs");
+			sprintf_s(name, "%s: pool blocks malloc'ed after warm up", pSource);
+			BenchmarkReport(name, after.m_heapBlocks - before.m_heapBlocks, "blocks");
+		}
+#ifdef ENABLE_MEMORY_TRACKING
+		sprintf_s(name, "%s: heap allocations, each frame", pSource);
+		BenchmarkReport(name, (double)heapAllocs / numFrames, "allocs");
+#endif
+	}
+}
@@ -0,0 +1,272 @@
+// ================================================================
+// JobSystemTests.cpp : Tests and benchmarks for the job system and its deques
+// ================================================================
+
+#include "EngineTests.h"
+#include "../EngineCore/Multicore/JobSystem.h"
+
+static void EmptyJob(void* pData) { }
+
+static Job MakeNumberedJob(size_t number)
+{
+	Job job = { EmptyJob, (void*)number, NULL };
+	return job;
+}
+
+//
+// The owner works at the newest end of its deque and thieves at the oldest.
+//
+ENGINE_TEST(WorkStealingDeque_PopNewestStealOldest)
+{
+	WorkStealingDeque deque(4);
+	for (size_t i = 1; i <= 10; ++i)
+	{
+		deque.Push(MakeNumberedJob(i));
+	}
+
+	Job job;
+	TEST_CHECK(deque.Steal(job) && job.m_pData == (void*)1);
+	TEST_CHECK(deque.Pop(job) && job.m_pData == (void*)10);
+	TEST_CHECK(deque.Steal(job) && job.m_pData == (void*)2);
+
+	unsigned int left = 0;
+	while (deque.Pop(job))
+	{
+		++left;
+	}
+	TEST_CHECK(left == 7);
+	TEST_CHECK(deque.Empty() && !deque.Steal(job));
+}
+
+struct DequeThiefParams
+{
+	WorkStealingDeque* m_pDeque;
+	std::atomic<bool>* m_pDone;
+	std::vector<size_t> m_taken;
+};
+
+static void DequeThiefProc(DequeThiefParams* pParams)
+{
+	while (!pParams->m_pDone->load(std::memory_order_acquire))
+	{
+		Job job;
+		if (pParams->m_pDeque->Steal(job)) {
+			pParams->m_taken.push_back((size_t)job.m_pData);
+		}
+	}
+}
+
+//
+// The owner pushes, and pops every third job, while three thieves steal from the other end. The
+// deque starts small so it grows under the thieves' feet. Every job has to come out exactly once,
+// whoever takes it.
+//
+ENGINE_TEST(WorkStealingDeque_ConcurrentStealTakesEveryJobOnce)
+{
+	const size_t numJobs = 200000;
+	const unsigned int numThieves = 3;
+
+	WorkStealingDeque deque(16);
+	std::atomic<bool> done(false);
+
+	DequeThiefParams thieves[numThieves];
+	std::thread threads[numThieves];
+	for (unsigned int i = 0; i < numThieves; ++i)
+	{
+		thieves[i].m_pDeque = &deque;
+		thieves[i].m_pDone = &done;
+		threads[i] = std::thread(DequeThiefProc, &thieves[i]);
+	}
+
+	std::vector<size_t> popped;
+	Job job;
+	for (size_t i = 1; i <= numJobs; ++i)
+	{
+		deque.Push(MakeNumberedJob(i));
+		if ((i % 3) == 0 && deque.Pop(job)) {
+			popped.push_back((size_t)job.m_pData);
+		}
+	}
+	// Pop() only fails early when a thief wins the last job
+	while (deque.Pop(job))
+	{
+		popped.push_back((size_t)job.m_pData);
+	}
+
+	done.store(true, std::memory_order_release);
+	for (unsigned int i = 0; i < numThieves; ++i)
+	{
+		threads[i].join();
+	}
+
+	std::vector<unsigned char> seen(numJobs, 0);
+	size_t numTaken = 0;
+	for (unsigned int i = 0; i <= numThieves; ++i)
+	{
+		const std::vector<size_t>& taken = (i < numThieves) ? thieves[i].m_taken : popped;
+		for (size_t j = 0; j < taken.size(); ++j)
+		{
+			TEST_CHECK(taken[j] >= 1 && taken[j] <= numJobs);
+			TEST_CHECK(seen[taken[j] - 1] == 0);
+			seen[taken[j] - 1] = 1;
+		}
+		numTaken += taken.size();
+	}
+	TEST_CHECK(numTaken == numJobs);
+}
+
+struct ForkTreeParams
+{
+	JobSystem* m_pJobSystem;
+	unsigned int m_depth;
+	std::atomic<unsigned int>* m_pRun;
+};
+
+// forks eight children and waits for them, so workers wait inside jobs all the way down
+static void ForkTreeJob(void* pData)
+{
+	ForkTreeParams* pParams = (ForkTreeParams*)pData;
+	pParams->m_pRun->fetch_add(1, std::memory_order_relaxed);
+	if (pParams->m_depth == 0) {
+		return;
+	}
+
+	ForkTreeParams children[8];
+	JobCounter counter;
+	for (unsigned int i = 0; i < _countof(children); ++i)
+	{
+		children[i].m_pJobSystem = pParams->m_pJobSystem;
+		children[i].m_depth = pParams->m_depth - 1;
+		children[i].m_pRun = pParams->m_pRun;
+		pParams->m_pJobSystem->Run(ForkTreeJob, &children[i], &counter);
+	}
+	pParams->m_pJobSystem->Wait(counter);
+}
+
+//
+// Forks nested four deep, joined from inside the workers as well as from the calling thread.
+//
+ENGINE_TEST(JobSystem_NestedForkJoin)
+{
+	JobSystem jobSystem(4);
+	std::atomic<unsigned int> run(0);
+
+	ForkTreeParams root = { &jobSystem, 4, &run };
+	JobCounter counter;
+	jobSystem.Run(ForkTreeJob, &root, &counter);
+	jobSystem.Wait(counter);
+
+	TEST_CHECK(counter.IsDone());
+	TEST_CHECK(run.load() == 1 + 8 + 64 + 512 + 4096);
+}
+
+struct SpawnParams
+{
+	JobSystem* m_pJobSystem;
+	JobCounter* m_pCounter;
+	unsigned int m_numJobs;
+	std::thread::id m_spawner;
+	std::atomic<unsigned int> m_run;
+	std::atomic<unsigned int> m_stolen;
+};
+
+static void SpawnedJob(void* pData)
+{
+	SpawnParams* pParams = (SpawnParams*)pData;
+	pParams->m_run.fetch_add(1, std::memory_order_relaxed);
+	if (std::this_thread::get_id() != pParams->m_spawner) {
+		pParams->m_stolen.fetch_add(1, std::memory_order_relaxed);
+	}
+}
+
+// runs on worker 0, so everything it spawns lands on that worker's deque for the others to steal
+static void SpawnerJob(void* pData)
+{
+	SpawnParams* pParams = (SpawnParams*)pData;
+	pParams->m_spawner = std::this_thread::get_id();
+	for (unsigned int i = 0; i < pParams->m_numJobs; ++i)
+	{
+		pParams->m_pJobSystem->Run(SpawnedJob, pParams, pParams->m_pCounter);
+	}
+}
+
+//
+// One worker spawns a hundred thousand empty jobs onto its own deque while the other workers,
+// and the calling thread waiting on them, steal what they can. Reported are the time each job
+// takes from spawn to done - the median of ten rounds - and how many of them were stolen.
+//
+ENGINE_BENCHMARK(JobSystem_SpawnSteal)
+{
+	const unsigned int numJobs = 100000, numRounds = 10;
+	const unsigned int workerCounts[] = { 1, 2, 4, 8 };
+
+	for (unsigned int i = 0; i < _countof(workerCounts); ++i)
+	{
+		JobSystem jobSystem(workerCounts[i]);
+
+		std::vector<double> jobNs;
+		unsigned int run = 0, stolen = 0;
+		for (unsigned int round = 0; round < numRounds; ++round)
+		{
+			JobCounter counter;
+			SpawnParams params;
+			params.m_pJobSystem = &jobSystem;
+			params.m_pCounter = &counter;
+			params.m_numJobs = numJobs;
+			params.m_run.store(0);
+			params.m_stolen.store(0);
+
+			BenchmarkTimer timer;
+			jobSystem.Run(SpawnerJob, &params, &counter, JOB_PRIORITY_NORMAL, 0);
+			jobSystem.Wait(counter);
+			jobNs.push_back(timer.ElapsedMs() * 1000000.0 / numJobs);
+
+			run += params.m_run.load();
+			stolen += params.m_stolen.load();
+		}
+		TEST_CHECK(run == numRounds * numJobs);
+
+		char name[64];
+		sprintf_s(name, "%u workers: spawn to done, each job", workerCounts[i]);
+		BenchmarkReport(name, BenchmarkPercentile(jobNs, 0.5), "ns");
+		sprintf_s(name, "%u workers: stolen", workerCounts[i]);
+		BenchmarkReport(name, 100.0 * stolen / run, "%");
+	}
+}
+
+//
+// How long the calling thread takes to fork a job, or sixty four of them, and join again - what a
+// system pays each frame to go wide. Reported are the median and the 99th percentile.
+//
+ENGINE_BENCHMARK(JobSystem_ForkJoinLatency)
+{
+	const unsigned int numForks = 5000;
+	const unsigned int workerCounts[] = { 1, 2, 4, 8 };
+	const unsigned int forkSizes[] = { 1, 64 };
+
+	for (unsigned int i = 0; i < _countof(workerCounts); ++i)
+	{
+		JobSystem jobSystem(workerCounts[i]);
+		for (unsigned int j = 0; j < _countof(forkSizes); ++j)
+		{
+			std::vector<double> forkUs;
+			for (unsigned int fork = 0; fork < numForks; ++fork)
+			{
+				JobCounter counter;
+				BenchmarkTimer timer;
+				for (unsigned int k = 0; k < forkSizes[j]; ++k)
+				{
+					jobSystem.Run(EmptyJob, NULL, &counter);
+				}
+				jobSystem.Wait(counter);
+				forkUs.push_back(timer.ElapsedMs() * 1000.0);
+			}
+
+			char name[64];
+			sprintf_s(name, "%u workers, fork of %u: median", workerCounts[i], forkSizes[j]);
+			BenchmarkReport(name, BenchmarkPercentile(forkUs, 0.5), "us");
+			sprintf_s(name, "%u workers, fork of %u: 99th percentile", workerCounts[i], forkSizes[j]);
+			BenchmarkReport(name, BenchmarkPercentile(forkUs, 0.99), "us");
+		}
+	}
+}
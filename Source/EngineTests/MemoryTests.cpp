@@ -0,0 +1,252 @@
+// ================================================================
+// MemoryTests.cpp : Benchmarks for the allocators
+// ================================================================
+
+#include "EngineTests.h"
+#include "../EngineCore/Memory/FrameArena.h"
+#include "../EngineCore/Memory/PoolAllocator.h"
+#include "../EngineCore/Multicore/JobSystem.h"
+
+#include <set>
+
+static unsigned int NextRandom(unsigned int& seed)
+{
+	seed = seed * 1103515245 + 12345;
+	return (seed >> 16) & 0x7fff;
+}
+
+enum AllocChurnSource
+{
+	ALLOC_CHURN_POOL,			// PoolAllocator
+	ALLOC_CHURN_MALLOC,
+	ALLOC_CHURN_NEW,			// operator new, which the memory tracker replaces when it's enabled
+};
+
+static void* ChurnAlloc(AllocChurnSource source, size_t size)
+{
+	switch (source)
+	{
+		case ALLOC_CHURN_POOL:
+			return PoolAllocator::Get().Alloc(size);
+		case ALLOC_CHURN_MALLOC:
+			return malloc(size);
+		default:
+			return Nv_NEW char[size];
+	}
+}
+
+static void ChurnFree(AllocChurnSource source, void* pMem, size_t size)
+{
+	switch (source)
+	{
+		case ALLOC_CHURN_POOL:
+			PoolAllocator::Get().Free(pMem, size);
+			break;
+		case ALLOC_CHURN_MALLOC:
+			free(pMem);
+			break;
+		default:
+			delete[] static_cast<char*>(pMem);
+			break;
+	}
+}
+
+//
+// struct AllocChurn								- not described in the book
+//
+// One thread's share of an allocation benchmark: it keeps a couple of thousand small blocks of
+// mixed sizes alive, allocating and freeing at random, the way events, packets and pathing nodes
+// come and go. The allocations are tagged MEMTAG_AI.
+//
+struct AllocChurn
+{
+	AllocChurnSource m_source;
+	unsigned int m_seed;
+	unsigned int m_operations;
+};
+
+static void RunAllocChurn(void* pData)
+{
+	Nv_MEMORY_TAG_SCOPE(MEMTAG_AI);
+
+	AllocChurn* pChurn = static_cast<AllocChurn*>(pData);
+	unsigned int seed = pChurn->m_seed;
+
+	std::vector<std::pair<void*, size_t> > live;
+	live.reserve(4096);
+	for (unsigned int i = 0; i < pChurn->m_operations; ++i)
+	{
+		if (live.size() < 2048 || (NextRandom(seed) & 1))
+		{
+			size_t size = 8 + NextRandom(seed) % 248;
+			void* pMem = ChurnAlloc(pChurn->m_source, size);
+			*static_cast<char*>(pMem) = 0;
+			live.push_back(std::make_pair(pMem, size));
+		}
+		else
+		{
+			size_t index = NextRandom(seed) % live.size();
+			ChurnFree(pChurn->m_source, live[index].first, live[index].second);
+			live[index] = live.back();
+			live.pop_back();
+		}
+	}
+
+	for (size_t i = 0; i < live.size(); ++i)
+	{
+		ChurnFree(pChurn->m_source, live[i].first, live[i].second);
+	}
+}
+
+// runs the churn on numThreads threads at once and returns the time each operation took
+static double RunAllocChurns(JobSystem& jobSystem, AllocChurnSource source, unsigned int numThreads, unsigned int numOperations)
+{
+	std::vector<AllocChurn> churns(numThreads);
+	JobCounter counter;
+
+	BenchmarkTimer timer;
+	for (unsigned int i = 0; i < numThreads; ++i)
+	{
+		churns[i].m_source = source;
+		churns[i].m_seed = 12345 + i;
+		churns[i].m_operations = numOperations;
+		jobSystem.Run(RunAllocChurn, &churns[i], &counter);
+	}
+	jobSystem.Wait(counter);
+	return timer.ElapsedMs() * 1000000.0 / (numOperations * numThreads);
+}
+
+//
+// Small allocations and frees at random from one thread and from four at once, through the
+// PoolAllocator and through malloc. The pool's threads only meet at the depot locks once every
+// batch, where malloc may serialize them.
+//
+ENGINE_BENCHMARK(Memory_PoolAllocatorChurn)
+{
+	const unsigned int numOperations = 2000000;
+	const unsigned int numThreads[] = { 1, 4 };
+
+	for (unsigned int i = 0; i < _countof(numThreads); ++i)
+	{
+		JobSystem jobSystem(numThreads[i]);
+		const char* pSuffix = (numThreads[i] == 1) ? "" : "s";
+
+		char name[64];
+		sprintf_s(name, "PoolAllocator, %u thread%s", numThreads[i], pSuffix);
+		BenchmarkReport(name, RunAllocChurns(jobSystem, ALLOC_CHURN_POOL, numThreads[i], numOperations), "ns/op");
+		sprintf_s(name, "malloc, %u thread%s", numThreads[i], pSuffix);
+		BenchmarkReport(name, RunAllocChurns(jobSystem, ALLOC_CHURN_MALLOC, numThreads[i], numOperations), "ns/op");
+	}
+}
+
+//
+// What the memory tracker costs: the same churn through operator new, from one thread and from
+// four. Run it from a build with ENABLE_MEMORY_TRACKING and one without and compare. With the
+// tracker on, every allocation has to show up under its tag, and taking a snapshot is timed too.
+//
+ENGINE_BENCHMARK(Memory_TrackerOverhead)
+{
+	const unsigned int numOperations = 2000000;
+	const unsigned int numThreads[] = { 1, 4 };
+
+#ifdef ENABLE_MEMORY_TRACKING
+	const char* pBuild = "tracked";
+	MemorySnapshot before;
+	MemoryTracker::TakeSnapshot(before);
+#else
+	const char* pBuild = "untracked";
+#endif
+
+	unsigned int numAllocs = 0;
+	for (unsigned int i = 0; i < _countof(numThreads); ++i)
+	{
+		JobSystem jobSystem(numThreads[i]);
+		char name[64];
+		sprintf_s(name, "new, %s, %u thread%s", pBuild, numThreads[i], (numThreads[i] == 1) ? "" : "s");
+		BenchmarkReport(name, RunAllocChurns(jobSystem, ALLOC_CHURN_NEW, numThreads[i], numOperations), "ns/op");
+		numAllocs += numThreads[i] * numOperations / 2;
+	}
+
+#ifdef ENABLE_MEMORY_TRACKING
+	MemorySnapshot after;
+	BenchmarkTimer timer;
+	MemoryTracker::TakeSnapshot(after);
+	BenchmarkReport("taking a snapshot", timer.ElapsedMs(), "ms");
+
+	const MemoryTagStats& stats = after.m_tags[MEMTAG_AI];
+	TEST_CHECK(stats.m_allocs - before.m_tags[MEMTAG_AI].m_allocs >= numAllocs);
+	TEST_CHECK(stats.m_liveBytes == before.m_tags[MEMTAG_AI].m_liveBytes);
+#else
+	(void)numAllocs;
+#endif
+}
+
+typedef std::pair<unsigned int, unsigned int> TestContactPair;
+
+// a tick's contact pairs the way a broadphase reports them, some of them more than once
+static TestContactPair NextContactPair(unsigned int& seed)
+{
+	unsigned int a = NextRandom(seed) % 1500;
+	return TestContactPair(a, a + 1 + NextRandom(seed) % 4);
+}
+
+//
+// The collision pairs of a physics tick gathered up, deduplicated and walked, a few ticks a
+// frame: in a std::set on the heap, as BulletInternalTickCallback used to, and in a FrameVector
+// in a ScopedFrameArena, as it does now. After the first frames the arena should be big enough
+// that it never goes to the heap again.
+//
+ENGINE_BENCHMARK(Memory_FrameArenaContactPairs)
+{
+	const unsigned int numFrames = 300, ticksPerFrame = 4, pairsPerTick = 2000;
+
+	unsigned int seed = 12345, total = 0;
+	BenchmarkTimer timer;
+	for (unsigned int frame = 0; frame < numFrames; ++frame)
+	{
+		for (unsigned int tick = 0; tick < ticksPerFrame; ++tick)
+		{
+			std::set<TestContactPair> pairs;
+			for (unsigned int i = 0; i < pairsPerTick; ++i)
+			{
+				pairs.insert(NextContactPair(seed));
+			}
+			for (std::set<TestContactPair>::const_iterator it = pairs.begin(); it != pairs.end(); ++it)
+			{
+				total += it->first;
+			}
+		}
+	}
+	BenchmarkReport("std::set, per frame", timer.ElapsedMs() / numFrames, "ms");
+
+	unsigned int heapTotal = total;
+	seed = 12345;
+	total = 0;
+	timer.Restart();
+	for (unsigned int frame = 0; frame < numFrames; ++frame)
+	{
+		for (unsigned int tick = 0; tick < ticksPerFrame; ++tick)
+		{
+			ScopedFrameArena scope;
+			FrameVector<TestContactPair>::type pairs;
+			for (unsigned int i = 0; i < pairsPerTick; ++i)
+			{
+				pairs.push_back(NextContactPair(seed));
+			}
+			std::sort(pairs.begin(), pairs.end());
+			pairs.erase(std::unique(pairs.begin(), pairs.end()), pairs.end());
+			for (size_t i = 0; i < pairs.size(); ++i)
+			{
+				total += pairs[i].first;
+			}
+		}
+		FrameArena::Get().EndFrame();
+	}
+	BenchmarkReport("FrameVector, per frame", timer.ElapsedMs() / numFrames, "ms");
+	TEST_CHECK(total == heapTotal);
+
+	const FrameArenaStats& stats = FrameArena::Get().GetLastFrameStats();
+	BenchmarkReport("FrameVector, arena allocations in the last frame", stats.m_numAllocs, "allocs");
+	BenchmarkReport("FrameVector, heap allocations in the last frame", stats.m_numHeapAllocs, "allocs");
+	BenchmarkReport("FrameVector, peak", stats.m_peakBytes / 1024.0, "KB");
+}
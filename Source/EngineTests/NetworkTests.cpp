@@ -0,0 +1,206 @@
+// ================================================================
+// NetworkTests.cpp : Benchmarks for events over TCP, on loopback
+// ================================================================
+
+#include "EngineTests.h"
+#include "../EngineCore/EventManager/EventManagerImpl.h"
+#include "../EngineCore/EventManager/Events.h"
+#include "../EngineCore/Network/Network.h"
+#include "../EngineCore/Network/EpollSocketManager.h"
+
+#ifdef __linux__
+#include <sys/resource.h>
+#endif
+
+static const unsigned short TEST_NETWORK_PORT = 40620;
+static const unsigned short TEST_NETWORK_LOAD_PORT = 40630;
+
+//
+// class NetworkMoveCounter							- not described in the book
+//
+// Counts the moves the server's remote event sockets pass on.
+//
+class NetworkMoveCounter
+{
+public:
+	unsigned int m_received;
+
+	NetworkMoveCounter(void) { m_received = 0; IEventManager::Get()->VAddListener(fastdelegate::MakeDelegate(this, &NetworkMoveCounter::MoveActorDelegate), EvtData_Move_Actor::sk_EventType); }
+	~NetworkMoveCounter(void) { IEventManager::Get()->VRemoveListener(fastdelegate::MakeDelegate(this, &NetworkMoveCounter::MoveActorDelegate), EvtData_Move_Actor::sk_EventType); }
+
+	void MoveActorDelegate(IEventDataPtr pEventData) { ++m_received; }
+};
+
+//
+// Moves from a handful of clients to a server, all through the one socket manager, the way a
+// NetworkGameView forwards them: each client queues a few per tick and the manager sends and
+// receives them. Reported are the moves delivered per second, the bytes each took on the wire,
+// and the time spent - sending and receiving both - per megabyte. Text events go the slow way
+// round, through std::ostrstream and a heap packet, for comparison.
+//
+// select() on Windows takes 64 sockets by default, so the clients and their server ends have to
+// fit in that.
+//
+ENGINE_BENCHMARK(Network_EventThroughput)
+{
+	const unsigned int numClients = 16, eventsPerClient = 20000, eventsPerTick = 8;
+	const unsigned int numEvents = numClients * eventsPerClient;
+	const bool textEvents[] = { false, true };
+
+	REGISTER_EVENT(EvtData_Move_Actor);
+
+	unsigned short port = TEST_NETWORK_PORT;
+	for (unsigned int i = 0; i < _countof(textEvents); ++i)
+	{
+		BaseSocketManager socketManager;
+		TEST_CHECK(socketManager.Init());
+		EventManager eventManager("NetworkTests", true);
+		NetworkMoveCounter counter;
+
+		socketManager.AddSocket(Nv_NEW GameServerListenSocket(++port));
+		std::vector<std::shared_ptr<NetworkEventForwarder> > forwarders;
+		for (unsigned int j = 0; j < numClients; ++j)
+		{
+			RemoteEventSocket* pSocket = Nv_NEW RemoteEventSocket;
+			if (!pSocket->Connect(INADDR_LOOPBACK, port))
+			{
+				SAFE_DELETE(pSocket);
+				TEST_CHECK(false);
+			}
+			forwarders.push_back(std::shared_ptr<NetworkEventForwarder>(Nv_NEW NetworkEventForwarder(socketManager.AddSocket(pSocket), textEvents[i])));
+		}
+
+		unsigned int startBytes = socketManager.GetOutbound();
+		unsigned int sent = 0;
+		Mat4x4 transform = Mat4x4::g_Identity;
+
+		BenchmarkTimer timer;
+		while (counter.m_received < numEvents && timer.ElapsedMs() < 30000.0)
+		{
+			for (unsigned int tick = 0; tick < eventsPerTick && sent < numEvents; ++tick)
+			{
+				for (unsigned int j = 0; j < numClients; ++j, ++sent)
+				{
+					transform.SetPosition(Vec3((float)sent * 0.01f, 0.0f, (float)j));
+					forwarders[j]->ForwardEvent(IEventDataPtr(Nv_NEW EvtData_Move_Actor(j + 1, transform)));
+				}
+			}
+
+			socketManager.DoSelect(0);
+			eventManager.VUpdate();
+		}
+		double seconds = timer.ElapsedMs() / 1000.0;
+		TEST_CHECK(counter.m_received == numEvents);
+
+		double bytes = (double)(socketManager.GetOutbound() - startBytes);
+		const char* pFormat = textEvents[i] ? "text" : "binary";
+
+		char name[64];
+		sprintf_s(name, "%s moves: delivered", pFormat);
+		BenchmarkReport(name, numEvents / seconds, "events/s");
+		sprintf_s(name, "%s moves: on the wire", pFormat);
+		BenchmarkReport(name, bytes / numEvents, "bytes/event");
+		sprintf_s(name, "%s moves: time per MB", pFormat);
+		BenchmarkReport(name, seconds * 1000.0 / (bytes / (1024.0 * 1024.0)), "ms");
+	}
+}
+
+//
+// A thousand clients on one server, each sending a move every tick, with the socket manager a
+// busy server would use: an EpollSocketManager on Linux, the select() one elsewhere. Both ends of
+// every connection are in the one manager, so select() gets as many clients as FD_SETSIZE has
+// room for. Reported are the time to connect everyone, a poll with nothing to do, a tick's poll
+// with every client sending, and the moves delivered each second.
+//
+ENGINE_BENCHMARK(Network_ThousandClients)
+{
+#ifdef __linux__
+	const unsigned int numClients = 1000;
+#else
+	const unsigned int numClients = std::min(1000u, (unsigned int)(FD_SETSIZE - 1) / 2);
+#endif
+	const unsigned int numTicks = 200, numIdlePolls = 100;
+	const unsigned int connectBatch = 100;		// fewer than the listen backlog
+
+	REGISTER_EVENT(EvtData_Move_Actor);
+
+#ifdef __linux__
+	// two descriptors a client, which is more than the usual soft limit of 1024
+	rlimit limit;
+	getrlimit(RLIMIT_NOFILE, &limit);
+	limit.rlim_cur = std::max<rlim_t>(limit.rlim_cur, std::min<rlim_t>(limit.rlim_max, numClients * 2 + 64));
+	setrlimit(RLIMIT_NOFILE, &limit);
+
+	EpollSocketManager socketManager;
+#else
+	BaseSocketManager socketManager;
+#endif
+	TEST_CHECK(socketManager.Init());
+	EventManager eventManager("NetworkTests", true);
+	NetworkMoveCounter counter;
+
+	socketManager.AddSocket(Nv_NEW GameServerListenSocket(TEST_NETWORK_LOAD_PORT));
+
+	// a batch at a time, with the server taking each batch in before the next can fill its backlog
+	std::vector<std::shared_ptr<NetworkEventForwarder> > forwarders;
+	BenchmarkTimer timer;
+	while (forwarders.size() < numClients)
+	{
+		for (unsigned int i = 0; i < connectBatch && forwarders.size() < numClients; ++i)
+		{
+			RemoteEventSocket* pSocket = Nv_NEW RemoteEventSocket;
+			if (!pSocket->Connect(INADDR_LOOPBACK, TEST_NETWORK_LOAD_PORT))
+			{
+				SAFE_DELETE(pSocket);
+				TEST_CHECK(false);
+			}
+			forwarders.push_back(std::shared_ptr<NetworkEventForwarder>(Nv_NEW NetworkEventForwarder(socketManager.AddSocket(pSocket))));
+		}
+		socketManager.DoSelect(0);
+	}
+	eventManager.VUpdate();
+
+	char name[64];
+	sprintf_s(name, "%u clients: connecting", numClients);
+	BenchmarkReport(name, timer.ElapsedMs(), "ms");
+
+	timer.Restart();
+	for (unsigned int i = 0; i < numIdlePolls; ++i)
+	{
+		socketManager.DoSelect(0);
+	}
+	sprintf_s(name, "%u clients: an idle poll", numClients);
+	BenchmarkReport(name, timer.ElapsedMs() / numIdlePolls, "ms");
+
+	const unsigned int numEvents = numClients * numTicks;
+	Mat4x4 transform = Mat4x4::g_Identity;
+	double pollMs = 0.0;
+	BenchmarkTimer total;
+	for (unsigned int tick = 0; tick < numTicks; ++tick)
+	{
+		for (unsigned int j = 0; j < numClients; ++j)
+		{
+			transform.SetPosition(Vec3((float)tick, 0.0f, (float)j));
+			forwarders[j]->ForwardEvent(IEventDataPtr(Nv_NEW EvtData_Move_Actor(j + 1, transform)));
+		}
+
+		timer.Restart();
+		socketManager.DoSelect(0);
+		pollMs += timer.ElapsedMs();
+		eventManager.VUpdate();
+	}
+
+	// whatever was still on its way at the last tick
+	while (counter.m_received < numEvents && total.ElapsedMs() < 30000.0)
+	{
+		socketManager.DoSelect(1000);
+		eventManager.VUpdate();
+	}
+	double seconds = total.ElapsedMs() / 1000.0;
+	TEST_CHECK(counter.m_received == numEvents);
+
+	sprintf_s(name, "%u clients: a poll with everyone sending", numClients);
+	BenchmarkReport(name, pollMs / numTicks, "ms");
+	sprintf_s(name, "%u clients: delivered", numClients);
+	BenchmarkReport(name, numEvents / seconds, "events/s");
+}
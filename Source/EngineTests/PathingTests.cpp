@@ -0,0 +1,487 @@
+// ================================================================
+// PathingTests.cpp : Benchmarks for the pathing graph searches
+// ================================================================
+
+#include "EngineTests.h"
+#include "../EngineCore/AI/Pathing.h"
+#include "../EngineCore/AI/PathingHierarchy.h"
+#include "../EngineCore/AI/PathQuery.h"
+#include "../EngineCore/Multicore/JobSystem.h"
+
+static const float TEST_GRID_SPACING = 10.0f;
+
+static unsigned int NextRandom(unsigned int& seed)
+{
+	seed = seed * 1103515245 + 12345;
+	return (seed >> 16) & 0x7fff;
+}
+
+//
+// A size x size grid of nodes, each linked to the ones beside it, with a wall down every 16th
+// column that has a single gap somewhere in it - so paths have to wind about rather than run
+// straight across. Wall nodes are left out and come back NULL in outGrid.
+//
+static void BuildTestGrid(PathingGraph& graph, unsigned int size, std::vector<PathingNode*>& outGrid, std::vector<PathingNode*>& outNodes)
+{
+	unsigned int seed = 12345;
+	outGrid.assign(size * size, NULL);
+	for (unsigned int x = 0; x < size; ++x)
+	{
+		unsigned int gap = NextRandom(seed) % size;
+		for (unsigned int z = 0; z < size; ++z)
+		{
+			if (x % 16 == 15 && z != gap) {
+				continue;
+			}
+
+			PathingNode* pNode = graph.AddNode(Vec3(x * TEST_GRID_SPACING, 0.0f, z * TEST_GRID_SPACING));
+			outGrid[x * size + z] = pNode;
+			outNodes.push_back(pNode);
+			if (x > 0 && outGrid[(x - 1) * size + z]) {
+				graph.LinkNodes(outGrid[(x - 1) * size + z], pNode);
+			}
+			if (z > 0 && outGrid[x * size + z - 1]) {
+				graph.LinkNodes(outGrid[x * size + z - 1], pNode);
+			}
+		}
+	}
+}
+
+static float GetPlanLength(PathPlan* pPlan)
+{
+	float length = 0.0f;
+	pPlan->ResetPath();
+	Vec3 last = pPlan->GetCurrentNodePosition();
+	while (!pPlan->CheckForEnd())
+	{
+		Vec3 pos = pPlan->GetCurrentNodePosition();
+		length += (pos - last).Length();
+		last = pos;
+		pPlan->CheckForNextNode(pos);
+	}
+	return length;
+}
+
+// a node in the columns from minX up to maxX, not in a wall
+static PathingNode* PickTestNode(const std::vector<PathingNode*>& grid, unsigned int size, unsigned int minX, unsigned int maxX, unsigned int& seed)
+{
+	PathingNode* pNode = NULL;
+	while (!pNode)
+	{
+		unsigned int x = minX + NextRandom(seed) % (maxX - minX);
+		pNode = grid[x * size + NextRandom(seed) % size];
+	}
+	return pNode;
+}
+
+//
+// Flat A* searches between random nodes of a 256 x 256 grid, through PathingGraph::FindPath() and
+// the AStar it keeps. The first search grows the scratch arrays to the graph, the rest shouldn't
+// allocate anything but the plans. Then a hundred agents heading for the same node, with a search
+// each and with one SearchFromGoal().
+//
+ENGINE_BENCHMARK(Pathing_AStarGrid)
+{
+	const unsigned int size = 256, numSearches = 100, numAgents = 100;
+
+	PathingGraph graph;
+	std::vector<PathingNode*> grid, nodes;
+	BuildTestGrid(graph, size, grid, nodes);
+
+	unsigned int seed = 54321;
+	std::vector<std::pair<PathingNode*, PathingNode*> > searches;
+	for (unsigned int i = 0; i < numSearches; ++i)
+	{
+		PathingNode* pStart = nodes[NextRandom(seed) * nodes.size() / 0x8000];
+		PathingNode* pGoal = nodes[NextRandom(seed) * nodes.size() / 0x8000];
+		searches.push_back(std::make_pair(pStart, pGoal));
+	}
+
+	BenchmarkTimer timer;
+	PathPlan* pPlan = graph.FindPath(searches[0].first, searches[0].second);
+	BenchmarkReport("first search", timer.ElapsedMs(), "ms");
+	TEST_CHECK(pPlan);
+	SAFE_DELETE(pPlan);
+
+	timer.Restart();
+	unsigned int found = 0;
+	for (unsigned int i = 1; i < numSearches; ++i)
+	{
+		pPlan = graph.FindPath(searches[i].first, searches[i].second);
+		if (pPlan) {
+			++found;
+		}
+		SAFE_DELETE(pPlan);
+	}
+	BenchmarkReport("later searches, each", timer.ElapsedMs() / (numSearches - 1), "ms");
+	TEST_CHECK(found == numSearches - 1);
+
+	PathingNode* pGoal = nodes[nodes.size() / 2];
+	PathingNodeVec agents;
+	for (unsigned int i = 0; i < numAgents; ++i)
+	{
+		agents.push_back(nodes[NextRandom(seed) * nodes.size() / 0x8000]);
+	}
+
+	timer.Restart();
+	for (unsigned int i = 0; i < numAgents; ++i)
+	{
+		pPlan = graph.FindPath(agents[i], pGoal);
+		SAFE_DELETE(pPlan);
+	}
+	BenchmarkReport("100 agents to one goal, a search each", timer.ElapsedMs(), "ms");
+
+	AStar aStar;
+	aStar.Reserve(graph.GetNumNodes());
+	timer.Restart();
+	TEST_CHECK(aStar.SearchFromGoal(pGoal, agents) == numAgents);
+	for (unsigned int i = 0; i < numAgents; ++i)
+	{
+		pPlan = aStar.BuildPlanFrom(agents[i]);
+		SAFE_DELETE(pPlan);
+	}
+	BenchmarkReport("100 agents to one goal, one search", timer.ElapsedMs(), "ms");
+}
+
+//
+// Searches from one side of a 512 x 512 grid to the other, flat and through a PathingHierarchy of
+// 16 x 16 node clusters: the abstract search on its own, refining just its first segment, and
+// refining all of it. Also the first search, which builds every cluster, the next search after an
+// edit, which rebuilds one, and how the path lengths and the nodes each search expands compare - the
+// lengths should come out the same.
+//
+ENGINE_BENCHMARK(Pathing_HierarchyGrid)
+{
+	const unsigned int size = 512, numSearches = 20;
+
+	PathingGraph graph;
+	std::vector<PathingNode*> grid, nodes;
+	BuildTestGrid(graph, size, grid, nodes);
+
+	unsigned int seed = 54321;
+	std::vector<std::pair<PathingNode*, PathingNode*> > searches;
+	for (unsigned int i = 0; i < numSearches; ++i)
+	{
+		PathingNode* pStart = PickTestNode(grid, size, 0, size / 4, seed);
+		PathingNode* pGoal = PickTestNode(grid, size, size * 3 / 4, size, seed);
+		searches.push_back(std::make_pair(pStart, pGoal));
+	}
+
+	// the same search FindPath() runs without a hierarchy, on an AStar of our own to count the nodes
+	AStar aStar;
+	aStar.Reserve((unsigned int)nodes.size());
+	float flatLength = 0.0f;
+	unsigned int flatExpanded = 0;
+	BenchmarkTimer timer;
+	for (unsigned int i = 0; i < numSearches; ++i)
+	{
+		PathPlan* pPlan = aStar(searches[i].first, searches[i].second);
+		TEST_CHECK(pPlan);
+		flatExpanded += aStar.GetLastExpanded();
+		flatLength += GetPlanLength(pPlan);
+		SAFE_DELETE(pPlan);
+	}
+	BenchmarkReport("flat search, each", timer.ElapsedMs() / numSearches, "ms");
+	BenchmarkReport("flat search, nodes expanded", (double)flatExpanded / numSearches, "nodes");
+
+	graph.EnableHierarchy(16 * TEST_GRID_SPACING);
+	PathingHierarchy* pHierarchy = graph.GetHierarchy();
+	HierarchicalPath path;
+
+	timer.Restart();
+	TEST_CHECK(pHierarchy->FindPath(searches[0].first, searches[0].second, path));
+	BenchmarkReport("first search, building the clusters", timer.ElapsedMs(), "ms");
+
+	double abstractMs = 0.0, firstSegmentMs = 0.0, refineMs = 0.0;
+	unsigned int expanded = 0;
+	float hierarchyLength = 0.0f;
+	PathingNodeVec segment;
+	for (unsigned int i = 0; i < numSearches; ++i)
+	{
+		timer.Restart();
+		TEST_CHECK(pHierarchy->FindPath(searches[i].first, searches[i].second, path));
+		abstractMs += timer.ElapsedMs();
+		expanded += pHierarchy->GetLastExpanded();
+
+		timer.Restart();
+		segment.clear();
+		TEST_CHECK(pHierarchy->RefineNextSegment(path, segment));
+		firstSegmentMs += timer.ElapsedMs();
+
+		TEST_CHECK(pHierarchy->FindPath(searches[i].first, searches[i].second, path));
+		timer.Restart();
+		PathPlan* pPlan = pHierarchy->BuildPlan(path);
+		refineMs += timer.ElapsedMs();
+		TEST_CHECK(pPlan);
+		hierarchyLength += GetPlanLength(pPlan);
+		SAFE_DELETE(pPlan);
+	}
+	BenchmarkReport("abstract search, each", abstractMs / numSearches, "ms");
+	BenchmarkReport("abstract search, nodes expanded", (double)expanded / numSearches, "nodes");
+	BenchmarkReport("refining the first segment, each", firstSegmentMs / numSearches, "ms");
+	BenchmarkReport("refining the whole path, each", refineMs / numSearches, "ms");
+	BenchmarkReport("path length against flat", hierarchyLength / flatLength, "x");
+
+	// an arc in the middle of the grid taken away and put back dirties the clusters at its ends
+	PathingNode* pNodeA = grid[(size / 2) * size + size / 2];
+	PathingNode* pNodeB = grid[(size / 2) * size + size / 2 + 1];
+	graph.UnlinkNodes(pNodeA, pNodeB);
+	graph.LinkNodes(pNodeA, pNodeB);
+	timer.Restart();
+	TEST_CHECK(pHierarchy->FindPath(searches[0].first, searches[0].second, path));
+	BenchmarkReport("search after an edit", timer.ElapsedMs(), "ms");
+}
+
+//
+// Four thousand agents on a 256 x 256 grid asking for paths to one of forty places at once: a
+// FindPath() each (timed for the first couple of hundred, it takes a while), and through a
+// PathQueryService - searching a goal once for everyone headed there - on the calling thread and on
+// a job system. Also the same wave spread out with a budget of eight searches an update, and what
+// the worst of those updates costs.
+//
+ENGINE_BENCHMARK(Pathing_QueryService)
+{
+	const unsigned int size = 256, numRequests = 4000, numGoals = 40, searchesPerUpdate = 8, numFindPaths = 200;
+
+	PathingGraph graph;
+	std::vector<PathingNode*> grid, nodes;
+	BuildTestGrid(graph, size, grid, nodes);
+
+	unsigned int seed = 24680;
+	std::vector<PathingNode*> goals;
+	for (unsigned int i = 0; i < numGoals; ++i)
+	{
+		goals.push_back(nodes[NextRandom(seed) * nodes.size() / 0x8000]);
+	}
+	std::vector<std::pair<PathingNode*, PathingNode*> > requests;
+	for (unsigned int i = 0; i < numRequests; ++i)
+	{
+		requests.push_back(std::make_pair(nodes[NextRandom(seed) * nodes.size() / 0x8000], goals[NextRandom(seed) % numGoals]));
+	}
+
+	BenchmarkTimer timer;
+	unsigned int found = 0;
+	for (unsigned int i = 0; i < numFindPaths; ++i)
+	{
+		PathPlan* pPlan = graph.FindPath(requests[i].first, requests[i].second);
+		if (pPlan || requests[i].first == requests[i].second) {
+			++found;
+		}
+		SAFE_DELETE(pPlan);
+	}
+	BenchmarkReport("FindPath() each, per request", timer.ElapsedMs() / numFindPaths, "ms");
+	TEST_CHECK(found == numFindPaths);
+
+	JobSystem jobSystem(3);
+	const char* modes[] = { "service, calling thread", "service, job system", "service, 8 searches an update" };
+	for (unsigned int mode = 0; mode < _countof(modes); ++mode)
+	{
+		PathQueryService service(&graph, (mode == 0) ? NULL : &jobSystem);
+		service.SetMaxSearchesPerUpdate((mode == 2) ? searchesPerUpdate : 0);
+
+		timer.Restart();
+		std::vector<PathQueryId> ids;
+		for (unsigned int i = 0; i < numRequests; ++i)
+		{
+			ids.push_back(service.Submit(requests[i].first, requests[i].second));
+		}
+
+		unsigned int updates = 0;
+		double worstUpdateMs = 0.0;
+		while (service.GetNumPending() > 0)
+		{
+			BenchmarkTimer updateTimer;
+			service.Update();
+			worstUpdateMs = std::max(worstUpdateMs, updateTimer.ElapsedMs());
+			++updates;
+		}
+
+		found = 0;
+		for (unsigned int i = 0; i < numRequests; ++i)
+		{
+			if (service.GetStatus(ids[i]) == PQS_Done) {
+				++found;
+			}
+			PathPlan* pPlan = service.Collect(ids[i]);
+			SAFE_DELETE(pPlan);
+		}
+		char name[64];
+		sprintf_s(name, "%s, per request", modes[mode]);
+		BenchmarkReport(name, timer.ElapsedMs() / numRequests, "ms");
+		TEST_CHECK(found == numRequests);
+
+		if (mode == 2)
+		{
+			BenchmarkReport("service, 8 searches an update: updates", updates, "updates");
+			BenchmarkReport("service, 8 searches an update: worst update", worstUpdateMs, "ms");
+		}
+	}
+}
+
+// the brute force scans PathingGraph used before it had a PathingGrid
+static PathingNode* LinearClosestNode(const std::vector<PathingNode*>& nodes, const Vec3& pos)
+{
+	PathingNode* pClosestNode = nodes.front();
+	float length = FLT_MAX;
+	for (size_t i = 0; i < nodes.size(); ++i)
+	{
+		Vec3 diff = pos - nodes[i]->GetPos();
+		if (diff.Length() < length)
+		{
+			pClosestNode = nodes[i];
+			length = diff.Length();
+		}
+	}
+	return pClosestNode;
+}
+
+static void LinearClosestNodes(const std::vector<PathingNode*>& nodes, const Vec3& pos, unsigned int count, std::vector<std::pair<float, PathingNode*> >& scratch, PathingNodeVec& outNodes)
+{
+	scratch.clear();
+	for (size_t i = 0; i < nodes.size(); ++i)
+	{
+		Vec3 diff = pos - nodes[i]->GetPos();
+		scratch.push_back(std::make_pair(diff.Dot(diff), nodes[i]));
+	}
+	count = std::min(count, (unsigned int)scratch.size());
+	std::partial_sort(scratch.begin(), scratch.begin() + count, scratch.end());
+
+	outNodes.clear();
+	for (unsigned int i = 0; i < count; ++i)
+	{
+		outNodes.push_back(scratch[i].second);
+	}
+}
+
+static void LinearNodesInRadius(const std::vector<PathingNode*>& nodes, const Vec3& pos, float radius, PathingNodeVec& outNodes)
+{
+	outNodes.clear();
+	for (size_t i = 0; i < nodes.size(); ++i)
+	{
+		Vec3 diff = pos - nodes[i]->GetPos();
+		if (diff.Dot(diff) <= radius * radius) {
+			outNodes.push_back(nodes[i]);
+		}
+	}
+}
+
+static float GetTestDistance(PathingNode* pNode, const Vec3& pos)
+{
+	Vec3 diff = pos - pNode->GetPos();
+	return diff.Length();
+}
+
+//
+// Random positions over a 64 x 64 and a 256 x 256 grid looked up through the PathingGrid that
+// PathingGraph keeps and through the linear scans it used to do: the closest node, the closest
+// eight and everything within three and a half nodes. Reported is the time each lookup takes. Both
+// ways have to find nodes the same distance away, and the same nodes within the radius.
+//
+ENGINE_BENCHMARK(Pathing_GridLookups)
+{
+	const unsigned int sizes[] = { 64, 256 };
+	const unsigned int numQueries = 2000, numClosest = 8;
+	const float radius = 3.5f * TEST_GRID_SPACING;
+
+	for (unsigned int i = 0; i < _countof(sizes); ++i)
+	{
+		PathingGraph graph;
+		std::vector<PathingNode*> grid, nodes;
+		BuildTestGrid(graph, sizes[i], grid, nodes);
+
+		unsigned int seed = 13579;
+		std::vector<Vec3> queries;
+		for (unsigned int j = 0; j < numQueries; ++j)
+		{
+			float x = (NextRandom(seed) % (sizes[i] * 100)) * TEST_GRID_SPACING / 100.0f;
+			float z = (NextRandom(seed) % (sizes[i] * 100)) * TEST_GRID_SPACING / 100.0f;
+			queries.push_back(Vec3(x, 0.0f, z));
+		}
+
+		// closest node
+		std::vector<PathingNode*> gridClosest(numQueries), linearClosest(numQueries);
+		BenchmarkTimer timer;
+		for (unsigned int j = 0; j < numQueries; ++j)
+		{
+			gridClosest[j] = graph.FindClosestNode(queries[j]);
+		}
+		double gridClosestMs = timer.ElapsedMs();
+
+		timer.Restart();
+		for (unsigned int j = 0; j < numQueries; ++j)
+		{
+			linearClosest[j] = LinearClosestNode(nodes, queries[j]);
+		}
+		double linearClosestMs = timer.ElapsedMs();
+
+		// the closest few
+		std::vector<PathingNodeVec> gridNodes(numQueries), linearNodes(numQueries);
+		timer.Restart();
+		for (unsigned int j = 0; j < numQueries; ++j)
+		{
+			graph.FindClosestNodes(queries[j], numClosest, gridNodes[j]);
+		}
+		double gridNodesMs = timer.ElapsedMs();
+
+		std::vector<std::pair<float, PathingNode*> > scratch;
+		timer.Restart();
+		for (unsigned int j = 0; j < numQueries; ++j)
+		{
+			LinearClosestNodes(nodes, queries[j], numClosest, scratch, linearNodes[j]);
+		}
+		double linearNodesMs = timer.ElapsedMs();
+
+		// everything in a radius
+		std::vector<PathingNodeVec> gridRadius(numQueries), linearRadius(numQueries);
+		timer.Restart();
+		for (unsigned int j = 0; j < numQueries; ++j)
+		{
+			graph.FindNodesInRadius(queries[j], radius, gridRadius[j]);
+		}
+		double gridRadiusMs = timer.ElapsedMs();
+
+		timer.Restart();
+		for (unsigned int j = 0; j < numQueries; ++j)
+		{
+			LinearNodesInRadius(nodes, queries[j], radius, linearRadius[j]);
+		}
+		double linearRadiusMs = timer.ElapsedMs();
+
+		// ties can go to either node, so compare how far away they are
+		unsigned int mismatches = 0;
+		for (unsigned int j = 0; j < numQueries; ++j)
+		{
+			if (fabs(GetTestDistance(gridClosest[j], queries[j]) - GetTestDistance(linearClosest[j], queries[j])) > 0.001f) {
+				++mismatches;
+			}
+			if (gridNodes[j].size() != linearNodes[j].size()) {
+				++mismatches;
+				continue;
+			}
+			for (size_t k = 0; k < gridNodes[j].size(); ++k)
+			{
+				if (fabs(GetTestDistance(gridNodes[j][k], queries[j]) - GetTestDistance(linearNodes[j][k], queries[j])) > 0.001f) {
+					++mismatches;
+				}
+			}
+			std::sort(gridRadius[j].begin(), gridRadius[j].end());
+			std::sort(linearRadius[j].begin(), linearRadius[j].end());
+			if (gridRadius[j] != linearRadius[j]) {
+				++mismatches;
+			}
+		}
+		TEST_CHECK(mismatches == 0);
+
+		const char* lookups[] = { "FindClosestNode", "FindClosestNodes", "FindNodesInRadius" };
+		const double gridMs[] = { gridClosestMs, gridNodesMs, gridRadiusMs };
+		const double linearMs[] = { linearClosestMs, linearNodesMs, linearRadiusMs };
+		for (unsigned int j = 0; j < _countof(lookups); ++j)
+		{
+			char name[64];
+			sprintf_s(name, "%u nodes: %s, grid", (unsigned int)nodes.size(), lookups[j]);
+			BenchmarkReport(name, gridMs[j] * 1000000.0 / numQueries, "ns");
+			sprintf_s(name, "%u nodes: %s, linear", (unsigned int)nodes.size(), lookups[j]);
+			BenchmarkReport(name, linearMs[j] * 1000000.0 / numQueries, "ns");
+		}
+	}
+}
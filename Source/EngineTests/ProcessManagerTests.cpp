@@ -0,0 +1,145 @@
+// ================================================================
+// ProcessManagerTests.cpp : Tests for the process manager's tick
+// ================================================================
+
+#include "EngineTests.h"
+#include "../EngineCore/MainLoop/ProcessManager.h"
+#include "../EngineCore/Multicore/JobSystem.h"
+
+//
+// class BusyProcess								- not described in the book
+//
+// Spins for a while every update, like a process with a bit of game logic to run, and counts its
+// updates and the time they were given.
+//
+class BusyProcess : public Process
+{
+	unsigned int m_iterations;
+	bool m_parallelSafe;
+	float m_value;
+
+public:
+	unsigned int m_updates;
+	unsigned long m_totalMs;
+
+	BusyProcess(unsigned int iterations, bool parallelSafe)
+	{
+		m_iterations = iterations;
+		m_parallelSafe = parallelSafe;
+		m_value = 1.0f;
+		m_updates = 0;
+		m_totalMs = 0;
+	}
+
+protected:
+	virtual void VOnUpdate(unsigned long deltaMs)
+	{
+		for (unsigned int i = 0; i < m_iterations; ++i)
+		{
+			m_value = m_value * 0.999f + 0.001f * (float)i;
+		}
+		++m_updates;
+		m_totalMs += deltaMs;
+	}
+
+	virtual bool VIsParallelSafe(void) const { return m_parallelSafe; }
+};
+
+typedef std::vector<std::shared_ptr<BusyProcess> > BusyProcesses;
+
+static void AttachBusyProcesses(ProcessManager& processManager, BusyProcesses& outProcesses, unsigned int count, unsigned int iterations, bool parallelSafe)
+{
+	for (unsigned int i = 0; i < count; ++i)
+	{
+		std::shared_ptr<BusyProcess> pProcess(Nv_NEW BusyProcess(iterations, parallelSafe));
+		processManager.AttachProcess(pProcess);
+		outProcesses.push_back(pProcess);
+	}
+}
+
+//
+// A budget of a couple of milliseconds has to cut the tick short - which it can't when the deadline
+// only moves as often as GetTickCount() does - and the processes it skips go first on the next tick
+// with the time they missed.
+//
+ENGINE_TEST(ProcessManager_TickBudgetDefersProcesses)
+{
+	const unsigned int numProcesses = 2000;
+	ProcessManager processManager;
+	processManager.SetTickBudget(2);
+
+	BusyProcesses processes;
+	AttachBusyProcesses(processManager, processes, numProcesses, 20000, false);
+
+	BenchmarkTimer timer;
+	processManager.UpdateProcesses(10);
+	double tickMs = timer.ElapsedMs();
+
+	unsigned int updated = 0;
+	for (size_t i = 0; i < processes.size(); ++i)
+	{
+		updated += processes[i]->m_updates;
+	}
+	TEST_CHECK(updated > 0 && updated < numProcesses);
+	TEST_CHECK(tickMs < 10.0);
+
+	// everyone gets there in the end, and once the budget is lifted every tick's time is handed out
+	const unsigned int numTicks = 1000;
+	for (unsigned int tick = 1; tick < numTicks; ++tick)
+	{
+		processManager.UpdateProcesses(10);
+	}
+	processManager.SetTickBudget(0);
+	processManager.UpdateProcesses(10);
+	for (size_t i = 0; i < processes.size(); ++i)
+	{
+		TEST_CHECK(processes[i]->m_updates > 1);
+		TEST_CHECK(processes[i]->m_totalMs == (numTicks + 1) * 10);
+	}
+}
+
+//
+// A tick of ten thousand parallel safe processes with no job system, and with 1 to 8 workers
+// helping the calling thread. Reported are the median and the worst of a hundred ticks.
+//
+ENGINE_BENCHMARK(ProcessManager_Workers)
+{
+	const unsigned int numProcesses = 10000, numTicks = 100;
+	const unsigned int workerCounts[] = { 0, 1, 2, 4, 8 };
+
+	for (unsigned int i = 0; i < _countof(workerCounts); ++i)
+	{
+		JobSystem* pJobSystem = (workerCounts[i] > 0) ? Nv_NEW JobSystem(workerCounts[i]) : NULL;
+		ProcessManager processManager(pJobSystem);
+
+		BusyProcesses processes;
+		AttachBusyProcesses(processManager, processes, numProcesses, 200, true);
+
+		// the first tick initializes the processes
+		processManager.UpdateProcesses(16);
+
+		std::vector<double> tickMs;
+		for (unsigned int tick = 0; tick < numTicks; ++tick)
+		{
+			BenchmarkTimer timer;
+			processManager.UpdateProcesses(16);
+			tickMs.push_back(timer.ElapsedMs());
+		}
+
+		bool allUpdated = true;
+		for (size_t j = 0; j < processes.size(); ++j)
+		{
+			allUpdated = allUpdated && (processes[j]->m_updates == numTicks + 1);
+		}
+
+		processManager.AbortAllProcesses(true);
+		SAFE_DELETE(pJobSystem);
+		TEST_CHECK(allUpdated);
+
+		char name[64];
+		sprintf_s(name, "%u workers: tick, median", workerCounts[i]);
+		BenchmarkReport(name, BenchmarkPercentile(tickMs, 0.5), "ms");
+		sprintf_s(name, "%u workers: tick, worst", workerCounts[i]);
+		BenchmarkReport(name, BenchmarkPercentile(tickMs, 1.0), "ms");
+	}
+}
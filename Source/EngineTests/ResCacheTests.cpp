@@ -0,0 +1,435 @@
+// ================================================================
+// ResCacheTests.cpp : Tests for the resource cache
+// ================================================================
+
+#include "EngineTests.h"
+#include "../EngineCore/ResourceCache/ResCache.h"
+
+//
+// class MemoryResourceFile							- not described in the book
+//
+// A resource file with nothing behind it - each resource is just a size, and reads fill the
+// buffer with a byte made from the name.
+//
+class MemoryResourceFile : public IResourceFile
+{
+	std::vector<std::pair<std::string, unsigned int> > m_resources;
+	std::unordered_map<std::string, int> m_indices;
+
+public:
+	void Add(const std::string& name, unsigned int size)
+	{
+		m_indices[Resource(name).m_name] = (int)m_resources.size();
+		m_resources.push_back(std::make_pair(Resource(name).m_name, size));
+	}
+
+	virtual bool VOpen() { return true; }
+	virtual int VGetRawResourceSize(const Resource &r)
+	{
+		int index = Find(r.m_name);
+		return (index < 0) ? -1 : (int)m_resources[index].second;
+	}
+	virtual int VGetRawResource(const Resource &r, char* buffer)
+	{
+		int index = Find(r.m_name);
+		if (index < 0) {
+			return 0;
+		}
+		memset(buffer, (int)(unsigned char)r.m_name[0], m_resources[index].second);
+		return (int)m_resources[index].second;
+	}
+	virtual int VGetNumResources() const { return (int)m_resources.size(); }
+	virtual std::string VGetResourceName(int num) const { return m_resources[num].first; }
+	virtual bool VIsUsingDevelopmentDirectories(void) const { return false; }
+	virtual bool VSupportsConcurrentReads(void) const { return true; }
+
+private:
+	int Find(const std::string& name) const
+	{
+		std::unordered_map<std::string, int>::const_iterator findIt = m_indices.find(name);
+		return (findIt != m_indices.end()) ? findIt->second : -1;
+	}
+};
+
+//
+// class TestResCache								- not described in the book
+//
+// Opens up the protected parts of the cache the tests need to set up races deterministically.
+//
+class TestResCache : public ResCache
+{
+public:
+	TestResCache(unsigned int sizeInMb, IResourceFile* pFile, unsigned int numShards = 1) : ResCache(sizeInMb, pFile, numShards) { }
+
+	std::shared_ptr<ResHandle> PinStale(Resource* r, std::shared_ptr<ResHandle> stale) { return PinHandle(r, stale); }
+};
+
+static ResCacheCategoryStats GetDefaultStats(const ResCache& cache)
+{
+	std::vector<ResCacheCategoryStats> stats;
+	cache.GetStats(stats);
+	return stats[0];
+}
+
+static const unsigned int TEST_RESOURCE_SIZE = 400 * 1024;	// two fit in a 1MB cache, three don't
+
+//
+// A handle that was evicted and loaded again between GetHandle() and Pin() taking the shard lock
+// - the reloaded handle gets pinned, and has to come out of the lru like any other.
+//
+ENGINE_TEST(ResCache_PinAfterReload)
+{
+	MemoryResourceFile* pFile = Nv_NEW MemoryResourceFile;
+	const char* names[] = { "a.bin", "b.bin", "c.bin", "d.bin", "e.bin", "f.bin" };
+	for (unsigned int i = 0; i < _countof(names); ++i)
+	{
+		pFile->Add(names[i], TEST_RESOURCE_SIZE);
+	}
+
+	TestResCache cache(1, pFile);
+	TEST_CHECK(cache.Init());
+
+	Resource a("a.bin"), b("b.bin"), c("c.bin"), d("d.bin"), e("e.bin"), f("f.bin");
+
+	// a is pushed out by b and c, then loaded again while the first handle is still held
+	std::shared_ptr<ResHandle> stale = cache.GetHandle(&a);
+	TEST_CHECK(stale);
+	cache.GetHandle(&b);
+	cache.GetHandle(&c);
+	std::shared_ptr<ResHandle> reloaded = cache.GetHandle(&a);
+	TEST_CHECK(reloaded && reloaded != stale);
+
+	std::shared_ptr<ResHandle> pinned = cache.PinStale(&a, stale);
+	TEST_CHECK(pinned == reloaded);
+	TEST_CHECK(pinned->IsPinned());
+	stale.reset();
+
+	// everything else gets pushed through the cache, a stays
+	unsigned __int64 hits = GetDefaultStats(cache).m_hits;
+	cache.GetHandle(&b);
+	cache.GetHandle(&d);
+	cache.GetHandle(&e);
+	TEST_CHECK(cache.GetHandle(&a) == reloaded);
+	TEST_CHECK(GetDefaultStats(cache).m_hits == hits + 1);
+	TEST_CHECK(GetDefaultStats(cache).m_pinned == 1);
+
+	// unpinned, it goes back on the lru once and is evicted like anything else
+	pinned.reset();
+	reloaded.reset();
+	cache.Unpin(&a);
+	TEST_CHECK(GetDefaultStats(cache).m_pinned == 0);
+	cache.GetHandle(&f);
+	cache.GetHandle(&b);
+	cache.GetHandle(&c);
+	TEST_CHECK(cache.GetAllocated() <= cache.GetCacheSize());
+	unsigned __int64 misses = GetDefaultStats(cache).m_misses;
+	cache.GetHandle(&a);
+	TEST_CHECK(GetDefaultStats(cache).m_misses == misses + 1);
+}
+
+//
+// The shards share one budget: a resource bigger than a quarter of the cache still loads in a
+// cache of four shards, and makes its room out of whichever shards have something to give up.
+//
+ENGINE_TEST(ResCache_ShardedResourceLargerThanShard)
+{
+	MemoryResourceFile* pFile = Nv_NEW MemoryResourceFile;
+	const char* names[] = { "a.bin", "b.bin", "c.bin", "d.bin" };
+	for (unsigned int i = 0; i < _countof(names); ++i)
+	{
+		pFile->Add(names[i], TEST_RESOURCE_SIZE);
+	}
+	pFile->Add("huge.bin", 2 * 1024 * 1024);
+
+	TestResCache cache(1, pFile, 4);
+	TEST_CHECK(cache.Init());
+
+	Resource a("a.bin"), b("b.bin"), c("c.bin"), d("d.bin"), huge("huge.bin");
+	TEST_CHECK(cache.GetHandle(&a));
+	TEST_CHECK(cache.GetHandle(&b));
+	TEST_CHECK(cache.GetAllocated() == 2 * TEST_RESOURCE_SIZE);
+
+	// no room left anywhere, so every load from here on has to evict one, wherever it lives
+	TEST_CHECK(cache.GetHandle(&c));
+	TEST_CHECK(cache.GetHandle(&d));
+	TEST_CHECK(cache.GetAllocated() == 2 * TEST_RESOURCE_SIZE);
+	TEST_CHECK(GetDefaultStats(cache).m_evictions == 2);
+
+	// memory held outside the cache isn't given back by evicting it, so nothing more fits - and
+	// nothing bigger than the whole cache ever does
+	std::shared_ptr<ResHandle> heldA = cache.GetHandle(&a);
+	std::shared_ptr<ResHandle> heldB = cache.GetHandle(&b);
+	TEST_CHECK(heldA && heldB);
+	TEST_CHECK(!cache.GetHandle(&c));
+	TEST_CHECK(!cache.GetHandle(&huge));
+	TEST_CHECK(cache.GetAllocated() == 2 * TEST_RESOURCE_SIZE);
+}
+
+//
+// class SlowResourceFile							- not described in the book
+//
+// A MemoryResourceFile whose reads take as long as a seek on a slow disk.
+//
+class SlowResourceFile : public MemoryResourceFile
+{
+public:
+	virtual int VGetRawResource(const Resource &r, char* buffer)
+	{
+		Sleep(2);
+		return MemoryResourceFile::VGetRawResource(r, buffer);
+	}
+};
+
+//
+// class BusyResourceLoader							- not described in the book
+//
+// Spends loadMs of cpu in VLoadResource() the way a decoder would, and remembers the thread it
+// last ran on. Loaders made with async = false act like the script loader.
+//
+class BusyResourceLoader : public IResourceLoader
+{
+	std::string m_pattern;
+	bool m_async;
+	double m_loadMs;
+
+public:
+	DWORD m_lastThreadId;
+
+	BusyResourceLoader(const std::string& pattern, bool async, double loadMs)
+		: m_pattern(pattern), m_async(async), m_loadMs(loadMs), m_lastThreadId(0) { }
+
+	virtual std::string VGetPattern() { return m_pattern; }
+	virtual bool VUseRawFile() { return false; }
+	virtual bool VDiscardRawBufferAfterLoad() { return true; }
+	virtual unsigned int VGetLoadedResourceSize(char* rawBuffer, unsigned int rawSize) { return rawSize; }
+	virtual bool VSupportsAsyncLoad() { return m_async; }
+	virtual bool VLoadResource(char* rawBuffer, unsigned int rawSize, std::shared_ptr<ResHandle> handle)
+	{
+		BenchmarkTimer timer;
+		while (timer.ElapsedMs() < m_loadMs)
+		{
+		}
+		memcpy(handle->WritableBuffer(), rawBuffer, rawSize);
+		m_lastThreadId = GetCurrentThreadId();
+		return true;
+	}
+};
+
+//
+// A loader that opts out of async loading gets its bytes read on a loader thread, but runs on
+// the game thread - whether the game polls FinishGameThreadLoads() or blocks in Wait().
+//
+ENGINE_TEST(ResCache_GameThreadLoaderRunsOnGameThread)
+{
+	MemoryResourceFile* pFile = Nv_NEW MemoryResourceFile;
+	pFile->Add("a.lua", 1024);
+	pFile->Add("b.lua", 1024);
+	pFile->Add("c.dat", 1024);
+
+	TestResCache cache(1, pFile);
+	TEST_CHECK(cache.Init());
+	std::shared_ptr<BusyResourceLoader> scriptLoader(Nv_NEW BusyResourceLoader("*.lua", false, 0.0));
+	std::shared_ptr<BusyResourceLoader> dataLoader(Nv_NEW BusyResourceLoader("*.dat", true, 0.0));
+	cache.RegisterLoader(scriptLoader);
+	cache.RegisterLoader(dataLoader);
+	TEST_CHECK(cache.StartAsyncLoading(2));
+
+	const DWORD gameThreadId = GetCurrentThreadId();
+	Resource a("a.lua"), b("b.lua"), c("c.dat");
+
+	// polled, the way App::OnUpdateGame() does it
+	ResLoadTicketPtr ticketA = cache.GetHandleAsync(&a);
+	BenchmarkTimer timer;
+	while (!ticketA->IsReady() && timer.ElapsedMs() < 5000.0)
+	{
+		cache.FinishGameThreadLoads();
+		Sleep(1);
+	}
+	TEST_CHECK(ticketA->IsReady() && ticketA->GetHandle());
+	TEST_CHECK(scriptLoader->m_lastThreadId == gameThreadId);
+	TEST_CHECK(ticketA->GetHandle()->Buffer()[0] == 'a');
+
+	// blocked on, without anyone calling FinishGameThreadLoads()
+	scriptLoader->m_lastThreadId = 0;
+	std::shared_ptr<ResHandle> handleB = cache.GetHandleAsync(&b)->Wait();
+	TEST_CHECK(handleB && handleB->Buffer()[0] == 'b');
+	TEST_CHECK(scriptLoader->m_lastThreadId == gameThreadId);
+
+	// everything else still loads on a loader thread
+	std::shared_ptr<ResHandle> handleC = cache.GetHandleAsync(&c)->Wait();
+	TEST_CHECK(handleC && handleC->Buffer()[0] == 'c');
+	TEST_CHECK(dataLoader->m_lastThreadId != gameThreadId);
+
+	cache.StopAsyncLoading();
+}
+
+//
+// How long a frame's worth of loading stalls the game thread: one new resource a frame, with a
+// 2ms read and 1ms of decoding, loaded with GetHandle(), with GetHandleAsync(), and with
+// GetHandleAsync() through a loader that has to run on the game thread.
+//
+ENGINE_BENCHMARK(ResCache_LoadStall)
+{
+	const unsigned int numFrames = 300;
+	const char* modes[] = { "sync", "async", "async, game thread loader" };
+
+	for (unsigned int mode = 0; mode < _countof(modes); ++mode)
+	{
+		SlowResourceFile* pFile = Nv_NEW SlowResourceFile;
+		for (unsigned int i = 0; i < numFrames; ++i)
+		{
+			char name[64];
+			sprintf_s(name, "r%u.dat", i);
+			pFile->Add(name, 16 * 1024);
+		}
+
+		TestResCache cache(64, pFile);
+		TEST_CHECK(cache.Init());
+		cache.RegisterLoader(std::shared_ptr<IResourceLoader>(Nv_NEW BusyResourceLoader("*.dat", mode != 2, 1.0)));
+		TEST_CHECK(mode == 0 || cache.StartAsyncLoading(2));
+
+		std::vector<double> stalls;
+		std::vector<ResLoadTicketPtr> tickets;
+		for (unsigned int i = 0; i < numFrames; ++i)
+		{
+			char name[64];
+			sprintf_s(name, "r%u.dat", i);
+			Resource r(name);
+
+			BenchmarkTimer timer;
+			if (mode == 0)
+			{
+				TEST_CHECK(cache.GetHandle(&r));
+			}
+			else
+			{
+				tickets.push_back(cache.GetHandleAsync(&r));
+				cache.FinishGameThreadLoads();
+			}
+			stalls.push_back(timer.ElapsedMs());
+
+			// the rest of a 4ms frame
+			Sleep(4);
+		}
+
+		for (size_t i = 0; i < tickets.size(); ++i)
+		{
+			TEST_CHECK(tickets[i]->Wait());
+		}
+		cache.StopAsyncLoading();
+
+		char name[64];
+		sprintf_s(name, "%s, median", modes[mode]);
+		BenchmarkReport(name, BenchmarkPercentile(stalls, 0.5), "ms");
+		sprintf_s(name, "%s, 99th percentile", modes[mode]);
+		BenchmarkReport(name, BenchmarkPercentile(stalls, 0.99), "ms");
+	}
+}
+
+struct StressParams
+{
+	ResCache* m_pCache;
+	std::vector<Resource>* m_pResources;
+	HANDLE m_hStart;
+	unsigned int m_seed;
+	unsigned int m_count;
+	volatile LONG* m_pFailures;
+};
+
+static DWORD WINAPI StressThreadProc(LPVOID lpParam)
+{
+	StressParams* pParams = static_cast<StressParams*>(lpParam);
+	std::vector<Resource>& resources = *pParams->m_pResources;
+	unsigned int seed = pParams->m_seed;
+
+	WaitForSingleObject(pParams->m_hStart, INFINITE);
+	for (unsigned int i = 0; i < pParams->m_count; ++i)
+	{
+		seed = seed * 1103515245 + 12345;
+		Resource& r = resources[((seed >> 8) & 0xffffff) % resources.size()];
+
+		// MemoryResourceFile fills every resource with the first letter of its name
+		std::shared_ptr<ResHandle> handle = pParams->m_pCache->GetHandle(&r);
+		if (!handle || handle->Buffer()[0] != r.m_name[0]) {
+			InterlockedIncrement(pParams->m_pFailures);
+		}
+	}
+	return 0;
+}
+
+//
+// 1 to 16 threads calling GetHandle() on one cache as fast as they can, with one shard and with
+// sixteen: on a working set that fits, so every call is a hit, and on one twice the size of the
+// cache, so about half of them load a resource and evict another. Every handle has to come back
+// with the right bytes in it.
+//
+ENGINE_BENCHMARK(ResCache_ShardedStress)
+{
+	const unsigned int cacheMb = 32, resourceSize = 16 * 1024, numCalls = 1 << 18;
+	const unsigned int workingSets[] = { 256, 4096 };
+	const unsigned int shardCounts[] = { 1, 16 };
+	const unsigned int threadCounts[] = { 1, 2, 4, 8, 16 };
+
+	for (unsigned int set = 0; set < _countof(workingSets); ++set)
+	{
+		const unsigned int numResources = workingSets[set];
+		std::vector<Resource> resources;
+		for (unsigned int i = 0; i < numResources; ++i)
+		{
+			char name[64];
+			sprintf_s(name, "%c%u.dat", 'a' + i % 26, i);
+			resources.push_back(Resource(name));
+		}
+
+		for (unsigned int shards = 0; shards < _countof(shardCounts); ++shards)
+		{
+			for (unsigned int threads = 0; threads < _countof(threadCounts); ++threads)
+			{
+				MemoryResourceFile* pFile = Nv_NEW MemoryResourceFile;
+				for (unsigned int i = 0; i < numResources; ++i)
+				{
+					pFile->Add(resources[i].m_name, resourceSize);
+				}
+				ResCache cache(cacheMb, pFile, shardCounts[shards]);
+				TEST_CHECK(cache.Init());
+				for (unsigned int i = 0; i < numResources; ++i)
+				{
+					cache.GetHandle(&resources[i]);
+				}
+
+				const unsigned int numThreads = threadCounts[threads];
+				volatile LONG failures = 0;
+				HANDLE hStart = CreateEvent(NULL, TRUE, FALSE, NULL);
+				std::vector<StressParams> params(numThreads);
+				std::vector<HANDLE> handles(numThreads);
+				for (unsigned int i = 0; i < numThreads; ++i)
+				{
+					params[i].m_pCache = &cache;
+					params[i].m_pResources = &resources;
+					params[i].m_hStart = hStart;
+					params[i].m_seed = 12345 + i;
+					params[i].m_count = numCalls / numThreads;
+					params[i].m_pFailures = &failures;
+					handles[i] = CreateThread(NULL, 0, StressThreadProc, &params[i], 0, NULL);
+				}
+
+				BenchmarkTimer timer;
+				SetEvent(hStart);
+				for (unsigned int i = 0; i < numThreads; ++i)
+				{
+					WaitForSingleObject(handles[i], INFINITE);
+					CloseHandle(handles[i]);
+				}
+				double ms = timer.ElapsedMs();
+				CloseHandle(hStart);
+
+				TEST_CHECK(failures == 0);
+				TEST_CHECK(cache.GetAllocated() <= cache.GetCacheSize());
+
+				char name[64];
+				sprintf_s(name, "%s, %u shards, %u threads", (set == 0) ? "hits" : "misses", shardCounts[shards], numThreads);
+				BenchmarkReport(name, (numCalls / numThreads) * numThreads / (ms / 1000.0) / 1000000.0, "M calls/s");
+			}
+		}
+	}
+}
@@ -0,0 +1,302 @@
+// ================================================================
+// SnapshotTests.cpp : Tests and benchmarks for snapshot replication, over loopback
+// ================================================================
+
+#include "EngineTests.h"
+#include "../EngineCore/Actors/Actor.h"
+#include "../EngineCore/Actors/ComponentStore.h"
+#include "../EngineCore/Actors/TransformComponent.h"
+#include "../EngineCore/EventManager/EventManagerImpl.h"
+#include "../EngineCore/EventManager/Events.h"
+#include "../EngineCore/Network/Snapshot.h"
+
+static const unsigned short TEST_SNAPSHOT_PORT = 40610;
+
+//
+// class SnapshotTestWorld							- not described in the book
+//
+// Actors with nothing but a transform, each wandering about a square at its own velocity and
+// turning as it goes. Only the first movingFraction of them move each step.
+//
+class SnapshotTestWorld : public Nv_noncopyable
+{
+	std::vector<StrongActorPtr> m_actors;
+	std::vector<std::shared_ptr<TransformComponent> > m_transforms;
+	std::vector<Vec3> m_positions;
+	std::vector<Vec3> m_velocities;
+	std::vector<float> m_yaws;
+	float m_size;
+
+public:
+	ComponentStore m_store;
+
+	SnapshotTestWorld(unsigned int numActors, float size);
+	~SnapshotTestWorld(void);
+
+	void Step(float seconds, float movingFraction);
+	Vec3 GetPosition(unsigned int i) const { return m_positions[i]; }
+	unsigned int GetNumActors(void) const { return (unsigned int)m_actors.size(); }
+};
+
+SnapshotTestWorld::SnapshotTestWorld(unsigned int numActors, float size)
+{
+	m_size = size;
+
+	unsigned int seed = 12345;
+	for (unsigned int i = 0; i < numActors; ++i)
+	{
+		float random[4];
+		for (unsigned int j = 0; j < _countof(random); ++j)
+		{
+			seed = seed * 1103515245 + 12345;
+			random[j] = (float)((seed >> 16) & 0x7fff) / 32767.0f;
+		}
+		m_positions.push_back(Vec3(random[0] * size, 0.0f, random[1] * size));
+		m_velocities.push_back(Vec3(random[2] * 10.0f - 5.0f, 0.0f, random[3] * 10.0f - 5.0f));
+		m_yaws.push_back(0.0f);
+
+		// ids from 1, the same in every world made with the same count
+		StrongActorPtr pActor(Nv_NEW Actor(i + 1));
+		std::shared_ptr<TransformComponent> pTransform(Nv_NEW TransformComponent);
+		pTransform->SetPosition(m_positions[i]);
+		pActor->AddComponent(pTransform);
+		m_store.AddActor(pActor.get());
+
+		m_actors.push_back(pActor);
+		m_transforms.push_back(pTransform);
+	}
+}
+
+SnapshotTestWorld::~SnapshotTestWorld(void)
+{
+	for (size_t i = 0; i < m_actors.size(); ++i)
+	{
+		m_store.RemoveActor(m_actors[i].get());
+		m_actors[i]->Destroy();
+	}
+}
+
+void SnapshotTestWorld::Step(float seconds, float movingFraction)
+{
+	unsigned int numMoving = (unsigned int)(m_actors.size() * movingFraction);
+	for (unsigned int i = 0; i < numMoving; ++i)
+	{
+		Vec3& position = m_positions[i];
+		Vec3& velocity = m_velocities[i];
+		position = position + velocity * seconds;
+		if (position.x < 0.0f || position.x > m_size) {
+			velocity.x = -velocity.x;
+		}
+		if (position.z < 0.0f || position.z > m_size) {
+			velocity.z = -velocity.z;
+		}
+		m_yaws[i] += seconds;
+
+		Mat4x4 transform;
+		transform.BuildRotationY(m_yaws[i]);
+		transform.SetPosition(position);
+		m_transforms[i]->SetTransform(transform);
+	}
+}
+
+//
+// class SnapshotTestSession						- not described in the book
+//
+// A server replicating a SnapshotTestWorld to clients with a world of their own, all in the one
+// thread. Every client's viewer is one of the actors, spread out across them.
+//
+class SnapshotTestSession : public Nv_noncopyable
+{
+public:
+	struct Client
+	{
+		UdpEventSocket* m_pSocket;
+		SnapshotReceiver* m_pReceiver;
+		SnapshotTestWorld* m_pWorld;
+	};
+
+	SnapshotTestWorld m_world;
+	UdpEventSocket m_server;
+	SnapshotReplicator m_replicator;
+	std::vector<Client> m_clients;
+	double m_replicatorMs;						// spent in the replicator's updates, capturing and encoding
+
+	SnapshotTestSession(unsigned int numActors, float size) : m_world(numActors, size), m_replicator(&m_server, &m_world.m_store) { m_replicatorMs = 0.0; }
+	~SnapshotTestSession(void);
+
+	bool Init(unsigned short port, unsigned int numClients);
+	void Run(unsigned int ms, float movingFraction);
+};
+
+SnapshotTestSession::~SnapshotTestSession(void)
+{
+	for (size_t i = 0; i < m_clients.size(); ++i)
+	{
+		SAFE_DELETE(m_clients[i].m_pReceiver);
+		SAFE_DELETE(m_clients[i].m_pSocket);
+		SAFE_DELETE(m_clients[i].m_pWorld);
+	}
+}
+
+bool SnapshotTestSession::Init(unsigned short port, unsigned int numClients)
+{
+	if (!m_server.Init(port)) {
+		return false;
+	}
+	m_server.SetAcceptConnections(true);
+	m_server.SetSnapshotReplicator(&m_replicator);
+
+	for (unsigned int i = 0; i < numClients; ++i)
+	{
+		Client client;
+		client.m_pWorld = Nv_NEW SnapshotTestWorld(m_world.GetNumActors(), 0.0f);
+		client.m_pSocket = Nv_NEW UdpEventSocket;
+		client.m_pReceiver = Nv_NEW SnapshotReceiver(client.m_pSocket, &client.m_pWorld->m_store);
+		client.m_pSocket->SetSnapshotReceiver(client.m_pReceiver);
+		m_clients.push_back(client);
+
+		unsigned int token = m_server.IssueToken();
+		m_replicator.AddClient(token, 1 + i * m_world.GetNumActors() / numClients);
+		if (!client.m_pSocket->Init() || client.m_pSocket->Connect(INADDR_LOOPBACK, port, token) == INVALID_SOCKET_ID) {
+			return false;
+		}
+	}
+	return true;
+}
+
+void SnapshotTestSession::Run(unsigned int ms, float movingFraction)
+{
+	unsigned int start = timeGetTime();
+	unsigned int lastTime = start;
+	while (timeGetTime() - start < ms)
+	{
+		unsigned int timeNow = timeGetTime();
+		m_world.Step((float)(timeNow - lastTime) / 1000.0f, movingFraction);
+		lastTime = timeNow;
+
+		BenchmarkTimer timer;
+		m_replicator.Update(timeNow);
+		m_replicatorMs += timer.ElapsedMs();
+
+		// each socket gets the time after its input, as the socket manager gives it
+		m_server.VHandleInput();
+		m_server.VUpdate(timeGetTime());
+		for (size_t i = 0; i < m_clients.size(); ++i)
+		{
+			m_clients[i].m_pSocket->VHandleInput();
+			m_clients[i].m_pSocket->VUpdate(timeGetTime());
+			m_clients[i].m_pReceiver->Update(timeGetTime());
+		}
+
+		IEventManager::Get()->VUpdate();
+		Sleep(1);
+	}
+}
+
+//
+// class SnapshotMoveRecorder						- not described in the book
+//
+// Keeps the last move the receiver passed on for each actor.
+//
+class SnapshotMoveRecorder
+{
+public:
+	std::map<ActorId, Mat4x4> m_moves;
+
+	SnapshotMoveRecorder(void) { IEventManager::Get()->VAddListener(fastdelegate::MakeDelegate(this, &SnapshotMoveRecorder::MoveActorDelegate), EvtData_Move_Actor::sk_EventType); }
+	~SnapshotMoveRecorder(void) { IEventManager::Get()->VRemoveListener(fastdelegate::MakeDelegate(this, &SnapshotMoveRecorder::MoveActorDelegate), EvtData_Move_Actor::sk_EventType); }
+
+	void MoveActorDelegate(IEventDataPtr pEventData)
+	{
+		std::shared_ptr<EvtData_Move_Actor> pCastEventData = std::static_pointer_cast<EvtData_Move_Actor>(pEventData);
+		m_moves[pCastEventData->GetId()] = pCastEventData->GetMatrix();
+	}
+};
+
+//
+// Snapshots of several parts each, over a connection that loses some datagrams and reorders the
+// rest, still come together on the client: it keeps up with the server, and once the world stands
+// still every actor in its interest ends up exactly where the server has it.
+//
+ENGINE_TEST(Snapshot_MultiPartSnapshotsReordered)
+{
+	BaseSocketManager socketManager;
+	TEST_CHECK(socketManager.Init());
+	EventManager eventManager("SnapshotTests", true);
+	SnapshotMoveRecorder recorder;
+
+	const unsigned int numActors = 2000, numInterest = 600;
+	SnapshotTestSession session(numActors, 300.0f);
+	TEST_CHECK(session.Init(TEST_SNAPSHOT_PORT, 1));
+	session.m_replicator.SetInterest(300.0f, numInterest);
+
+	// the jitter is several times the gap between datagrams, so the parts arrive out of order
+	session.m_server.SetNetworkSimulation(0.05f, 30, 15);
+	session.m_clients[0].m_pSocket->SetNetworkSimulation(0.05f, 30, 15);
+	SnapshotReceiver* pReceiver = session.m_clients[0].m_pReceiver;
+
+	session.Run(3000, 1.0f);
+	TEST_CHECK(pReceiver->GetLatestTick() + 10 >= session.m_replicator.GetTick());
+
+	session.Run(1000, 0.0f);
+	TEST_CHECK(pReceiver->GetLatestTick() + 3 >= session.m_replicator.GetTick());
+
+	unsigned int inPlace = 0;
+	for (unsigned int i = 0; i < numActors; ++i)
+	{
+		std::map<ActorId, Mat4x4>::const_iterator findIt = recorder.m_moves.find(i + 1);
+		if (findIt == recorder.m_moves.end()) {
+			continue;
+		}
+
+		Vec3 difference = findIt->second.GetPosition() - session.m_world.GetPosition(i);
+		if (difference.Length() < 2.0f / EVENT_CODEC_POSITION_SCALE) {
+			++inPlace;
+		}
+	}
+	TEST_CHECK(inPlace >= numInterest);
+}
+
+//
+// The bytes sent per client each second, and what the server spends on each snapshot, for a few
+// sizes of world. Clients are spread across the world with the default interest, so each is sent
+// the nearest SNAPSHOT_DEFAULT_MAX_ACTORS at most. The bytes are everything sent on loopback, acks
+// included.
+//
+ENGINE_BENCHMARK(Snapshot_Bandwidth)
+{
+	const unsigned int numClients = 8;
+	const unsigned int numActors[] = { 100, 1000, 10000 };
+	const float movingFractions[] = { 1.0f, 0.25f };
+
+	unsigned short port = TEST_SNAPSHOT_PORT;
+	for (unsigned int i = 0; i < _countof(numActors); ++i)
+	{
+		for (unsigned int j = 0; j < _countof(movingFractions); ++j)
+		{
+			BaseSocketManager socketManager;
+			TEST_CHECK(socketManager.Init());
+			EventManager eventManager("SnapshotTests", true);
+
+			SnapshotTestSession session(numActors[i], 300.0f);
+			TEST_CHECK(session.Init(++port, numClients));
+
+			// settle in first, so the clients have acked baselines to delta against
+			session.Run(1000, movingFractions[j]);
+			unsigned int startBytes = socketManager.GetOutbound();
+			unsigned int startTick = session.m_replicator.GetTick();
+			session.m_replicatorMs = 0.0;
+
+			BenchmarkTimer timer;
+			session.Run(3000, movingFractions[j]);
+			double seconds = timer.ElapsedMs() / 1000.0;
+			unsigned int snapshots = session.m_replicator.GetTick() - startTick;
+
+			char name[64];
+			sprintf_s(name, "%u actors, %u%% moving: per client", numActors[i], (unsigned int)(movingFractions[j] * 100.0f));
+			BenchmarkReport(name, (double)(socketManager.GetOutbound() - startBytes) / seconds / 1024.0 / numClients, "KB/s");
+			sprintf_s(name, "%u actors, %u%% moving: per snapshot", numActors[i], (unsigned int)(movingFractions[j] * 100.0f));
+			BenchmarkReport(name, snapshots ? session.m_replicatorMs / snapshots : 0.0, "ms");
+		}
+	}
+}
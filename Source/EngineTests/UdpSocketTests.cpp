@@ -0,0 +1,209 @@
+// ================================================================
+// UdpSocketTests.cpp : Tests for the datagram transport, over loopback
+// ================================================================
+
+#include "EngineTests.h"
+#include "../EngineCore/Network/UdpSocket.h"
+
+static const unsigned short TEST_UDP_PORT = 40600;
+static const unsigned int TEST_UDP_MESSAGES = 10;
+
+//
+// class TestUdpSocket								- not described in the book
+//
+// Counts what comes in instead of doing anything with it.
+//
+class TestUdpSocket : public UdpSocket
+{
+public:
+	unsigned int m_connects, m_disconnects, m_received;
+
+	TestUdpSocket(void) { m_connects = 0; m_disconnects = 0; m_received = 0; }
+
+	int GetNumConnections(void) const { return (int)m_connects - (int)m_disconnects; }
+
+protected:
+	virtual void VOnConnect(int connId) { ++m_connects; }
+	virtual void VOnDisconnect(int connId) { ++m_disconnects; }
+	virtual void VOnReceive(int connId, UdpChannel channel, const char* pData, unsigned int size) { ++m_received; }
+};
+
+// runs every socket for ms, or until the server has received expected messages
+static void PumpSockets(TestUdpSocket** ppSockets, unsigned int numSockets, unsigned int ms, unsigned int expected = 0)
+{
+	unsigned int start = timeGetTime();
+	while (timeGetTime() - start < ms && (expected == 0 || ppSockets[0]->m_received < expected))
+	{
+		for (unsigned int i = 0; i < numSockets; ++i)
+		{
+			ppSockets[i]->VHandleInput();
+			ppSockets[i]->VUpdate(timeGetTime());
+		}
+		Sleep(1);
+	}
+}
+
+static void SendTestMessages(UdpSocket& socket, int connId)
+{
+	for (unsigned int i = 0; i < TEST_UDP_MESSAGES; ++i)
+	{
+		socket.Send(connId, UdpChannel_ReliableOrdered, "test", 4);
+	}
+}
+
+//
+// The server only takes in a connection whose hello carries a token it issued and nobody else
+// holds: a second address with the same token, or one with a made up token, gets nothing through.
+// Revoking the token closes the connection.
+//
+ENGINE_TEST(UdpSocket_HelloNeedsIssuedToken)
+{
+	BaseSocketManager socketManager;
+	TEST_CHECK(socketManager.Init());
+
+	TestUdpSocket server, client, thief, guesser;
+	TEST_CHECK(server.Init(TEST_UDP_PORT));
+	TEST_CHECK(client.Init() && thief.Init() && guesser.Init());
+	server.SetAcceptConnections(true);
+	TestUdpSocket* sockets[] = { &server, &client, &thief, &guesser };
+
+	// the hello can be lost like anything else
+	client.SetNetworkSimulation(0.3f, 0, 0);
+	unsigned int token = server.IssueToken();
+	SendTestMessages(client, client.Connect(INADDR_LOOPBACK, TEST_UDP_PORT, token));
+	PumpSockets(sockets, _countof(sockets), 5000, TEST_UDP_MESSAGES);
+	TEST_CHECK(server.m_received == TEST_UDP_MESSAGES);
+	TEST_CHECK(server.GetNumConnections() == 1);
+	int connId = server.FindConnectionByToken(token);
+	TEST_CHECK(connId != INVALID_SOCKET_ID);
+
+	SendTestMessages(thief, thief.Connect(INADDR_LOOPBACK, TEST_UDP_PORT, token));
+	SendTestMessages(guesser, guesser.Connect(INADDR_LOOPBACK, TEST_UDP_PORT, token ^ 1));
+	PumpSockets(sockets, _countof(sockets), 500);
+	TEST_CHECK(server.m_received == TEST_UDP_MESSAGES);
+	TEST_CHECK(server.GetNumConnections() == 1);
+	TEST_CHECK(server.FindConnectionByToken(token) == connId);
+
+	server.RevokeToken(token);
+	PumpSockets(sockets, _countof(sockets), 50);
+	TEST_CHECK(server.GetNumConnections() == 0);
+	TEST_CHECK(server.FindConnectionByToken(token) == INVALID_SOCKET_ID);
+}
+
+//
+// class UdpAgeRecorder								- not described in the book
+//
+// Takes in what a UdpLinkSender sends: how old each update is when it arrives, and whether the
+// reliable messages come in order.
+//
+class UdpAgeRecorder : public UdpSocket
+{
+public:
+	std::vector<double> m_updateAges;
+	unsigned int m_nextReliable;
+	bool m_bReliableInOrder;
+
+	UdpAgeRecorder(void) { m_nextReliable = 0; m_bReliableInOrder = true; }
+
+protected:
+	virtual void VOnReceive(int connId, UdpChannel channel, const char* pData, unsigned int size)
+	{
+		unsigned int value;
+		if (size != sizeof(value)) {
+			return;
+		}
+		memcpy(&value, pData, sizeof(value));
+
+		if (channel == UdpChannel_UnreliableSequenced) {
+			m_updateAges.push_back((double)(timeGetTime() - value));
+		}
+		else if (channel == UdpChannel_ReliableOrdered)
+		{
+			if (value != m_nextReliable) {
+				m_bReliableInOrder = false;
+			}
+			m_nextReliable = value + 1;
+		}
+	}
+};
+
+//
+// A client sending the server an update of its state every frame, unreliable and stamped with the
+// time it was sent, and a reliable message every fourth frame, over a link that loses 10% of the
+// datagrams each way and delays the rest 50ms, give or take 20. Reported are how old the updates
+// are when they arrive, and the datagrams each end sends a second once everything has gone quiet
+// - acks aren't answered with acks, so that should be down to the keepalives. Every reliable
+// message has to arrive, in order.
+//
+ENGINE_BENCHMARK(UdpSocket_LossyLinkUpdateAge)
+{
+	const unsigned int sendMs = 5000, frameMs = 16, idleMs = 2000;
+
+	BaseSocketManager socketManager;
+	TEST_CHECK(socketManager.Init());
+
+	UdpAgeRecorder server;
+	UdpSocket client;
+	TEST_CHECK(server.Init(TEST_UDP_PORT + 1) && client.Init());
+	server.SetAcceptConnections(true);
+	server.SetNetworkSimulation(0.1f, 50, 20);
+	client.SetNetworkSimulation(0.1f, 50, 20);
+
+	unsigned int token = server.IssueToken();
+	int connId = client.Connect(INADDR_LOOPBACK, TEST_UDP_PORT + 1, token);
+	TEST_CHECK(connId != INVALID_SOCKET_ID);
+
+	unsigned int start = timeGetTime(), lastFrame = start, frame = 0, reliableSent = 0;
+	unsigned int idleStart = 0;
+	UdpConnectionStats serverIdle, clientIdle;
+	while (true)
+	{
+		unsigned int timeNow = timeGetTime();
+		if (timeNow - start < sendMs && timeNow - lastFrame >= frameMs)
+		{
+			lastFrame = timeNow;
+			client.Send(connId, UdpChannel_UnreliableSequenced, (const char*)&timeNow, sizeof(timeNow));
+			if (frame++ % 4 == 0)
+			{
+				TEST_CHECK(client.Send(connId, UdpChannel_ReliableOrdered, (const char*)&reliableSent, sizeof(reliableSent)));
+				++reliableSent;
+			}
+		}
+
+		client.VHandleInput();
+		client.VUpdate(timeGetTime());
+		server.VHandleInput();
+		server.VUpdate(timeGetTime());
+		Sleep(1);
+
+		// once the last reliable message is in and acked, count what still goes back and forth
+		UdpConnectionStats clientStats;
+		TEST_CHECK(client.GetStats(connId, clientStats));
+		if (!idleStart && timeNow - start >= sendMs && server.m_nextReliable == reliableSent && clientStats.m_reliablePending == 0)
+		{
+			idleStart = timeGetTime();
+			int serverConnId = server.FindConnectionByToken(token);
+			TEST_CHECK(server.GetStats(serverConnId, serverIdle));
+			clientIdle = clientStats;
+		}
+		if (idleStart && timeGetTime() - idleStart >= idleMs) {
+			break;
+		}
+		TEST_CHECK(timeNow - start < sendMs + 10000);
+	}
+
+	TEST_CHECK(server.m_bReliableInOrder);
+	TEST_CHECK(server.m_nextReliable == reliableSent);
+
+	UdpConnectionStats serverStats, clientStats;
+	TEST_CHECK(server.GetStats(server.FindConnectionByToken(token), serverStats));
+	TEST_CHECK(client.GetStats(connId, clientStats));
+	double idleSeconds = idleMs / 1000.0;
+
+	BenchmarkReport("updates arrived", 100.0 * server.m_updateAges.size() / frame, "%");
+	BenchmarkReport("update age, median", BenchmarkPercentile(server.m_updateAges, 0.5), "ms");
+	BenchmarkReport("update age, 99th percentile", BenchmarkPercentile(server.m_updateAges, 0.99), "ms");
+	BenchmarkReport("reliable messages resent", clientStats.m_messagesResent, "messages");
+	BenchmarkReport("idle, client datagrams", (clientStats.m_datagramsSent - clientIdle.m_datagramsSent) / idleSeconds, "/s");
+	BenchmarkReport("idle, server datagrams", (serverStats.m_datagramsSent - serverIdle.m_datagramsSent) / idleSeconds, "/s");
+}
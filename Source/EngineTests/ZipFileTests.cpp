@@ -0,0 +1,452 @@
+// ================================================================
+// ZipFileTests.cpp : Tests for reading and writing zip files
+// ================================================================
+
+#include "EngineTests.h"
+#include "../EngineCore/ResourceCache/ZipFile.h"
+#include "../EngineCore/Multicore/JobSystem.h"
+
+#include <cctype>
+#include <map>
+
+static const wchar_t* TEST_ZIP_NAME = L"EngineTests_Chunked.zip";
+static const wchar_t* TEST_STREAM_ZIP_NAME = L"EngineTests_Stream.zip";
+static const wchar_t* TEST_MANY_ZIP_NAME = L"EngineTests_Many.zip";
+static const unsigned int TEST_STREAM_PIECE_SIZE = 64 * 1024;	// what a SoundStream decodes into
+
+// compresses, but not to nothing, so every chunk has real work in it
+static void FillTestData(std::vector<char>& data)
+{
+	unsigned int seed = 12345;
+	for (size_t i = 0; i < data.size(); ++i)
+	{
+		seed = seed * 1103515245 + 12345;
+		data[i] = (char)('a' + ((seed >> 16) % 8));
+	}
+}
+
+static bool WriteChunkedZip(const std::vector<char>& data)
+{
+	ZipWriter writer;
+	if (!writer.Open(TEST_ZIP_NAME)) {
+		return false;
+	}
+	writer.EnableChunking(1024 * 1024, 256 * 1024);
+	bool added = writer.AddFile("chunked.bin", &data[0], (unsigned long)data.size());
+	return writer.Close() && added;
+}
+
+static bool LoadZip(const wchar_t* name, std::vector<char>& bytes)
+{
+	FILE* pFile = nullptr;
+	if (_wfopen_s(&pFile, name, L"rb") != 0 || !pFile) {
+		return false;
+	}
+	fseek(pFile, 0, SEEK_END);
+	bytes.resize(ftell(pFile));
+	fseek(pFile, 0, SEEK_SET);
+	bool read = fread(&bytes[0], bytes.size(), 1, pFile) == 1;
+	fclose(pFile);
+	return read;
+}
+
+static bool SaveZip(const wchar_t* name, const std::vector<char>& bytes)
+{
+	FILE* pFile = nullptr;
+	if (_wfopen_s(&pFile, name, L"wb") != 0 || !pFile) {
+		return false;
+	}
+	bool written = fwrite(&bytes[0], bytes.size(), 1, pFile) == 1;
+	fclose(pFile);
+	return written;
+}
+
+// offset of the first central directory header in a zip without a comment, or 0
+static size_t FindDirHeader(const std::vector<char>& bytes)
+{
+	const size_t DIR_END_SIZE = 22, DIR_OFFSET_OFFSET = 16;
+	const char signature[] = { 'P', 'K', 5, 6 };
+	if (bytes.size() < DIR_END_SIZE || memcmp(&bytes[bytes.size() - DIR_END_SIZE], signature, sizeof(signature)) != 0) {
+		return 0;
+	}
+
+	unsigned int dirOffset = 0;
+	memcpy(&dirOffset, &bytes[bytes.size() - DIR_END_SIZE + DIR_OFFSET_OFFSET], sizeof(dirOffset));
+	return (dirOffset < bytes.size() - DIR_END_SIZE) ? dirOffset : 0;
+}
+
+static bool ReadChunked(bool useMemoryMapping, JobSystem* pJobSystem, const std::vector<char>& expected)
+{
+	ZipFile zipFile;
+	if (!zipFile.Init(TEST_ZIP_NAME, useMemoryMapping)) {
+		return false;
+	}
+	zipFile.SetJobSystem(pJobSystem);
+
+	int index = zipFile.Find("chunked.bin");
+	if (index < 0 || !zipFile.IsChunked(index) || zipFile.GetFileLen(index) != (int)expected.size()) {
+		return false;
+	}
+
+	std::vector<char> buffer(expected.size());
+	return zipFile.ReadFile(index, &buffer[0]) && buffer == expected;
+}
+
+//
+// Chunked entries come out the same inflated as jobs on the job system, or serially on the
+// calling thread when there's none.
+//
+ENGINE_TEST(ZipFile_ChunkedReadWithAndWithoutJobSystem)
+{
+	std::vector<char> data(4 * 1024 * 1024 + 1000);
+	FillTestData(data);
+	TEST_CHECK(WriteChunkedZip(data));
+
+	TEST_CHECK(ReadChunked(false, NULL, data));
+	TEST_CHECK(ReadChunked(true, NULL, data));
+
+	JobSystem jobSystem(3);
+	TEST_CHECK(ReadChunked(false, &jobSystem, data));
+	TEST_CHECK(ReadChunked(true, &jobSystem, data));
+
+	_wremove(TEST_ZIP_NAME);
+}
+
+//
+// A chunk table without any chunks - an empty entry, as far as the sizes go - doesn't make the
+// entry chunked. Inflating one used to ask the job system for ~0 helpers.
+//
+ENGINE_TEST(ZipFile_EmptyChunkTableIsIgnored)
+{
+	std::vector<char> data(4 * 1024 * 1024 + 1000);
+	FillTestData(data);
+	TEST_CHECK(WriteChunkedZip(data));
+
+	// zero the entry's uncompressed size, in its local header and the directory, and the chunk
+	// count in the directory, where the reader looks for it
+	std::vector<char> bytes;
+	TEST_CHECK(LoadZip(TEST_ZIP_NAME, bytes));
+	size_t dirHeader = FindDirHeader(bytes);
+	TEST_CHECK(dirHeader != 0);
+	const size_t LOCAL_UC_SIZE_OFFSET = 22, DIR_UC_SIZE_OFFSET = 24, FNAME_LEN_OFFSET = 28, DIR_HEADER_SIZE = 46, NUM_CHUNKS_OFFSET = 8;
+	unsigned short fnameLen = 0;
+	memcpy(&fnameLen, &bytes[dirHeader + FNAME_LEN_OFFSET], sizeof(fnameLen));
+	memset(&bytes[LOCAL_UC_SIZE_OFFSET], 0, 4);
+	memset(&bytes[dirHeader + DIR_UC_SIZE_OFFSET], 0, 4);
+	memset(&bytes[dirHeader + DIR_HEADER_SIZE + fnameLen + NUM_CHUNKS_OFFSET], 0, 4);
+	TEST_CHECK(SaveZip(TEST_ZIP_NAME, bytes));
+
+	JobSystem jobSystem(3);
+	for (int mapped = 0; mapped < 2; ++mapped)
+	{
+		ZipFile zipFile;
+		TEST_CHECK(zipFile.Init(TEST_ZIP_NAME, mapped != 0));
+		zipFile.SetJobSystem(&jobSystem);
+
+		int index = zipFile.Find("chunked.bin");
+		TEST_CHECK(index >= 0 && !zipFile.IsChunked(index));
+
+		// it doesn't fit in the size it claims, so it fails - but only that
+		char buffer[16];
+		TEST_CHECK(!zipFile.ReadFile(index, buffer));
+	}
+
+	_wremove(TEST_ZIP_NAME);
+}
+
+//
+// A directory entry whose name runs past the end of the directory fails Init(), mapped or not,
+// instead of being read - and, to fix up its slashes, written - out of bounds.
+//
+ENGINE_TEST(ZipFile_DirectoryEntryPastTheEnd)
+{
+	std::vector<char> data(64 * 1024);
+	FillTestData(data);
+	TEST_CHECK(WriteChunkedZip(data));
+
+	std::vector<char> bytes;
+	TEST_CHECK(LoadZip(TEST_ZIP_NAME, bytes));
+	size_t dirHeader = FindDirHeader(bytes);
+	TEST_CHECK(dirHeader != 0);
+	const size_t FNAME_LEN_OFFSET = 28;
+	const unsigned short fnameLen = 0xffff;
+	memcpy(&bytes[dirHeader + FNAME_LEN_OFFSET], &fnameLen, sizeof(fnameLen));
+	TEST_CHECK(SaveZip(TEST_ZIP_NAME, bytes));
+
+	for (int mapped = 0; mapped < 2; ++mapped)
+	{
+		ZipFile zipFile;
+		TEST_CHECK(!zipFile.Init(TEST_ZIP_NAME, mapped != 0));
+		TEST_CHECK(zipFile.GetNumFiles() == 0);
+	}
+
+	_wremove(TEST_ZIP_NAME);
+}
+
+struct ZipReaderParams
+{
+	ZipFile* m_pZipFile;
+	HANDLE m_hStart;
+	int m_first;
+	int m_stride;
+	unsigned int m_entrySize;
+	bool m_failed;
+};
+
+static DWORD WINAPI ZipReaderThreadProc(LPVOID lpParam)
+{
+	ZipReaderParams* pParams = static_cast<ZipReaderParams*>(lpParam);
+	std::vector<char> buffer(pParams->m_entrySize);
+	WaitForSingleObject(pParams->m_hStart, INFINITE);
+	for (int i = pParams->m_first; i < pParams->m_pZipFile->GetNumFiles(); i += pParams->m_stride)
+	{
+		if (!pParams->m_pZipFile->ReadFile(i, &buffer[0])) {
+			pParams->m_failed = true;
+		}
+	}
+	return 0;
+}
+
+//
+// 1 to 8 threads reading every entry of one archive between them, through the file and through
+// the mapping.
+//
+ENGINE_BENCHMARK(ZipFile_ConcurrentReads)
+{
+	const unsigned int numEntries = 256;
+	const unsigned int entrySize = 256 * 1024;
+	{
+		std::vector<char> data(entrySize);
+		ZipWriter writer;
+		TEST_CHECK(writer.Open(TEST_MANY_ZIP_NAME));
+		bool added = true;
+		for (unsigned int i = 0; i < numEntries; ++i)
+		{
+			char name[64];
+			sprintf_s(name, "entry%u.bin", i);
+			FillTestData(data);
+			data[0] = (char)i;
+			added = added && writer.AddFile(name, &data[0], entrySize);
+		}
+		TEST_CHECK(writer.Close() && added);
+	}
+
+	const unsigned int threadCounts[] = { 1, 2, 4, 8 };
+	for (int mapped = 0; mapped < 2; ++mapped)
+	{
+		ZipFile zipFile;
+		TEST_CHECK(zipFile.Init(TEST_MANY_ZIP_NAME, mapped != 0));
+		TEST_CHECK(zipFile.GetNumFiles() == (int)numEntries);
+
+		for (unsigned int t = 0; t < _countof(threadCounts); ++t)
+		{
+			const unsigned int numThreads = threadCounts[t];
+			HANDLE hStart = CreateEvent(NULL, TRUE, FALSE, NULL);
+			std::vector<ZipReaderParams> params(numThreads);
+			std::vector<HANDLE> threads(numThreads);
+			for (unsigned int i = 0; i < numThreads; ++i)
+			{
+				params[i].m_pZipFile = &zipFile;
+				params[i].m_hStart = hStart;
+				params[i].m_first = (int)i;
+				params[i].m_stride = (int)numThreads;
+				params[i].m_entrySize = entrySize;
+				params[i].m_failed = false;
+				threads[i] = CreateThread(NULL, 0, ZipReaderThreadProc, &params[i], 0, NULL);
+			}
+
+			BenchmarkTimer timer;
+			SetEvent(hStart);
+			bool failed = false;
+			for (unsigned int i = 0; i < numThreads; ++i)
+			{
+				WaitForSingleObject(threads[i], INFINITE);
+				CloseHandle(threads[i]);
+				failed = failed || params[i].m_failed;
+			}
+			double ms = timer.ElapsedMs();
+			CloseHandle(hStart);
+			TEST_CHECK(!failed);
+
+			char name[64];
+			sprintf_s(name, "%s: %u threads", mapped ? "mapped" : "file", numThreads);
+			BenchmarkReport(name, (double)numEntries * entrySize / (1024.0 * 1024.0) / (ms / 1000.0), "MB/s");
+		}
+	}
+
+	_wremove(TEST_MANY_ZIP_NAME);
+}
+
+//
+// A chunked entry inflated by 1 to 8 threads, the calling thread and the job system's workers.
+//
+ENGINE_BENCHMARK(ZipFile_ChunkedInflateThreads)
+{
+	std::vector<char> data(64 * 1024 * 1024);
+	FillTestData(data);
+	TEST_CHECK(WriteChunkedZip(data));
+
+	JobSystem jobSystem(7);
+	const unsigned int threadCounts[] = { 1, 2, 4, 8 };
+	for (int mapped = 0; mapped < 2; ++mapped)
+	{
+		ZipFile zipFile;
+		TEST_CHECK(zipFile.Init(TEST_ZIP_NAME, mapped != 0));
+		zipFile.SetJobSystem(&jobSystem);
+		int index = zipFile.Find("chunked.bin");
+		TEST_CHECK(index >= 0 && zipFile.IsChunked(index));
+
+		std::vector<char> buffer(data.size());
+		for (unsigned int i = 0; i < _countof(threadCounts); ++i)
+		{
+			zipFile.SetMaxInflateThreads(threadCounts[i]);
+
+			// best of three, the first read of a file pays for the page cache
+			double bestMs = 0.0;
+			for (int run = 0; run < 3; ++run)
+			{
+				BenchmarkTimer timer;
+				TEST_CHECK(zipFile.ReadFile(index, &buffer[0]));
+				double ms = timer.ElapsedMs();
+				bestMs = (run == 0 || ms < bestMs) ? ms : bestMs;
+			}
+			TEST_CHECK(buffer == data);
+
+			char name[64];
+			sprintf_s(name, "%s: %u threads", mapped ? "mapped" : "file", threadCounts[i]);
+			BenchmarkReport(name, data.size() / (1024.0 * 1024.0) / (bestMs / 1000.0), "MB/s");
+		}
+	}
+
+	_wremove(TEST_ZIP_NAME);
+}
+
+//
+// A long deflated entry read whole with ReadFile(), against pulling it through a ZipReadStream a
+// sound stream's buffer at a time, from a file and from a mapping. The stream has its first piece
+// long before ReadFile() is done, and all it holds is that piece, its read-ahead and zlib's 32KB
+// window, where ReadFile() needs the whole entry.
+//
+ENGINE_BENCHMARK(ZipFile_StreamVersusReadFile)
+{
+	std::vector<char> data(32 * 1024 * 1024);
+	FillTestData(data);
+	{
+		ZipWriter writer;
+		TEST_CHECK(writer.Open(TEST_STREAM_ZIP_NAME));
+		bool added = writer.AddFile("stream.bin", &data[0], (unsigned long)data.size());
+		TEST_CHECK(writer.Close() && added);
+	}
+
+	for (int mapped = 0; mapped < 2; ++mapped)
+	{
+		ZipFile zipFile;
+		TEST_CHECK(zipFile.Init(TEST_STREAM_ZIP_NAME, mapped != 0));
+		int index = zipFile.Find("stream.bin");
+		TEST_CHECK(index >= 0);
+
+		const char* pSource = mapped ? "mapped" : "file";
+		char name[64];
+
+		std::vector<char> buffer(data.size());
+		BenchmarkTimer timer;
+		TEST_CHECK(zipFile.ReadFile(index, &buffer[0]));
+		sprintf_s(name, "%s: ReadFile, whole entry", pSource);
+		BenchmarkReport(name, timer.ElapsedMs(), "ms");
+		sprintf_s(name, "%s: ReadFile, held", pSource);
+		BenchmarkReport(name, buffer.size() / 1024.0, "KB");
+
+		ZipReadStream stream(&zipFile);
+		std::vector<char> piece(TEST_STREAM_PIECE_SIZE);
+		timer.Restart();
+		TEST_CHECK(stream.Open(index) && stream.VRead(&piece[0], TEST_STREAM_PIECE_SIZE) == TEST_STREAM_PIECE_SIZE);
+		sprintf_s(name, "%s: stream, first piece", pSource);
+		BenchmarkReport(name, timer.ElapsedMs(), "ms");
+
+		size_t total = TEST_STREAM_PIECE_SIZE;
+		unsigned int read;
+		while ((read = stream.VRead(&piece[0], TEST_STREAM_PIECE_SIZE)) != 0) {
+			total += read;
+		}
+		TEST_CHECK(total == data.size());
+		sprintf_s(name, "%s: stream, whole entry", pSource);
+		BenchmarkReport(name, timer.ElapsedMs(), "ms");
+		sprintf_s(name, "%s: stream, held", pSource);
+		BenchmarkReport(name, (TEST_STREAM_PIECE_SIZE + (mapped ? 0 : ZipReadStream::READ_AHEAD_SIZE) + 32 * 1024) / 1024.0, "KB");
+	}
+
+	_wremove(TEST_STREAM_ZIP_NAME);
+}
+
+// what ZipFile::Find() did before the ZipContentsIndex: lower case a copy, then look it up in a map
+static int FindInContentsMap(const std::map<std::string, int>& contents, const std::string& path)
+{
+	std::string lowerCase = path;
+	std::transform(lowerCase.begin(), lowerCase.end(), lowerCase.begin(), (int(*)(int)) std::tolower);
+	std::map<std::string, int>::const_iterator findIt = contents.find(lowerCase);
+	return (findIt != contents.end()) ? findIt->second : -1;
+}
+
+//
+// Looking paths up in a ZipContentsIndex against the std::map ZipFile used to keep, for archives
+// of a thousand to a million entries. The queries come in mixed case, as resource names do, and one
+// in eight of them isn't in the archive.
+//
+ENGINE_BENCHMARK(ZipFile_ContentsIndexLookups)
+{
+	const unsigned int entryCounts[] = { 1000, 100000, 1000000 };
+	const unsigned int numLookups = 1000000;
+
+	for (unsigned int i = 0; i < _countof(entryCounts); ++i)
+	{
+		const unsigned int numEntries = entryCounts[i];
+		char path[_MAX_PATH];
+
+		std::map<std::string, int> contentsMap;
+		ZipContentsIndex contentsIndex;
+		for (unsigned int entry = 0; entry < numEntries; ++entry)
+		{
+			sprintf_s(path, "art\\level_%02u\\textures\\tile_%07u.dds", entry % 37, entry);
+			contentsMap[path] = (int)entry;
+			contentsIndex.Insert(path, strlen(path), (int)entry);
+		}
+
+		std::vector<std::string> queries;
+		std::vector<int> expected;
+		unsigned int seed = 12345;
+		for (unsigned int lookup = 0; lookup < numLookups; ++lookup)
+		{
+			seed = seed * 1103515245 + 12345;
+			unsigned int entry = ((seed >> 8) & 0xffffff) % numEntries;
+			bool miss = (lookup % 8) == 7;
+			sprintf_s(path, "Art\\Level_%02u\\Textures\\Tile_%07u.%s", entry % 37, entry, miss ? "png" : "DDS");
+			queries.push_back(path);
+			expected.push_back(miss ? -1 : (int)entry);
+		}
+
+		bool mapFound = true;
+		BenchmarkTimer timer;
+		for (unsigned int lookup = 0; lookup < numLookups; ++lookup)
+		{
+			mapFound = (FindInContentsMap(contentsMap, queries[lookup]) == expected[lookup]) && mapFound;
+		}
+		double mapMs = timer.ElapsedMs();
+
+		bool indexFound = true;
+		timer.Restart();
+		for (unsigned int lookup = 0; lookup < numLookups; ++lookup)
+		{
+			indexFound = (contentsIndex.Find(queries[lookup]) == expected[lookup]) && indexFound;
+		}
+		double indexMs = timer.ElapsedMs();
+
+		TEST_CHECK(mapFound);
+		TEST_CHECK(indexFound);
+
+		char name[64];
+		sprintf_s(name, "%u entries: std::map", numEntries);
+		BenchmarkReport(name, mapMs * 1000000.0 / numLookups, "ns/lookup");
+		sprintf_s(name, "%u entries: ZipContentsIndex", numEntries);
+		BenchmarkReport(name, indexMs * 1000000.0 / numLookups, "ns/lookup");
+	}
+}